@@ -0,0 +1,497 @@
+#include "CompactShow.hpp"
+#include "IldaReader.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static inline void putVarint(std::vector<uint8_t>& dst, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        dst.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    dst.push_back((uint8_t)value);
+}
+
+// Returns false if the varint runs past end or is too long
+static inline bool getVarint(const uint8_t*& src, const uint8_t* end, uint32_t& value)
+{
+    value = 0;
+    for (unsigned shift = 0; shift < 35; shift += 7)
+    {
+        if (src >= end)
+            return false;
+        uint8_t byte = *src++;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+static inline uint32_t zigzag(uint16_t delta)
+{
+    int16_t value = (int16_t)delta;
+    return (uint32_t)(((int32_t)value << 1) ^ ((int32_t)value >> 31)) & 0xFFFF;
+}
+
+static inline uint16_t unzigzag(uint32_t value)
+{
+    return (uint16_t)((value >> 1) ^ (0 - (value & 1)));
+}
+
+static inline void putLittleEndian(uint8_t* dst, uint64_t value, unsigned bytes)
+{
+    for (unsigned i = 0; i < bytes; i++)
+        dst[i] = (uint8_t)(value >> (8 * i));
+}
+
+static inline uint64_t getLittleEndian(const uint8_t* src, unsigned bytes)
+{
+    uint64_t value = 0;
+    for (unsigned i = 0; i < bytes; i++)
+        value |= (uint64_t)src[i] << (8 * i);
+    return value;
+}
+
+void CompactShow::encodeHeader(const ShowHeader& header, uint8_t* dst)
+{
+    memcpy(dst, header.magic, 8);
+    putLittleEndian(dst + 8, header.version, 4);
+    putLittleEndian(dst + 12, header.frameCount, 4);
+    putLittleEndian(dst + 16, header.pointCount, 8);
+}
+
+bool CompactShow::decodeHeader(const uint8_t* src, ShowHeader& header)
+{
+    memcpy(header.magic, src, 8);
+    header.version = getLittleEndian(src + 8, 4);
+    header.frameCount = getLittleEndian(src + 12, 4);
+    header.pointCount = getLittleEndian(src + 16, 8);
+    return memcmp(header.magic, "IDNSHOWZ", 8) == 0 && header.version == COMPACT_SHOW_VERSION;
+}
+
+uint64_t CompactShow::hashPoints(const ISPDB25Point* points, unsigned pointCount)
+{
+    // FNV-1a over the coded fields
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned i = 0; i < pointCount; i++)
+    {
+        uint64_t fields = ((uint64_t)points[i].x << 48) | ((uint64_t)points[i].y << 32) | ((uint64_t)(points[i].r >> 8) << 16) | ((points[i].g >> 8) << 8) | (points[i].b >> 8);
+        hash = (hash ^ fields) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void CompactShow::addToHistory(const ISPDB25Point* points, unsigned pointCount, unsigned frameIndex, uint64_t hash)
+{
+    HistoryFrame frame;
+    frame.points.assign(points, points + pointCount);
+    frame.frameIndex = frameIndex;
+    frame.hash = hash;
+    history.push_back(std::move(frame));
+    historyPoints += pointCount;
+
+    while (historyPoints > COMPACT_SHOW_HISTORY_POINTS && history.size() > 1)
+    {
+        historyPoints -= history.front().points.size();
+        history.pop_front();
+    }
+}
+
+int CompactShow::readInfo(const char* filename, uint32_t& frameCount, uint64_t& pointCount)
+{
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    uint8_t data[headerSize];
+    ShowHeader header;
+    bool valid = read(fd, data, headerSize) == (ssize_t)headerSize && decodeHeader(data, header);
+    ::close(fd);
+    if (!valid)
+        return -1;
+
+    frameCount = header.frameCount;
+    pointCount = header.pointCount;
+    return 0;
+}
+
+int CompactShow::convertIlda(const char* ildaFilename, const char* showFilename, const unsigned long* defaultPalette)
+{
+    IldaReader reader;
+    if (reader.open(ildaFilename) != 0)
+        return -1;
+
+    CompactShowWriter writer;
+    if (writer.begin(showFilename) != 0)
+        return -1;
+
+    unsigned long palette[256];
+    const unsigned long* currentPalette = defaultPalette;
+    std::vector<ISPDB25Point> points;
+    IldaReader::IldaSection section;
+    int result;
+    while ((result = reader.nextSection(section)) > 0)
+    {
+        if (section.formatCode == ILDA_FORMAT_PALETTE)
+        {
+            if ((result = reader.decodePalette(section, palette)) != 0)
+                break;
+            currentPalette = palette;
+            continue;
+        }
+
+        points.resize(section.recordCnt);
+        if ((result = reader.decodePoints(section, 0, section.recordCnt, currentPalette, points.data())) != 0)
+            break;
+        if (writer.addFrame(points.data(), points.size()) != 0)
+            return -1;
+    }
+
+    if (result != 0)
+    {
+        printf("[IDTF] %s: Malformed ILDA file, not converted\n", ildaFilename);
+        writer.abort();
+        return -1;
+    }
+
+    if (writer.finish() != 0)
+        return -1;
+
+    printf("[IDTF] %s: %u frames (%u repeated), %.2f MB ILDA to %.2f MB, ratio %.2f\n", showFilename, writer.frameCount(), writer.referenceCount(),
+        reader.fileSize() / 1e6, writer.bytesWritten() / 1e6, writer.bytesWritten() > 0 ? (double)reader.fileSize() / writer.bytesWritten() : 0.0);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+
+CompactShowWriter::~CompactShowWriter()
+{
+    abort();
+}
+
+int CompactShowWriter::begin(const char* filename)
+{
+    abort();
+
+    path = filename;
+    tempPath = path + ".XXXXXX";
+    int fd = mkstemp(&tempPath[0]);
+    if (fd < 0)
+    {
+        printf("[IDTF] Cannot create show file %s (errno: %d)\n", filename, errno);
+        return -1;
+    }
+    file = fdopen(fd, "wb");
+    if (file == nullptr)
+    {
+        ::close(fd);
+        unlink(tempPath.c_str());
+        return -1;
+    }
+
+    memcpy(header.magic, "IDNSHOWZ", 8);
+    header.version = COMPACT_SHOW_VERSION;
+    header.frameCount = 0;
+    header.pointCount = 0;
+    references = 0;
+    history.clear();
+    historyPoints = 0;
+
+    // Placeholder, the header is complete once all frames are known
+    uint8_t data[headerSize];
+    encodeHeader(header, data);
+    if (fwrite(data, headerSize, 1, file) != 1)
+    {
+        abort();
+        return -1;
+    }
+    written = headerSize;
+
+    return 0;
+}
+
+int CompactShowWriter::addFrame(const ISPDB25Point* points, unsigned pointCount)
+{
+    if (file == nullptr)
+        return -1;
+
+    record.clear();
+    uint64_t hash = hashPoints(points, pointCount);
+
+    // Repeated frame, refer to the newest equal one
+    for (size_t slot = 1; slot <= history.size(); slot++)
+    {
+        const HistoryFrame& candidate = history[history.size() - slot];
+        if (candidate.hash != hash || candidate.points.size() != pointCount || memcmp(candidate.points.data(), points, pointCount * sizeof(ISPDB25Point)) != 0)
+            continue;
+
+        record.push_back(COMPACT_SHOW_RECORD_REFERENCE);
+        putVarint(record, slot);
+        references++;
+        header.frameCount++;
+        header.pointCount += pointCount;
+        return writeRecord();
+    }
+
+    record.push_back(COMPACT_SHOW_RECORD_POINTS);
+    putVarint(record, pointCount);
+
+    uint16_t x = 0x8000, y = 0x8000;
+    for (unsigned i = 0; i < pointCount; i++)
+    {
+        putVarint(record, zigzag(points[i].x - x));
+        putVarint(record, zigzag(points[i].y - y));
+        x = points[i].x;
+        y = points[i].y;
+    }
+
+    for (unsigned i = 0; i < pointCount; )
+    {
+        unsigned run = 1;
+        while (i + run < pointCount && (points[i + run].r >> 8) == (points[i].r >> 8) && (points[i + run].g >> 8) == (points[i].g >> 8) && (points[i + run].b >> 8) == (points[i].b >> 8))
+            run++;
+
+        putVarint(record, run);
+        record.push_back(points[i].r >> 8);
+        record.push_back(points[i].g >> 8);
+        record.push_back(points[i].b >> 8);
+        i += run;
+    }
+
+    addToHistory(points, pointCount, header.frameCount, hash);
+    header.frameCount++;
+    header.pointCount += pointCount;
+    return writeRecord();
+}
+
+int CompactShowWriter::writeRecord()
+{
+    std::vector<uint8_t> length;
+    putVarint(length, record.size());
+    if (fwrite(length.data(), length.size(), 1, file) != 1 || fwrite(record.data(), record.size(), 1, file) != 1)
+    {
+        printf("[IDTF] Cannot write show file %s (errno: %d)\n", tempPath.c_str(), errno);
+        abort();
+        return -1;
+    }
+    written += length.size() + record.size();
+    return 0;
+}
+
+int CompactShowWriter::finish()
+{
+    if (file == nullptr)
+        return -1;
+
+    uint8_t data[headerSize];
+    encodeHeader(header, data);
+    bool ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(data, headerSize, 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+    file = nullptr;
+    history.clear();
+    historyPoints = 0;
+
+    if (!ok || rename(tempPath.c_str(), path.c_str()) != 0)
+    {
+        printf("[IDTF] Cannot write show file %s (errno: %d)\n", path.c_str(), errno);
+        unlink(tempPath.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+void CompactShowWriter::abort()
+{
+    history.clear();
+    historyPoints = 0;
+    if (file == nullptr)
+        return;
+
+    fclose(file);
+    file = nullptr;
+    unlink(tempPath.c_str());
+}
+
+// -----------------------------------------------------------------------------
+
+CompactShowReader::~CompactShowReader()
+{
+    close();
+}
+
+int CompactShowReader::open(const char* filename)
+{
+    close();
+
+    this->filename = filename;
+    fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("[IDTF] %s: Cannot open show file (errno: %d)\n", filename, errno);
+        return -1;
+    }
+
+    // Played front to back
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    buffer.resize(COMPACT_SHOW_READ_BUFFER);
+    if (!fill(headerSize) || !decodeHeader(&buffer[bufferStart], header))
+    {
+        printf("[IDTF] %s: Not a show file of version %d\n", filename, COMPACT_SHOW_VERSION);
+        close();
+        return -1;
+    }
+    bufferStart += headerSize;
+    consumed = headerSize;
+
+    return 0;
+}
+
+void CompactShowReader::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    frameIndex = 0;
+    bufferStart = bufferEnd = 0;
+    consumed = 0;
+    endOfFile = false;
+    history.clear();
+    historyPoints = 0;
+    std::vector<uint8_t>().swap(buffer);
+}
+
+// Makes at least the given number of bytes available from bufferStart, false if the file ends before
+bool CompactShowReader::fill(size_t bytes)
+{
+    if (bufferEnd - bufferStart >= bytes)
+        return true;
+
+    if (bufferStart > 0)
+    {
+        memmove(buffer.data(), buffer.data() + bufferStart, bufferEnd - bufferStart);
+        bufferEnd -= bufferStart;
+        bufferStart = 0;
+    }
+    if (buffer.size() < bytes)
+        buffer.resize(bytes);
+
+    while (bufferEnd < bytes && !endOfFile)
+    {
+        ssize_t result = read(fd, buffer.data() + bufferEnd, buffer.size() - bufferEnd);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result < 0)
+        {
+            printf("[IDTF] %s: Read error, media removed? (errno: %d)\n", filename.c_str(), errno);
+            return false;
+        }
+        if (result == 0)
+            endOfFile = true;
+        bufferEnd += result;
+    }
+
+    return bufferEnd >= bytes;
+}
+
+int CompactShowReader::nextFrame(std::vector<ISPDB25Point>& points, unsigned& sourceFrame)
+{
+    if (fd < 0)
+        return -1;
+    if (frameIndex >= header.frameCount)
+        return 0;
+
+    // Record length, at most 5 bytes. Less may be left at the end of the file.
+    fill(5);
+    const uint8_t* src = buffer.data() + bufferStart;
+    uint32_t length;
+    if (!getVarint(src, buffer.data() + bufferEnd, length) || length == 0 || length > COMPACT_SHOW_MAX_RECORD)
+    {
+        printf("[IDTF] %s: Malformed show file at frame %u\n", filename.c_str(), frameIndex);
+        return -1;
+    }
+    size_t lengthSize = src - (buffer.data() + bufferStart);
+
+    if (!fill(lengthSize + length))
+    {
+        printf("[IDTF] %s: Show file ends within frame %u\n", filename.c_str(), frameIndex);
+        return -1;
+    }
+    src = buffer.data() + bufferStart + lengthSize;
+    if (decodeRecord(src, src + length, points, sourceFrame) != 0)
+    {
+        printf("[IDTF] %s: Malformed show file at frame %u\n", filename.c_str(), frameIndex);
+        return -1;
+    }
+
+    bufferStart += lengthSize + length;
+    consumed += lengthSize + length;
+    frameIndex++;
+    return 1;
+}
+
+int CompactShowReader::decodeRecord(const uint8_t* src, const uint8_t* end, std::vector<ISPDB25Point>& points, unsigned& sourceFrame)
+{
+    uint8_t type = *src++;
+    uint32_t value;
+
+    if (type == COMPACT_SHOW_RECORD_REFERENCE)
+    {
+        if (!getVarint(src, end, value) || value == 0 || value > history.size())
+            return -1;
+
+        const HistoryFrame& frame = history[history.size() - value];
+        points = frame.points;
+        sourceFrame = frame.frameIndex;
+        return 0;
+    }
+    if (type != COMPACT_SHOW_RECORD_POINTS)
+        return -1;
+
+    uint32_t pointCount;
+    if (!getVarint(src, end, pointCount) || pointCount > 0xFFFF)
+        return -1;
+    points.resize(pointCount);
+
+    uint16_t x = 0x8000, y = 0x8000;
+    for (uint32_t i = 0; i < pointCount; i++)
+    {
+        uint32_t dx, dy;
+        if (!getVarint(src, end, dx) || !getVarint(src, end, dy))
+            return -1;
+        x += unzigzag(dx);
+        y += unzigzag(dy);
+        points[i].x = x;
+        points[i].y = y;
+        points[i].intensity = 0xFFFF;
+        points[i].shutter = 0;
+        points[i].u1 = points[i].u2 = points[i].u3 = points[i].u4 = 0;
+    }
+
+    for (uint32_t i = 0; i < pointCount; )
+    {
+        uint32_t run;
+        if (!getVarint(src, end, run) || run == 0 || run > pointCount - i || end - src < 3)
+            return -1;
+
+        uint16_t r = src[0] * 0x101, g = src[1] * 0x101, b = src[2] * 0x101;
+        src += 3;
+        for (uint32_t last = i + run; i < last; i++)
+        {
+            points[i].r = r;
+            points[i].g = g;
+            points[i].b = b;
+        }
+    }
+
+    sourceFrame = frameIndex;
+    addToHistory(points.data(), pointCount, frameIndex, 0);
+    return 0;
+}
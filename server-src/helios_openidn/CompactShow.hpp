@@ -0,0 +1,136 @@
+#pragma once
+
+#include "shared/ISPDB25Point.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+// Compact show files (.ilz) for the FilePlayer.
+// A smaller alternative to ILDA files for shows played from slow USB sticks and SD cards, converted
+// from ILDA offline (--convertShow). Points are stored as the player decodes them, with the colors
+// already resolved through the palettes, so playback only has to undo the coding:
+//  - coordinates as zigzag varint deltas to the previous point of the frame
+//  - colors as runs of points with the same 8 bit RGB color
+//  - frames equal to a recent frame as a reference to it
+// The reader streams the file through a fixed buffer and only keeps the recent frames that can be
+// referenced, so its memory use does not grow with the file.
+//
+// Layout, little endian: ShowHeader, then per frame a varint record length and the record:
+//	type 0 (points):	varint point count, the coordinate deltas of all points, then the color
+//						runs (varint run length, r, g, b) covering all points
+//	type 1 (reference):	varint slot in the history, 1 being the latest frame in it
+// The history holds the latest frames of type 0, up to COMPACT_SHOW_HISTORY_POINTS points in total
+// but at least one frame. Frames of type 1 are not added to it.
+
+#define COMPACT_SHOW_VERSION 1
+#define COMPACT_SHOW_HISTORY_POINTS 65536
+#define COMPACT_SHOW_READ_BUFFER 65536
+#define COMPACT_SHOW_MAX_RECORD (1 << 20)      // Enough for a frame of 65535 points
+
+#define COMPACT_SHOW_RECORD_POINTS 0
+#define COMPACT_SHOW_RECORD_REFERENCE 1
+
+class CompactShow
+{
+public:
+
+    typedef struct ShowHeader
+    {
+        char magic[8];              // "IDNSHOWZ"
+        uint32_t version;
+        uint32_t frameCount;
+        uint64_t pointCount;
+    } ShowHeader;
+
+    static const size_t headerSize = 24;
+
+    // Reads the frame and point count of a show file without decoding it. Returns 0 on success.
+    static int readInfo(const char* filename, uint32_t& frameCount, uint64_t& pointCount);
+
+    // Converts an ILDA file, indexed colors are resolved with the given palette until the file sets its own.
+    // Returns 0 on success.
+    static int convertIlda(const char* ildaFilename, const char* showFilename, const unsigned long* defaultPalette);
+
+protected:
+
+    typedef struct HistoryFrame
+    {
+        std::vector<ISPDB25Point> points;
+        unsigned frameIndex;        // Frame of the file the points were first decoded for
+        uint64_t hash;
+    } HistoryFrame;
+
+    std::deque<HistoryFrame> history;
+    size_t historyPoints = 0;
+
+    void addToHistory(const ISPDB25Point* points, unsigned pointCount, unsigned frameIndex, uint64_t hash);
+    static uint64_t hashPoints(const ISPDB25Point* points, unsigned pointCount);
+    static void encodeHeader(const ShowHeader& header, uint8_t* dst);
+    static bool decodeHeader(const uint8_t* src, ShowHeader& header);
+};
+
+class CompactShowWriter : public CompactShow
+{
+public:
+
+    ~CompactShowWriter();
+
+    // Frames are written to a temporary file that replaces the show file once finished
+    int begin(const char* filename);
+    int addFrame(const ISPDB25Point* points, unsigned pointCount);
+    int finish();
+    void abort();
+
+    bool isWriting() { return file != nullptr; }
+    uint32_t frameCount() { return header.frameCount; }
+    uint32_t referenceCount() { return references; }
+    uint64_t bytesWritten() { return written; }
+
+private:
+
+    FILE* file = nullptr;
+    std::string path;
+    std::string tempPath;
+    ShowHeader header;
+    uint32_t references = 0;
+    uint64_t written = 0;
+    std::vector<uint8_t> record;
+
+    int writeRecord();
+};
+
+class CompactShowReader : public CompactShow
+{
+public:
+
+    ~CompactShowReader();
+
+    int open(const char* filename);
+    void close();
+
+    // Returns 1 and the points of the next frame, 0 at the end of the file, or -1 on a malformed or
+    // unreadable file. sourceFrame is the frame the points were first decoded for, which differs from
+    // the current frame if it repeats an earlier one.
+    int nextFrame(std::vector<ISPDB25Point>& points, unsigned& sourceFrame);
+
+    uint32_t frameCount() { return header.frameCount; }
+    uint64_t bytesRead() { return consumed; }
+
+private:
+
+    std::string filename;
+    int fd = -1;
+    ShowHeader header;
+    unsigned frameIndex = 0;
+
+    std::vector<uint8_t> buffer;
+    size_t bufferStart = 0;
+    size_t bufferEnd = 0;
+    uint64_t consumed = 0;
+    bool endOfFile = false;
+
+    bool fill(size_t bytes);
+    int decodeRecord(const uint8_t* src, const uint8_t* end, std::vector<ISPDB25Point>& points, unsigned& sourceFrame);
+};
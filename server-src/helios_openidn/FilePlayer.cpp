@@ -28,14 +28,34 @@ FilePlayer::FilePlayer()
     defaultParameters.speed = 30000;
     defaultParameters.numRepetitions = 1;
 
-    if (!std::filesystem::is_directory(localFileDirectory))
-        std::filesystem::create_directory(localFileDirectory);
+    // Without the parent directory (a development machine) the player runs with an empty library
+    std::error_code error;
+    if (!std::filesystem::is_directory(localFileDirectory, error))
+        std::filesystem::create_directory(localFileDirectory, error);
 }
 
 void FilePlayer::startup()
 {
+#ifdef DEBUGOUTPUT
+    auto startTime = std::chrono::steady_clock::now();
+#endif
+
+    // The saved library index makes the program list available without scanning the library,
+    // the watcher thread then picks up whatever changed since it was saved
+    if (libraryIndex.load() != 0 || libraryIndex.size() == 0)
+    {
+        libraryIndex.scan({ localFileDirectory, usbFileDirectory });
+        libraryIndex.save();
+    }
     buildProgramMap();
 
+#ifdef DEBUGOUTPUT
+    printf("[IDTF] Library: %zu files, %zu programs ready in %.1f ms\n", libraryIndex.size(), programCount(),
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+#endif
+
+    libraryIndex.startWatching({ localFileDirectory, usbFileDirectory }, [this]() { buildProgramMap(); });
+
     if (autoplay)
     {
         playFile(getCurrentProgramName());
@@ -56,6 +76,8 @@ void FilePlayer::stop()
 {
 	state.store(FILEPLAYER_STATE_STOP);
     fileJob.fetch_add(1); // Cancels current file async loading, if any
+    for (const auto& device : management->devices)
+        device->endLocalFrames();
     management->relinquishOutput(OUTPUT_MODE_FILE);
     std::lock_guard<std::mutex> lock(threadLock);
     queue.clear();
@@ -80,6 +102,7 @@ void FilePlayer::playFile(std::string programName)
     {
         std::lock_guard<std::mutex> lock(threadLock);
         queue.clear();
+        fileLoading = true;
     }
 
     PlayFileThreadArgs* args = new PlayFileThreadArgs();
@@ -118,12 +141,28 @@ void* playFileThreaded(void* _arg)
 // Threaded inner function. Should not be used directly, call playFile() instead.
 // This piecewise loads the file from the disk to RAM while the file is playing, keeping track of buffer size. It cancels loading if a new file is played instead.
 int FilePlayer::playFileInnerJob(std::string programName, int job)
+{
+    int result = loadPrograms(programName, job);
+
+    // Lets the output loop know that an empty queue now means the end of playback
+    std::lock_guard<std::mutex> lock(threadLock);
+    if (job == fileJob.load())
+        fileLoading = false;
+
+    return result;
+}
+
+// Queues the frames of a program, and of the programs that follow it in the next and shuffle
+// modes. Following programs are loaded right behind the current one while its last queued frames
+// are still playing, so the transition happens on a frame boundary without a gap.
+int FilePlayer::loadPrograms(std::string programName, int job)
 {
     if (programName.empty())
         programName = nextRandomProgram(usbFileDirectory + "a.ild");
     if (programName.empty())
         programName = nextRandomProgram(localFileDirectory + "a.ild");
-    if (programName.empty() || programs.count(programName) == 0)
+    Program currentProgram;
+    if (programName.empty() || !getProgram(programName, currentProgram))
     {
         stop();
         return -1;
@@ -131,8 +170,6 @@ int FilePlayer::playFileInnerJob(std::string programName, int job)
 
     setCurrentProgramName(programName);
 
-    Program currentProgram = programs[programName];
-
     if (management->devices.empty())
     {
         printf("[IDTF] Attempted to play file when no devices are connected");
@@ -148,366 +185,416 @@ int FilePlayer::playFileInnerJob(std::string programName, int job)
     //else if (palOption == IDTFOPT_PALETTE_ILDA_STANDARD) { currentPalette = ildaStandardPalette; }
     //else { printf("[IDTF] Invalid palette option"); return -1; }*/
 
-    const float xScale = 0xFFFF; //(options & IDTFOPT_MIRROR_X) ?  -xyScale : 0xFFFF;
-    const float yScale = 0xFFFF; //(options & IDTFOPT_MIRROR_Y) ?  -xyScale : 0xFFFF;
-
-    do
+    while (1)
     {
-        for (int fileIndex = 0; fileIndex < currentProgram.files.size(); fileIndex++)
-        {
-            IldaFile ildaFile = currentProgram.files[fileIndex];
-            const char* filename = ildaFile.filePath.c_str();
-            // Open the passed file
-            FILE* fpIDTF = fopen(filename, "rb");
-            if (!fpIDTF)
-            {
-                printf("[IDTF] %s: Cannot open file (errno: %d)", filename, errno);
-                continue;
-            }
+        std::shared_ptr<const OutputList> outputs = std::make_shared<const OutputList>(resolveOutputs(currentProgram.outputs));
 
-            long filePos;
-            uint8_t ilda[4];
+        if (!queueProgramStart(programName, job))
+            return 0;
 
-            // Sanity check - Read signature of first section
-            filePos = ftell(fpIDTF);
-            fread(ilda, sizeof(ilda), 1, fpIDTF);
-
-            // Check for EOF and the signature of first section
-            if (feof(fpIDTF) || !((ilda[0] == 'I') && (ilda[1] == 'L') && (ilda[2] == 'D') && (ilda[3] == 'A')))
+        do
+        {
+            for (int fileIndex = 0; fileIndex < currentProgram.files.size(); fileIndex++)
             {
-                printf("[IDTF] %s: Not an IDTF file", filename);
-                fclose(fpIDTF);
-                continue;
-            }
-
-            // Rewind for loop start
-            fseek(fpIDTF, filePos, SEEK_SET);
-
+                IldaFile ildaFile = currentProgram.files[fileIndex];
+                const char* filename = ildaFile.filePath.c_str();
 #ifdef DEBUGOUTPUT
-            printf("Playing file %s, speed %g %s, reps %d\n", filename, ildaFile.parameters.speed, ildaFile.parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_FPS ? "fps" : "pps", ildaFile.parameters.numRepetitions);
+                printf("Playing file %s, speed %g %s, reps %d\n", filename, ildaFile.parameters.speed, ildaFile.parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_FPS ? "fps" : "pps", ildaFile.parameters.numRepetitions);
 #endif
 
-            // -------------------------------------------------------------------------
-            // OK - Read the file
-            // -------------------------------------------------------------------------
-
-            int result = 0;
-
-            while (1)
-            {
-                // Read section signature. Silently abort in case of (incorrect) EOF.
-                filePos = ftell(fpIDTF);
-                fread(ilda, sizeof(ilda), 1, fpIDTF);
-                if (feof(fpIDTF))
-                    break;
-
-                // Some systems use this signature before appending further (non-IDTF) data...
-                if ((ilda[0] == 0) && (ilda[1] == 0) && (ilda[2] == 0) && (ilda[3] == 0))
-                    break;
-
-                // Check for IDTF section signature
-                if (!((ilda[0] == 'I') && (ilda[1] == 'L') && (ilda[2] == 'D') && (ilda[3] == 'A')))
+                struct timespec cpuStart, cpuEnd;
+                clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuStart);
+
+                // Frames of files that start with the default palette can be taken from the frame cache
+                // and their converted slices can be reused
+                // Compact show files have their colors resolved and don't depend on the palette
+                bool compactShow = LibraryIndex::isCompactShowFile(filename);
+                bool useFrameCache = frameCacheEnabled && currentPalette == ildaDefaultPalette;
+                uint32_t fileId = 0;
+                uint32_t frameIndex = 0;
+                struct stat fileStat;
+                if ((compactShow || currentPalette == ildaDefaultPalette) && stat(filename, &fileStat) == 0)
+                    fileId = sliceCache.fileId(ildaFile.filePath.string() + "|" + std::to_string(fileStat.st_size) + "|" + std::to_string(fileStat.st_mtim.tv_sec) + "." + std::to_string(fileStat.st_mtim.tv_nsec));
+
+                if (compactShow)
                 {
-                    printf("[IDTF] %s: Bad section signature at pos 0x%08X", filename, filePos);
-                    result = -1;
-                    break;
+                    if (!queueCompactShow(ildaFile, job, fileId, outputs))
+                        return 0;
+                    continue;
                 }
-
-                // Skip reserved bytes and read format code
-                fgetc(fpIDTF);
-                fgetc(fpIDTF);
-                fgetc(fpIDTF);
-                uint8_t formatCode = (uint8_t)fgetc(fpIDTF);
-                if ((result = checkEOF(fpIDTF, "Header")) != 0)
-                    break;
-
-                // Read data set name (frame name or color palette name) and company name
-                uint8_t dataSetName[8], companyName[8];
-                fread(dataSetName, 8, 1, fpIDTF);
-                fread(companyName, 8, 1, fpIDTF);
-                if ((result = checkEOF(fpIDTF, "Header")) != 0)
-                    break;
-
-                //logInfo("dataSetName: %8.8s", dataSetName);
-                //logInfo("companyName: %8.8s", companyName);
-
-                // Read record count and data set number (frame number or color palette number)
-                uint16_t recordCnt = (uint16_t)readShort(fpIDTF);
-                uint16_t dataSetNumber = (uint16_t)readShort(fpIDTF);
-                if ((result = checkEOF(fpIDTF, "Header")) != 0)
-                    break;
-
-                // Read data set count (not used) and head number (not used)
-                uint16_t dataSetCnt = (uint16_t)readShort(fpIDTF);
-                uint8_t headNumber = (uint8_t)fgetc(fpIDTF);
-                fgetc(fpIDTF);
-
-                //logInfo("Format: %d, Records: %d, Set number: %d, Set count: %d, Head: %d", formatCode, recordCnt, dataSetNumber, dataSetCnt, headNumber);
-
-                // Terminate in case of an empty section (no records - regular end)
-                if (recordCnt == 0)
-                    break;
-
-                // Handle data section depending on format code
-                if ((formatCode == 0) || (formatCode == 1) || (formatCode == 4) || (formatCode == 5))
+                IldaFrameCache frameCache;
+                if (useFrameCache && frameCache.open(frameCacheDirectory, filename) == 0)
                 {
-                    //logInfo("Frame, fmt=%u, filePos 0x%08X", formatCode, filePos);
-
-                    // Terminate on insane frames
-                    if (recordCnt <= 1)
+                    frameCacheHits++;
+                    for (unsigned frameIndex = 0; frameIndex < frameCache.frameCount(); frameIndex++)
                     {
-                        printf("[IDTF] %s: Frames should contain at least 2 points", filename);
-                        result = -1;
-                        break;
+                        unsigned pointCount;
+                        const ISPDB25Point* points = frameCache.framePoints(frameIndex, pointCount);
+                        if (!queueFramePoints(points, pointCount, ildaFile, job, fileId, frameIndex, outputs))
+                            return 0;
                     }
 
-                    // Formats 0 and 4 are X, Y, Z; Formats 1 and 5 are X, Y.
-                    int hasZ = (formatCode == 0) || (formatCode == 4);
-
-                    // Formats 0 and 1 have color index; Formats 4 and 5 are true color RGB.
-                    int hasIndex = (formatCode == 0) || (formatCode == 1);
+                    if (frameCache.getPalette(customPalette))
+                        currentPalette = customPalette;
 
 #ifdef DEBUGOUTPUT
-                    //printf("Playing frame from file %s, speed %d, reps %d\n", filename, parameters.speed, parameters.numRepetitions);
+                    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+                    printf("[IDTF] %s: %u frames from frame cache, loader CPU %.1f ms, cache hit rate %.0f%% (%u of %u)\n", filename, frameCache.frameCount(), (cpuEnd.tv_sec - cpuStart.tv_sec) * 1e3 + (cpuEnd.tv_nsec - cpuStart.tv_nsec) / 1e6, 100.0 * frameCacheHits / (frameCacheHits + frameCacheMisses), frameCacheHits, frameCacheHits + frameCacheMisses);
+                    sliceCache.printStats();
 #endif
+                    continue;
+                }
 
-                //std::vector<std::shared_ptr<QueuedChunk>> chunksInFrame;
-
-                    std::shared_ptr<QueuedFrame> frame = std::make_shared<QueuedFrame>();
-
-                    if (ildaFile.parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_PPS)
-                        frame->durationMs = recordCnt / ildaFile.parameters.speed * 1000;
-                    else // if (parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_FPS)
-                        frame->durationMs = 1.0 / ildaFile.parameters.speed * 1000;
+                // Map the passed file, this also checks the signature of the first section
+                IldaReader reader;
+                if (reader.open(filename) != 0)
+                    continue;
 
-                    std::shared_ptr<QueuedChunk> chunk = std::make_shared<QueuedChunk>();
+                if (useFrameCache)
+                {
+                    frameCacheMisses++;
+                    frameCache.beginBuild(frameCacheDirectory, filename);
+                }
 
-                    int pointsPerChunk = recordCnt;
-                    int maxPointsPerChunk = management->devices.front()->maxBytesPerTransmission() / management->devices.front()->bytesPerPoint();
-                    if (recordCnt > maxPointsPerChunk)
-                    {
-                        if (maxPointsPerChunk == 0)
-                            continue;
+                unsigned parsedFrames = 0;
+                double parseTimeMs = 0;
 
-                        pointsPerChunk = (int)ceil(recordCnt / ceil((double)recordCnt / maxPointsPerChunk));
-                        if (pointsPerChunk < maxPointsPerChunk)
-                            pointsPerChunk += 1;
+                // -------------------------------------------------------------------------
+                // OK - Read the file
+                // -------------------------------------------------------------------------
 
-                        if (pointsPerChunk == 0)
-                            continue;
-                    }
+                int result = 0;
+                IldaReader::IldaSection section;
 
-                    chunk->buffer.reserve(pointsPerChunk);
+                while ((result = reader.nextSection(section)) > 0)
+                {
+                    //logInfo("Format: %d, Records: %d, Set number: %d, Set count: %d, Head: %d", section.formatCode, section.recordCnt, section.dataSetNumber, section.dataSetCnt, section.headNumber);
 
-                    // Loop through all points
-                    unsigned int currentPointInChunk = 0;
-                    for (int i = 0; i < recordCnt; i++)
+                    // Handle data section depending on format code
+                    if (section.formatCode == ILDA_FORMAT_PALETTE)
                     {
-                        int16_t x, y, z;
-                        uint8_t statusCode, r, g, b;
-
-                        // Remember file pos at the beginning of the point
-                        filePos = ftell(fpIDTF);
-
-                        // Read coordinates
-                        x = (short)((float)(short)readShort(fpIDTF) * xScale);
-                        y = (short)((float)(short)readShort(fpIDTF) * yScale);
-                        if (hasZ)
-                            z = readShort(fpIDTF);
-                        else
-                            z = 0;
-
-                        // Read status code
-                        statusCode = (uint8_t)fgetc(fpIDTF);
-
-                        // Read color
-                        if (hasIndex)
-                        {
-                            uint8_t colorIndex = (uint8_t)fgetc(fpIDTF);
-                            long rgb = currentPalette[colorIndex];
-                            r = (uint8_t)(rgb >> 16);
-                            g = (uint8_t)(rgb >> 8);
-                            b = (uint8_t)rgb;
-                        }
-                        else
-                        {
-                            b = (uint8_t)fgetc(fpIDTF);
-                            g = (uint8_t)fgetc(fpIDTF);
-                            r = (uint8_t)fgetc(fpIDTF);
-                        }
-
-                        // Check for unexpected EOF
-                        if (feof(fpIDTF))
-                        {
-                            printf("[IDTF] Unexpected end of file: Record %u of %u", i, recordCnt);
-                            result = -1;
-                            break;
-                        }
-
-                        // Output the point
-                        if (statusCode & 0x40)
-                            r = g = b = 0;
-
-                        ISPDB25Point point;
-                        point.x = 0xFFFF - (x + 0x8000);
-                        point.y = 0xFFFF - (y + 0x8000);
-                        point.r = r * 0x101;
-                        point.g = g * 0x101;
-                        point.b = b * 0x101;
-                        point.intensity = 0xFFFF;
-                        point.u1 = point.u2 = point.u3 = point.u4 = 0;
-                        chunk->buffer.push_back(point);
-
-                        currentPointInChunk++;
-
-                        if (currentPointInChunk >= pointsPerChunk && i < recordCnt - 1) //  Send partial frame, if frame is split due to being too large for DAC.
-                        {
-                            if (ildaFile.parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_PPS)
-                                chunk->pps = ildaFile.parameters.speed;
-                            else // if (parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_FPS)
-                                chunk->pps = ildaFile.parameters.speed * recordCnt;
-
-                            //{
-                                //std::lock_guard<std::mutex> lock(threadLock);
-                                //queue.push_back(chunk);
-                            //}
-                            frame->chunks.push_back(chunk);
-
-                            //printf("Played chunk from file %s\n", filename.c_str());
-
-                            chunk = std::make_shared<QueuedChunk>();
-                            chunk->buffer.reserve(pointsPerChunk);
-
-                            currentPointInChunk = 0;
-                        }
-
-                        /*if (cbFunc->putSampleXYRGB(cbContext, x, y, r, g, b))
-                        {
-                            result = -1;
-                            break;
-                        }*/
-
-                        // Check the status code (last point) against the record counter
-                        int lastPointFlag = ((statusCode & 0x80) != 0);
-                        int lastRecordFlag = ((i + 1) == recordCnt);
-                        if (lastPointFlag && !lastRecordFlag)
-                        {
-                            printf("[IDTF] Last point flag set, record count mismatch: Record %u of %u, file pos 0x%08X", i, recordCnt, filePos);
-                            result = -1;
+                        //logInfo("Palette, filePos 0x%08X", section.filePos);
+
+                        // Set custom palette for the next sections
+                        if ((result = reader.decodePalette(section, customPalette)) != 0)
                             break;
-                        }
-                        else if (!lastPointFlag && lastRecordFlag)
-                        {
-                            printf("[IDTF] Last point flag not set on last record: File pos 0x%08X", filePos);
-                        }
+                        currentPalette = customPalette;
+                        continue;
                     }
-                    if (result != 0)
-                        break;
 
+                    //logInfo("Frame, fmt=%u, filePos 0x%08X", section.formatCode, section.filePos);
 
-                    if (!chunk->buffer.empty())
-                    {
-                        if (ildaFile.parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_PPS)
-                            chunk->pps = ildaFile.parameters.speed;
-                        else // if (parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_FPS)
-                            chunk->pps = ildaFile.parameters.speed * recordCnt;
+                    auto parseStart = std::chrono::steady_clock::now();
 
-                        {
-                            //std::lock_guard<std::mutex> lock(threadLock);
-                            //queue.push_back(chunk);
-                        }
-                        frame->chunks.push_back(chunk);
+                    // Decode all points of the frame in bulk
+                    framePoints.resize(section.recordCnt);
+                    if ((result = reader.decodePoints(section, 0, section.recordCnt, currentPalette, framePoints.data())) != 0)
+                        break;
 
-#ifdef DEBUGOUTPUT
-                        //printf("Played chunk from file %s\n", filename.c_str());
-#endif
-                    }
+                    // Check the status code (last point) against the record counter
+                    if (!reader.lastPointFlagSet(section))
+                        printf("[IDTF] Last point flag not set on last record: File pos 0x%08zX", section.filePos);
 
-                    // Wait in the background until the queue is small enough to need new frames
-                    struct timespec delay, dummy;
-                    delay.tv_sec = 0;
-                    delay.tv_nsec = 10000000; // 10 ms
-                    while (hasEnoughBufferedFileQueue() && job == fileJob.load())
-                    {
-                        nanosleep(&delay, &dummy); 
-                        //printf(".");
-                    }
+                    if (frameCache.isBuilding())
+                        frameCache.addFrame(framePoints.data(), framePoints.size());
 
-                    std::lock_guard<std::mutex> lock(threadLock);
+                    parseTimeMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - parseStart).count();
+                    parsedFrames++;
 
-                    if (job != fileJob.load())
-                    {
-                        fclose(fpIDTF);
+                    if (!queueFramePoints(framePoints.data(), framePoints.size(), ildaFile, job, fileId, frameIndex++, outputs))
                         return 0;
-                    }
+                }
 
-                    queue.push_back(frame);
-                    for (int repetition = 1; repetition < ildaFile.parameters.numRepetitions; repetition++)
+                // Frames up to a malformed section are cached as well, that is what gets played
+                if (frameCache.isBuilding())
+                {
+                    auto finishStart = std::chrono::steady_clock::now();
+                    if (frameCache.finishBuild(currentPalette == customPalette ? customPalette : nullptr) == 0)
                     {
-                        queue.push_back(frame);
+                        parseTimeMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - finishStart).count();
+                        printf("[IDTF] %s: Built frame cache, %u frames in %.1f ms\n", filename, parsedFrames, parseTimeMs);
                     }
+                }
 
 #ifdef DEBUGOUTPUT
-                    //printf("Played frame, pos %d, from file\n", filePos);
+                clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+                if (parseTimeMs > 0)
+                    printf("[IDTF] %s: Parsed %u frames, %.2f MB in %.1f ms (%.1f MB/s, %.0f frames/s), loader CPU %.1f ms\n", filename, parsedFrames, reader.bytesRead() / 1e6, parseTimeMs, reader.bytesRead() / 1e3 / parseTimeMs, parsedFrames * 1000.0 / parseTimeMs, (cpuEnd.tv_sec - cpuStart.tv_sec) * 1e3 + (cpuEnd.tv_nsec - cpuStart.tv_nsec) / 1e6);
+                sliceCache.printStats();
 #endif
+            }
+        }
+        while (state.load() == FILEPLAYER_STATE_PLAY && mode == FILEPLAYER_MODE_REPEAT && job == fileJob.load()); // Start over again if looping
 
-                    if (state.load() != FILEPLAYER_STATE_PAUSE)
-                        start();
-                }
-                else if (formatCode == 2)
-                {
-                    //logInfo("Palette, filePos 0x%08X", formatCode, filePos);
+        if (job != fileJob.load())
+            return 0;
 
-                    // Terminate on insane palettes
-                    if (recordCnt > 256)
-                    {
-                        printf("[IDTF] %s: Palettes shall not contain more than 256 colors", filename);
-                        result = -1;
-                        break;
-                    }
+        std::string nextProgramName = nextChainedProgram(programName);
+        if (nextProgramName.empty())
+            break;
+
+        programName = nextProgramName;
+        if (!getProgram(programName, currentProgram))
+            break;
+    }
 
-                    // Initialize palette table
-                    memset(customPalette, 0, sizeof(customPalette));
+    return 0;
+}
 
-                    // Loop through all color indices
-                    for (int i = 0; i < recordCnt; i++)
-                    {
-                        // Read color
-                        uint8_t r = (uint8_t)fgetc(fpIDTF);
-                        uint8_t g = (uint8_t)fgetc(fpIDTF);
-                        uint8_t b = (uint8_t)fgetc(fpIDTF);
-
-                        // Check for unexpected EOF
-                        if (feof(fpIDTF))
-                        {
-                            printf("[IDTF] Unexpected end of file: Record %u of %u", i, recordCnt);
-                            result = -1;
-                            break;
-                        }
+// Streams the frames of a compact show file into the queue. Repeated frames are queued with the index of
+// the frame they repeat, so they find its converted slices in the slice cache.
+// Returns false if the file job was cancelled in the meantime.
+bool FilePlayer::queueCompactShow(const IldaFile& ildaFile, int job, uint32_t fileId, const std::shared_ptr<const OutputList>& outputs)
+{
+    const char* filename = ildaFile.filePath.c_str();
+    CompactShowReader reader;
+    if (reader.open(filename) != 0)
+        return true;
+
+    struct timespec cpuStart, cpuEnd;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuStart);
+    double decodeTimeMs = 0;
+    unsigned decodedFrames = 0;
+    unsigned repeatedFrames = 0;
+    uint64_t decodedPoints = 0;
+
+    int result;
+    unsigned frameIndex = 0;
+    unsigned sourceFrame;
+    while (true)
+    {
+        auto decodeStart = std::chrono::steady_clock::now();
+        result = reader.nextFrame(framePoints, sourceFrame);
+        decodeTimeMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - decodeStart).count();
+        if (result <= 0)
+            break;
+
+        decodedFrames++;
+        decodedPoints += framePoints.size();
+        if (sourceFrame != frameIndex)
+            repeatedFrames++;
+
+        if (!queueFramePoints(framePoints.data(), framePoints.size(), ildaFile, job, fileId, sourceFrame, outputs))
+            return false;
+        frameIndex++;
+    }
 
-                        // Set palette entry
-                        customPalette[i] = ILDACOLOR(r, g, b);
-                    }
-                    if (result != 0)
-                        break;
+#ifdef DEBUGOUTPUT
+    // Read bandwidth saved against the same points in the smallest true color ILDA format
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+    double ildaBytes = decodedPoints * 8.0 + decodedFrames * ILDA_HEADER_SIZE;
+    if (decodeTimeMs > 0)
+        printf("[IDTF] %s: Decoded %u frames (%u repeated), %.2f MB read instead of %.2f MB ILDA (%.0f%% saved) in %.1f ms (%.0f frames/s), loader CPU %.1f ms\n", filename, decodedFrames, repeatedFrames,
+            reader.bytesRead() / 1e6, ildaBytes / 1e6, ildaBytes > 0 ? 100.0 * (1.0 - reader.bytesRead() / ildaBytes) : 0.0, decodeTimeMs, decodedFrames * 1000.0 / decodeTimeMs,
+            (cpuEnd.tv_sec - cpuStart.tv_sec) * 1e3 + (cpuEnd.tv_nsec - cpuStart.tv_nsec) / 1e6);
+    sliceCache.printStats();
+#endif
 
-                    // Set custom palette for the next sections
-                    currentPalette = customPalette;
-                }
-                else
-                {
-                    printf("[IDTF] %s: formatCode = %d", filename, formatCode);
-                    result = -1;
-                    break;
-                }
+    return true;
+}
+
+// The program that playback continues with after the given one ends, empty if playback ends
+std::string FilePlayer::nextChainedProgram(const std::string& programName)
+{
+    if (state.load() != FILEPLAYER_STATE_PLAY)
+        return "";
+
+    std::string nextProgramName;
+    if (mode == FILEPLAYER_MODE_NEXT)
+        nextProgramName = nextAlphabeticalProgram(programName, false);
+    else if (mode == FILEPLAYER_MODE_SHUFFLE)
+        nextProgramName = nextRandomProgram(programName);
+    else
+        return "";
+
+    if (nextProgramName == programName || !hasProgram(nextProgramName))
+        return "";
+
+    return nextProgramName;
+}
+
+// Devices for an output spec of a program: "all", or the 1-based numbers of the output services
+// separated by commas. Falls back to the first device if the spec names none that exist.
+FilePlayer::OutputList FilePlayer::resolveOutputs(const std::string& outputSpec)
+{
+    const std::string& spec = outputSpec.empty() ? defaultOutputs : outputSpec;
+    if (spec == "all")
+        return management->devices;
+
+    OutputList outputs;
+    std::stringstream specStream(spec);
+    std::string field;
+    while (std::getline(specStream, field, ','))
+    {
+        try
+        {
+            int number = std::stoi(field);
+            if (number < 1 || number > (int)management->devices.size())
+            {
+                printf("Warning: File player output %d doesn't exist\n", number);
+                continue;
             }
+            const std::shared_ptr<DACHWInterface>& device = management->devices[number - 1];
+            if (std::find(outputs.begin(), outputs.end(), device) == outputs.end())
+                outputs.push_back(device);
+        }
+        catch (std::exception& ex)
+        {
+            printf("Warning: Invalid file player output %s\n", field.c_str());
+        }
+    }
+
+    if (outputs.empty() && !management->devices.empty())
+        outputs.push_back(management->devices.front());
+
+    return outputs;
+}
 
-            fclose(fpIDTF);
+// Queues an empty frame marking the start of a program, the output loop makes it the current
+// program when it gets there. Returns false if the file job was cancelled.
+bool FilePlayer::queueProgramStart(const std::string& programName, int job)
+{
+    std::shared_ptr<QueuedFrame> marker = std::make_shared<QueuedFrame>();
+    marker->durationMs = 0;
+    marker->programStart = programName;
+
+    std::lock_guard<std::mutex> lock(threadLock);
+
+    if (job != fileJob.load())
+        return false;
+
+    queue.push_back(marker);
+    return true;
+}
+
+// Splits the points of one frame into chunks all output devices can take and queues the frame once the queue has room for it.
+// Frames that are already in the slice cache for all device types are queued with their converted slices instead.
+// Returns false if the file job was cancelled in the meantime.
+bool FilePlayer::queueFramePoints(const ISPDB25Point* points, unsigned pointCount, const IldaFile& ildaFile, int job, uint32_t fileId, uint32_t frameIndex, const std::shared_ptr<const OutputList>& outputs)
+{
+    std::shared_ptr<QueuedFrame> frame = std::make_shared<QueuedFrame>();
+
+    // Clock timed frames need to fit their period at a point rate all devices can take
+    std::vector<ISPDB25Point> fittedPoints;
+    bool clockTimed = (timing == FILEPLAYER_TIMING_CLOCK && ildaFile.parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_FPS && ildaFile.parameters.speed > 0);
+    if (clockTimed)
+    {
+        unsigned maxPoints = UINT_MAX;
+        for (const auto& device : *outputs)
+            maxPoints = std::min(maxPoints, (unsigned)std::min((double)UINT_MAX, std::max(1.0, device->maxPointrate() / ildaFile.parameters.speed)));
+
+        if (pointCount == 0)
+        {
+            // Empty frames blank at the last position for their period. Not cached, the position depends on the previous frame.
+            ISPDB25Point blank = {};
+            blank.x = clockLastPoint.x;
+            blank.y = clockLastPoint.y;
+            fittedPoints.push_back(blank);
+            fileId = 0;
         }
+        else if (pointCount > maxPoints)
+        {
+            // Reduce to the points the devices can output in the period
+            fittedPoints.assign(points, points + pointCount);
+            pointReducer.reduce(fittedPoints, maxPoints);
+        }
+
+        if (!fittedPoints.empty())
+        {
+            points = fittedPoints.data();
+            pointCount = fittedPoints.size();
+        }
+        clockLastPoint = points[pointCount - 1];
+        frame->clockFps = ildaFile.parameters.speed;
     }
-    while (state.load() == FILEPLAYER_STATE_PLAY && mode == FILEPLAYER_MODE_REPEAT && job == fileJob.load()); // Start over again if looping
 
-    return 0;
+    if (ildaFile.parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_PPS)
+        frame->durationMs = pointCount / ildaFile.parameters.speed * 1000;
+    else // if (parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_FPS)
+        frame->durationMs = 1.0 / ildaFile.parameters.speed * 1000;
+
+    unsigned int pps;
+    if (ildaFile.parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_PPS)
+        pps = ildaFile.parameters.speed;
+    else // if (parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_FPS)
+        pps = ildaFile.parameters.speed * pointCount;
+
+    frame->fileId = fileId;
+    frame->frameIndex = frameIndex;
+    frame->outputs = outputs;
+
+    // Devices of the same type share one conversion
+    bool allConverted = true;
+    int maxPointsPerChunk = INT_MAX;
+    for (const auto& device : *outputs)
+    {
+        maxPointsPerChunk = std::min(maxPointsPerChunk, (int)(device->maxBytesPerTransmission() / device->bytesPerPoint()));
+        if (findConverted(*frame, *device) != nullptr)
+            continue;
+
+        std::shared_ptr<const FrameSliceCache::ConvertedFrame> converted;
+        if (fileId != 0)
+            converted = sliceCache.find(FrameSliceCache::Key(fileId, frameIndex, typeid(*device), pps));
+        if (converted != nullptr)
+            frame->converted.push_back(converted);
+        else
+            allConverted = false;
+    }
+
+    if (!allConverted)
+    {
+        int pointsPerChunk = pointCount;
+        if (pointCount > maxPointsPerChunk)
+        {
+            if (maxPointsPerChunk == 0)
+                return true;
+
+            pointsPerChunk = (int)ceil(pointCount / ceil((double)pointCount / maxPointsPerChunk));
+            if (pointsPerChunk < maxPointsPerChunk)
+                pointsPerChunk += 1;
+
+            if (pointsPerChunk == 0)
+                return true;
+        }
+
+        // Frame is split if it is too large for the DAC
+        for (unsigned first = 0; first < pointCount; first += pointsPerChunk)
+        {
+            unsigned count = std::min(pointCount - first, (unsigned)pointsPerChunk);
+
+            std::shared_ptr<QueuedChunk> chunk = std::make_shared<QueuedChunk>();
+            chunk->buffer.assign(points + first, points + first + count);
+            chunk->pps = pps;
+
+            frame->chunks.push_back(chunk);
+        }
+    }
+
+    // Wait in the background until the queue is small enough to need new frames
+    struct timespec delay, dummy;
+    delay.tv_sec = 0;
+    delay.tv_nsec = 10000000; // 10 ms
+    while (hasEnoughBufferedFileQueue() && job == fileJob.load())
+    {
+        nanosleep(&delay, &dummy); 
+        //printf(".");
+    }
+
+    std::lock_guard<std::mutex> lock(threadLock);
+
+    if (job != fileJob.load())
+        return false;
+
+    queue.push_back(frame);
+    for (int repetition = 1; repetition < ildaFile.parameters.numRepetitions; repetition++)
+    {
+        queue.push_back(frame);
+    }
+
+    if (state.load() != FILEPLAYER_STATE_PAUSE)
+        start();
+
+    return true;
 }
 
 void* outputLoopThread(void* arg)
@@ -529,19 +616,36 @@ void FilePlayer::outputLoop()
 
         if (state.load() == FILEPLAYER_STATE_STOP)
         {
+            playedSinceEndAction = false;
+            playedOutputs.clear();
+            lastFrameOutputs = nullptr;
+            transitionProgramName.clear();
+            lastFrameEnd = std::chrono::steady_clock::time_point();
+            clockRunning = false;
 
             delay.tv_nsec = 10000000; // 10 ms
         }
         else if (state.load() == FILEPLAYER_STATE_PLAY || state.load() == FILEPLAYER_STATE_PAUSE)
         {
             bool empty = false;
+            bool loading = false;
             {
                 std::lock_guard<std::mutex> lock(threadLock);
                 if (queue.empty())
                     empty = true;
+                loading = fileLoading;
             }
             if (empty)
             {
+                // Everything the file job queued has been played, or picked up by the driver
+                if (playedSinceEndAction && !loading && outputsDrained())
+                {
+                    playedSinceEndAction = false;
+                    playedOutputs.clear();
+                    lastFrameOutputs = nullptr;
+                    doFileEndAction(false);
+                    continue;
+                }
                 nanosleep(&delay, &dummy);
                 continue;
             }
@@ -558,15 +662,20 @@ void FilePlayer::outputLoop()
                 continue;
             }
 
-
             {
                 std::shared_ptr<QueuedFrame> frame;
+                bool ready = true;
                 {
                     std::lock_guard<std::mutex> lock(threadLock);
                     if (queue.empty())
                         continue;
                     frame = queue.front();
-                    queue.pop_front();
+
+                    // The driver threads pace the output, only keep them a little ahead. At least
+                    // the target is queued here, so the wait can be a good part of it.
+                    ready = outputsReady(*frame);
+                    if (ready)
+                        queue.pop_front();
                     //if (mode == FILEPLAYER_MODE_REPEAT)
                     //    queue.push_back(frame);
 
@@ -575,39 +684,34 @@ void FilePlayer::outputLoop()
 #endif
                 }
 
-                for (auto chunk : frame->chunks)
+                if (!ready)
                 {
-                    unsigned int numOfPoints = chunk->buffer.size();
-
-                    if (numOfPoints > 0)
-                    {
-                        TimeSlice slice;
-                        slice.dataChunk = management->devices.front()->convertPoints(chunk->buffer);
-                        slice.durationUs = std::round((double)(1000000 * numOfPoints) / chunk->pps);
-
-                        management->devices.front()->writeFrame(slice, slice.durationUs);
-                    }
-                    else
-                    {
-                        //delay.tv_nsec = frame->pps / 1000;
-                        //nanosleep(&delay, &dummy); // todo sleep if FPS timing mode
-                    }
+                    delay.tv_nsec = FILEPLAYER_BRIDGE_QUEUE_MS * 1000000 / 4;
+                    nanosleep(&delay, &dummy);
+                    continue;
                 }
 
-                //if (state.load() != FILEPLAYER_STATE_PAUSE)
-                //{
-                bool empty;
+                if (!frame->programStart.empty())
                 {
-                    std::lock_guard<std::mutex> lock(threadLock);
-                    empty = queue.empty();
+                    setCurrentProgramName(frame->programStart);
+                    transitionProgramName = frame->programStart;
+                    continue;
                 }
 
-                if (empty)
+                // Convert the frame once per device type, unless it was converted before. Repetitions
+                // of a frame share the queued frame and reuse its conversions as well.
+                if (!frame->chunks.empty())
                 {
-                    doFileEndAction(false);
-                    continue;
+                    for (const auto& device : *frame->outputs)
+                    {
+                        if (findConverted(*frame, *device) == nullptr)
+                            frame->converted.push_back(convertFrame(*frame, device));
+                    }
+                    frame->chunks.clear();
                 }
-                //}
+
+                outputFrame(*frame);
+                playedSinceEndAction = true;
             }
         }
 
@@ -615,6 +719,300 @@ void FilePlayer::outputLoop()
     }
 }
 
+// Conversion of the frame for the type of the given device, nullptr if there is none yet
+std::shared_ptr<const FrameSliceCache::ConvertedFrame> FilePlayer::findConverted(const QueuedFrame& frame, const DACHWInterface& device)
+{
+    for (const auto& converted : frame.converted)
+    {
+        if (converted->key.deviceType == typeid(device))
+            return converted;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<const FrameSliceCache::ConvertedFrame> FilePlayer::convertFrame(const QueuedFrame& frame, const std::shared_ptr<DACHWInterface>& device)
+{
+    unsigned int pps = frame.chunks.empty() ? 0 : frame.chunks.front()->pps;
+    std::shared_ptr<FrameSliceCache::ConvertedFrame> converted = std::make_shared<FrameSliceCache::ConvertedFrame>(FrameSliceCache::Key(frame.fileId, frame.frameIndex, typeid(*device), pps));
+
+    for (auto chunk : frame.chunks)
+    {
+        unsigned int numOfPoints = chunk->buffer.size();
+
+        if (numOfPoints > 0)
+        {
+            std::shared_ptr<TimeSlice> slice = std::make_shared<TimeSlice>();
+            slice->dataChunk = device->convertPoints(chunk->buffer);
+            slice->durationUs = std::round((double)(1000000 * numOfPoints) / chunk->pps);
+            converted->bytes += slice->dataChunk.capacity() * sizeof(SlicePrimitive) + sizeof(TimeSlice) + sizeof(std::shared_ptr<TimeSlice>);
+            converted->slices.push_back(slice);
+            converted->lastX = chunk->buffer.back().x;
+            converted->lastY = chunk->buffer.back().y;
+        }
+        else
+        {
+            //delay.tv_nsec = frame->pps / 1000;
+            //nanosleep(&delay, &dummy); // todo sleep if FPS timing mode
+        }
+    }
+
+    if (frame.fileId != 0)
+        sliceCache.insert(converted);
+    return converted;
+}
+
+// True if the frame can be handed over, that is once the output furthest ahead is below the
+// queue target. Outputs that fell far behind don't hold the others back, they skip frames.
+bool FilePlayer::outputsReady(const QueuedFrame& frame)
+{
+    if (!bridgeOutput || frame.outputs == nullptr)
+        return true;
+
+    for (const auto& device : *frame.outputs)
+    {
+        if (device->localQueuedDurationUs() < FILEPLAYER_BRIDGE_QUEUE_MS * 1000)
+            return true;
+    }
+    return frame.outputs->empty();
+}
+
+// True once the driver threads of the devices played on have picked up everything handed to them
+bool FilePlayer::outputsDrained()
+{
+    if (!bridgeOutput)
+        return true;
+
+    for (const auto& device : playedOutputs)
+    {
+        if (device->localQueuedDurationUs() > 0)
+            return false;
+    }
+    return true;
+}
+
+// Hands a converted frame to the driver threads of its output devices, or writes it to them directly
+void FilePlayer::outputFrame(const QueuedFrame& frame)
+{
+    if (frame.outputs == nullptr || frame.converted.empty() || frame.converted.front()->slices.empty())
+        return;
+
+    // Time the laser had nothing from the file player to output
+    auto now = std::chrono::steady_clock::now();
+    bool hadOutput = (lastFrameEnd != std::chrono::steady_clock::time_point());
+    double starvedMs = 0;
+    if (hadOutput && now > lastFrameEnd)
+        starvedMs = std::chrono::duration<double, std::milli>(now - lastFrameEnd).count();
+    if (lastFrameEnd < now)
+        lastFrameEnd = now;
+
+    // Time from the end of the last frame of the previous program to the first frame of the next one
+    if (!transitionProgramName.empty())
+    {
+#ifdef DEBUGOUTPUT
+        if (hadOutput)
+            printf("[IDTF] Transition to program %s, gap %.2f ms\n", transitionProgramName.c_str(), starvedMs);
+#endif
+        transitionProgramName.clear();
+    }
+
+    double frameUs = 0;
+    for (const auto& slice : frame.converted.front()->slices)
+        frameUs += slice->durationUs;
+
+    // Clock timed frames are stretched or trimmed to their period on the clock
+    double durationUs = frameUs;
+    if (frame.clockFps > 0)
+        durationUs = clockFrameDurationUs(frame, now);
+    else
+        clockRunning = false;
+    bool retime = std::fabs(durationUs - frameUs) > FILEPLAYER_CLOCK_RETIME_US;
+    if (retime)
+        clockStatsRetimed++;
+
+    for (const auto& device : *frame.outputs)
+    {
+        std::shared_ptr<const FrameSliceCache::ConvertedFrame> converted = findConverted(frame, *device);
+        if (converted == nullptr)
+            continue;
+
+        // The driver outputs the cached slices, which stay alive with the frame while it uses them
+        std::shared_ptr<const SliceBuf> slices(converted, &converted->slices);
+        if (retime)
+            slices = std::make_shared<SliceBuf>(retimeSlices(converted->slices, durationUs));
+
+        if (bridgeOutput)
+        {
+            if (device->localQueuedDurationUs() > FILEPLAYER_BRIDGE_MAX_LAG_MS * 1000)
+                outputStatsDropped++;
+            else
+                device->putLocalFrame(slices, converted->lastX, converted->lastY, OUTPUT_MODE_FILE);
+        }
+        else
+        {
+            for (const auto& slice : *slices)
+                device->writeFrame(*slice, slice->durationUs);
+        }
+    }
+
+    lastFrameEnd += std::chrono::microseconds((long long)durationUs);
+
+    // The frames of a program share their output list, the devices only need to be added when it changes
+    if (frame.outputs != lastFrameOutputs)
+    {
+        for (const auto& device : *frame.outputs)
+        {
+            if (std::find(playedOutputs.begin(), playedOutputs.end(), device) == playedOutputs.end())
+                playedOutputs.push_back(device);
+        }
+        lastFrameOutputs = frame.outputs;
+    }
+
+    if (outputStatsStart == std::chrono::steady_clock::time_point())
+        outputStatsStart = now;
+    outputStatsStarvedMs += starvedMs;
+    outputStatsMaxStarvedMs = std::max(outputStatsMaxStarvedMs, starvedMs);
+    outputStatsFrames++;
+
+#ifdef DEBUGOUTPUT
+    if (now - outputStatsStart >= std::chrono::seconds(FILEPLAYER_OUTPUT_STATS_S))
+        printOutputStats();
+#endif
+}
+
+// Duration of the next clock timed frame: the end of its period on the schedule of the frame rate,
+// stretched by the drift correction. Frame ends are computed from the start of the schedule, not
+// summed up, and durations are handed over in whole us with the rounding carried over, so neither
+// adds up over long runs. The drift is measured against the lead the output had once it settled.
+double FilePlayer::clockFrameDurationUs(const QueuedFrame& frame, std::chrono::steady_clock::time_point now)
+{
+    if (clockRunning)
+    {
+        // Output handed over minus what is still queued is what the lasers have shown by now. The
+        // backlog is averaged over the outputs, outputs that fell behind and skip frames are left out.
+        double queuedUs = 0;
+        unsigned queuedOutputs = 0;
+        for (const auto& device : *frame.outputs)
+        {
+            double localQueuedUs = bridgeOutput ? device->localQueuedDurationUs() : 0;
+            if (localQueuedUs > FILEPLAYER_BRIDGE_MAX_LAG_MS * 1000)
+                continue;
+            double deviceQueuedUs = device->queuedDurationUs();
+            queuedUs += localQueuedUs + std::max(deviceQueuedUs, 0.0);
+            queuedOutputs++;
+        }
+        if (queuedOutputs > 0)
+            queuedUs /= queuedOutputs;
+        double elapsedUs = std::chrono::duration<double, std::micro>(now - clockStart).count();
+        double leadUs = clockScheduledUs - queuedUs - elapsedUs;
+
+        clockLeadSamples++;
+        clockLeadUs += (leadUs - clockLeadUs) * std::max(FILEPLAYER_CLOCK_AVERAGE, 1.0 / clockLeadSamples);
+
+        if (!clockSettled && elapsedUs >= FILEPLAYER_CLOCK_SETTLE_MS * 1000)
+        {
+            clockBaselineUs = clockLeadUs;
+            clockSettled = true;
+        }
+        if (clockSettled)
+        {
+            // Positive drift: the devices run fast against the clock and get longer periods
+            double driftUs = clockLeadUs - clockBaselineUs;
+            clockStatsMaxDriftUs = std::max(clockStatsMaxDriftUs, std::fabs(driftUs));
+            if (std::fabs(driftUs) > FILEPLAYER_CLOCK_RESYNC_MS * 1000)
+            {
+                printf("[IDTF] Clock drift %.1f ms, restarting the clock\n", driftUs / 1000);
+                clockStatsResyncs++;
+                clockRunning = false;
+            }
+            else
+                clockRate = 1 + std::min(FILEPLAYER_CLOCK_MAX_CORRECTION, std::max(-FILEPLAYER_CLOCK_MAX_CORRECTION, driftUs / (FILEPLAYER_CLOCK_CORRECTION_MS * 1000)));
+        }
+    }
+
+    if (!clockRunning)
+    {
+        clockRunning = true;
+        clockStart = now;
+        clockFps = 0;
+        clockScheduledUs = 0;
+        clockDeviceTargetUs = 0;
+        clockDeviceUs = 0;
+        clockLeadUs = 0;
+        clockLeadSamples = 0;
+        clockSettled = false;
+        clockRate = 1;
+    }
+
+    if (frame.clockFps != clockFps)
+    {
+        clockFps = frame.clockFps;
+        clockSegmentStartUs = clockScheduledUs;
+        clockSegmentFrames = 0;
+    }
+    clockSegmentFrames++;
+
+    double frameEndUs = clockSegmentStartUs + clockSegmentFrames * 1000000.0 / clockFps;
+    clockDeviceTargetUs += (frameEndUs - clockScheduledUs) * clockRate;
+    clockScheduledUs = frameEndUs;
+
+    long long durationUs = std::llround(clockDeviceTargetUs) - clockDeviceUs;
+    clockDeviceUs += durationUs;
+    return durationUs;
+}
+
+// Copies of the slices with their durations scaled to the given total
+SliceBuf FilePlayer::retimeSlices(const SliceBuf& slices, double durationUs)
+{
+    double totalUs = 0;
+    for (const auto& slice : slices)
+        totalUs += slice->durationUs;
+
+    SliceBuf result;
+    double endUs = 0;
+    double assignedUs = 0;
+    for (const auto& slice : slices)
+    {
+        std::shared_ptr<TimeSlice> retimed = std::make_shared<TimeSlice>(*slice);
+        endUs += slice->durationUs;
+        retimed->durationUs = std::round(durationUs * endUs / totalUs) - assignedUs;
+        assignedUs += retimed->durationUs;
+        result.push_back(retimed);
+    }
+    return result;
+}
+
+// Frames, time without output and CPU use of the whole process since the last call, to compare the output paths
+void FilePlayer::printOutputStats()
+{
+    auto now = std::chrono::steady_clock::now();
+    struct timespec cpuTime;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuTime);
+    double cpuMs = cpuTime.tv_sec * 1000.0 + cpuTime.tv_nsec / 1000000.0;
+    double wallMs = std::chrono::duration<double, std::milli>(now - outputStatsStart).count();
+
+    if (outputStatsCpuStartMs > 0 && wallMs > 0)
+        printf("[IDTF] Output (%s): %u frames, %.2f ms starved (max %.2f ms), %u frames skipped by lagging outputs, process CPU %.1f%%\n", bridgeOutput ? "driver" : "direct",
+            outputStatsFrames, outputStatsStarvedMs, outputStatsMaxStarvedMs, outputStatsDropped, 100.0 * (cpuMs - outputStatsCpuStartMs) / wallMs);
+
+    if (clockRunning)
+    {
+        printf("[IDTF] Clock: drift %.2f ms (max %.2f ms), correction %+.0f ppm, %u frames retimed, %u restarts ",
+            clockSettled ? (clockLeadUs - clockBaselineUs) / 1000 : 0.0, clockStatsMaxDriftUs / 1000, (clockRate - 1) * 1000000, clockStatsRetimed, clockStatsResyncs);
+        pointReducer.printStats();
+        printf("\n");
+    }
+
+    outputStatsStart = now;
+    outputStatsCpuStartMs = cpuMs;
+    outputStatsFrames = 0;
+    outputStatsStarvedMs = 0;
+    outputStatsMaxStarvedMs = 0;
+    outputStatsDropped = 0;
+    clockStatsRetimed = 0;
+    clockStatsResyncs = 0;
+    clockStatsMaxDriftUs = 0;
+}
+
 void FilePlayer::playButtonPress()
 {
     if (state.load() == FILEPLAYER_STATE_PLAY)
@@ -690,9 +1088,33 @@ void FilePlayer::readSettings(mINI::INIStructure ini)
                 mode = FILEPLAYER_MODE_REPEAT;
         }
 
+        std::string& fileplayer_timing = ini["file_player"]["timing"];
+        if (!fileplayer_timing.empty())
+            timing = (fileplayer_timing == "clock" || fileplayer_timing == "Clock" || fileplayer_timing == "\"clock\"" || fileplayer_timing == "\"Clock\"") ? FILEPLAYER_TIMING_CLOCK : FILEPLAYER_TIMING_POINTS;
+
         std::string& fileplayer_defaultpps = ini["file_player"]["default_pps"];
         if (!fileplayer_defaultpps.empty())
             defaultParameters.speed = std::stoi(fileplayer_defaultpps);
+
+        std::string& fileplayer_framecache = ini["file_player"]["frame_cache"];
+        if (!fileplayer_framecache.empty())
+            frameCacheEnabled = !(fileplayer_framecache == "false" || fileplayer_framecache == "False" || fileplayer_framecache == "\"false\"" || fileplayer_framecache == "\"False\"");
+
+        std::string& fileplayer_framecachedirectory = ini["file_player"]["frame_cache_directory"];
+        if (!fileplayer_framecachedirectory.empty())
+            frameCacheDirectory = fileplayer_framecachedirectory;
+
+        std::string& fileplayer_bridgeoutput = ini["file_player"]["driver_output"];
+        if (!fileplayer_bridgeoutput.empty())
+            bridgeOutput = !(fileplayer_bridgeoutput == "false" || fileplayer_bridgeoutput == "False" || fileplayer_bridgeoutput == "\"false\"" || fileplayer_bridgeoutput == "\"False\"");
+
+        std::string& fileplayer_outputs = ini["file_player"]["outputs"];
+        if (!fileplayer_outputs.empty())
+            defaultOutputs = fileplayer_outputs;
+
+        std::string& fileplayer_slicecachemb = ini["file_player"]["slice_cache_mb"];
+        if (!fileplayer_slicecachemb.empty())
+            sliceCache.setBudget((size_t)std::stoi(fileplayer_slicecachemb) * 1024 * 1024);
     }
     catch (std::exception& ex)
     {
@@ -701,26 +1123,9 @@ void FilePlayer::readSettings(mINI::INIStructure ini)
 
 }
 
-int FilePlayer::checkEOF(FILE* file, const char* debugText)
-{
-    if (feof(file))
-    { 
-        printf("[IDTF] Unexpected end of file (%s)", debugText); return -1;
-    }
-
-    return 0;
-}
-
-uint16_t FilePlayer::readShort(FILE* file)
-{
-    uint16_t c1 = ((uint16_t)fgetc(file)) & 0xFF;
-    uint16_t c2 = ((uint16_t)fgetc(file)) & 0xFF;
-
-    return (uint16_t)((c1 << 8) | c2);
-}
-
 std::string FilePlayer::nextAlphabeticalProgram(const std::string& previousProgramName, bool reverseOrder)
 {
+    std::lock_guard<std::recursive_mutex> lock(programsLock);
     if (programsAlphabeticSort.empty())
         return "";
 
@@ -748,6 +1153,7 @@ std::string FilePlayer::nextAlphabeticalProgram(const std::string& previousProgr
 
 std::string FilePlayer::nextRandomProgram(const std::string& previousProgramName)
 {
+    std::lock_guard<std::recursive_mutex> lock(programsLock);
     if (programsRandomSort.empty())
         return "";
 
@@ -823,26 +1229,34 @@ std::string FilePlayer::getFilename(const std::string& filepath) {
     return defaultParameters;
 }*/
 
-void FilePlayer::parsePrgFile(const std::filesystem::directory_entry& fileEntry)
+void FilePlayer::parsePrgFile(const std::filesystem::path& filePath, std::map<std::string, Program>& targetPrograms)
 {
-    if (!fileEntry.is_regular_file() || !hasPrgExtension(fileEntry.path().filename()))
+    if (!hasPrgExtension(filePath.filename()))
         return;
 
     // TODO recursive checking in all subfolders, with subfolder being part of the program name
     // Check for duplicate
-    if (programs.count(fileEntry.path().filename()) != 0)
+    if (targetPrograms.count(filePath.filename()) != 0)
         return;
 
-    std::ifstream fileStream(fileEntry.path());
+    std::ifstream fileStream(filePath);
     std::string line;
 
     if (fileStream)
     {
         Program program;
-        std::string programName = fileEntry.path().filename();
+        std::string programName = filePath.filename();
 
         while (std::getline(fileStream, line))
         {
+            if (line.rfind("#outputs,", 0) == 0)
+            {
+                program.outputs = line.substr(strlen("#outputs,"));
+                if (!program.outputs.empty() && program.outputs.back() == '\r')
+                    program.outputs.pop_back();
+                continue;
+            }
+
             try
             {
                 std::stringstream lineStream(line);
@@ -871,7 +1285,7 @@ void FilePlayer::parsePrgFile(const std::filesystem::directory_entry& fileEntry)
                     continue;
 
                 IldaFile file;
-                file.filePath = fileEntry.path().parent_path() / field1;
+                file.filePath = filePath.parent_path() / field1;
                 file.parameters.speedType = isFps ? FILEPLAYER_PARAM_SPEEDTYPE_FPS : FILEPLAYER_PARAM_SPEEDTYPE_PPS;
                 file.parameters.speed = speed;
                 file.parameters.numRepetitions = repetitions;
@@ -891,50 +1305,48 @@ void FilePlayer::parsePrgFile(const std::filesystem::directory_entry& fileEntry)
         }
         fileStream.close();
 
-        program.filePath = fileEntry.path();
+        program.filePath = filePath;
 
-        programs[programName] = program;
+        targetPrograms[programName] = program;
     }
     else
     {
-        printf("Warning: couldn't open .prg file %s\n", fileEntry.path());
+        printf("Warning: couldn't open .prg file %s\n", filePath.c_str());
     }
 
 }
 
-void FilePlayer::parseIldFile(const std::filesystem::directory_entry& fileEntry)
+// filesByName holds the files of all programs so far by file name, as program name and index in its file list
+void FilePlayer::parseIldFile(const std::filesystem::path& filePath, std::map<std::string, Program>& targetPrograms, ProgramFileMap& filesByName)
 {
-    if (!fileEntry.is_regular_file() || !hasIldExtension(fileEntry.path().filename()))
+    if (!hasIldExtension(filePath.filename()) && !LibraryIndex::isCompactShowFile(filePath.filename()))
         return;
 
-    std::filesystem::path filename = fileEntry.path().filename();
-
-    bool found = false;
+    std::string filename = filePath.filename();
 
-    for (auto& program : programs)
+    auto found = filesByName.find(filename);
+    if (found != filesByName.end())
     {
-        for (auto& file : program.second.files)
+        for (const auto& [programName, fileIndex] : found->second)
         {
-            if (file.filePath.filename() == filename)
-            {
-                file.errorCode = 0; // Mark file as exists in the program list
-                found = true;
-            }
+            auto program = targetPrograms.find(programName);
+            if (program != targetPrograms.end() && fileIndex < program->second.files.size())
+                program->second.files[fileIndex].errorCode = 0; // Mark file as exists in the program list
         }
-    }
-
-    if (found) // File is missing an accompanying prg file, in which case we create a default one
         return;
+    }
 
+    // File is missing an accompanying prg file, in which case we create a default one
     Program newProgram;
-    newProgram.filePath = fileEntry.path();
+    newProgram.filePath = filePath;
     newProgram.filePath = newProgram.filePath.replace_extension(".prg");
     IldaFile file;
-    file.filePath = fileEntry.path();
+    file.filePath = filePath;
     file.parameters = defaultParameters;
     file.errorCode = 2; // = Missing PRG, using default
     newProgram.files.push_back(file);
-    programs[newProgram.filePath.filename()] = newProgram;
+    targetPrograms[newProgram.filePath.filename()] = newProgram;
+    filesByName[filename].emplace_back(newProgram.filePath.filename(), 0);
 }
 
 bool caseInsensitiveLess(const std::string& a, const std::string& b) 
@@ -948,38 +1360,56 @@ bool caseInsensitiveLess(const std::string& a, const std::string& b)
 
 void FilePlayer::buildProgramMap()
 {
-    // Parse file-specific settings from .prg files in the library folders
+    // Programs are built from the library index instead of scanning the library folders
     try
     {
-        programs.clear();
-        programsAlphabeticSort.clear();
-        programsRandomSort.clear();
+        std::map<std::string, Program> newPrograms;
+        ProgramFileMap filesByName;
+        std::vector<LibraryIndex::LibraryEntry> entries = libraryIndex.getEntries();
 
-        for (const auto& fileEntry : std::filesystem::recursive_directory_iterator(localFileDirectory))
-        {
-            parsePrgFile(fileEntry);
-        }
-        for (const auto& fileEntry : std::filesystem::recursive_directory_iterator(localFileDirectory))
+        // Parse file-specific settings from .prg files in the library folders
+        for (const std::string& directory : { localFileDirectory, usbFileDirectory })
         {
-            parseIldFile(fileEntry);
-        }
-        for (const auto& fileEntry : std::filesystem::recursive_directory_iterator(usbFileDirectory))
-        {
-            parsePrgFile(fileEntry);
-        }
-        for (const auto& fileEntry : std::filesystem::recursive_directory_iterator(usbFileDirectory))
-        {
-            parseIldFile(fileEntry);
+            std::set<std::string> directoryPrograms;
+            for (const auto& entry : entries)
+            {
+                if (entry.path.compare(0, directory.size(), directory) == 0 && hasPrgExtension(entry.path) && newPrograms.count(std::filesystem::path(entry.path).filename()) == 0)
+                {
+                    parsePrgFile(entry.path, newPrograms);
+                    directoryPrograms.insert(std::filesystem::path(entry.path).filename());
+                }
+            }
+            for (const auto& programName : directoryPrograms)
+            {
+                auto program = newPrograms.find(programName);
+                if (program == newPrograms.end())
+                    continue;
+                for (size_t i = 0; i < program->second.files.size(); i++)
+                    filesByName[program->second.files[i].filePath.filename()].emplace_back(programName, i);
+            }
+
+            for (const auto& entry : entries)
+            {
+                if (entry.path.compare(0, directory.size(), directory) == 0)
+                    parseIldFile(entry.path, newPrograms, filesByName);
+            }
         }
 
-        for (const auto& [key, value] : programs)
+        std::vector<std::string> newAlphabeticSort;
+        std::vector<std::string> newRandomSort;
+        for (const auto& [key, value] : newPrograms)
         {
-            programsAlphabeticSort.push_back(key);
-            programsRandomSort.push_back(key);
+            newAlphabeticSort.push_back(key);
+            newRandomSort.push_back(key);
         }
-        std::sort(programsAlphabeticSort.begin(), programsAlphabeticSort.end(), caseInsensitiveLess);
+        std::sort(newAlphabeticSort.begin(), newAlphabeticSort.end(), caseInsensitiveLess);
         auto rng = std::default_random_engine{};
-        std::shuffle(std::begin(programsRandomSort), std::end(programsRandomSort), rng);
+        std::shuffle(std::begin(newRandomSort), std::end(newRandomSort), rng);
+
+        std::lock_guard<std::recursive_mutex> lock(programsLock);
+        programs.swap(newPrograms);
+        programsAlphabeticSort.swap(newAlphabeticSort);
+        programsRandomSort.swap(newRandomSort);
     }
     catch (std::exception& ex)
     {
@@ -987,41 +1417,142 @@ void FilePlayer::buildProgramMap()
     }
 }
 
-std::string FilePlayer::getProgramListString()
+// Appends the lines of one program to a program list, with the library details of its files if extended
+void FilePlayer::appendProgramListEntry(std::string& result, const std::string& name, const Program& program, bool extended)
 {
-    std::string result = "";
-    result.reserve(programs.size() * 60);
+    result += name;
+    result += ";";
+    result += std::to_string(program.dmxIndex);
+    result += ";";
+    result += program.filePath.string().rfind("/h") == 0 ? "i" : "e";
+    result += ";";
+    result += std::to_string(program.files.size());
+    if (extended)
+    {
+        // Playing time of one pass through the program, 0 if unknown
+        double durationMs = 0;
+        for (const IldaFile& file : program.files)
+        {
+            LibraryIndex::LibraryEntry entry;
+            if (!libraryIndex.getEntry(file.filePath.string(), entry) || file.parameters.speed <= 0)
+                continue;
+            double passMs = (file.parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_PPS) ? entry.points * 1000.0 / file.parameters.speed : entry.frames * 1000.0 / file.parameters.speed;
+            durationMs += passMs * std::max(file.parameters.numRepetitions, 1u);
+        }
+        result += ";";
+        result += std::to_string((unsigned long long)durationMs);
+        result += ";";
+        result += program.outputs;
+    }
+    result += "\n";
 
-    for (const auto& [key, value] : programs)
+    for (const IldaFile& file : program.files)
     {
-        result += key;
+        result += getFilename(file.filePath);
         result += ";";
-        result += std::to_string(value.dmxIndex);
+        result += std::to_string(file.parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_PPS ? file.parameters.speed / 1000 : file.parameters.speed);
         result += ";";
-        result += value.filePath.string().rfind("/h") == 0 ? "i" : "e";
+        result += std::to_string(file.parameters.speedType);
         result += ";";
-        result += std::to_string(value.files.size());
-        result += "\n";
-
-        for (const IldaFile& file : value.files)
+        result += std::to_string(file.parameters.numRepetitions);
+        result += ";";
+        result += std::to_string(file.parameters.palette);
+        result += ";";
+        result += std::to_string(file.errorCode);
+        if (extended)
         {
-            result += getFilename(file.filePath);
+            LibraryIndex::LibraryEntry entry;
+            libraryIndex.getEntry(file.filePath.string(), entry);
             result += ";";
-            result += std::to_string(file.parameters.speedType == FILEPLAYER_PARAM_SPEEDTYPE_PPS ? file.parameters.speed / 1000 : file.parameters.speed);
+            result += std::to_string(entry.frames);
             result += ";";
-            result += std::to_string(file.parameters.speedType);
+            result += std::to_string(entry.points);
             result += ";";
-            result += std::to_string(file.parameters.numRepetitions);
-            result += ";";
-            result += std::to_string(file.parameters.palette);
-            result += ";";
-            result += std::to_string(file.errorCode);
-            result += "\n";
+            result += std::to_string(entry.formats);
+        }
+        result += "\n";
+    }
+}
+
+std::string FilePlayer::getProgramListString()
+{
+    std::lock_guard<std::recursive_mutex> lock(programsLock);
+
+    std::string result = "";
+    result.reserve(programs.size() * 60);
+
+    for (const auto& [key, value] : programs)
+        appendProgramListEntry(result, key, value, false);
+
+    return result;
+}
+
+// One page of the program list, starting at program number firstProgram and holding as many whole programs
+// as fit into maxLength, at least one, cut if it is too long. The lines carry the library details of the
+// programs and files.
+std::string FilePlayer::getProgramListPage(unsigned firstProgram, size_t maxLength, unsigned& programsInPage, unsigned& totalPrograms)
+{
+    std::lock_guard<std::recursive_mutex> lock(programsLock);
+
+    std::string result = "";
+    programsInPage = 0;
+    totalPrograms = programs.size();
+    if (firstProgram >= programs.size())
+        return result;
+
+    auto it = programs.begin();
+    std::advance(it, firstProgram);
+    for (; it != programs.end(); ++it)
+    {
+        std::string entry;
+        appendProgramListEntry(entry, it->first, it->second, true);
+        if (result.size() + entry.size() > maxLength)
+        {
+            if (programsInPage > 0)
+                break;
+
+            // A program that doesn't fit in a page on its own is cut after the last line that fits,
+            // so the page ends before all of its files are listed. A program line that doesn't fit
+            // at all is cut as well, there is no shorter way to list the program.
+            size_t lineEnd = (maxLength > 0) ? entry.rfind('\n', maxLength - 1) : std::string::npos;
+            if (lineEnd != std::string::npos)
+                entry.resize(lineEnd + 1);
+            else
+                entry.resize(maxLength);
+            printf("Warning: Program %s does not fit in a program list page, listed up to %zu bytes\n", it->first.c_str(), entry.size());
         }
+
+        result += entry;
+        programsInPage++;
     }
+
     return result;
 }
 
+bool FilePlayer::getProgram(const std::string& name, Program& program)
+{
+    std::lock_guard<std::recursive_mutex> lock(programsLock);
+
+    auto found = programs.find(name);
+    if (found == programs.end())
+        return false;
+
+    program = found->second;
+    return true;
+}
+
+bool FilePlayer::hasProgram(const std::string& name)
+{
+    std::lock_guard<std::recursive_mutex> lock(programsLock);
+    return programs.count(name) != 0;
+}
+
+size_t FilePlayer::programCount()
+{
+    std::lock_guard<std::recursive_mutex> lock(programsLock);
+    return programs.size();
+}
+
 void FilePlayer::writeProgramList(std::string settingString)
 {
     std::stringstream settingStringStream(settingString);
@@ -1056,6 +1587,17 @@ void FilePlayer::writeProgramList(std::string settingString)
                     prgDirectory = std::filesystem::path((field3 == "i") ? localFileDirectory : usbFileDirectory);
                     newProgram.filePath = prgDirectory / field1;
                     numIldaFilesToParse = std::stoi(field4);
+
+                    // Outputs follow the playing time of the extended list, programs listed without them keep theirs
+                    std::string field6;
+                    if (std::getline(lineStream, field5, ';') && std::getline(lineStream, field6, ';'))
+                        newProgram.outputs = field6;
+                    else
+                    {
+                        Program existingProgram;
+                        if (getProgram(newProgram.filePath.filename(), existingProgram))
+                            newProgram.outputs = existingProgram.outputs;
+                    }
                 }
                 else
                 {
@@ -1089,6 +1631,7 @@ void FilePlayer::writeProgramList(std::string settingString)
         }
     }
 
+    std::lock_guard<std::recursive_mutex> lock(programsLock);
     for (auto& programToUpdate : programsToUpdate)
     {
         programs[programToUpdate.filePath.filename()] = programToUpdate;
@@ -1098,6 +1641,8 @@ void FilePlayer::writeProgramList(std::string settingString)
 
 std::vector<std::string> FilePlayer::getCurrentOrderedProgramList()
 {
+    std::lock_guard<std::recursive_mutex> lock(programsLock);
+
     if (mode == FILEPLAYER_MODE_SHUFFLE)
         return programsRandomSort;
     else
@@ -1110,6 +1655,12 @@ std::string FilePlayer::getCurrentProgramName()
     return currentProgramName;
 }
 
+// Offline conversion of an ILDA file to a compact show file, with the palette the player uses for ILDA files
+int FilePlayer::convertToCompactShow(const std::string& ildaFilename, const std::string& showFilename)
+{
+    return CompactShow::convertIlda(ildaFilename.c_str(), showFilename.c_str(), ildaDefaultPalette);
+}
+
 void FilePlayer::setCurrentProgramName(std::string name)
 {
     std::lock_guard<std::mutex> lock(threadLock);
@@ -1170,14 +1721,14 @@ void FilePlayer::doFileEndAction(bool dontAttemptRepeat)
 
 void FilePlayer::savePrgFile(const std::string& name)
 {
-    if (programs.count(name) <= 0)
+    Program program;
+    if (!getProgram(name, program))
     {
         std::printf("Warning: Attempted to save prg file for program that doesn't exist.\n");
         return;
     }
     try
     {
-        Program program = programs[name];
         std::ofstream prgFileStream = std::ofstream(program.filePath, std::ios::trunc);
         char line[256];
         for (auto& ildaFile : program.files)
@@ -1191,6 +1742,8 @@ void FilePlayer::savePrgFile(const std::string& name)
         }
         if (program.dmxIndex >= 0)
             std::sprintf(line, "#dmx_index,%d\n", program.dmxIndex);
+        if (!program.outputs.empty())
+            prgFileStream << "#outputs," << program.outputs << "\n";
         prgFileStream.close();
         chmod(program.filePath.c_str(), 0666);
         sync();
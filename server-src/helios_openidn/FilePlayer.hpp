@@ -8,16 +8,26 @@
 #include "shared/DACHWInterface.hpp"
 #include "output/V1LaproGraphOut.hpp"
 #include "ini.hpp"
+#include "IldaReader.hpp"
+#include "IldaFrameCache.hpp"
+#include "FrameSliceCache.hpp"
+#include "LibraryIndex.hpp"
+#include "CompactShow.hpp"
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <set>
 #include <cstring>
 #include <queue>
 #include <cmath>
+#include <climits>
 #include <mutex>
 #include <dirent.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <filesystem>
 #include <atomic>
+#include <chrono>
 #include <random>
 
 #define FILEPLAYER_MODE_REPEAT 0
@@ -32,6 +42,22 @@
 #define FILEPLAYER_PARAM_SPEEDTYPE_PPS 0
 #define FILEPLAYER_PARAM_SPEEDTYPE_FPS 1
 
+// Timing of FPS files: frame durations from their points at the frame rate, or frames on deadlines
+// of an absolute monotonic clock. Files with a point rate are always timed by their points.
+#define FILEPLAYER_TIMING_POINTS 0
+#define FILEPLAYER_TIMING_CLOCK 1
+
+#define FILEPLAYER_CLOCK_SETTLE_MS 1000         // Lead of the output after the clock starts, the reference for the drift
+#define FILEPLAYER_CLOCK_CORRECTION_MS 2000     // Drift is corrected over this time
+#define FILEPLAYER_CLOCK_MAX_CORRECTION 0.01    // Largest stretch or trim of a frame period for drift correction
+#define FILEPLAYER_CLOCK_RESYNC_MS 100          // Drift beyond this restarts the clock
+#define FILEPLAYER_CLOCK_RETIME_US 10           // Frames further off their period than this get new slice durations
+#define FILEPLAYER_CLOCK_AVERAGE 0.02           // Weight of each frame in the averaged lead
+
+#define FILEPLAYER_BRIDGE_QUEUE_MS 30       // Output handed to the driver ahead of the laser
+#define FILEPLAYER_BRIDGE_MAX_LAG_MS 150    // Outputs further behind than this skip frames instead of holding back the others
+#define FILEPLAYER_OUTPUT_STATS_S 10        // Interval of the output statistics
+
 class FilePlayer
 {
 public:
@@ -57,30 +83,47 @@ public:
         std::filesystem::path filePath;
         std::vector<IldaFile> files;
         int dmxIndex = -1;
+        std::string outputs;  // "all" or 1-based output numbers separated by commas, empty for the default outputs
     } Program;
 
     typedef struct QueuedChunk
     {
-        std::vector<ISPDB25Point> buffer;  // Todo reuse buffers, avoid memory allocation
+        std::vector<ISPDB25Point> buffer;
         unsigned int pps;
     } QueuedChunk;
 
+    typedef std::vector<std::shared_ptr<DACHWInterface>> OutputList;
+
     typedef struct QueuedFrame
     {
-        std::vector<std::shared_ptr<QueuedChunk>> chunks;
+        std::vector<std::shared_ptr<QueuedChunk>> chunks;  // Empty once converted for all outputs
         double durationMs;
+        uint32_t fileId = 0;  // Slice cache file id, 0 if the frame is not cached
+        uint32_t frameIndex = 0;
+        std::shared_ptr<const OutputList> outputs;  // Devices the frame is played on, shared by the frames of a program
+        double clockFps = 0;  // Frame rate of the clock timing, 0 if the frame is timed by its points
+        std::vector<std::shared_ptr<const FrameSliceCache::ConvertedFrame>> converted;  // One per device type
+        std::string programStart;  // Set on the empty frame that marks the start of a program
     } QueuedFrame;
 
 	bool autoplay = false;
     bool handleMissingPrg = true;
-    std::map<std::string, Program> programs;
+    std::map<std::string, Program> programs;  // Programs and their sorted lists are guarded by programsLock
     std::vector<std::string> programsAlphabeticSort;
     std::vector<std::string> programsRandomSort;
+    std::recursive_mutex programsLock;
 	int mode = FILEPLAYER_MODE_REPEAT;
+    int timing = FILEPLAYER_TIMING_POINTS;
+    PointReducer pointReducer;          // Fits clock timed frames to the maximum point rate of the outputs
     std::atomic_int state;
 	FileParameters defaultParameters;
     std::string localFileDirectory = std::string("/home/laser/library/");
     std::string usbFileDirectory = std::string("/media/usbdrive/");
+    bool bridgeOutput = true;  // Output through the driver thread of the device instead of writing from the output loop
+    std::string defaultOutputs = std::string("1");  // Outputs of programs that don't name their own
+    bool frameCacheEnabled = true;
+    std::string frameCacheDirectory = std::string("/home/laser/openidn/cache/");
+    LibraryIndex libraryIndex{ "/home/laser/openidn/library.idx" };
 
     FilePlayer();
 
@@ -98,31 +141,44 @@ public:
     void readSettings(mINI::INIStructure ini);
     void buildProgramMap();
     std::string getProgramListString();
+    std::string getProgramListPage(unsigned firstProgram, size_t maxLength, unsigned& programsInPage, unsigned& totalPrograms);
+    bool getProgram(const std::string& name, Program& program);
+    bool hasProgram(const std::string& name);
+    size_t programCount();
     void writeProgramList(std::string settingString);
     std::vector<std::string> getCurrentOrderedProgramList();
     std::string getCurrentProgramName();
     void setCurrentProgramName(std::string name);
+    int convertToCompactShow(const std::string& ildaFilename, const std::string& showFilename);
 
 private:
 
     #define ILDACOLOR(r, g, b)      (((r & 0xFF) << 16) | ((g & 0xFF) << 8) | (b & 0xFF))
 
-    int checkEOF(FILE* file, const char* debugText);
-    uint16_t readShort(FILE* file);
+    typedef std::unordered_map<std::string, std::vector<std::pair<std::string, size_t>>> ProgramFileMap;
+
     bool hasIldExtension(const std::string& name);
     bool hasPrgExtension(const std::string& name);
     std::string nextAlphabeticalProgram(const std::string& previousProgramName, bool reverseOrder);
     std::string nextRandomProgram(const std::string& previousProgramName);
     std::string getDirectory(const std::string& filepath);
     std::string getFilename(const std::string& filepath);
-    void parsePrgFile(const std::filesystem::directory_entry& fileEntry);
-    void parseIldFile(const std::filesystem::directory_entry& fileEntry);
+    void parsePrgFile(const std::filesystem::path& filePath, std::map<std::string, Program>& targetPrograms);
+    void parseIldFile(const std::filesystem::path& filePath, std::map<std::string, Program>& targetPrograms, ProgramFileMap& filesByName);
+    void appendProgramListEntry(std::string& result, const std::string& name, const Program& program, bool extended);
     void doFileEndAction(bool dontAttemptRepeat);
     void savePrgFile(const std::string& name);
     bool hasEnoughBufferedFileQueue();
+    int loadPrograms(std::string programName, int job);
+    std::string nextChainedProgram(const std::string& programName);
+    bool queueProgramStart(const std::string& programName, int job);
+    bool queueCompactShow(const IldaFile& ildaFile, int job, uint32_t fileId, const std::shared_ptr<const OutputList>& outputs);
+    bool queueFramePoints(const ISPDB25Point* points, unsigned pointCount, const IldaFile& ildaFile, int job, uint32_t fileId, uint32_t frameIndex, const std::shared_ptr<const OutputList>& outputs);
+    OutputList resolveOutputs(const std::string& outputSpec);
 
     std::deque<std::shared_ptr<QueuedFrame>> queue;
     std::atomic_int fileJob;
+    bool fileLoading = false;  // File job still queueing frames, guarded by threadLock
     pthread_t outputThread = 0;
     pthread_t playFileThread = 0;
     std::mutex threadLock;
@@ -130,6 +186,56 @@ private:
     const double minimumQueueDurationMs = 500;
     std::mutex currentProgramNameLock;
     std::string currentProgramName = "";
+    std::vector<ISPDB25Point> framePoints;
+    unsigned frameCacheHits = 0;
+    unsigned frameCacheMisses = 0;
+    FrameSliceCache sliceCache;
+
+    // Output loop state
+    bool playedSinceEndAction = false;
+    OutputList playedOutputs;   // Devices played on since the end action
+    std::shared_ptr<const OutputList> lastFrameOutputs;
+    std::string transitionProgramName;
+    std::chrono::steady_clock::time_point lastFrameEnd;  // Estimated end of the output handed over so far
+
+    // Output statistics
+    std::chrono::steady_clock::time_point outputStatsStart;
+    double outputStatsCpuStartMs = 0;
+    unsigned outputStatsFrames = 0;
+    double outputStatsStarvedMs = 0;
+    double outputStatsMaxStarvedMs = 0;
+    unsigned outputStatsDropped = 0;
+
+    // Clock timing state of the output loop. Schedule times are in us since the clock started,
+    // device times are what the devices were handed, which differs by the drift correction.
+    bool clockRunning = false;
+    std::chrono::steady_clock::time_point clockStart;
+    double clockFps = 0;
+    double clockSegmentStartUs = 0;     // Schedule time where the current frame rate took over
+    unsigned long long clockSegmentFrames = 0;
+    double clockScheduledUs = 0;        // Schedule time of the end of the output handed over so far
+    double clockDeviceTargetUs = 0;
+    long long clockDeviceUs = 0;        // Device time handed over so far, in whole us
+    double clockLeadUs = 0;             // Averaged lead of the output handed over against the clock
+    unsigned clockLeadSamples = 0;
+    double clockBaselineUs = 0;
+    bool clockSettled = false;
+    double clockRate = 1;               // Stretch of the frame periods to correct the drift
+    unsigned clockStatsRetimed = 0;
+    unsigned clockStatsResyncs = 0;
+    double clockStatsMaxDriftUs = 0;
+
+    // Loader state for clock timing
+    ISPDB25Point clockLastPoint = { 0x8000, 0x8000 };
+
+    static std::shared_ptr<const FrameSliceCache::ConvertedFrame> findConverted(const QueuedFrame& frame, const DACHWInterface& device);
+    std::shared_ptr<const FrameSliceCache::ConvertedFrame> convertFrame(const QueuedFrame& frame, const std::shared_ptr<DACHWInterface>& device);
+    bool outputsReady(const QueuedFrame& frame);
+    bool outputsDrained();
+    void outputFrame(const QueuedFrame& frame);
+    double clockFrameDurationUs(const QueuedFrame& frame, std::chrono::steady_clock::time_point now);
+    static SliceBuf retimeSlices(const SliceBuf& slices, double durationUs);
+    void printOutputStats();
 
     unsigned long customPalette[256];
     unsigned long ildaDefaultPalette[256] =      // LFI / Aura Technologies
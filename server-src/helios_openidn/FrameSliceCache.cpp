@@ -0,0 +1,86 @@
+#include "FrameSliceCache.hpp"
+
+void FrameSliceCache::setBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    budget = bytes;
+    evict();
+}
+
+size_t FrameSliceCache::getUsed()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return used;
+}
+
+uint32_t FrameSliceCache::fileId(const std::string& fileKey)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (budget == 0)
+        return 0;
+
+    auto found = fileIds.find(fileKey);
+    if (found != fileIds.end())
+        return found->second;
+
+    // Ids of older versions of a file are not reused, their frames simply age out
+    uint32_t id = nextFileId++;
+    fileIds[fileKey] = id;
+    return id;
+}
+
+std::shared_ptr<const FrameSliceCache::ConvertedFrame> FrameSliceCache::find(const Key& key)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto found = index.find(key);
+    if (found == index.end())
+    {
+        misses++;
+        return nullptr;
+    }
+
+    hits++;
+    lru.splice(lru.begin(), lru, found->second);
+    return *found->second;
+}
+
+void FrameSliceCache::insert(const std::shared_ptr<const ConvertedFrame>& frame)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (frame->bytes > budget || index.count(frame->key) != 0)
+        return;
+
+    lru.push_front(frame);
+    index.emplace(frame->key, lru.begin());
+    used += frame->bytes;
+    evict();
+}
+
+void FrameSliceCache::evict()
+{
+    while (used > budget && !lru.empty())
+    {
+        used -= lru.back()->bytes;
+        index.erase(lru.back()->key);
+        lru.pop_back();
+        evictions++;
+    }
+}
+
+void FrameSliceCache::printStats()
+{
+    // Resident set size of the whole process, to see the cache against everything else
+    long totalPages = 0, residentPages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL)
+    {
+        if (fscanf(statm, "%ld %ld", &totalPages, &residentPages) != 2)
+            residentPages = 0;
+        fclose(statm);
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    printf("[IDTF] Slice cache: %zu frames, %.1f of %.1f MB, %u hits, %u misses, %u evictions, process RSS %.1f MB\n", lru.size(), used / 1048576.0, budget / 1048576.0, hits, misses, evictions, residentPages * sysconf(_SC_PAGESIZE) / 1048576.0);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "shared/types.h"
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+#include <typeindex>
+
+// In-memory LRU cache of file frames that are already converted for a device.
+// Entries are keyed by (file, frame, device type, point rate) and hold the device-ready slices of
+// one frame, so looping files and replayed programs skip convertPoints() once they have been
+// played. Files are identified by a key string that must change with their content (path, size,
+// modification time) and are interned to a small id by the file loader, so lookups during output
+// do not allocate. The least recently played frames are evicted when the memory budget is exceeded.
+
+#define FRAME_SLICE_CACHE_DEFAULT_BUDGET_MB 32
+
+class FrameSliceCache
+{
+public:
+
+    typedef struct Key
+    {
+        uint32_t fileId;
+        uint32_t frameIndex;
+        std::type_index deviceType;
+        unsigned pps;
+
+        Key(uint32_t fileId, uint32_t frameIndex, std::type_index deviceType, unsigned pps)
+            : fileId(fileId), frameIndex(frameIndex), deviceType(deviceType), pps(pps) {}
+
+        bool operator==(const Key& other) const
+        {
+            return fileId == other.fileId && frameIndex == other.frameIndex && deviceType == other.deviceType && pps == other.pps;
+        }
+    } Key;
+
+    typedef struct ConvertedFrame
+    {
+        Key key;
+        SliceBuf slices;    // Shared with the driver, which outputs the slices without copying them
+        uint16_t lastX = 0x8000;
+        uint16_t lastY = 0x8000;
+        size_t bytes = 0;
+
+        ConvertedFrame(const Key& key) : key(key) {}
+    } ConvertedFrame;
+
+    void setBudget(size_t bytes);
+    size_t getBudget() { return budget; }
+    size_t getUsed();   // Bytes of the cached frames, as counted against the budget
+
+    // Id for the given file key string, 0 if caching is disabled
+    uint32_t fileId(const std::string& fileKey);
+
+    std::shared_ptr<const ConvertedFrame> find(const Key& key);
+    void insert(const std::shared_ptr<const ConvertedFrame>& frame);
+
+    void printStats();
+
+private:
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            return (((size_t)key.fileId * 0x9E3779B1u) ^ key.frameIndex) * 31 + key.deviceType.hash_code() + key.pps;
+        }
+    };
+
+    typedef std::list<std::shared_ptr<const ConvertedFrame>> LruList;
+
+    std::mutex lock;
+    LruList lru;    // Most recently played first
+    std::unordered_map<Key, LruList::iterator, KeyHash> index;
+    std::map<std::string, uint32_t> fileIds;
+    uint32_t nextFileId = 1;
+
+    size_t budget = (size_t)FRAME_SLICE_CACHE_DEFAULT_BUDGET_MB * 1024 * 1024;
+    size_t used = 0;
+
+    // Statistics
+    unsigned hits = 0;
+    unsigned misses = 0;
+    unsigned evictions = 0;
+
+    void evict();
+};
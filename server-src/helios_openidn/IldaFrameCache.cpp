@@ -0,0 +1,260 @@
+#include "IldaFrameCache.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <filesystem>
+
+IldaFrameCache::IldaFrameCache()
+{
+}
+
+IldaFrameCache::~IldaFrameCache()
+{
+    close();
+    abortBuild();
+}
+
+std::string IldaFrameCache::cachePath(const std::string& cacheDirectory, const char* filename)
+{
+    // FNV-1a hash of the source path
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const char* c = filename; *c != 0; c++)
+    {
+        hash ^= (uint8_t)*c;
+        hash *= 0x100000001b3ULL;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+
+    std::string path = cacheDirectory;
+    if (!path.empty() && path.back() != '/')
+        path += "/";
+    return path + name + ILDA_FRAME_CACHE_EXTENSION;
+}
+
+int IldaFrameCache::statSource(const char* filename, uint64_t& sourceSize, int64_t& sourceMtimeNs)
+{
+    struct stat fileStat;
+    if (stat(filename, &fileStat) != 0)
+        return -1;
+
+    sourceSize = fileStat.st_size;
+    sourceMtimeNs = (int64_t)fileStat.st_mtim.tv_sec * 1000000000 + fileStat.st_mtim.tv_nsec;
+    return 0;
+}
+
+int IldaFrameCache::open(const std::string& cacheDirectory, const char* filename)
+{
+    close();
+
+    if (strlen(filename) >= ILDA_FRAME_CACHE_MAX_PATH)
+        return -1;
+
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+    if (statSource(filename, sourceSize, sourceMtimeNs) != 0)
+        return -1;
+
+    std::string path = cachePath(cacheDirectory, filename);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || (size_t)fileStat.st_size < sizeof(CacheHeader))
+    {
+        ::close(fd);
+        return -1;
+    }
+    size = fileStat.st_size;
+
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        size = 0;
+        return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    data = (const uint8_t*)map;
+    header = (const CacheHeader*)data;
+
+    // Stale or foreign cache files are simply rebuilt
+    bool valid = memcmp(header->magic, "IDTFCACH", 8) == 0
+        && header->version == ILDA_FRAME_CACHE_VERSION
+        && header->pointSize == sizeof(ISPDB25Point)
+        && header->sourceSize == sourceSize
+        && header->sourceMtimeNs == sourceMtimeNs
+        && strncmp(header->sourcePath, filename, ILDA_FRAME_CACHE_MAX_PATH) == 0
+        && header->tableOffset == sizeof(CacheHeader) + header->pointCount * sizeof(ISPDB25Point)
+        && header->tableOffset <= size
+        && (size - header->tableOffset) == (uint64_t)header->frameCount * sizeof(CachedFrame);
+
+    if (valid)
+    {
+        points = (const ISPDB25Point*)(data + sizeof(CacheHeader));
+        frames = (const CachedFrame*)(data + header->tableOffset);
+        for (unsigned i = 0; i < header->frameCount && valid; i++)
+            valid = frames[i].firstPoint + frames[i].pointCount <= header->pointCount;
+    }
+
+    if (!valid)
+    {
+        close();
+        return -1;
+    }
+
+    return 0;
+}
+
+void IldaFrameCache::close()
+{
+    if (data != nullptr)
+        munmap((void*)data, size);
+    data = nullptr;
+    size = 0;
+    header = nullptr;
+    points = nullptr;
+    frames = nullptr;
+}
+
+unsigned IldaFrameCache::frameCount()
+{
+    return (header != nullptr) ? header->frameCount : 0;
+}
+
+const ISPDB25Point* IldaFrameCache::framePoints(unsigned frame, unsigned& pointCount)
+{
+    if (header == nullptr || frame >= header->frameCount)
+    {
+        pointCount = 0;
+        return nullptr;
+    }
+
+    pointCount = frames[frame].pointCount;
+    return points + frames[frame].firstPoint;
+}
+
+bool IldaFrameCache::getPalette(unsigned long* palette)
+{
+    if (header == nullptr || !header->hasCustomPalette)
+        return false;
+
+    for (int i = 0; i < 256; i++)
+        palette[i] = header->palette[i];
+    return true;
+}
+
+int IldaFrameCache::beginBuild(const std::string& cacheDirectory, const char* filename)
+{
+    abortBuild();
+
+    if (strlen(filename) >= ILDA_FRAME_CACHE_MAX_PATH)
+        return -1;
+
+    memset(&buildHeader, 0, sizeof(buildHeader));
+    if (statSource(filename, buildHeader.sourceSize, buildHeader.sourceMtimeNs) != 0)
+        return -1;
+
+    std::error_code error;
+    std::filesystem::create_directories(cacheDirectory, error);
+
+    buildPath = cachePath(cacheDirectory, filename);
+    buildTempPath = buildPath + ".XXXXXX";
+    int fd = mkstemp(&buildTempPath[0]);
+    if (fd < 0)
+    {
+        printf("[IDTF] Cannot create frame cache file in %s (errno: %d)\n", cacheDirectory.c_str(), errno);
+        return -1;
+    }
+    buildFile = fdopen(fd, "wb");
+    if (buildFile == nullptr)
+    {
+        ::close(fd);
+        unlink(buildTempPath.c_str());
+        return -1;
+    }
+
+    memcpy(buildHeader.magic, "IDTFCACH", 8);
+    buildHeader.version = ILDA_FRAME_CACHE_VERSION;
+    buildHeader.pointSize = sizeof(ISPDB25Point);
+    strncpy(buildHeader.sourcePath, filename, ILDA_FRAME_CACHE_MAX_PATH - 1);
+    buildFrames.clear();
+
+    // Placeholder, the header is complete once all frames are known
+    if (fwrite(&buildHeader, sizeof(buildHeader), 1, buildFile) != 1)
+    {
+        abortBuild();
+        return -1;
+    }
+
+    return 0;
+}
+
+int IldaFrameCache::addFrame(const ISPDB25Point* points, unsigned pointCount)
+{
+    if (buildFile == nullptr)
+        return -1;
+
+    CachedFrame frame;
+    frame.firstPoint = buildHeader.pointCount;
+    frame.pointCount = pointCount;
+    frame.reserved = 0;
+
+    if (fwrite(points, sizeof(ISPDB25Point), pointCount, buildFile) != pointCount)
+    {
+        printf("[IDTF] Cannot write frame cache file %s (errno: %d)\n", buildTempPath.c_str(), errno);
+        abortBuild();
+        return -1;
+    }
+
+    buildFrames.push_back(frame);
+    buildHeader.pointCount += pointCount;
+    return 0;
+}
+
+int IldaFrameCache::finishBuild(const unsigned long* customPalette)
+{
+    if (buildFile == nullptr)
+        return -1;
+
+    buildHeader.frameCount = buildFrames.size();
+    buildHeader.tableOffset = sizeof(CacheHeader) + buildHeader.pointCount * sizeof(ISPDB25Point);
+    buildHeader.hasCustomPalette = (customPalette != nullptr);
+    if (customPalette != nullptr)
+    {
+        for (int i = 0; i < 256; i++)
+            buildHeader.palette[i] = customPalette[i];
+    }
+
+    bool ok = fwrite(buildFrames.data(), sizeof(CachedFrame), buildFrames.size(), buildFile) == buildFrames.size()
+        && fseek(buildFile, 0, SEEK_SET) == 0
+        && fwrite(&buildHeader, sizeof(buildHeader), 1, buildFile) == 1;
+    ok = (fclose(buildFile) == 0) && ok;
+    buildFile = nullptr;
+
+    if (!ok || rename(buildTempPath.c_str(), buildPath.c_str()) != 0)
+    {
+        printf("[IDTF] Cannot write frame cache file %s (errno: %d)\n", buildPath.c_str(), errno);
+        unlink(buildTempPath.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+void IldaFrameCache::abortBuild()
+{
+    if (buildFile == nullptr)
+        return;
+
+    fclose(buildFile);
+    buildFile = nullptr;
+    unlink(buildTempPath.c_str());
+}
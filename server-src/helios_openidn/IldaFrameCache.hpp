@@ -0,0 +1,92 @@
+#pragma once
+
+#include "shared/ISPDB25Point.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// On-disk cache of pre-parsed ILDA files for the FilePlayer.
+// Holds the decoded frames of one file as ISPDB25Points, ready to be queued, plus a table of frame
+// offsets. The cache file is named after a hash of the source path and is only used while the
+// source path, size and modification time still match. It is memory mapped when playing, so a
+// cached file needs neither reading nor parsing.
+//
+// The cache is built while a file is parsed for playback and only becomes visible once complete.
+// Frames are decoded with the palette that is active at the start of the file, only files that
+// start with the default palette are cached. A custom palette set by the file is kept in the
+// cache, as it stays active for the files that follow.
+//
+// Cache file layout, host byte order: CacheHeader, points, frame table.
+
+#define ILDA_FRAME_CACHE_VERSION 1
+#define ILDA_FRAME_CACHE_EXTENSION ".ildcache"
+#define ILDA_FRAME_CACHE_MAX_PATH 1024
+
+class IldaFrameCache
+{
+public:
+
+    IldaFrameCache();
+    ~IldaFrameCache();
+
+    // Maps the cache of the given ILDA file if it is up to date. Returns 0 on a hit.
+    int open(const std::string& cacheDirectory, const char* filename);
+    void close();
+
+    unsigned frameCount();
+    const ISPDB25Point* framePoints(unsigned frame, unsigned& pointCount);
+
+    // Palette set by the file itself, if any. Returns false if the file has none.
+    bool getPalette(unsigned long* palette);
+
+    // Starts building the cache of the given ILDA file, frames are added in playback order.
+    // A build that is not finished is discarded.
+    int beginBuild(const std::string& cacheDirectory, const char* filename);
+    int addFrame(const ISPDB25Point* points, unsigned pointCount);
+    int finishBuild(const unsigned long* customPalette);
+    void abortBuild();
+
+    bool isBuilding() { return buildFile != nullptr; }
+
+private:
+
+    typedef struct CacheHeader
+    {
+        char magic[8];                  // "IDTFCACH"
+        uint32_t version;
+        uint32_t pointSize;             // sizeof(ISPDB25Point)
+        uint64_t sourceSize;
+        int64_t sourceMtimeNs;
+        uint64_t pointCount;
+        uint64_t tableOffset;
+        uint32_t frameCount;
+        uint32_t hasCustomPalette;
+        uint32_t palette[256];
+        char sourcePath[ILDA_FRAME_CACHE_MAX_PATH];
+    } CacheHeader;
+
+    typedef struct CachedFrame
+    {
+        uint64_t firstPoint;
+        uint32_t pointCount;
+        uint32_t reserved;
+    } CachedFrame;
+
+    // Playback
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    const CacheHeader* header = nullptr;
+    const ISPDB25Point* points = nullptr;
+    const CachedFrame* frames = nullptr;
+
+    // Building
+    FILE* buildFile = nullptr;
+    std::string buildPath;
+    std::string buildTempPath;
+    CacheHeader buildHeader;
+    std::vector<CachedFrame> buildFrames;
+
+    static std::string cachePath(const std::string& cacheDirectory, const char* filename);
+    static int statSource(const char* filename, uint64_t& sourceSize, int64_t& sourceMtimeNs);
+};
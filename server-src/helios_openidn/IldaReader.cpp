@@ -0,0 +1,373 @@
+#include "IldaReader.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mutex>
+#include <atomic>
+
+// Set while the current thread accesses a mapping, see the SIGBUS note in the header.
+// Volatile and fenced in the guards, as the compiler cannot see the handler reading it and
+// would otherwise drop the store or move the accesses to the mapping outside of the guard.
+static thread_local sigjmp_buf* volatile busErrorJump = nullptr;
+static std::once_flag busErrorHandlerInstalled;
+
+static void busErrorHandler(int signal)
+{
+    if (busErrorJump != nullptr)
+        siglongjmp(*busErrorJump, 1);
+
+    // Not ours, crash as usual
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    sigaction(SIGBUS, &action, NULL);
+    raise(SIGBUS);
+}
+
+static void installBusErrorHandler()
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = busErrorHandler;
+    action.sa_flags = SA_NODEFER; // Leaves SIGBUS unblocked after the jump, no need to save the signal mask
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, NULL);
+}
+
+#define ILDA_GUARD_BEGIN(errorValue) \
+    sigjmp_buf busErrorTarget; \
+    if (sigsetjmp(busErrorTarget, 0) != 0) \
+    { \
+        busErrorJump = nullptr; \
+        printf("[IDTF] %s: Read error, media removed?\n", filename); \
+        return errorValue; \
+    } \
+    busErrorJump = &busErrorTarget; \
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+
+#define ILDA_GUARD_END() \
+    std::atomic_signal_fence(std::memory_order_seq_cst); \
+    busErrorJump = nullptr;
+
+static inline uint16_t bigEndianShort(const uint8_t* src)
+{
+    return (uint16_t)((src[0] << 8) | src[1]);
+}
+
+IldaReader::IldaReader()
+{
+    std::call_once(busErrorHandlerInstalled, installBusErrorHandler);
+}
+
+IldaReader::~IldaReader()
+{
+    close();
+}
+
+int IldaReader::open(const char* filename, bool headersOnly)
+{
+    close();
+    this->filename = filename;
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("[IDTF] %s: Cannot open file (errno: %d)", filename, errno);
+        return -1;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0)
+    {
+        printf("[IDTF] %s: Cannot open file (errno: %d)", filename, errno);
+        ::close(fd);
+        return -1;
+    }
+    size = fileStat.st_size;
+
+    if (size < 4)
+    {
+        printf("[IDTF] %s: Not an IDTF file", filename);
+        ::close(fd);
+        return -1;
+    }
+
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED)
+    {
+        // Frames are consumed front to back, let the kernel read ahead aggressively
+        madvise(map, size, headersOnly ? MADV_RANDOM : MADV_SEQUENTIAL);
+        data = (const uint8_t*)map;
+        mapped = true;
+    }
+    else
+    {
+        // File systems without mmap support: read the whole file in one go instead
+        uint8_t* buffer = (uint8_t*)malloc(size);
+        size_t bytesDone = 0;
+        while (buffer != NULL && bytesDone < size)
+        {
+            ssize_t result = read(fd, buffer + bytesDone, size - bytesDone);
+            if (result <= 0)
+                break;
+            bytesDone += result;
+        }
+        if (buffer == NULL || bytesDone < size)
+        {
+            printf("[IDTF] %s: Cannot read file (errno: %d)", filename, errno);
+            free(buffer);
+            ::close(fd);
+            size = 0;
+            return -1;
+        }
+        data = buffer;
+        mapped = false;
+    }
+    ::close(fd);
+
+    // Sanity check - Signature of first section
+    ILDA_GUARD_BEGIN(-1);
+    bool signatureOk = (data[0] == 'I') && (data[1] == 'L') && (data[2] == 'D') && (data[3] == 'A');
+    ILDA_GUARD_END();
+    if (!signatureOk)
+    {
+        printf("[IDTF] %s: Not an IDTF file", filename);
+        close();
+        return -1;
+    }
+
+    return 0;
+}
+
+void IldaReader::close()
+{
+    if (data != nullptr)
+    {
+        if (mapped)
+            munmap((void*)data, size);
+        else
+            free((void*)data);
+    }
+    data = nullptr;
+    size = 0;
+    position = 0;
+    mapped = false;
+}
+
+unsigned IldaReader::recordSize(uint8_t formatCode)
+{
+    switch (formatCode)
+    {
+    case ILDA_FORMAT_3D_INDEXED: return 8;
+    case ILDA_FORMAT_2D_INDEXED: return 6;
+    case ILDA_FORMAT_PALETTE: return 3;
+    case ILDA_FORMAT_3D_TRUECOLOR: return 10;
+    case ILDA_FORMAT_2D_TRUECOLOR: return 8;
+    default: return 0;
+    }
+}
+
+int IldaReader::nextSection(IldaSection& section)
+{
+    if (data == nullptr)
+        return -1;
+
+    // Silently end in case of an (incorrect) EOF at a section boundary
+    if (size - position < 4)
+        return 0;
+
+    const uint8_t* header = data + position;
+
+    ILDA_GUARD_BEGIN(-1);
+
+    // Some systems use this signature before appending further (non-IDTF) data...
+    if ((header[0] == 0) && (header[1] == 0) && (header[2] == 0) && (header[3] == 0))
+    {
+        ILDA_GUARD_END();
+        return 0;
+    }
+
+    // Check for IDTF section signature
+    if (!((header[0] == 'I') && (header[1] == 'L') && (header[2] == 'D') && (header[3] == 'A')))
+    {
+        ILDA_GUARD_END();
+        printf("[IDTF] %s: Bad section signature at pos 0x%08zX", filename, position);
+        return -1;
+    }
+
+    if (size - position < ILDA_HEADER_SIZE)
+    {
+        ILDA_GUARD_END();
+        printf("[IDTF] Unexpected end of file (Header)");
+        return -1;
+    }
+
+    section.filePos = position;
+    section.formatCode = header[7];
+    memcpy(section.dataSetName, header + 8, 8);
+    memcpy(section.companyName, header + 16, 8);
+    section.recordCnt = bigEndianShort(header + 24);
+    section.dataSetNumber = bigEndianShort(header + 26);
+    section.dataSetCnt = bigEndianShort(header + 28);
+    section.headNumber = header[30];
+
+    ILDA_GUARD_END();
+
+    // Terminate in case of an empty section (no records - regular end)
+    if (section.recordCnt == 0)
+        return 0;
+
+    section.recordSize = recordSize(section.formatCode);
+    if (section.recordSize == 0)
+    {
+        printf("[IDTF] %s: formatCode = %d", filename, section.formatCode);
+        return -1;
+    }
+
+    if (section.formatCode == ILDA_FORMAT_PALETTE)
+    {
+        // Terminate on insane palettes
+        if (section.recordCnt > 256)
+        {
+            printf("[IDTF] %s: Palettes shall not contain more than 256 colors", filename);
+            return -1;
+        }
+    }
+    else
+    {
+        // Terminate on insane frames
+        if (section.recordCnt <= 1)
+        {
+            printf("[IDTF] %s: Frames should contain at least 2 points", filename);
+            return -1;
+        }
+    }
+
+    // All records must be present, so decoding needs no further bounds checks
+    size_t available = (size - position - ILDA_HEADER_SIZE) / section.recordSize;
+    if (available < section.recordCnt)
+    {
+        printf("[IDTF] Unexpected end of file: Record %u of %u", (unsigned)available, section.recordCnt);
+        return -1;
+    }
+
+    section.records = header + ILDA_HEADER_SIZE;
+    position += ILDA_HEADER_SIZE + (size_t)section.recordCnt * section.recordSize;
+
+    return 1;
+}
+
+template <bool hasZ, bool hasIndex>
+int IldaReader::decodeFormat(const uint8_t* src, unsigned first, unsigned count, unsigned last, const unsigned long* palette, ISPDB25Point* dst)
+{
+    // Formats 0 and 4 are X, Y, Z; Formats 1 and 5 are X, Y.
+    // Formats 0 and 1 have color index; Formats 4 and 5 are true color BGR.
+    const unsigned size = (hasZ ? 6 : 4) + (hasIndex ? 2 : 4);
+    const unsigned statusOffset = hasZ ? 6 : 4;
+
+    const float xScale = 0xFFFF;
+    const float yScale = 0xFFFF;
+
+    src += (size_t)first * size;
+    for (unsigned i = first; i < first + count; i++, src += size, dst++)
+    {
+        int16_t x = (short)((float)(short)bigEndianShort(src) * xScale);
+        int16_t y = (short)((float)(short)bigEndianShort(src + 2) * yScale);
+
+        uint8_t statusCode = src[statusOffset];
+        uint8_t r, g, b;
+        if (hasIndex)
+        {
+            long rgb = palette[src[statusOffset + 1]];
+            r = (uint8_t)(rgb >> 16);
+            g = (uint8_t)(rgb >> 8);
+            b = (uint8_t)rgb;
+        }
+        else
+        {
+            b = src[statusOffset + 1];
+            g = src[statusOffset + 2];
+            r = src[statusOffset + 3];
+        }
+
+        if (statusCode & 0x40)
+            r = g = b = 0;
+
+        dst->x = 0xFFFF - (x + 0x8000);
+        dst->y = 0xFFFF - (y + 0x8000);
+        dst->r = r * 0x101;
+        dst->g = g * 0x101;
+        dst->b = b * 0x101;
+        dst->intensity = 0xFFFF;
+        dst->shutter = 0;
+        dst->u1 = dst->u2 = dst->u3 = dst->u4 = 0;
+
+        if ((statusCode & 0x80) && i != last)
+            return i;
+    }
+
+    return -1;
+}
+
+int IldaReader::decodePoints(const IldaSection& section, unsigned first, unsigned count, const unsigned long* palette, ISPDB25Point* dst)
+{
+    if (first + count > section.recordCnt)
+        count = section.recordCnt - first;
+
+    unsigned last = section.recordCnt - 1;
+    int result = -1;
+
+    ILDA_GUARD_BEGIN(-1);
+    switch (section.formatCode)
+    {
+    case ILDA_FORMAT_3D_INDEXED: result = decodeFormat<true, true>(section.records, first, count, last, palette, dst); break;
+    case ILDA_FORMAT_2D_INDEXED: result = decodeFormat<false, true>(section.records, first, count, last, palette, dst); break;
+    case ILDA_FORMAT_3D_TRUECOLOR: result = decodeFormat<true, false>(section.records, first, count, last, palette, dst); break;
+    case ILDA_FORMAT_2D_TRUECOLOR: result = decodeFormat<false, false>(section.records, first, count, last, palette, dst); break;
+    default: result = first; break;
+    }
+    ILDA_GUARD_END();
+
+    if (result >= 0)
+    {
+        printf("[IDTF] Last point flag set, record count mismatch: Record %u of %u, file pos 0x%08zX", result, section.recordCnt, (size_t)(section.records - data) + (size_t)result * section.recordSize);
+        return -1;
+    }
+
+    return 0;
+}
+
+bool IldaReader::lastPointFlagSet(const IldaSection& section)
+{
+    unsigned statusOffset = (section.formatCode == ILDA_FORMAT_3D_INDEXED || section.formatCode == ILDA_FORMAT_3D_TRUECOLOR) ? 6 : 4;
+
+    ILDA_GUARD_BEGIN(false);
+    bool flagSet = (section.records[(size_t)(section.recordCnt - 1) * section.recordSize + statusOffset] & 0x80) != 0;
+    ILDA_GUARD_END();
+
+    return flagSet;
+}
+
+int IldaReader::decodePalette(const IldaSection& section, unsigned long* palette)
+{
+    if (section.formatCode != ILDA_FORMAT_PALETTE)
+        return -1;
+
+    memset(palette, 0, 256 * sizeof(unsigned long));
+
+    ILDA_GUARD_BEGIN(-1);
+    const uint8_t* src = section.records;
+    for (unsigned i = 0; i < section.recordCnt; i++, src += 3)
+        palette[i] = ((src[0] & 0xFF) << 16) | ((src[1] & 0xFF) << 8) | (src[2] & 0xFF);
+    ILDA_GUARD_END();
+
+    return 0;
+}
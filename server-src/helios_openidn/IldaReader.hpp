@@ -0,0 +1,76 @@
+#pragma once
+
+#include "shared/ISPDB25Point.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Memory mapped ILDA (IDTF) file parser.
+// The file is mapped once and its section headers are walked in place. Every section is fully
+// bounds checked when it is returned by nextSection(), so the per-format point decoders can run
+// over the records without further checks.
+//
+// Pages of a file on removable media can vanish while it is mapped (USB stick pulled), which
+// raises SIGBUS on access. All accesses to the mapping are guarded and turn that into a read error.
+
+#define ILDA_HEADER_SIZE 32
+
+#define ILDA_FORMAT_3D_INDEXED 0
+#define ILDA_FORMAT_2D_INDEXED 1
+#define ILDA_FORMAT_PALETTE 2
+#define ILDA_FORMAT_3D_TRUECOLOR 4
+#define ILDA_FORMAT_2D_TRUECOLOR 5
+
+class IldaReader
+{
+public:
+
+    typedef struct IldaSection
+    {
+        uint8_t formatCode;
+        uint16_t recordCnt;
+        uint16_t dataSetNumber;     // Frame number or color palette number
+        uint16_t dataSetCnt;
+        uint8_t headNumber;
+        char dataSetName[8];
+        char companyName[8];
+        size_t filePos;             // Offset of the section header
+        const uint8_t* records;
+        unsigned recordSize;
+    } IldaSection;
+
+    IldaReader();
+    ~IldaReader();
+
+    // Maps the file and checks the signature of the first section. Returns 0 on success.
+    // Readers that only walk the section headers should not make the kernel read ahead.
+    int open(const char* filename, bool headersOnly = false);
+    void close();
+
+    // Returns 1 and the next section, 0 at the regular end of the file, or -1 on a malformed file.
+    int nextSection(IldaSection& section);
+
+    // Decodes count records of a frame section, starting at record first, into dst.
+    // Fails with -1 on a record that has the last point flag set without being the last record.
+    int decodePoints(const IldaSection& section, unsigned first, unsigned count, const unsigned long* palette, ISPDB25Point* dst);
+
+    // Whether the last record of a frame section carries the last point flag
+    bool lastPointFlagSet(const IldaSection& section);
+
+    // Fills palette with the colors of a palette section, unused entries are black
+    int decodePalette(const IldaSection& section, unsigned long* palette);
+
+    size_t fileSize() { return size; }
+    size_t bytesRead() { return position; }
+
+private:
+
+    const char* filename = "";
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    size_t position = 0;
+    bool mapped = false;
+
+    static unsigned recordSize(uint8_t formatCode);
+    template <bool hasZ, bool hasIndex>
+    static int decodeFormat(const uint8_t* src, unsigned first, unsigned count, unsigned last, const unsigned long* palette, ISPDB25Point* dst);
+};
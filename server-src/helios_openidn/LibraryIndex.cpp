@@ -0,0 +1,374 @@
+#include "LibraryIndex.hpp"
+#include "IldaReader.hpp"
+#include "CompactShow.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+
+#define LIBRARY_INDEX_WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_ATTRIB)
+
+LibraryIndex::LibraryIndex(const std::string& indexPath)
+{
+    this->indexPath = indexPath;
+    stopRequested.store(false);
+}
+
+void LibraryIndex::setIndexPath(const std::string& indexPath)
+{
+    this->indexPath = indexPath;
+}
+
+LibraryIndex::~LibraryIndex()
+{
+    stopWatching();
+}
+
+static bool hasExtension(const std::string& path, const char* ext)
+{
+    size_t length = strlen(ext);
+    if (path.size() < length)
+        return false;
+
+    return std::equal(path.end() - length, path.end(), ext,
+        [](char a, char b) { return std::tolower(a) == std::tolower(b); }
+    );
+}
+
+bool LibraryIndex::isIldaFile(const std::string& path)
+{
+    return hasExtension(path, ".ild");
+}
+
+bool LibraryIndex::isCompactShowFile(const std::string& path)
+{
+    return hasExtension(path, ".ilz");
+}
+
+bool LibraryIndex::isLibraryFile(const std::string& path)
+{
+    return hasExtension(path, ".ild") || hasExtension(path, ".ilz") || hasExtension(path, ".prg");
+}
+
+int LibraryIndex::load()
+{
+    std::ifstream indexFile(indexPath);
+    if (!indexFile)
+        return -1;
+
+    std::string line;
+    if (!std::getline(indexFile, line) || line != "LIBRARYINDEX " + std::to_string(LIBRARY_INDEX_VERSION))
+    {
+        printf("Warning: Ignoring library index %s of unknown version\n", indexPath.c_str());
+        return -1;
+    }
+
+    std::map<std::string, LibraryEntry> loadedEntries;
+    while (std::getline(indexFile, line))
+    {
+        LibraryEntry entry;
+        unsigned long long size, points;
+        long long mtimeNs;
+        int pathOffset = 0;
+        if (sscanf(line.c_str(), "%llu;%lld;%u;%llu;%u;%n", &size, &mtimeNs, &entry.frames, &points, &entry.formats, &pathOffset) != 5 || pathOffset == 0)
+            continue;
+
+        entry.size = size;
+        entry.mtimeNs = mtimeNs;
+        entry.points = points;
+        entry.path = line.substr(pathOffset);
+        loadedEntries[entry.path] = entry;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    entries.swap(loadedEntries);
+    return 0;
+}
+
+int LibraryIndex::save()
+{
+    std::string tempPath = indexPath + ".tmp";
+    FILE* indexFile = fopen(tempPath.c_str(), "w");
+    if (indexFile == NULL)
+    {
+        printf("Warning: Couldn't write library index %s (errno: %d)\n", tempPath.c_str(), errno);
+        return -1;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        fprintf(indexFile, "LIBRARYINDEX %d\n", LIBRARY_INDEX_VERSION);
+        for (const auto& [path, entry] : entries)
+            fprintf(indexFile, "%llu;%lld;%u;%llu;%u;%s\n", (unsigned long long)entry.size, (long long)entry.mtimeNs, entry.frames, (unsigned long long)entry.points, entry.formats, path.c_str());
+    }
+
+    if (fclose(indexFile) != 0 || rename(tempPath.c_str(), indexPath.c_str()) != 0)
+    {
+        printf("Warning: Couldn't write library index %s (errno: %d)\n", indexPath.c_str(), errno);
+        unlink(tempPath.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+int LibraryIndex::readIldaInfo(LibraryEntry& entry)
+{
+    IldaReader reader;
+    if (reader.open(entry.path.c_str(), true) != 0)
+        return -1;
+
+    IldaReader::IldaSection section;
+    int result;
+    while ((result = reader.nextSection(section)) > 0)
+    {
+        entry.formats |= 1 << (section.formatCode & 0x1F);
+        if (section.formatCode != ILDA_FORMAT_PALETTE)
+        {
+            entry.frames++;
+            entry.points += section.recordCnt;
+        }
+    }
+
+    return result;
+}
+
+// Re-reads a single file if it is new or changed, or drops it if it is gone. Returns true if the index changed.
+bool LibraryIndex::updateEntry(const std::string& path)
+{
+    struct stat fileStat;
+    if (stat(path.c_str(), &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return entries.erase(path) > 0;
+    }
+
+    LibraryEntry entry;
+    entry.path = path;
+    entry.size = fileStat.st_size;
+    entry.mtimeNs = (int64_t)fileStat.st_mtim.tv_sec * 1000000000 + fileStat.st_mtim.tv_nsec;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = entries.find(path);
+        if (found != entries.end() && found->second.size == entry.size && found->second.mtimeNs == entry.mtimeNs)
+            return false;
+    }
+
+    // Unreadable ILDA files stay in the index, like in the program list
+    if (isIldaFile(path))
+        readIldaInfo(entry);
+    else if (isCompactShowFile(path))
+        CompactShow::readInfo(path.c_str(), entry.frames, entry.points);
+
+    std::lock_guard<std::mutex> guard(lock);
+    entries[path] = entry;
+    return true;
+}
+
+unsigned LibraryIndex::scan(const std::vector<std::string>& directories)
+{
+    unsigned changed = 0;
+
+    for (const auto& directory : directories)
+    {
+        std::set<std::string> present;
+        std::error_code error;
+        for (auto it = std::filesystem::recursive_directory_iterator(directory, std::filesystem::directory_options::skip_permission_denied, error);
+            it != std::filesystem::recursive_directory_iterator(); it.increment(error))
+        {
+            if (error)
+                break;
+            if (!it->is_regular_file(error) || !isLibraryFile(it->path().filename()))
+                continue;
+
+            present.insert(it->path().string());
+            if (updateEntry(it->path().string()))
+                changed++;
+        }
+
+        // Drop files that disappeared from this directory
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto it = entries.lower_bound(directory); it != entries.end() && it->first.compare(0, directory.size(), directory) == 0; )
+        {
+            if (present.count(it->first) == 0)
+            {
+                it = entries.erase(it);
+                changed++;
+            }
+            else
+                ++it;
+        }
+    }
+
+    return changed;
+}
+
+void LibraryIndex::startWatching(const std::vector<std::string>& directories, std::function<void()> changeCallback)
+{
+    stopWatching();
+    stopRequested.store(false);
+    watchThread = std::thread(&LibraryIndex::watchLoop, this, directories, changeCallback);
+}
+
+void LibraryIndex::stopWatching()
+{
+    if (!watchThread.joinable())
+        return;
+
+    stopRequested.store(true);
+    watchThread.join();
+}
+
+void LibraryIndex::addWatches(const std::string& directory)
+{
+    std::error_code error;
+    if (!std::filesystem::is_directory(directory, error))
+        return;
+
+    int wd = inotify_add_watch(inotifyFd, directory.c_str(), LIBRARY_INDEX_WATCH_MASK);
+    if (wd >= 0)
+        watches[wd] = directory;
+
+    for (auto it = std::filesystem::recursive_directory_iterator(directory, std::filesystem::directory_options::skip_permission_denied, error);
+        it != std::filesystem::recursive_directory_iterator(); it.increment(error))
+    {
+        if (error)
+            break;
+        if (!it->is_directory(error))
+            continue;
+
+        wd = inotify_add_watch(inotifyFd, it->path().c_str(), LIBRARY_INDEX_WATCH_MASK);
+        if (wd >= 0)
+            watches[wd] = it->path().string();
+    }
+}
+
+void LibraryIndex::watchLoop(std::vector<std::string> directories, std::function<void()> changeCallback)
+{
+    // Catch up with changes made while the server was not running
+    if (scan(directories) > 0)
+    {
+        save();
+        changeCallback();
+    }
+
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0)
+    {
+        printf("Warning: inotify unavailable, library changes are picked up at the next start (errno: %d)\n", errno);
+        return;
+    }
+    for (const auto& directory : directories)
+        addWatches(directory);
+
+    std::set<std::string> changedFiles;
+    bool rescan = false;
+    alignas(struct inotify_event) char buffer[8192];
+
+    while (!stopRequested.load())
+    {
+        struct pollfd pollFd = { inotifyFd, POLLIN, 0 };
+        bool pending = rescan || !changedFiles.empty();
+        int result = poll(&pollFd, 1, pending ? LIBRARY_INDEX_SETTLE_MS : 1000);
+
+        if (result > 0)
+        {
+            ssize_t length;
+            while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+            {
+                for (char* ptr = buffer; ptr < buffer + length; ptr += sizeof(struct inotify_event) + ((struct inotify_event*)ptr)->len)
+                {
+                    const struct inotify_event* event = (const struct inotify_event*)ptr;
+
+                    if (event->mask & IN_Q_OVERFLOW)
+                    {
+                        rescan = true;
+                        continue;
+                    }
+                    if (event->mask & IN_IGNORED)
+                    {
+                        watches.erase(event->wd);
+                        continue;
+                    }
+                    if (watches.count(event->wd) == 0 || event->len == 0)
+                        continue;
+
+                    std::string path = watches[event->wd];
+                    if (path.back() != '/')
+                        path += "/";
+                    path += event->name;
+                    if (event->mask & IN_ISDIR)
+                    {
+                        // Whole directories moved in or out, rescan rather than track each file
+                        if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                            addWatches(path);
+                        rescan = true;
+                    }
+                    else if (isLibraryFile(event->name))
+                        changedFiles.insert(path);
+                }
+            }
+            continue;
+        }
+
+        if (!pending)
+            continue;
+
+        // Quiet for a while, apply the batch
+        unsigned changed = 0;
+        if (rescan)
+            changed = scan(directories);
+        else
+        {
+            for (const auto& path : changedFiles)
+                changed += updateEntry(path) ? 1 : 0;
+        }
+        rescan = false;
+        changedFiles.clear();
+
+        if (changed > 0)
+        {
+            save();
+            changeCallback();
+        }
+    }
+
+    close(inotifyFd);
+    inotifyFd = -1;
+    watches.clear();
+}
+
+std::vector<LibraryIndex::LibraryEntry> LibraryIndex::getEntries()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<LibraryEntry> result;
+    result.reserve(entries.size());
+    for (const auto& [path, entry] : entries)
+        result.push_back(entry);
+    return result;
+}
+
+bool LibraryIndex::getEntry(const std::string& path, LibraryEntry& entry)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto found = entries.find(path);
+    if (found == entries.end())
+        return false;
+
+    entry = found->second;
+    return true;
+}
+
+size_t LibraryIndex::size()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return entries.size();
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+// Persistent index of the .ild, .ilz and .prg files in the file player library directories.
+// Holds size and modification time of every file, and for ILDA files the frame count, point count
+// and used formats, gathered from the section headers only. Compact show files (.ilz) report the
+// counts from their header and no formats. The index is saved to disk and loaded
+// at startup, so the library is known without scanning it. A background thread then brings it up
+// to date, reading only new and changed files, and keeps it current through inotify.
+//
+// Index file: a "LIBRARYINDEX <version>" line, then one line per file:
+//	<size>;<mtime ns>;<frames>;<points>;<format mask>;<path>
+
+#define LIBRARY_INDEX_VERSION 1
+#define LIBRARY_INDEX_SETTLE_MS 500		// Changes are applied once the directories were quiet this long
+
+class LibraryIndex
+{
+public:
+
+    typedef struct LibraryEntry
+    {
+        std::string path;
+        uint64_t size = 0;
+        int64_t mtimeNs = 0;
+
+        // ILDA and compact show files only
+        uint32_t frames = 0;
+        uint64_t points = 0;
+        uint32_t formats = 0;   // Bit n set if the file contains format n sections
+    } LibraryEntry;
+
+    LibraryIndex(const std::string& indexPath);
+    ~LibraryIndex();
+
+    // The file load() and save() use, set before either runs
+    void setIndexPath(const std::string& indexPath);
+
+    int load();
+    int save();
+
+    // Brings all entries under the given directories up to date. Returns the number of changed entries.
+    unsigned scan(const std::vector<std::string>& directories);
+
+    // Scans once in the background, then follows changes to the directories. The callback runs on
+    // the watcher thread after each batch of changes.
+    void startWatching(const std::vector<std::string>& directories, std::function<void()> changeCallback);
+    void stopWatching();
+
+    std::vector<LibraryEntry> getEntries();
+    bool getEntry(const std::string& path, LibraryEntry& entry);
+    size_t size();
+
+    static bool isLibraryFile(const std::string& path);
+    static bool isIldaFile(const std::string& path);
+    static bool isCompactShowFile(const std::string& path);
+
+private:
+
+    std::string indexPath;
+    std::mutex lock;
+    std::map<std::string, LibraryEntry> entries;
+
+    std::thread watchThread;
+    std::atomic_bool stopRequested;
+    int inotifyFd = -1;
+    std::map<int, std::string> watches;     // Watch descriptor to directory
+
+    bool updateEntry(const std::string& path);
+    static int readIldaInfo(LibraryEntry& entry);
+    void addWatches(const std::string& directory);
+    void watchLoop(std::vector<std::string> directories, std::function<void()> changeCallback);
+};
@@ -574,7 +574,7 @@ void ManagementInterface::networkLoop(int sd) {
 					if (nameLength > 0 && nameLength < (num_bytes - 2))
 					{
 						std::string programName(&buffer_in[2]);
-						if (filePlayer.programs.count(programName) >= 1)
+						if (filePlayer.hasProgram(programName))
 						{ 
 							if (requestOutput(OUTPUT_MODE_FILE))
 							{
@@ -591,6 +591,50 @@ void ManagementInterface::networkLoop(int sd) {
 					sendto(sd, &responseBuffer, sizeof(responseBuffer), 0, (struct sockaddr*)&remote, len);
 					continue;
 				}
+				else if (buffer_in[1] == 0x14) // Get program list page, with library details
+				{
+					// Request: 4 byte big endian number of the first program. Response: 4 byte total program count,
+					// 4 byte first program, 2 byte program count in this page, then the list lines like in 0x5
+					// with the duration (ms) and output spec added to the program lines and frames, points and format mask
+					// to the file lines. The output spec is "all" or output numbers separated by commas, empty for the default.
+					char responseBuffer[UDP_MAXBUF] = { 0xE6, 0x14, 0 };
+					size_t msgSize = 12;
+
+					if (num_bytes < 6)
+						continue;
+
+					unsigned firstProgram = ((unsigned)(uint8_t)buffer_in[2] << 24) | ((unsigned)(uint8_t)buffer_in[3] << 16) | ((unsigned)(uint8_t)buffer_in[4] << 8) | (uint8_t)buffer_in[5];
+					unsigned programsInPage = 0, totalPrograms = 0;
+
+					try
+					{
+						// The page is never longer than requested, a program too large for a page is cut
+						std::string programListString = filePlayer.getProgramListPage(firstProgram, UDP_MAXBUF - 13, programsInPage, totalPrograms);
+						strncpy(responseBuffer + 12, programListString.c_str(), UDP_MAXBUF - 13);
+						msgSize = programListString.size() + 13;
+					}
+					catch (std::exception& ex)
+					{
+						printf("WARNING: Error during get program list page command: %s.\n", ex.what());
+						programsInPage = 0;
+						responseBuffer[12] = 0;
+						msgSize = 13;
+					}
+
+					responseBuffer[2] = (totalPrograms >> 24) & 0xFF;
+					responseBuffer[3] = (totalPrograms >> 16) & 0xFF;
+					responseBuffer[4] = (totalPrograms >> 8) & 0xFF;
+					responseBuffer[5] = totalPrograms & 0xFF;
+					responseBuffer[6] = (firstProgram >> 24) & 0xFF;
+					responseBuffer[7] = (firstProgram >> 16) & 0xFF;
+					responseBuffer[8] = (firstProgram >> 8) & 0xFF;
+					responseBuffer[9] = firstProgram & 0xFF;
+					responseBuffer[10] = (programsInPage >> 8) & 0xFF;
+					responseBuffer[11] = programsInPage & 0xFF;
+
+					sendto(sd, &responseBuffer, msgSize, 0, (struct sockaddr*)&remote, len);
+					continue;
+				}
 				else if (buffer_in[1] == 0xF0) // Stop/lock output, can be used as emergency stop
 				{
 					char responseBuffer[2] = { 0xE6, 0xF0 };
@@ -681,7 +725,7 @@ void ManagementInterface::emitEnterButtonPressed()
 		}
 		else if (currentMenu == Menus::FilePlayerMenu)
 		{
-			if (!filePlayer.programs.empty())
+			if (filePlayer.programCount() > 0)
 			{
 				std::string newFile = display->MenuGetSelectedFile();
 
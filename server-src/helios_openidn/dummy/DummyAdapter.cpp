@@ -1,37 +1,192 @@
 #include "DummyAdapter.hpp"
 
+#include <thread>
+
+unsigned DummyAdapter::fifoDepth = DUMMY_DEFAULT_FIFO_POINTS;
+unsigned DummyAdapter::latencyUs = DUMMY_DEFAULT_LATENCY_US;
+unsigned DummyAdapter::jitterUs = DUMMY_DEFAULT_JITTER_US;
+double DummyAdapter::clockSkewPpm = 0;
+const char* DummyAdapter::recordPath = nullptr;
+unsigned DummyAdapter::recordCount = 0;
+
 DummyAdapter::DummyAdapter() {
 	this->maximumPointRate = -1;
 }
 
 DummyAdapter::~DummyAdapter() {
+	if(recordFile != nullptr)
+		fclose(recordFile);
+}
+
+void DummyAdapter::setFifoDepth(unsigned points) {
+	fifoDepth = points;
+}
+
+void DummyAdapter::setTransferLatency(unsigned latency, unsigned jitter) {
+	latencyUs = latency;
+	jitterUs = jitter;
+}
+
+//positive values make the device emit faster than the slice durations
+void DummyAdapter::setClockSkew(double ppm) {
+	clockSkewPpm = ppm;
+}
+
+void DummyAdapter::setRecordPath(const char* path) {
+	recordPath = path;
+}
+
+double DummyAdapter::nowUs() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000.0 + now.tv_nsec / 1000.0;
+}
+
+void DummyAdapter::drainFifo(double now) {
+	while(!fifo.empty() && fifo.front().endUs <= now)
+		fifo.pop_front();
+}
+
+//points in the device FIFO that have not been emitted yet
+double DummyAdapter::fifoPoints(double now) {
+	double points = 0;
+	for(const auto& chunk : fifo) {
+		if(now <= chunk.startUs)
+			points += chunk.points;
+		else
+			points += chunk.points * (chunk.endUs - now) / (chunk.endUs - chunk.startUs);
+	}
+	return points;
+}
+
+//time at which the FIFO has room for the given number of points.
+//larger chunks than the FIFO wait for it to run empty.
+double DummyAdapter::timeForSpace(double now, unsigned points) {
+	double excess = fifoPoints(now) + std::min(points, fifoDepth) - fifoDepth;
+	if(excess <= 0)
+		return now;
+
+	for(const auto& chunk : fifo) {
+		double pointUs = (chunk.endUs - chunk.startUs) / chunk.points;
+		double remaining = (now <= chunk.startUs) ? chunk.points : (chunk.endUs - now) / pointUs;
+		if(excess <= remaining)
+			return chunk.endUs - (remaining - excess) * pointUs;
+		excess -= remaining;
+	}
+	return fifoEndUs;
 }
 
 int DummyAdapter::writeFrame(const TimeSlice& slice, double duration) {
 	const SliceType& data = slice.dataChunk;
-	struct timespec now, pulse;
-	unsigned long sdif, nsdif, tdif;
-	unsigned long bpdelay = (unsigned long)(bytesPerPoint() * duration / (double)data.size());
-
-	for(int i = 0; i < data.size(); i += 20) {
-		//write the point to spi
-		clock_gettime(CLOCK_MONOTONIC, &now);
-		writeDACPoint((uint8_t*)&data.front() + i);
-
-		//busy waiting
-		do { 
-			clock_gettime(CLOCK_MONOTONIC, &pulse);
-			sdif = pulse.tv_sec - now.tv_sec;
-			nsdif = pulse.tv_nsec - now.tv_nsec;
-			tdif = sdif*1000000000 + nsdif ;
-		} while (tdif < bpdelay * 1000); 
+	unsigned numPoints = data.size() / bytesPerPoint();
+	if(numPoints == 0 || duration <= 0)
+		return 0;
+
+	//wait for room in the device FIFO, like polling the status of a real DAC
+	double now = nowUs();
+	drainFifo(now);
+	double readyUs = timeForSpace(now, numPoints);
+	if(readyUs > now)
+		std::this_thread::sleep_for(std::chrono::microseconds((long long)(readyUs - now)));
+
+	//transfer to the device
+	double transferUs = latencyUs;
+	if(jitterUs > 0)
+		transferUs += std::uniform_real_distribution<double>(0, jitterUs)(jitterRandom);
+	std::this_thread::sleep_for(std::chrono::microseconds((long long)transferUs));
+
+	now = nowUs();
+	drainFifo(now);
+
+	//the device ran out of points before this slice arrived
+	double startUs = now;
+	if(fifoEndUs > now)
+		startUs = fifoEndUs;
+	else if(fifoEndUs > 0 && now - fifoEndUs < DUMMY_MAX_UNDERRUN_US) {
+		underruns++;
+		idleUs += now - fifoEndUs;
 	}
 
+	duration /= 1.0 + clockSkewPpm / 1000000.0;
+
+	FifoChunk chunk;
+	chunk.startUs = startUs;
+	chunk.endUs = startUs + duration;
+	chunk.points = numPoints;
+	fifo.push_back(chunk);
+	fifoEndUs = chunk.endUs;
+
+	if(recordPath != nullptr)
+		recordChunk(data, startUs, duration / numPoints);
+
 	return 0;
 }
 
-void DummyAdapter::writeDACPoint(const unsigned char* bp) {
+void DummyAdapter::openRecording() {
+	//one file per dummy device, further devices get the device number appended
+	std::string path = recordPath;
+	if(recordCount > 0)
+		path += "." + std::to_string(recordCount + 1);
+	recordCount++;
+
+	recordFile = fopen(path.c_str(), "wb");
+	if(recordFile == nullptr) {
+		printf("Dummy: Couldn't open recording file %s: %s\n", path.c_str(), strerror(errno));
+		recordPath = nullptr;
+		return;
+	}
+
+	uint32_t version = 1;
+	uint32_t recordSize = 20;
+	fwrite("DUMMYREC", 1, 8, recordFile);
+	fwrite(&version, sizeof(version), 1, recordFile);
+	fwrite(&recordSize, sizeof(recordSize), 1, recordFile);
+	printf("Dummy: Recording output to %s\n", path.c_str());
+}
+
+static uint16_t decodeChannel(const uint8_t* bytes) {
+	return ((bytes[1] & 0x0f) << 12) | (bytes[2] << 4) | (bytes[3] >> 4);
+}
+
+void DummyAdapter::recordChunk(const SliceType& data, double startUs, double pointUs) {
+	if(recordFile == nullptr) {
+		openRecording();
+		if(recordFile == nullptr)
+			return;
+	}
+
+	#pragma pack(push, 1)
+	struct {
+		uint64_t timeNs;
+		uint16_t x, y, r, g, b, reserved;
+	} record;
+	#pragma pack(pop)
+
+	record.reserved = 0;
+	unsigned numPoints = data.size() / bytesPerPoint();
+	for(unsigned i = 0; i < numPoints; i++) {
+		const uint8_t* point = (const uint8_t*)&data[i * bytesPerPoint()];
+		record.timeNs = (uint64_t)((startUs + i * pointUs) * 1000.0);
+		record.x = decodeChannel(point);
+		record.y = decodeChannel(point + 4);
+		record.r = decodeChannel(point + 8);
+		record.g = decodeChannel(point + 12);
+		record.b = decodeChannel(point + 16);
+		fwrite(&record, sizeof(record), 1, recordFile);
+	}
+}
+
+double DummyAdapter::queuedDurationUs() {
+	double now = nowUs();
+	return (fifoEndUs > now) ? fifoEndUs - now : 0;
+}
 
+void DummyAdapter::printStats() {
+	double now = nowUs();
+	drainFifo(now);
+	printf("%.0f Points / %.2f ms in Dummy FIFO %u Dummy Underruns (%.2f ms idle) ", fifoPoints(now), queuedDurationUs() / 1000.0, underruns, idleUs / 1000.0);
+	underruns = 0;
+	idleUs = 0;
 }
 
 SliceType DummyAdapter::convertPoints(const std::vector<ISPDB25Point>& points) {
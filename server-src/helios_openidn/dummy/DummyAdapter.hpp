@@ -2,9 +2,29 @@
 
 #include <stdint.h>
 #include <unistd.h>
+#include <stdio.h>
+#include <deque>
+#include <random>
 
 #include "../shared/types.h"
 
+//simulated DAC: written points go into a device FIFO that is emptied at the
+//point rate of each slice. writes take a transfer latency with random jitter
+//and block while the FIFO has no room, the FIFO running empty between slices
+//is counted as an underrun. the point clock can be skewed against the host
+//clock, like the crystal of a real DAC.
+//
+//optional recording of the emitted points, in host byte order:
+//header "DUMMYREC", uint32 version (1), uint32 record size (20), then per point
+//uint64 emission time (CLOCK_MONOTONIC ns), uint16 x, y, r, g, b, reserved
+
+#define DUMMY_DEFAULT_FIFO_POINTS 1024
+#define DUMMY_DEFAULT_LATENCY_US 150
+#define DUMMY_DEFAULT_JITTER_US 50
+
+//longer gaps between slices are pauses of the output, not underruns
+#define DUMMY_MAX_UNDERRUN_US 1000000
+
 class DummyAdapter : public DACHWInterface {
 public:
 	int writeFrame(const TimeSlice& slice, double duration) override;
@@ -14,12 +34,52 @@ public:
 	unsigned maxPointrate() override;
 	void setMaxPointrate(unsigned) override;
 	void getName(char *nameBufferPtr, unsigned nameBufferSize) override;
+	void printStats() override;
+	double queuedDurationUs() override;
 
 	DummyAdapter();
 	~DummyAdapter();
 
+	//device model, shared by all dummy devices
+	static void setFifoDepth(unsigned points);
+	static void setTransferLatency(unsigned latencyUs, unsigned jitterUs);
+	static void setClockSkew(double ppm);
+	static void setRecordPath(const char* path);
+
+	//statistics since the last printStats
+	unsigned getUnderruns() { return underruns; }
+	double getIdleUs() { return idleUs; }
+
 private:
-	void writeDACPoint(const unsigned char* point);
 	unsigned maximumPointRate;
-};
 
+	struct FifoChunk {
+		double startUs;
+		double endUs;
+		unsigned points;
+	};
+
+	//queued output of the simulated device, in CLOCK_MONOTONIC us
+	std::deque<FifoChunk> fifo;
+	double fifoEndUs = 0;
+
+	std::mt19937 jitterRandom;
+	FILE* recordFile = nullptr;
+
+	unsigned underruns = 0;
+	double idleUs = 0;
+
+	static unsigned fifoDepth;
+	static unsigned latencyUs;
+	static unsigned jitterUs;
+	static double clockSkewPpm;
+	static const char* recordPath;
+	static unsigned recordCount;
+
+	double nowUs();
+	void drainFifo(double now);
+	double fifoPoints(double now);
+	double timeForSpace(double now, unsigned points);
+	void openRecording();
+	void recordChunk(const SliceType& data, double startUs, double pointUs);
+};
@@ -1,13 +1,14 @@
 #include "HeliosAdapter.hpp"
 
+#include <algorithm>
+
 bool HeliosAdapter::isInitialized = false;
-int HeliosAdapter::numHeliosDevices = 0;
-int HeliosAdapter::indexFirstDevice = -1;
-int HeliosAdapter::indexSecondDevice = -1;
-IDNLaproService* HeliosAdapter::serviceFirstDevice = NULL;
-IDNLaproService* HeliosAdapter::serviceSecondDevice = NULL;
+bool HeliosAdapter::asyncTransfers = false;
+bool HeliosAdapter::hotplugActive = false;
 bool HeliosAdapter::firstServiceIsAlwaysVisible = false;
-HeliosDac HeliosAdapter::helios;
+std::vector<HeliosAdapter::DeviceSlot> HeliosAdapter::slots;
+std::mutex HeliosAdapter::slotLock;
+HeliosDac HeliosAdapter::helios; // After the slots, so the hotplug thread is stopped before they are destroyed
 
 
 void HeliosAdapter::initialize() {
@@ -16,13 +17,18 @@ void HeliosAdapter::initialize() {
         return;
     }
 
-    numHeliosDevices = helios.OpenDevices();
+    int numHeliosDevices = helios.OpenDevices();
 
 	refreshDacReferences(numHeliosDevices);
 
 	if(numHeliosDevices == 0) {
 		printf("No Helios device found!\n");
 	}
+
+	hotplugActive = (helios.EnableHotplug([]() { refreshDacReferences(helios.GetNumDevices()); }) == HELIOS_SUCCESS);
+	if (!hotplugActive) {
+		printf("Helios hotplug events not available, falling back to rescanning.\n");
+	}
     printf("HeliosAdapter initialized.\n");
     isInitialized = true;
 }
@@ -46,9 +52,10 @@ std::map<std::string, int> HeliosAdapter::getAvailableDevices() {
 
     std::map<std::string, int> deviceMap;
 
+    int numHeliosDevices = helios.GetNumDevices();
     for (int i = 0; i < numHeliosDevices; ++i) {
         char deviceName[32];
-        if (helios.GetName(i, deviceName)) {
+        if (!helios.GetIsClosed(i) && helios.GetName(i, deviceName)) {
             deviceMap[std::string(deviceName)] = i;
         }
     }
@@ -57,11 +64,22 @@ std::map<std::string, int> HeliosAdapter::getAvailableDevices() {
 }
 
 
-HeliosAdapter::HeliosAdapter(int id) {
+HeliosAdapter::HeliosAdapter() : HeliosAdapter(std::string()) {
+}
+
+HeliosAdapter::HeliosAdapter(const std::string& deviceName) {
 	if (!isInitialized) {
         throw std::runtime_error("HeliosAdapter::Initialize must be called before creating an instance.");
     }
-	this->id = id;
+
+	{
+		std::lock_guard<std::mutex> lock(slotLock);
+		DeviceSlot slot;
+		slot.boundName = deviceName;
+		slots.push_back(slot);
+		this->id = slots.size() - 1;
+	}
+	refreshDacReferences(helios.GetNumDevices());
 
 	this->heliosFlags = HELIOS_FLAGS_SINGLE_MODE;
 	this->maximumPointRate = 0xFFFF*0.8 - 1; // Actual max is 65535, but subtract to account for max time factor strecthing (0.8)
@@ -71,6 +89,23 @@ HeliosAdapter::~HeliosAdapter() {
 }
 
 int HeliosAdapter::writeFrame(const TimeSlice& slice, double duration) {
+	return writeHeliosFrame(slice, duration, this->heliosFlags);
+}
+
+bool HeliosAdapter::canLoopFrames() {
+	return true;
+}
+
+int HeliosAdapter::writeLoopingFrame(const TimeSlice& slice, double duration) {
+	// Larger frames would be subsampled by the DAC
+	if (slice.dataChunk.size() / bytesPerPoint() > HELIOS_MAX_POINTS)
+		return -1;
+
+	// Without HELIOS_FLAGS_SINGLE_MODE the DAC repeats the frame until the next one is written
+	return writeHeliosFrame(slice, duration, this->heliosFlags & ~HELIOS_FLAGS_SINGLE_MODE);
+}
+
+int HeliosAdapter::writeHeliosFrame(const TimeSlice& slice, double duration, std::uint8_t flags) {
 
 	isBusy = true;
 
@@ -80,14 +115,7 @@ int HeliosAdapter::writeFrame(const TimeSlice& slice, double duration) {
 	//	numHeliosDevices = helios.OpenDevices(); // For hot-plugging
 	//}
 
-	int heliosId;
-	if (this->id == 0)
-		heliosId = indexFirstDevice;
-	else if (this->id == 1)
-		heliosId = indexSecondDevice;
-	else
-		heliosId = this->id;
-
+	int heliosId = getDeviceIndex();
 	if (heliosId < 0)
 		return -1;
 
@@ -98,16 +126,18 @@ int HeliosAdapter::writeFrame(const TimeSlice& slice, double duration) {
 	const SliceType& data = slice.dataChunk;
 	unsigned numPoints = data.size() / bytesPerPoint();
 	unsigned framePointRate = 65500;
+	int result = 0;
 
 	if(duration > 0) {
-		framePointRate = (unsigned)((1000000.0*(double)data.size()) / (duration*(double)sizeof(HeliosPoint)));
+		framePointRate = (unsigned)((1000000.0*(double)data.size()) / (duration*(double)bytesPerPoint()));
 	}
 	
 	if (framePointRate <= HELIOS_MAX_PPS)
 	{
 		int status = 0;
 
-		while (true)
+		// With asynchronous transfers, WriteFrame() itself waits until the DAC is predicted to be ready
+		while (!asyncTransfers)
 		{
 			status = helios.GetStatus(heliosId);
 			if (status == 1)
@@ -117,40 +147,37 @@ int HeliosAdapter::writeFrame(const TimeSlice& slice, double duration) {
 			{
 				printf("Error checking Helios status: %d\n", status);
 				if (status == HELIOS_ERROR_DEVICE_CLOSED)
-				{
-					if (this->id == 0)
-						indexFirstDevice = -1;
-					else if (this->id == 1)
-						indexSecondDevice = -1;
-				}
+					releaseDevice();
 				break;
 			}
 		}
 
 		//printf("Sent hel frame: samples %d, pps %d\n", numPoints, framePointRate);
 
-		status = helios.WriteFrame(heliosId
+		status = helios.WriteFramePacked(heliosId
 			, framePointRate
-			, this->heliosFlags, (HeliosPoint*)&data.front()
+			, flags, &data.front()
 			, numPoints);
 
 		if (status < 0)
 		{
+			result = -1;
 			printf("Error writing Helios frame: %d\n", status);
 			if (status == HELIOS_ERROR_DEVICE_CLOSED)
-			{
-				if (this->id == 0)
-					indexFirstDevice = -1;
-				else if (this->id == 1)
-					indexSecondDevice = -1;
-			}
+				releaseDevice();
 		}
 	}
 	else
+	{
+		result = -1;
 		printf("Too high helios rate, bypassing write: %d\n", framePointRate);
+	}
 
 	isBusy = false;
 
+	if (asyncTransfers)
+		return result;
+
 	//waiting, not really required normally
 	do {
 		clock_gettime(CLOCK_MONOTONIC, &now);
@@ -160,36 +187,26 @@ int HeliosAdapter::writeFrame(const TimeSlice& slice, double duration) {
 	} while (tdif < ((unsigned long)duration * 1000 * 0.1) );
 
 
-	return 0;
+	return result;
 }
 
 SliceType HeliosAdapter::convertPoints(const std::vector<ISPDB25Point>& points) {
 
-	SliceType result(points.size()* bytesPerPoint());
+	// Packed straight into the USB wire format, so the frame only has to be copied into the transfer buffer
+	SliceType result(points.size() * HELIOS_PACKED_POINT_SIZE);
 
-	int index = 0;
+	uint8_t* dst = result.data();
 
 	for(const auto& point : points) {
-
-		HeliosPoint currentPoint;
-
-		currentPoint.x = (std::uint16_t)(point.x >> 4); //12 bit (from 0 to 0xFFF)
-		currentPoint.y = (std::uint16_t)(point.y >> 4); //12 bit (from 0 to 0xFFF)
-		currentPoint.r = (std::uint8_t) (point.r >> 8);	//8 bit	(from 0 to 0xFF)
-		currentPoint.g = (std::uint8_t) (point.g >> 8);	//8 bit (from 0 to 0xFF)
-		currentPoint.b = (std::uint8_t) (point.b >> 8);	//8 bit (from 0 to 0xFF)
-		currentPoint.i = (std::uint8_t) (point.intensity >> 8);	//8 bit (from 0 to 0xFF)
-
-		for(int i = 0; i < bytesPerPoint(); i++) {
-			result[index++] = (*((uint8_t*)&currentPoint + i));
-		}
+		HeliosDac::PackPoint(dst, point.x, point.y, point.r, point.g, point.b, point.intensity);
+		dst += HELIOS_PACKED_POINT_SIZE;
 	}
 
 	return result;
 }
 
 unsigned HeliosAdapter::bytesPerPoint() {
-	return (unsigned)sizeof(HeliosPoint);
+	return HELIOS_PACKED_POINT_SIZE;
 }
 
 unsigned HeliosAdapter::maxBytesPerTransmission() {
@@ -206,18 +223,12 @@ void HeliosAdapter::setMaxPointrate(unsigned newRate) {
 
 void HeliosAdapter::getName(char *nameBufferPtr, unsigned nameBufferSize)
 {
-	int heliosId;
-	if (this->id == 0)
-		heliosId = indexFirstDevice;
-	else if (this->id == 1)
-		heliosId = indexSecondDevice;
-	else
-		heliosId = this->id;
+	int heliosId = getDeviceIndex();
 
 	char heliosName[32];
 	if (heliosId >= 0)
 	{
-		if (helios.GetName(this->id, heliosName) != HELIOS_SUCCESS)
+		if (helios.GetName(heliosId, heliosName) != HELIOS_SUCCESS)
 			strcpy(heliosName, "[Unknown Helios]");
 	}
 	else
@@ -233,8 +244,18 @@ bool HeliosAdapter::getHeliosConnected()
 	//return helios.GetStatus(this->id);
 }
 
+void HeliosAdapter::setAsyncTransfers(bool enable)
+{
+	asyncTransfers = enable;
+	helios.SetAsyncTransfers(enable);
+}
+
 void HeliosAdapter::updateDeviceList()
 {
+	// With hotplug events the references are refreshed whenever the device list changes
+	if (hotplugActive)
+		return;
+
 	int listSize = helios.ReScanDevices();
 
 	refreshDacReferences(listSize);
@@ -247,54 +268,90 @@ void HeliosAdapter::updateDeviceList()
 
 void HeliosAdapter::refreshDacReferences(unsigned int numDevices)
 {
-#ifdef DEBUGOUTPUT
-	printf("Refreshing Helios references. %d, %d. Num: %d\n", indexFirstDevice, indexSecondDevice, numDevices);
-#endif
-
-	if (indexFirstDevice >= numDevices)
-		indexFirstDevice = -1;
-	if (indexFirstDevice >= 0 && helios.GetIsClosed(indexFirstDevice))
-		indexFirstDevice = -1;
-	if (indexSecondDevice >= numDevices)
-		indexSecondDevice = -1;
-	if (indexSecondDevice >= 0 && helios.GetIsClosed(indexSecondDevice))
-		indexSecondDevice = -1;
+	std::lock_guard<std::mutex> lock(slotLock);
 
 #ifdef DEBUGOUTPUT
-	printf("After clean. %d, %d\n", indexFirstDevice, indexSecondDevice);
+	printf("Refreshing Helios references for %d slots. Num: %d\n", (int)slots.size(), numDevices);
 #endif
 
+	std::vector<bool> assigned(numDevices, false);
+	for (auto& slot : slots)
+	{
+		if (slot.deviceIndex >= (int)numDevices)
+			slot.deviceIndex = -1;
+		if (slot.deviceIndex >= 0 && helios.GetIsClosed(slot.deviceIndex))
+			slot.deviceIndex = -1;
+		if (slot.deviceIndex >= 0)
+			assigned[slot.deviceIndex] = true;
+	}
+
+	// Names are only read from unassigned DACs, to keep USB traffic away from DACs in use
+	std::vector<std::string> freeNames(numDevices);
 	for (int i = 0; i < numDevices; i++)
 	{
-		if (indexFirstDevice == -1 && indexSecondDevice != i)
+		if (assigned[i] || helios.GetIsClosed(i))
+			continue;
+		char name[33];
+		helios.GetName(i, name);
+		name[32] = 0;
+		freeNames[i] = name;
+	}
+
+	// Slots bound to a name first, so a named DAC is never taken by an unbound slot
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (size_t s = 0; s < slots.size(); s++)
 		{
-			if (!helios.GetIsClosed(i))
+			DeviceSlot& slot = slots[s];
+			if (slot.deviceIndex >= 0 || slot.boundName.empty() != (pass == 1))
+				continue;
+
+			for (int i = 0; i < numDevices; i++)
 			{
-				indexFirstDevice = i;
-				char name[33];
-				helios.GetName(indexFirstDevice, name);
-				name[32] = 0;
-				printf("Adding Helios 1 reference. %d %s\n", indexFirstDevice, name);
-				if (serviceFirstDevice != NULL)
-					serviceFirstDevice->setServiceName(name, strlen(name));
+				if (assigned[i] || freeNames[i].empty())
+					continue;
+
+				if (pass == 0 && freeNames[i] != slot.boundName)
+					continue;
+				if (pass == 1 && std::any_of(slots.begin(), slots.end(), [&](const DeviceSlot& other) { return other.boundName == freeNames[i]; }))
+					continue;
+
+				slot.deviceIndex = i;
+				assigned[i] = true;
+				printf("Adding Helios %d reference. %d %s\n", (int)s + 1, i, freeNames[i].c_str());
+				if (slot.service != NULL && slot.boundName.empty())
+					slot.service->setServiceName(&freeNames[i][0], freeNames[i].size());
+				break;
 			}
 		}
-		else if (indexSecondDevice == -1 && indexFirstDevice != i && !helios.GetIsClosed(i))
-		{
-			indexSecondDevice = i;
-			char name[33];
-			helios.GetName(indexSecondDevice, name);
-			name[32] = 0;
-			printf("Adding Helios 2 reference. %d %s\n", indexSecondDevice, name);
-			if (serviceSecondDevice != NULL)
-				serviceSecondDevice->setServiceName(name, strlen(name));
-		}
 	}
 
-	if (serviceFirstDevice != NULL)
-		serviceFirstDevice->isActive = firstServiceIsAlwaysVisible || indexFirstDevice >= 0;
-	if (serviceSecondDevice != NULL)
-		serviceSecondDevice->isActive = indexSecondDevice >= 0;
+	for (size_t s = 0; s < slots.size(); s++)
+	{
+		if (slots[s].service != NULL)
+			slots[s].service->isActive = (s == 0 && firstServiceIsAlwaysVisible) || slots[s].deviceIndex >= 0;
+	}
+}
+
+void HeliosAdapter::setService(IDNLaproService* service)
+{
+	{
+		std::lock_guard<std::mutex> lock(slotLock);
+		slots[this->id].service = service;
+	}
+	refreshDacReferences(helios.GetNumDevices());
+}
+
+int HeliosAdapter::getDeviceIndex()
+{
+	std::lock_guard<std::mutex> lock(slotLock);
+	return slots[this->id].deviceIndex;
+}
+
+void HeliosAdapter::releaseDevice()
+{
+	std::lock_guard<std::mutex> lock(slotLock);
+	slots[this->id].deviceIndex = -1;
 }
 
 void HeliosAdapter::checkConnection()
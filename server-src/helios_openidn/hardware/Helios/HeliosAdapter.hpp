@@ -6,6 +6,8 @@
 #include "../../shared/types.h"
 
 #include <map>
+#include <vector>
+#include <mutex>
 #include "../../server/IDNLaproService.hpp"
 
 class HeliosAdapter : public DACHWInterface {
@@ -20,41 +22,55 @@ public:
 	unsigned maxBytesPerTransmission() override;
 
 	int writeFrame(const TimeSlice& slice, double duration) override;
+	bool canLoopFrames() override;
+	int writeLoopingFrame(const TimeSlice& slice, double duration) override;
 	unsigned maxPointrate() override;
 	void setMaxPointrate(unsigned) override;
 	void getName(char *nameBufferPtr, unsigned nameBufferSize) override;
 	bool getHeliosConnected();
 	//bool getIsBusy() override;
 
-	//static int getFirstDeviceIndex() { return indexFirstDevice; }
-	//static int getSecondDeviceIndex() { return indexSecondDevice; }
-	static void setFirstDeviceService(IDNLaproService* service) { serviceFirstDevice = service; }
-	static void setSecondDeviceService(IDNLaproService* service) { serviceSecondDevice = service; }
 	static bool setFirstServiceIsAlwaysVisible() { firstServiceIsAlwaysVisible = true; }
+	static void setAsyncTransfers(bool enable);
 
-	HeliosAdapter(int id);
+	// Links the service of this adapter, its active state then follows whether a DAC is attached.
+	// The service name is updated to the DAC name for adapters that are not bound to a name.
+	void setService(IDNLaproService* service);
+
+	// Adapter taking any Helios DAC that is not used by another adapter
+	HeliosAdapter();
+	// Adapter bound to the Helios DAC with the given name, it is used whenever that DAC is attached
+	HeliosAdapter(const std::string& deviceName);
 	~HeliosAdapter();
 
 	static bool firstServiceIsAlwaysVisible;
 
 private:
+	// Hot-plugging system: every adapter owns a slot, which is assigned a DAC whenever a matching one is attached
+	struct DeviceSlot
+	{
+		int deviceIndex = -1;		// index in the HeliosDac device list, -1 if no DAC is assigned
+		std::string boundName;		// name of the DAC this slot is bound to, empty to take any free DAC
+		IDNLaproService* service = NULL;
+	};
+
 	int id;
 	std::uint8_t heliosFlags;
 	unsigned maximumPointRate;
 	int connectionRetries = 50;
 
 	static bool isInitialized;
+	static bool asyncTransfers;
+	static bool hotplugActive;
+	static std::vector<DeviceSlot> slots;
+	static std::mutex slotLock;
 	static HeliosDac helios;
-	static int numHeliosDevices;
 	bool isBusy = false;
 
-	// Special two-device hot-plugging system
-	static int indexFirstDevice;
-	static int indexSecondDevice;
-	static IDNLaproService* serviceFirstDevice;
-	static IDNLaproService* serviceSecondDevice;
-
 	static void refreshDacReferences(unsigned int numDevices);
+	int writeHeliosFrame(const TimeSlice& slice, double duration, std::uint8_t flags);
+	int getDeviceIndex();
+	void releaseDevice();
 	void checkConnection();
 };
 
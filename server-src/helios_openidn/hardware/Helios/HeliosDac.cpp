@@ -7,7 +7,7 @@ MIT License
 Dependencies:
 Libusb 1.0 (GNU Lesser General Public License, see libusb.h)
 
-Standard: C++14
+Standard: C++17
 git repo: https://github.com/Grix/helios_dac.git
 
 See header HeliosDac.h for function and usage documentation
@@ -69,10 +69,14 @@ HeliosDac::HeliosDac()
 HeliosDac::~HeliosDac()
 {
 	CloseDevices();
+	_StopHotplug();
+	_StopEventThread();
 }
 
 int HeliosDac::OpenDevices()
 {
+	std::lock_guard<std::mutex> scanGuard(scanLock);
+
 	if (inited)
 		return (int)deviceList.size();
 
@@ -89,6 +93,8 @@ int HeliosDac::OpenDevices()
 
 int HeliosDac::OpenDevicesOnlyUsb()
 {
+	std::lock_guard<std::mutex> scanGuard(scanLock);
+
 	if (inited)
 		return (int)deviceList.size();
 
@@ -105,6 +111,8 @@ int HeliosDac::OpenDevicesOnlyUsb()
 
 int HeliosDac::ReScanDevices()
 {
+	std::lock_guard<std::mutex> scanGuard(scanLock);
+
 	_OpenUsbDevices(true);
 
 	inited = true;
@@ -114,6 +122,8 @@ int HeliosDac::ReScanDevices()
 
 int HeliosDac::ReScanDevicesOnlyUsb()
 {
+	std::lock_guard<std::mutex> scanGuard(scanLock);
+
 	_OpenUsbDevices(true);
 
 	inited = true;
@@ -122,6 +132,8 @@ int HeliosDac::ReScanDevicesOnlyUsb()
 }
 
 // Internal function. inPlace = Whether to keep the current opened devices in their device number slots and only scan for changes.
+// Must be called with scanLock held. Only scans and CloseDevices() modify the device list, so it can be read here without
+// deviceListLock, which is only taken exclusively for the actual modifications. Output to other devices continues meanwhile.
 int HeliosDac::_OpenUsbDevices(bool inPlace)
 {
 	// Scanning for USB devices
@@ -133,6 +145,10 @@ int HeliosDac::_OpenUsbDevices(bool inPlace)
 			return result;
 
 		libusb_set_option(NULL, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL);
+		usbInited = true;
+
+		if (asyncTransfers)
+			_StartEventThread();
 	}
 
 	if (inPlace && inited)
@@ -169,115 +185,118 @@ int HeliosDac::_OpenUsbDevices(bool inPlace)
 		if ((devDesc.idProduct != HELIOS_PID) || (devDesc.idVendor != HELIOS_VID))
 			continue;
 
-		if (inPlace)
+		if (inPlace && _IsUsbDeviceOpen(devs[i]))
+			continue; // This Helios is already opened, no need to do anything
+
+		if (_AttachUsbDevice(devs[i], inPlace) > 0)
+			numDevices++;
+	}
+
+	libusb_free_device_list(devs, 1);
+
+	return numDevices;
+}
+
+// Internal function. Checks if a USB device is the same as an already opened device.
+bool HeliosDac::_IsUsbDeviceOpen(libusb_device* usbDevice)
+{
+	for (int j = 0; j < deviceList.size(); j++)
+	{
+		if (!deviceList[j]->GetIsUsb())
+			continue;
+		if (!deviceList[j]->GetIsClosed())
 		{
-			// Check if this is the same as an already opened device
-			bool found = false;
-			for (int j = 0; j < deviceList.size(); j++)
+			libusb_device_handle* handle = ((HeliosDacUsbDevice*)(deviceList[j].get()))->GetLibusbHandle();
+			if (handle == NULL)
+				continue;
+			uint8_t newPortNumbers[7], existingPortNumbers[7];
+			int existingPortNumberDepth = libusb_get_port_numbers(libusb_get_device(handle), existingPortNumbers, 16);
+			int newPortNumberDepth = libusb_get_port_numbers(usbDevice, newPortNumbers, 16);
+			if (existingPortNumberDepth < 0)
+				continue;
+			if (newPortNumberDepth < 0)
+				continue;
+			bool match = true;
+			if (existingPortNumberDepth == newPortNumberDepth)
 			{
-				if (!deviceList[j]->GetIsUsb())
-					continue;
-				if (!deviceList[j]->GetIsClosed())
+				for (int k = 0; k < existingPortNumberDepth; k++)
 				{
-					libusb_device_handle* handle = ((HeliosDacUsbDevice*)(deviceList[j].get()))->GetLibusbHandle();
-					if (handle == NULL)
-						continue;
-					uint8_t newPortNumbers[7], existingPortNumbers[7];
-					int existingPortNumberDepth = libusb_get_port_numbers(libusb_get_device(handle), existingPortNumbers, 16);
-					int newPortNumberDepth = libusb_get_port_numbers(devs[i], newPortNumbers, 16);
-					if (existingPortNumberDepth < 0)
-						continue;
-					if (newPortNumberDepth < 0)
-						continue;
-					bool match = true;
-					if (existingPortNumberDepth == newPortNumberDepth)
-					{
-						for (int k = 0; k < existingPortNumberDepth; k++)
-						{
-							if (newPortNumbers[k] != existingPortNumbers[k])
-							{
-								match = false;
-								break;
-							}
-						}
-					}
-					if (match)
+					if (newPortNumbers[k] != existingPortNumbers[k])
 					{
-						found = true;
+						match = false;
 						break;
 					}
 				}
-				if (found)
-					break;
 			}
-
-			if (found)
-				continue; // This Helios is already opened, no need to do anything
+			if (match)
+				return true;
 		}
+	}
 
-		libusb_device_handle* devHandle;
-		result = libusb_open(devs[i], &devHandle);
-		if (result < 0)
-			continue;
+	return false;
+}
 
-		result = libusb_claim_interface(devHandle, 0);
-		if (result < 0)
-			continue;
+// Internal function. Opens a USB device and adds it to the device list.
+// inPlace = Whether a previously closed device with the same name gets its old device number back.
+// Returns 1 if the device was appended to the list, 0 if it took the place of a closed device, or a negative error code.
+int HeliosDac::_AttachUsbDevice(libusb_device* usbDevice, bool inPlace)
+{
+	libusb_device_handle* devHandle;
+	int result = libusb_open(usbDevice, &devHandle);
+	if (result < 0)
+		return HELIOS_ERROR_LIBUSB_BASE + result;
 
+	result = libusb_claim_interface(devHandle, 0);
+	if (result >= 0)
 		result = libusb_set_interface_alt_setting(devHandle, 0, 1);
-		if (result < 0)
-			continue;
+	if (result < 0)
+	{
+		libusb_close(devHandle);
+		return HELIOS_ERROR_LIBUSB_BASE + result;
+	}
 
-		// Successfully opened, add to device list
+	// Successfully opened, add to device list
 
-		std::unique_ptr<HeliosDacDevice> device = std::make_unique<HeliosDacUsbDevice>(devHandle);
+	std::shared_ptr<HeliosDacDevice> device = std::make_shared<HeliosDacUsbDevice>(devHandle);
+	if (asyncTransfers)
+		device->SetAsyncTransfers(true);
 
-		if (inPlace)
+	if (inPlace)
+	{
+		// Check if this is an already known device that was previously closed, if so insert it back to its previous device number
+		for (int j = 0; j < deviceList.size(); j++)
 		{
-			// Check if this is an already known device that was previously closed, if so insert it back to its previous device number
-			bool found = false;
-			for (int j = 0; j < deviceList.size(); j++)
-			{
-				if (!deviceList[j]->GetIsUsb())
-					continue;
-				if (!deviceList[j]->GetIsClosed())
-					continue;
-				char newName[32] = { 0 }, existingName[32] = { 0 };
-				device->GetName(newName);
-				deviceList[j]->GetName(existingName);
-				if (strncmp(newName, existingName, 32) == 0)
-				{
-					logInfo("Found previous USB Helios DAC that was reconnected: %s\n", newName);
-
-					deviceList[j] = std::move(device);
-					found = true;
-					break;
-				}
-			}
-			if (!found)
+			if (!deviceList[j]->GetIsUsb())
+				continue;
+			if (!deviceList[j]->GetIsClosed())
+				continue;
+			char newName[32] = { 0 }, existingName[32] = { 0 };
+			device->GetName(newName);
+			deviceList[j]->GetName(existingName);
+			if (strncmp(newName, existingName, 32) == 0)
 			{
-				//char name[32] = { 0 };
-				//device->GetName(name);
-				logInfo("Found new USB Helios DAC during rescan\n");
+				logInfo("Found previous USB Helios DAC that was reconnected: %s\n", newName);
 
-				deviceList.push_back(std::move(device));
-				numDevices++;
+				std::unique_lock<std::shared_mutex> listGuard(deviceListLock);
+				deviceList[j] = std::move(device);
+				return 0;
 			}
 		}
-		else
-		{
-			//char name[32] = { 0 };
-			//device->GetName(name);
-			logInfo("Found new USB Helios DAC\n");
 
-			deviceList.push_back(std::move(device));
-			numDevices++;
-		}
+		//char name[32] = { 0 };
+		//device->GetName(name);
+		logInfo("Found new USB Helios DAC during rescan\n");
+	}
+	else
+	{
+		//char name[32] = { 0 };
+		//device->GetName(name);
+		logInfo("Found new USB Helios DAC\n");
 	}
 
-	libusb_free_device_list(devs, 1);
-
-	return numDevices;
+	std::unique_lock<std::shared_mutex> listGuard(deviceListLock);
+	deviceList.push_back(std::move(device));
+	return 1;
 }
 
 
@@ -298,16 +317,151 @@ void HeliosDac::_SortDeviceList()
 	}
 }
 
+int HeliosDac::EnableHotplug(std::function<void()> onChange)
+{
+	std::lock_guard<std::mutex> scanGuard(scanLock);
+
+	if (hotplugEnabled)
+		return HELIOS_SUCCESS;
+
+	if (!usbInited)
+		return HELIOS_ERROR_NOT_INITIALIZED;
+
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+		return HELIOS_ERROR_NOT_SUPPORTED;
+
+	onDeviceListChange = onChange;
+	hotplugRunning = true;
+	hotplugThread = std::thread(&HeliosDac::_HotplugLoop, this);
+
+	// Devices present at this point have already been opened by OpenDevices*(), so no enumeration
+	int result = libusb_hotplug_register_callback(NULL, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT, LIBUSB_HOTPLUG_NO_FLAGS,
+		HELIOS_VID, HELIOS_PID, LIBUSB_HOTPLUG_MATCH_ANY, _HotplugCallback, this, &hotplugHandle);
+	if (result != LIBUSB_SUCCESS)
+	{
+		_StopHotplug();
+		return HELIOS_ERROR_LIBUSB_BASE + result;
+	}
+
+	hotplugEnabled = true;
+	_StartEventThread(); // Hotplug callbacks are dispatched from the event handling
+
+	return HELIOS_SUCCESS;
+}
+
+// Internal function. Called from the libusb event thread, only queues the event.
+int LIBUSB_CALL HeliosDac::_HotplugCallback(libusb_context* ctx, libusb_device* usbDevice, libusb_hotplug_event event, void* userData)
+{
+	HeliosDac* dac = (HeliosDac*)userData;
+
+	std::lock_guard<std::mutex> lock(dac->hotplugLock);
+	dac->hotplugEvents.push_back(std::make_pair(libusb_ref_device(usbDevice), event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED));
+	dac->hotplugCond.notify_one();
+
+	return 0;
+}
+
+// Internal function. Opens attached and closes detached DACs, one event at a time.
+void HeliosDac::_HotplugLoop()
+{
+	std::unique_lock<std::mutex> lock(hotplugLock);
+	while (true)
+	{
+		hotplugCond.wait(lock, [this] { return !hotplugRunning || !hotplugEvents.empty(); });
+		if (!hotplugRunning)
+			break;
+
+		std::pair<libusb_device*, bool> event = hotplugEvents.front();
+		hotplugEvents.pop_front();
+		lock.unlock();
+
+		uint64_t eventTime = plt_getMonoTimeUS();
+		std::unique_lock<std::mutex> scanGuard(scanLock);
+		if (event.second)
+		{
+			if (!_IsUsbDeviceOpen(event.first) && _AttachUsbDevice(event.first, true) >= 0)
+			{
+				inited = true;
+				printf("Attached Helios DAC in %d ms\n", (int)((plt_getMonoTimeUS() - eventTime) / 1000));
+			}
+		}
+		else
+			_DetachUsbDevice(event.first);
+		scanGuard.unlock();
+
+		libusb_unref_device(event.first);
+
+		if (onDeviceListChange)
+			onDeviceListChange();
+
+		lock.lock();
+	}
+
+	// Drop events that have not been handled
+	for (auto& event : hotplugEvents)
+		libusb_unref_device(event.first);
+	hotplugEvents.clear();
+}
+
+void HeliosDac::_StopHotplug()
+{
+	if (hotplugEnabled)
+	{
+		libusb_hotplug_deregister_callback(NULL, hotplugHandle);
+		hotplugEnabled = false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(hotplugLock);
+		hotplugRunning = false;
+		hotplugCond.notify_one();
+	}
+	if (hotplugThread.joinable())
+		hotplugThread.join();
+}
+
+// Internal function. Marks the DAC belonging to a detached USB device as closed, its device number stays reserved for a reconnect.
+void HeliosDac::_DetachUsbDevice(libusb_device* usbDevice)
+{
+	for (int j = 0; j < deviceList.size(); j++)
+	{
+		if (!deviceList[j]->GetIsUsb() || deviceList[j]->GetIsClosed())
+			continue;
+
+		libusb_device_handle* handle = ((HeliosDacUsbDevice*)(deviceList[j].get()))->GetLibusbHandle();
+		if (handle != NULL && libusb_get_device(handle) == usbDevice)
+		{
+			printf("Detached Helios DAC %d\n", j);
+			deviceList[j]->Close();
+			return;
+		}
+	}
+}
+
+int HeliosDac::GetNumDevices()
+{
+	std::shared_lock<std::shared_mutex> lock(deviceListLock);
+	return (int)deviceList.size();
+}
+
 int HeliosDac::CloseDevices()
 {
 	if (!inited)
 		return HELIOS_ERROR_NOT_INITIALIZED;
 
-	std::lock_guard<std::mutex> lock(threadLock);
+	_StopHotplug(); // Before taking scanLock, the hotplug thread may be waiting for it
+	std::lock_guard<std::mutex> scanGuard(scanLock);
 	inited = false;
-	deviceList.clear(); // Various destructors will clean all devices
 
+	std::vector<std::shared_ptr<HeliosDacDevice>> closingDevices;
+	std::unique_lock<std::shared_mutex> listGuard(deviceListLock);
+	closingDevices.swap(deviceList);
+	listGuard.unlock();
+	closingDevices.clear(); // Various destructors will clean all devices, once no other thread is using them any more
+
+	_StopEventThread(); // After the devices, their destructors need it to complete cancelled transfers
 	libusb_exit(NULL);
+	usbInited = false;
 
 	printf("Freed USB Helios library\n");
 
@@ -322,11 +476,7 @@ int HeliosDac::WriteFrame(unsigned int devNum, unsigned int pps, std::uint8_t fl
 	if (points == NULL || numOfPoints == 0)
 		return HELIOS_ERROR_NULL_POINTS;
 
-	std::unique_lock<std::mutex> lock(threadLock);
-	HeliosDacDevice* dev = NULL;
-	if (devNum < deviceList.size())
-		dev = deviceList[devNum].get();
-	lock.unlock();
+	std::shared_ptr<HeliosDacDevice> dev = _GetDevice(devNum);
 
 	if (dev == NULL)
 		return HELIOS_ERROR_INVALID_DEVNUM;
@@ -342,11 +492,7 @@ int HeliosDac::WriteFrameHighResolution(unsigned int devNum, unsigned int pps, u
 	if (points == NULL || numOfPoints == 0)
 		return HELIOS_ERROR_NULL_POINTS;
 
-	std::unique_lock<std::mutex> lock(threadLock);
-	HeliosDacDevice* dev = NULL;
-	if (devNum < deviceList.size())
-		dev = deviceList[devNum].get();
-	lock.unlock();
+	std::shared_ptr<HeliosDacDevice> dev = _GetDevice(devNum);
 
 	if (dev == NULL)
 		return HELIOS_ERROR_INVALID_DEVNUM;
@@ -362,11 +508,7 @@ int HeliosDac::WriteFrameExtended(unsigned int devNum, unsigned int pps, unsigne
 	if (points == NULL || numOfPoints == 0)
 		return HELIOS_ERROR_NULL_POINTS;
 
-	std::unique_lock<std::mutex> lock(threadLock);
-	HeliosDacDevice* dev = NULL;
-	if (devNum < deviceList.size())
-		dev = deviceList[devNum].get();
-	lock.unlock();
+	std::shared_ptr<HeliosDacDevice> dev = _GetDevice(devNum);
 
 	if (dev == NULL)
 		return HELIOS_ERROR_INVALID_DEVNUM;
@@ -374,16 +516,28 @@ int HeliosDac::WriteFrameExtended(unsigned int devNum, unsigned int pps, unsigne
 	return dev->SendFrameExtended(pps, flags, points, numOfPoints);
 }
 
+int HeliosDac::WriteFramePacked(unsigned int devNum, unsigned int pps, std::uint8_t flags, const std::uint8_t* packedPoints, unsigned int numOfPoints)
+{
+	if (!inited)
+		return HELIOS_ERROR_NOT_INITIALIZED;
+
+	if (packedPoints == NULL || numOfPoints == 0)
+		return HELIOS_ERROR_NULL_POINTS;
+
+	std::shared_ptr<HeliosDacDevice> dev = _GetDevice(devNum);
+
+	if (dev == NULL)
+		return HELIOS_ERROR_INVALID_DEVNUM;
+
+	return dev->SendFramePacked(pps, flags, packedPoints, numOfPoints);
+}
+
 int HeliosDac::GetIsClosed(unsigned int devNum)
 {
 	if (!inited)
 		return HELIOS_ERROR_NOT_INITIALIZED;
 
-	std::unique_lock<std::mutex> lock(threadLock);
-	HeliosDacDevice* dev = NULL;
-	if (devNum < deviceList.size())
-		dev = deviceList[devNum].get();
-	lock.unlock();
+	std::shared_ptr<HeliosDacDevice> dev = _GetDevice(devNum);
 	if (dev == NULL)
 		return HELIOS_ERROR_INVALID_DEVNUM;
 
@@ -395,11 +549,7 @@ int HeliosDac::GetStatus(unsigned int devNum)
 	if (!inited)
 		return HELIOS_ERROR_NOT_INITIALIZED;
 
-	std::unique_lock<std::mutex> lock(threadLock);
-	HeliosDacDevice* dev = NULL;
-	if (devNum < deviceList.size())
-		dev = deviceList[devNum].get();
-	lock.unlock();
+	std::shared_ptr<HeliosDacDevice> dev = _GetDevice(devNum);
 	if (dev == NULL)
 		return HELIOS_ERROR_INVALID_DEVNUM;
 
@@ -411,11 +561,7 @@ int HeliosDac::GetFirmwareVersion(unsigned int devNum)
 	if (!inited)
 		return HELIOS_ERROR_NOT_INITIALIZED;
 
-	std::unique_lock<std::mutex> lock(threadLock);
-	HeliosDacDevice* dev = NULL;
-	if (devNum < deviceList.size())
-		dev = deviceList[devNum].get();
-	lock.unlock();
+	std::shared_ptr<HeliosDacDevice> dev = _GetDevice(devNum);
 	if (dev == NULL)
 		return HELIOS_ERROR_INVALID_DEVNUM;
 
@@ -427,11 +573,7 @@ int HeliosDac::GetName(unsigned int devNum, char* name)
 	if (!inited)
 		return HELIOS_ERROR_NOT_INITIALIZED;
 
-	std::unique_lock<std::mutex> lock(threadLock);
-	HeliosDacDevice* dev = NULL;
-	if (devNum < deviceList.size())
-		dev = deviceList[devNum].get();
-	lock.unlock();
+	std::shared_ptr<HeliosDacDevice> dev = _GetDevice(devNum);
 	if (dev == NULL)
 		return HELIOS_ERROR_INVALID_DEVNUM;
 
@@ -456,11 +598,7 @@ int HeliosDac::SetName(unsigned int devNum, char* name)
 	if (!inited)
 		return HELIOS_ERROR_NOT_INITIALIZED;
 
-	std::unique_lock<std::mutex> lock(threadLock);
-	HeliosDacDevice* dev = NULL;
-	if (devNum < deviceList.size())
-		dev = deviceList[devNum].get();
-	lock.unlock();
+	std::shared_ptr<HeliosDacDevice> dev = _GetDevice(devNum);
 	if (dev == NULL)
 		return HELIOS_ERROR_INVALID_DEVNUM;
 
@@ -472,11 +610,7 @@ int HeliosDac::Stop(unsigned int devNum)
 	if (!inited)
 		return HELIOS_ERROR_NOT_INITIALIZED;
 
-	std::unique_lock<std::mutex> lock(threadLock);
-	HeliosDacDevice* dev = NULL;
-	if (devNum < deviceList.size())
-		dev = deviceList[devNum].get();
-	lock.unlock();
+	std::shared_ptr<HeliosDacDevice> dev = _GetDevice(devNum);
 	if (dev == NULL)
 		return HELIOS_ERROR_INVALID_DEVNUM;
 
@@ -488,11 +622,7 @@ int HeliosDac::SetShutter(unsigned int devNum, bool level)
 	if (!inited)
 		return HELIOS_ERROR_NOT_INITIALIZED;
 
-	std::unique_lock<std::mutex> lock(threadLock);
-	HeliosDacDevice* dev = NULL;
-	if (devNum < deviceList.size())
-		dev = deviceList[devNum].get();
-	lock.unlock();
+	std::shared_ptr<HeliosDacDevice> dev = _GetDevice(devNum);
 	if (dev == NULL)
 		return HELIOS_ERROR_INVALID_DEVNUM;
 
@@ -504,11 +634,7 @@ int HeliosDac::GetSupportsHigherResolutions(unsigned int devNum)
 	if (!inited)
 		return HELIOS_ERROR_NOT_INITIALIZED;
 
-	std::unique_lock<std::mutex> lock(threadLock);
-	HeliosDacDevice* dev = NULL;
-	if (devNum < deviceList.size())
-		dev = deviceList[devNum].get();
-	lock.unlock();
+	std::shared_ptr<HeliosDacDevice> dev = _GetDevice(devNum);
 
 	if (dev == NULL)
 		return HELIOS_ERROR_INVALID_DEVNUM;
@@ -521,11 +647,7 @@ int HeliosDac::GetIsUsb(unsigned int devNum)
 	if (!inited)
 		return HELIOS_ERROR_NOT_INITIALIZED;
 
-	std::unique_lock<std::mutex> lock(threadLock);
-	HeliosDacDevice* dev = NULL;
-	if (devNum < deviceList.size())
-		dev = deviceList[devNum].get();
-	lock.unlock();
+	std::shared_ptr<HeliosDacDevice> dev = _GetDevice(devNum);
 
 	if (dev == NULL)
 		return HELIOS_ERROR_INVALID_DEVNUM;
@@ -543,16 +665,62 @@ int HeliosDac::SetLibusbDebugLogLevel(int logLevel)
 	return HELIOS_SUCCESS;
 }
 
+int HeliosDac::SetAsyncTransfers(bool enable)
+{
+	std::lock_guard<std::mutex> scanGuard(scanLock);
+	asyncTransfers = enable;
+
+	if (enable && usbInited)
+		_StartEventThread();
+
+	for (auto& dev : deviceList)
+	{
+		if (dev->GetIsUsb() && !dev->GetIsClosed())
+			dev->SetAsyncTransfers(enable);
+	}
+
+	return HELIOS_SUCCESS;
+}
+
+// Internal function. Looks up a device, the returned reference keeps it alive even if it is replaced by a concurrent rescan.
+std::shared_ptr<HeliosDac::HeliosDacDevice> HeliosDac::_GetDevice(unsigned int devNum)
+{
+	std::shared_lock<std::shared_mutex> lock(deviceListLock);
+	if (devNum < deviceList.size())
+		return deviceList[devNum];
+	return NULL;
+}
+
+// Internal function. Starts the thread completing asynchronous libusb transfers, if not already running.
+void HeliosDac::_StartEventThread()
+{
+	if (eventThreadRunning)
+		return;
+
+	eventThreadRunning = true;
+	eventThread = std::thread([this]()
+		{
+			while (eventThreadRunning)
+			{
+				struct timeval timeout = { 0, 10000 };
+				libusb_handle_events_timeout_completed(NULL, &timeout, NULL);
+			}
+		});
+}
+
+void HeliosDac::_StopEventThread()
+{
+	eventThreadRunning = false;
+	if (eventThread.joinable())
+		eventThread.join();
+}
+
 int HeliosDac::EraseFirmware(unsigned int devNum)
 {
 	if (!inited)
 		return HELIOS_ERROR_NOT_INITIALIZED;
 
-	std::unique_lock<std::mutex> lock(threadLock);
-	HeliosDacDevice* dev = NULL;
-	if (devNum < deviceList.size())
-		dev = deviceList[devNum].get();
-	lock.unlock();
+	std::shared_ptr<HeliosDacDevice> dev = _GetDevice(devNum);
 	if (dev == NULL)
 		return HELIOS_ERROR_INVALID_DEVNUM;
 
@@ -720,6 +888,104 @@ int HeliosDac::HeliosDacUsbDevice::SendFrame(unsigned int pps, std::uint8_t flag
 	if (!shutterIsOpen)
 		SetShutter(1);
 
+	if (asyncEnabled)
+		return SubmitFrame(ppsActual, numOfPointsActual);
+
+	if ((flags & HELIOS_FLAGS_DONT_BLOCK) != 0)
+	{
+		threadingHasBeenUsed = true;
+		frameReady = true;
+		return HELIOS_SUCCESS;
+	}
+	else
+	{
+		return DoFrame();
+	}
+}
+
+// Sends a raw frame buffer (implemented as bulk transfer) to a dac device, using points already in the wire format
+// Produces the same buffer as SendFrame() with the corresponding HeliosPoint array, without any intermediate point copies
+// Returns 1 if success
+int HeliosDac::HeliosDacUsbDevice::SendFramePacked(unsigned int pps, std::uint8_t flags, const std::uint8_t* packedPoints, unsigned int numOfPoints)
+{
+	if (GetIsClosed())
+		return HELIOS_ERROR_DEVICE_CLOSED;
+
+	if (frameReady)
+		return HELIOS_ERROR_DEVICE_FRAME_READY;
+
+	// If pps is too low, duplicate points to simulate a higher pps rather than failing
+	unsigned int duplicationFactor = 1;
+	if (pps < GetMinSampleRate())
+	{
+		if (pps == 0)
+			return HELIOS_ERROR_PPS_TOO_LOW;
+
+		duplicationFactor = GetMinSampleRate() / pps + 1;
+		if (numOfPoints * duplicationFactor > GetMaxFrameSize())
+			return HELIOS_ERROR_PPS_TOO_LOW;
+
+		numOfPoints = numOfPoints * duplicationFactor;
+		pps = pps * duplicationFactor;
+	}
+
+	// If pps is too high or frame size too high, subsample frames to simulate a lower pps/size rather than failing
+	unsigned int samplingFactor = 1;
+	if (pps > GetMaxSampleRate() || numOfPoints > GetMaxFrameSize())
+	{
+		samplingFactor = pps / GetMaxSampleRate() + 1;
+		if ((numOfPoints / GetMaxFrameSize() + 1) > samplingFactor)
+			samplingFactor = numOfPoints / GetMaxFrameSize() + 1;
+
+		pps = pps / samplingFactor;
+		numOfPoints = numOfPoints / samplingFactor;
+
+		if (pps < GetMinSampleRate())
+			return HELIOS_ERROR_TOO_MANY_POINTS;
+	}
+
+	// This is a bug workaround, the mcu won't correctly receive transfers with these sizes
+	unsigned int ppsActual = pps;
+	unsigned int numOfPointsActual = numOfPoints;
+	if ((((int)numOfPoints - 45) % 64) == 0)
+	{
+		numOfPointsActual--;
+		//adjust pps to keep the same frame duration even with one less point
+		ppsActual = (unsigned int)((pps * (double)numOfPointsActual / (double)numOfPoints) + 0.5);
+	}
+
+	unsigned int bufPos = 0;
+
+	// Prepare frame buffer, output point n is the (n * samplingFactor)th point of the duplicated sequence
+	if (samplingFactor == 1 && duplicationFactor == 1)
+	{
+		bufPos = numOfPointsActual * HELIOS_PACKED_POINT_SIZE;
+		memcpy(frameBuffer, packedPoints, bufPos);
+	}
+	else
+	{
+		for (unsigned int n = 0; n < numOfPointsActual; n++)
+		{
+			memcpy(&frameBuffer[bufPos], &packedPoints[((n * samplingFactor) / duplicationFactor) * HELIOS_PACKED_POINT_SIZE], HELIOS_PACKED_POINT_SIZE);
+			bufPos += HELIOS_PACKED_POINT_SIZE;
+		}
+	}
+	frameBuffer[bufPos++] = (ppsActual & 0xFF);
+	frameBuffer[bufPos++] = (ppsActual >> 8);
+	frameBuffer[bufPos++] = (numOfPointsActual & 0xFF);
+	frameBuffer[bufPos++] = (numOfPointsActual >> 8);
+	frameBuffer[bufPos++] = flags;
+
+	frameBufferSize = bufPos;
+
+	lastSendTime = plt_getMonoTimeUS();
+
+	if (!shutterIsOpen)
+		SetShutter(1);
+
+	if (asyncEnabled)
+		return SubmitFrame(ppsActual, numOfPointsActual);
+
 	if ((flags & HELIOS_FLAGS_DONT_BLOCK) != 0)
 	{
 		threadingHasBeenUsed = true;
@@ -832,6 +1098,9 @@ int HeliosDac::HeliosDacUsbDevice::SendFrameHighResolution(unsigned int pps, std
 	if (!shutterIsOpen)
 		SetShutter(1);
 
+	if (asyncEnabled)
+		return SubmitFrame(ppsActual, numOfPointsActual);
+
 	if ((flags & HELIOS_FLAGS_DONT_BLOCK) != 0)
 	{
 		threadingHasBeenUsed = true;
@@ -943,6 +1212,9 @@ int HeliosDac::HeliosDacUsbDevice::SendFrameExtended(unsigned int pps, std::uint
 	if (!shutterIsOpen)
 		SetShutter(1);
 
+	if (asyncEnabled)
+		return SubmitFrame(ppsActual, numOfPointsActual);
+
 	if ((flags & HELIOS_FLAGS_DONT_BLOCK) != 0)
 	{
 		threadingHasBeenUsed = true;
@@ -977,6 +1249,154 @@ int HeliosDac::HeliosDacUsbDevice::DoFrame()
 		return HELIOS_ERROR_LIBUSB_BASE + transferResult;
 }
 
+// Enables or disables the asynchronous transfer pipeline of this DAC
+int HeliosDac::HeliosDacUsbDevice::SetAsyncTransfers(bool enable)
+{
+	std::unique_lock<std::mutex> lock(asyncLock);
+
+	// Let a transfer in flight finish before changing modes
+	asyncCond.wait_for(lock, std::chrono::milliseconds(HELIOS_ASYNC_TIMEOUT_MS), [this] { return !asyncInFlight; });
+	if (asyncInFlight)
+		return HELIOS_ERROR_LIBUSB_BASE + LIBUSB_ERROR_BUSY;
+
+	if (enable && asyncTransfer == NULL)
+	{
+		asyncTransfer = libusb_alloc_transfer(0);
+		if (asyncTransfer == NULL)
+			return HELIOS_ERROR_LIBUSB_BASE + LIBUSB_ERROR_NO_MEM;
+		asyncBuffer = new std::uint8_t[HELIOS_MAX_POINTS * 7 + 5];
+	}
+
+	asyncEnabled = enable;
+	predictionValid = false;
+	lastFrameDurationUs = 0;
+	asyncResult = HELIOS_SUCCESS;
+
+	return HELIOS_SUCCESS;
+}
+
+// Submits the packed frame buffer as an asynchronous bulk transfer.
+// Waits for the previous transfer to complete and for the DAC to be predicted ready, the frame buffers are then swapped
+// so the next frame can be packed while this one is in flight.
+// Returns the result of the previous transfer, since the result of this one is not known yet.
+int HeliosDac::HeliosDacUsbDevice::SubmitFrame(unsigned int pps, unsigned int numOfPoints)
+{
+	std::unique_lock<std::mutex> lock(asyncLock);
+
+	if (!asyncCond.wait_for(lock, std::chrono::milliseconds(HELIOS_ASYNC_TIMEOUT_MS), [this] { return !asyncInFlight; }))
+		return HELIOS_ERROR_LIBUSB_BASE + LIBUSB_ERROR_TIMEOUT;
+
+	int result = asyncResult;
+	asyncResult = HELIOS_SUCCESS;
+
+	// The periodic verification also waits for the predicted readiness first, so that its status request only
+	// finds the DAC busy if the prediction was really early
+	if (predictionValid)
+	{
+		uint64_t readyTime = predictedReady + HELIOS_ASYNC_READY_MARGIN_US;
+		uint64_t now = plt_getMonoTimeUS();
+		if (now < readyTime)
+		{
+			lock.unlock();
+			std::this_thread::sleep_for(std::chrono::microseconds(readyTime - now));
+			lock.lock();
+		}
+	}
+
+	if (!predictionValid || framesSinceStatusCheck >= HELIOS_ASYNC_STATUS_INTERVAL)
+	{
+		lock.unlock();
+		int statusResult = SyncReadyPrediction();
+		lock.lock();
+		if (statusResult < 0)
+			return statusResult;
+	}
+
+	std::swap(frameBuffer, asyncBuffer);
+	inFlightDurationUs = (uint64_t)(numOfPoints * 1000000.0 / pps);
+	framesSinceStatusCheck++;
+
+	libusb_fill_bulk_transfer(asyncTransfer, usbHandle, EP_BULK_OUT, asyncBuffer, frameBufferSize, AsyncTransferCallback, this, 8 + (frameBufferSize >> 5));
+	int transferResult = libusb_submit_transfer(asyncTransfer);
+	if (transferResult != LIBUSB_SUCCESS)
+	{
+		predictionValid = false;
+		return HELIOS_ERROR_LIBUSB_BASE + transferResult;
+	}
+	asyncInFlight = true;
+
+	return result;
+}
+
+// Polls the real DAC status until it is ready and resynchronizes the readiness prediction.
+// If the DAC was seen becoming ready, the last received frame has just started playing.
+int HeliosDac::HeliosDacUsbDevice::SyncReadyPrediction()
+{
+	bool sawBusy = false;
+	int status;
+	while ((status = GetStatus()) == 0)
+		sawBusy = true;
+
+	if (status < 0)
+		return status;
+
+	std::lock_guard<std::mutex> lock(asyncLock);
+	uint64_t now = plt_getMonoTimeUS();
+
+	if (sawBusy)
+	{
+		if (predictionValid)
+		{
+			asyncMispredictions++;
+			logInfo("Helios ready prediction was early, %d mispredictions\n", asyncMispredictions);
+		}
+		predictedPlayEnd = now + lastFrameDurationUs;
+	}
+	else if (now >= predictedPlayEnd)
+		predictedPlayEnd = now;
+
+	predictedReady = now;
+
+	// Without a previous prediction the DAC may be playing a frame of unknown length, e.g. one written synchronously,
+	// so the next frame is verified as well. It then either finds the DAC busy with the frame sent now, whose length
+	// is known, or confirms that the DAC was idle.
+	bool playEndKnown = predictionValid || (sawBusy && lastFrameDurationUs > 0);
+	framesSinceStatusCheck = playEndKnown ? 0 : HELIOS_ASYNC_STATUS_INTERVAL;
+	predictionValid = true;
+
+	return HELIOS_SUCCESS;
+}
+
+// Called from the libusb event thread when an asynchronous frame transfer has completed
+void LIBUSB_CALL HeliosDac::HeliosDacUsbDevice::AsyncTransferCallback(struct libusb_transfer* transfer)
+{
+	HeliosDacUsbDevice* device = (HeliosDacUsbDevice*)transfer->user_data;
+
+	std::lock_guard<std::mutex> lock(device->asyncLock);
+
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED)
+	{
+		// The DAC starts playing the frame when the previous one has ended, and can receive the next frame from then on
+		uint64_t start = std::max(plt_getMonoTimeUS(), device->predictedPlayEnd);
+		device->predictedReady = start;
+		device->predictedPlayEnd = start + device->inFlightDurationUs;
+		device->lastFrameDurationUs = device->inFlightDurationUs;
+	}
+	else
+	{
+		if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT)
+			device->asyncResult = HELIOS_ERROR_LIBUSB_BASE + LIBUSB_ERROR_TIMEOUT;
+		else if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE)
+			device->asyncResult = HELIOS_ERROR_LIBUSB_BASE + LIBUSB_ERROR_NO_DEVICE;
+		else
+			device->asyncResult = HELIOS_ERROR_LIBUSB_BASE + LIBUSB_ERROR_IO;
+		device->predictionValid = false;
+	}
+
+	device->asyncInFlight = false;
+	device->asyncCond.notify_all();
+}
+
 //Gets firmware version of DAC
 int HeliosDac::HeliosDacUsbDevice::GetFirmwareVersion()
 {
@@ -1223,7 +1643,22 @@ HeliosDac::HeliosDacUsbDevice::~HeliosDacUsbDevice()
 	closed = true;
 	std::lock_guard<std::mutex>lock(frameLock); //wait until all threads have closed
 
+	if (asyncTransfer != NULL)
+	{
+		std::unique_lock<std::mutex> asyncGuard(asyncLock);
+		if (asyncInFlight)
+		{
+			libusb_cancel_transfer(asyncTransfer);
+			asyncCond.wait_for(asyncGuard, std::chrono::milliseconds(HELIOS_ASYNC_TIMEOUT_MS), [this] { return !asyncInFlight; });
+		}
+		if (!asyncInFlight) // Otherwise the transfer is still owned by libusb and has to be leaked
+		{
+			libusb_free_transfer(asyncTransfer);
+			delete[] asyncBuffer;
+		}
+	}
+
 	libusb_close(usbHandle);
-	delete frameBuffer;
+	delete[] frameBuffer;
 }
 
@@ -7,7 +7,7 @@ MIT License
 Dependencies:
 Libusb 1.0 (GNU Lesser General Public License, see libusb.h)
 
-Standard: C++14
+Standard: C++17
 git repo: https://github.com/Grix/helios_dac.git
 
 BASIC USAGE:
@@ -31,11 +31,16 @@ Unless otherwise specified, functions return a negative error code on failure.
 #include <cstdint>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
 #include <vector>
 #include <memory>
 #include <chrono>
 #include <algorithm>
 #include <queue>
+#include <deque>
+#include <functional>
 #include <cstdarg>
 #ifdef WIN32
 #pragma comment(lib, "winmm.lib")
@@ -46,6 +51,8 @@ Unless otherwise specified, functions return a negative error code on failure.
 // Frame limits
 // For original USB model
 #define HELIOS_MAX_POINTS	0xFFF
+// Size of one point in the USB wire format of the original model, see PackPoint()
+#define HELIOS_PACKED_POINT_SIZE	7
 #define HELIOS_MAX_PPS		0xFFFF
 #define HELIOS_MIN_PPS		7
 // For IDN, max points depend on the complexity of those points
@@ -141,6 +148,14 @@ Unless otherwise specified, functions return a negative error code on failure.
 
 #define MANAGEMENT_PORT 7355
 
+// Asynchronous transfer pipeline (see SetAsyncTransfers())
+// Number of frames after which a predicted device readiness is verified with a real status request
+#define HELIOS_ASYNC_STATUS_INTERVAL	64
+// Safety margin added to the predicted time at which the DAC can receive the next frame
+#define HELIOS_ASYNC_READY_MARGIN_US	250
+// Upper limit for waiting on a transfer in flight
+#define HELIOS_ASYNC_TIMEOUT_MS			500
+
 #ifdef _DEBUG
 #define LIBUSB_LOG_LEVEL LIBUSB_LOG_LEVEL_WARNING
 #else
@@ -209,6 +224,16 @@ public:
 	int ReScanDevices();
 	int ReScanDevicesOnlyUsb();
 
+	// Enables event driven hot-plugging of USB DACs, instead of periodically calling ReScanDevices*().
+	// Attached DACs are opened in a background thread and added to the device list, a reconnected DAC gets its previous device number back.
+	// Detached DACs are marked as closed. Output to the other DACs is not disturbed by either.
+	// onChange is called from the background thread after every change of the device list, it may be empty.
+	// Returns HELIOS_ERROR_NOT_SUPPORTED if libusb doesn't support hotplug on this platform.
+	int EnableHotplug(std::function<void()> onChange);
+
+	// Returns the size of the device list, including devices that have been closed.
+	int GetNumDevices();
+
 	// Closes and frees all devices.
 	int CloseDevices();
 
@@ -237,6 +262,26 @@ public:
 	int WriteFrameHighResolution(unsigned int devNum, unsigned int pps, unsigned int flags, HeliosPointHighRes* points, unsigned int numOfPoints);
 	int WriteFrameExtended(unsigned int devNum, unsigned int pps, unsigned int flags, HeliosPointExt* points, unsigned int numOfPoints);
 
+	// Writes a frame of points that are already in the USB wire format (see PackPoint()), skipping all intermediate point structures.
+	// The points are copied into the transfer buffer in a single pass, which also applies the point rate adjustments of WriteFrame().
+	// Only supported by USB DACs.
+	// packedPoints: numOfPoints * HELIOS_PACKED_POINT_SIZE bytes.
+	int WriteFramePacked(unsigned int devNum, unsigned int pps, std::uint8_t flags, const std::uint8_t* packedPoints, unsigned int numOfPoints);
+
+	// Packs a point with 16 bit position and color values into the USB wire format, reducing it to 12 bit position and 8 bit color.
+	static inline void PackPoint(std::uint8_t* dst, std::uint16_t x, std::uint16_t y, std::uint16_t r, std::uint16_t g, std::uint16_t b, std::uint16_t i)
+	{
+		x >>= 4;
+		y >>= 4;
+		dst[0] = (std::uint8_t)(x >> 4);
+		dst[1] = (std::uint8_t)(((x & 0x0F) << 4) | (y >> 8));
+		dst[2] = (std::uint8_t)(y & 0xFF);
+		dst[3] = (std::uint8_t)(r >> 8);
+		dst[4] = (std::uint8_t)(g >> 8);
+		dst[5] = (std::uint8_t)(b >> 8);
+		dst[6] = (std::uint8_t)(i >> 8);
+	}
+
 	// Gets whether the DAC is still connected (0) or not (1). If not, all function calls will fail. 
 	// You can call ReScanDevices*() to attempt to re-establish connection if the DAC has since been reconnected.
 	int GetIsClosed(unsigned int devNum);
@@ -278,6 +323,14 @@ public:
 	// Sets debug log level in libusb.
 	int SetLibusbDebugLogLevel(int logLevel);
 
+	// Enables or disables asynchronous, pipelined frame transfers for all current and future USB DACs.
+	// When enabled, WriteFrame*() packs the next frame while the previous one is still being transferred, submits it
+	// without blocking on the transfer, and waits until the DAC is predicted to be ready based on the durations of the
+	// frames sent so far. GetStatus() does not have to be polled before writing in this mode, the readiness prediction
+	// is verified with a real status request on startup, after errors and every HELIOS_ASYNC_STATUS_INTERVAL frames.
+	// Transfers are completed by a libusb event thread owned by this class.
+	int SetAsyncTransfers(bool enable);
+
 	// Erase the firmware of the DAC, allowing it to be updated by accessing the SAM-BA bootloader. 
 	// NB: For advanced use only, most software should never call this. 
 	int EraseFirmware(unsigned int devNum);
@@ -295,6 +348,7 @@ private:
 		virtual int SendFrame(unsigned int pps, std::uint8_t flags, HeliosPoint* points, unsigned int numOfPoints) = 0;
 		virtual int SendFrameHighResolution(unsigned int pps, std::uint8_t flags, HeliosPointHighRes* points, unsigned int numOfPoints) = 0;
 		virtual int SendFrameExtended(unsigned int pps, std::uint8_t flags, HeliosPointExt* points, unsigned int numOfPoints) = 0;
+		virtual int SendFramePacked(unsigned int pps, std::uint8_t flags, const std::uint8_t* packedPoints, unsigned int numOfPoints) { return HELIOS_ERROR_NOT_SUPPORTED; }
 		virtual int GetStatus() = 0;
 		virtual int GetFirmwareVersion() = 0;
 		virtual int GetName(char* name) = 0;
@@ -306,6 +360,7 @@ private:
 		virtual int Close() = 0;
 		virtual int EraseFirmware() = 0;
 		virtual bool GetDidSendFrameRecently() = 0;
+		virtual int SetAsyncTransfers(bool enable) { return HELIOS_ERROR_NOT_SUPPORTED; }
 		bool GetIsClosed() { return closed; }
 
 	protected:
@@ -324,6 +379,7 @@ private:
 		int SendFrame(unsigned int pps, std::uint8_t flags, HeliosPoint* points, unsigned int numOfPoints);
 		int SendFrameHighResolution(unsigned int pps, std::uint8_t flags, HeliosPointHighRes* points, unsigned int numOfPoints);
 		int SendFrameExtended(unsigned int pps, std::uint8_t flags, HeliosPointExt* points, unsigned int numOfPoints);
+		int SendFramePacked(unsigned int pps, std::uint8_t flags, const std::uint8_t* packedPoints, unsigned int numOfPoints);
 		int GetStatus();
 		int GetSupportsHigherResolutions() { return 0; } // TODO read capabilities from DAC
 		int GetIsUsb() { return 1; }
@@ -335,6 +391,7 @@ private:
 		int Close();
 		int EraseFirmware();
 		bool GetDidSendFrameRecently();
+		int SetAsyncTransfers(bool enable);
 
 		libusb_device_handle* GetLibusbHandle();
 
@@ -342,6 +399,9 @@ private:
 	private:
 
 		int DoFrame();
+		int SubmitFrame(unsigned int pps, unsigned int numOfPoints);
+		int SyncReadyPrediction();
+		static void LIBUSB_CALL AsyncTransferCallback(struct libusb_transfer* transfer);
 		int SendControl(std::uint8_t* buffer, unsigned int bufferSize);
 
 		unsigned int GetMaxSampleRate() { return HELIOS_MAX_PPS; } // TODO read exact capabilities from DAC
@@ -364,13 +424,57 @@ private:
 		int errorLimitCountdown = errorLimitResetValue;
 		bool threadingHasBeenUsed = false;
 		uint64_t lastSendTime = 0;
+
+		// Asynchronous transfer pipeline: frameBuffer is packed while asyncBuffer is in flight, then the two are swapped
+		bool asyncEnabled = false;
+		struct libusb_transfer* asyncTransfer = NULL;
+		std::uint8_t* asyncBuffer = NULL;
+		std::mutex asyncLock;
+		std::condition_variable asyncCond;
+		bool asyncInFlight = false;
+		int asyncResult = HELIOS_SUCCESS;
+		uint64_t inFlightDurationUs = 0;
+		uint64_t lastFrameDurationUs = 0;
+		// Predicted time at which the DAC has finished playing all received frames
+		uint64_t predictedPlayEnd = 0;
+		// Predicted time at which the DAC can receive the next frame
+		uint64_t predictedReady = 0;
+		bool predictionValid = false;
+		unsigned int framesSinceStatusCheck = 0;
+		unsigned int asyncMispredictions = 0;
 	};
 
 	int _OpenUsbDevices(bool inPlace);
+	bool _IsUsbDeviceOpen(libusb_device* usbDevice);
+	int _AttachUsbDevice(libusb_device* usbDevice, bool inPlace);
+	void _DetachUsbDevice(libusb_device* usbDevice);
 	void _SortDeviceList();
-
-	std::vector<std::unique_ptr<HeliosDacDevice>> deviceList;
-	std::mutex threadLock;
+	static int LIBUSB_CALL _HotplugCallback(libusb_context* ctx, libusb_device* usbDevice, libusb_hotplug_event event, void* userData);
+	void _HotplugLoop();
+	void _StopHotplug();
+	void _StartEventThread();
+	void _StopEventThread();
+	std::shared_ptr<HeliosDacDevice> _GetDevice(unsigned int devNum);
+
+	// Device list, read-mostly: every call looks up its device under a shared lock and then only uses the device's own locks,
+	// so output to one DAC never waits for USB transactions of another. Modified only by scans, which are serialized by scanLock.
+	std::vector<std::shared_ptr<HeliosDacDevice>> deviceList;
+	std::shared_mutex deviceListLock;
+	std::mutex scanLock;
 	bool inited = false;
 	bool idnInited = false;
+	bool usbInited = false;
+	bool asyncTransfers = false;
+	std::thread eventThread;
+	std::atomic<bool> eventThreadRunning{ false };
+
+	// Hotplug events are queued by the libusb callback and handled by hotplugThread, since opening a DAC needs synchronous transfers
+	bool hotplugEnabled = false;
+	libusb_hotplug_callback_handle hotplugHandle;
+	std::thread hotplugThread;
+	std::mutex hotplugLock;
+	std::condition_variable hotplugCond;
+	std::deque<std::pair<libusb_device*, bool>> hotplugEvents;
+	bool hotplugRunning = false;
+	std::function<void()> onDeviceListChange;
 };
\ No newline at end of file
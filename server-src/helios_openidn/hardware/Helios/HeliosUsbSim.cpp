@@ -0,0 +1,894 @@
+/*
+Simulated Helios USB DACs behind the subset of the libusb API used by HeliosDac.cpp
+
+Compiled in place of the real libusb when building with HELIOS_SIMULATED_USB (make HELIOS_SIM=1),
+so that the complete Helios output path of the server (HeliosAdapter, HeliosDac, sync and async
+transfers, hotplug) can be run and timed on any machine without a DAC attached.
+
+Device model, following the original USB Helios:
+- Control commands on the interrupt endpoints (status, firmware version, name, shutter, stop)
+- Bulk frames in the 7 bytes per point wire format with the 5 byte pps/points/flags trailer
+- One frame playing and one frame buffered. Frames without HELIOS_FLAGS_SINGLE_MODE loop until
+  the next frame arrives, START_IMMEDIATELY replaces the playing frame, and the status reports
+  ready as long as no frame is buffered.
+- Transfer durations of a full speed bulk link and the 1 ms interrupt polling interval
+
+Configuration through environment variables, read at the first libusb_init():
+	HELIOS_SIM_DEVICES		number of simulated DACs (default 1)
+	HELIOS_SIM_ERROR_RATE	probability of a transfer failing with a timeout, 0 to 1 (default 0)
+	HELIOS_SIM_UNPLUG_MS	time after start at which the last DAC gets unplugged, 0 for never (default 0)
+	HELIOS_SIM_REPLUG_MS	time after the unplug at which it gets plugged back in, 0 for never (default 0)
+	HELIOS_SIM_STATS_S		interval of the statistics printout in seconds, 0 to print only at exit (default 5)
+
+The statistics count received frames and points, status requests, frames overwritten in the buffer before they
+were played (sent without waiting for the status), output gaps between consecutive frames
+(underruns) and failed transfers. Tests and benchmarks read them, capture the received transfers and
+unplug devices through the functions in HeliosUsbSim.hpp.
+*/
+
+#ifdef HELIOS_SIMULATED_USB
+
+#include "HeliosDac.hpp"
+#include "HeliosUsbSim.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// Timing model of the USB link
+#define SIM_BULK_BYTES_PER_US	1.0		// effective full speed bulk throughput, about 1 MB/s
+#define SIM_BULK_OVERHEAD_US	150		// per bulk transfer
+#define SIM_INTERRUPT_US		500		// interrupt endpoints are polled every 1 ms, half of that on average
+
+// Gaps between frames longer than this are treated as pauses of the output, not as underruns
+#define SIM_MAX_UNDERRUN_US		500000
+
+#define SIM_FIRMWARE_VERSION	6
+
+
+struct SimFrame
+{
+	unsigned int pps = 0;
+	unsigned int numOfPoints = 0;
+	std::uint8_t flags = 0;
+	double durationUs = 0;
+	double startUs = 0;
+};
+
+struct libusb_context
+{
+};
+
+struct libusb_device
+{
+	int index = 0;
+	bool present = true;
+	char name[32] = { 0 };
+
+	std::mutex lock;
+
+	// Frame double buffer of the DAC
+	bool playing = false;
+	bool queued = false;
+	SimFrame playingFrame;
+	SimFrame queuedFrame;
+	double lastPlayEndUs = -1;
+	bool shutterOpen = false;
+
+	// Pending responses on the interrupt IN endpoint
+	std::deque<std::vector<std::uint8_t>> responses;
+
+	// End of the bulk transfer currently on the wire, for queued asynchronous transfers
+	double bulkBusyUntilUs = 0;
+
+	// Statistics, the "last" values are the state at the previous printout
+	unsigned int framesReceived = 0;
+	unsigned long long pointsReceived = 0;
+	unsigned int statusRequests = 0;
+	unsigned int framesDropped = 0;
+	unsigned int underruns = 0;
+	unsigned int transferErrors = 0;
+	double idleUs = 0;
+	double maxIdleUs = 0;
+	unsigned long long lastPointsReceived = 0;
+
+	// Received bulk transfers, while capturing is enabled
+	std::vector<std::vector<std::uint8_t>> captured;
+};
+
+struct libusb_device_handle
+{
+	libusb_device* device;
+};
+
+struct SimHotplugCallback
+{
+	libusb_hotplug_callback_handle handle;
+	int events;
+	libusb_hotplug_callback_fn function;
+	void* userData;
+};
+
+struct SimHotplugEvent
+{
+	libusb_device* device;
+	libusb_hotplug_event event;
+};
+
+struct SimPendingTransfer
+{
+	libusb_transfer* transfer;
+	double doneUs;
+	bool cancelled;
+};
+
+
+// Device list, hotplug state and the asynchronous transfer queue
+static std::mutex simLock;
+static std::condition_variable simCond;
+static int simInitCount = 0;
+static std::chrono::steady_clock::time_point simStart;
+static libusb_context simContext;
+static std::vector<libusb_device*> simDevices;
+
+static double simErrorRate = 0;
+static double simUnplugAtUs = 0;
+static double simReplugAfterUs = 0;
+static bool simUnplugged = false;
+static bool simReplugged = false;
+static double simStatsIntervalUs = 5000000;
+static double simNextStatsUs = 0;
+static double simLastStatsUs = 0;
+static std::atomic<bool> simCapture{ false };
+
+static std::vector<SimHotplugCallback> simHotplugCallbacks;
+static std::deque<SimHotplugEvent> simHotplugEvents;
+static libusb_hotplug_callback_handle simNextHotplugHandle = 1;
+
+static std::vector<SimPendingTransfer> simPending;
+
+
+static double simNowUs()
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - simStart).count();
+}
+
+static void simSleepUs(double us)
+{
+	if (us > 0)
+		std::this_thread::sleep_for(std::chrono::microseconds((long long)us));
+}
+
+static double simEnv(const char* name, double defaultValue)
+{
+	const char* value = getenv(name);
+	if (value == NULL || *value == '\0')
+		return defaultValue;
+	return atof(value);
+}
+
+static bool simShouldFail()
+{
+	if (simErrorRate <= 0)
+		return false;
+
+	static thread_local std::mt19937 random(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	return std::uniform_real_distribution<double>(0.0, 1.0)(random) < simErrorRate;
+}
+
+// Plays the buffered frames of a device up to the given time. Caller holds device->lock.
+static void simAdvance(libusb_device* device, double nowUs)
+{
+	while (device->playing)
+	{
+		SimFrame& frame = device->playingFrame;
+		double endUs = frame.startUs + frame.durationUs;
+
+		if (((frame.flags & HELIOS_FLAGS_SINGLE_MODE) == 0) && !device->queued)
+		{
+			// Looping frame: keep startUs at the beginning of the current repetition
+			if (nowUs >= endUs)
+				frame.startUs += std::floor((nowUs - frame.startUs) / frame.durationUs) * frame.durationUs;
+			return;
+		}
+
+		if (nowUs < endUs)
+			return;
+
+		device->lastPlayEndUs = endUs;
+		if (device->queued)
+		{
+			device->playingFrame = device->queuedFrame;
+			device->playingFrame.startUs = endUs;
+			device->queued = false;
+		}
+		else
+			device->playing = false;
+	}
+}
+
+// Takes a complete bulk frame into the buffer of a device
+static void simReceiveFrame(libusb_device* device, const std::uint8_t* data, int length, double nowUs)
+{
+	std::lock_guard<std::mutex> lock(device->lock);
+
+	if (simCapture)
+		device->captured.emplace_back(data, data + length);
+
+	simAdvance(device, nowUs);
+
+	if (length < 5)
+	{
+		device->transferErrors++;
+		return;
+	}
+
+	SimFrame frame;
+	frame.pps = data[length - 5] | (data[length - 4] << 8);
+	frame.numOfPoints = data[length - 3] | (data[length - 2] << 8);
+	frame.flags = data[length - 1];
+
+	if ((frame.numOfPoints == 0) || (frame.pps == 0) || ((unsigned int)length != frame.numOfPoints * HELIOS_PACKED_POINT_SIZE + 5))
+	{
+		device->transferErrors++;
+		return;
+	}
+
+	frame.durationUs = frame.numOfPoints * 1000000.0 / frame.pps;
+	frame.startUs = nowUs;
+
+	device->framesReceived++;
+	device->pointsReceived += frame.numOfPoints;
+
+	if (!device->playing || (frame.flags & HELIOS_FLAGS_START_IMMEDIATELY))
+	{
+		if (!device->playing && (device->lastPlayEndUs >= 0))
+		{
+			double idleUs = nowUs - device->lastPlayEndUs;
+			if ((idleUs > 0) && (idleUs < SIM_MAX_UNDERRUN_US))
+			{
+				device->underruns++;
+				device->idleUs += idleUs;
+				if (idleUs > device->maxIdleUs)
+					device->maxIdleUs = idleUs;
+			}
+		}
+
+		device->playing = true;
+		device->playingFrame = frame;
+		device->queued = false;
+	}
+	else
+	{
+		if (device->queued)
+			device->framesDropped++;
+
+		device->queued = true;
+		device->queuedFrame = frame;
+	}
+}
+
+// Executes a control command received on the interrupt OUT endpoint
+static void simControl(libusb_device* device, const std::uint8_t* data, int length, double nowUs)
+{
+	std::lock_guard<std::mutex> lock(device->lock);
+
+	if (length < 1)
+		return;
+
+	switch (data[0])
+	{
+	case 0x01: // stop
+		device->playing = false;
+		device->queued = false;
+		device->lastPlayEndUs = -1;
+		break;
+	case 0x02: // shutter
+		device->shutterOpen = (length > 1) && (data[1] != 0);
+		break;
+	case 0x03: // status
+		device->statusRequests++;
+		simAdvance(device, nowUs);
+		device->responses.push_back({ 0x83, (std::uint8_t)(device->queued ? 0 : 1) });
+		break;
+	case 0x04: // firmware version
+		device->responses.push_back({ 0x84, SIM_FIRMWARE_VERSION, 0, 0, 0 });
+		break;
+	case 0x05: // name
+	{
+		std::vector<std::uint8_t> response(32, 0);
+		response[0] = 0x85;
+		memcpy(&response[1], device->name, 30);
+		device->responses.push_back(response);
+		break;
+	}
+	case 0x06: // set name
+		memset(device->name, 0, sizeof(device->name));
+		if (length > 1)
+			memcpy(device->name, &data[1], std::min(length - 1, 30));
+		break;
+	default: // SDK version, firmware erase
+		break;
+	}
+}
+
+static void simPrintStats(double nowUs)
+{
+	double intervalS = (nowUs - simLastStatsUs) / 1000000.0;
+	simLastStatsUs = nowUs;
+
+	for (libusb_device* device : simDevices)
+	{
+		std::lock_guard<std::mutex> lock(device->lock);
+
+		double kpps = (intervalS > 0) ? (device->pointsReceived - device->lastPointsReceived) / intervalS / 1000.0 : 0;
+		device->lastPointsReceived = device->pointsReceived;
+
+		printf("[Helios Sim %d] %u frames, %.1f kpps, %u underruns (%.2f ms idle, %.2f ms max), %u dropped, %u errors\n",
+			device->index, device->framesReceived, kpps, device->underruns, device->idleUs / 1000.0, device->maxIdleUs / 1000.0,
+			device->framesDropped, device->transferErrors);
+	}
+}
+
+// Caller holds simLock
+static void simUnplug(libusb_device* device)
+{
+	{
+		std::lock_guard<std::mutex> lock(device->lock);
+		if (!device->present)
+			return;
+		device->present = false;
+		device->playing = false;
+		device->queued = false;
+		device->lastPlayEndUs = -1;
+		device->responses.clear();
+	}
+	printf("[Helios Sim %d] Unplugged\n", device->index);
+	simHotplugEvents.push_back({ device, LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT });
+	simCond.notify_all();
+}
+
+// Caller holds simLock
+static void simReplug(libusb_device* device)
+{
+	{
+		std::lock_guard<std::mutex> lock(device->lock);
+		if (device->present)
+			return;
+		device->present = true;
+		device->bulkBusyUntilUs = 0;
+	}
+	printf("[Helios Sim %d] Plugged in\n", device->index);
+	simHotplugEvents.push_back({ device, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED });
+	simCond.notify_all();
+}
+
+// Scheduled unplug/replug and periodic statistics. Caller holds simLock.
+static void simUpdate(double nowUs)
+{
+	if (!simDevices.empty())
+	{
+		libusb_device* device = simDevices.back();
+
+		if (!simUnplugged && (simUnplugAtUs > 0) && (nowUs >= simUnplugAtUs))
+		{
+			simUnplugged = true;
+			simUnplug(device);
+		}
+		else if (simUnplugged && !simReplugged && (simReplugAfterUs > 0) && (nowUs >= simUnplugAtUs + simReplugAfterUs))
+		{
+			simReplugged = true;
+			simReplug(device);
+		}
+	}
+
+	if ((simStatsIntervalUs > 0) && (nowUs >= simNextStatsUs))
+	{
+		simNextStatsUs = nowUs + simStatsIntervalUs;
+		simPrintStats(nowUs);
+	}
+}
+
+static void simUpdate()
+{
+	std::lock_guard<std::mutex> lock(simLock);
+	simUpdate(simNowUs());
+}
+
+
+// -- libusb API ----------------
+
+int LIBUSB_CALL libusb_init(libusb_context** ctx)
+{
+	std::lock_guard<std::mutex> lock(simLock);
+
+	if (simInitCount++ == 0 && simDevices.empty())
+	{
+		simStart = std::chrono::steady_clock::now();
+
+		int numDevices = (int)simEnv("HELIOS_SIM_DEVICES", 1);
+		simErrorRate = simEnv("HELIOS_SIM_ERROR_RATE", 0);
+		simUnplugAtUs = simEnv("HELIOS_SIM_UNPLUG_MS", 0) * 1000.0;
+		simReplugAfterUs = simEnv("HELIOS_SIM_REPLUG_MS", 0) * 1000.0;
+		simStatsIntervalUs = simEnv("HELIOS_SIM_STATS_S", 5) * 1000000.0;
+		simNextStatsUs = simStatsIntervalUs;
+
+		for (int i = 0; i < numDevices; i++)
+		{
+			libusb_device* device = new libusb_device();
+			device->index = i;
+			snprintf(device->name, 30, "Helios Sim %d", i);
+			simDevices.push_back(device);
+		}
+
+		printf("Simulating %d Helios USB DAC(s)\n", numDevices);
+	}
+
+	if (ctx != NULL)
+		*ctx = &simContext;
+	return LIBUSB_SUCCESS;
+}
+
+void LIBUSB_CALL libusb_exit(libusb_context* ctx)
+{
+	std::lock_guard<std::mutex> lock(simLock);
+
+	if (simInitCount > 0 && --simInitCount == 0)
+		simPrintStats(simNowUs());
+}
+
+int LIBUSB_CALL libusb_set_option(libusb_context* ctx, enum libusb_option option, ...)
+{
+	return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_has_capability(uint32_t capability)
+{
+	return (capability == LIBUSB_CAP_HAS_CAPABILITY) || (capability == LIBUSB_CAP_HAS_HOTPLUG);
+}
+
+ssize_t LIBUSB_CALL libusb_get_device_list(libusb_context* ctx, libusb_device*** list)
+{
+	std::lock_guard<std::mutex> lock(simLock);
+	simUpdate(simNowUs());
+
+	libusb_device** devices = (libusb_device**)calloc(simDevices.size() + 1, sizeof(libusb_device*));
+	if (devices == NULL)
+		return LIBUSB_ERROR_NO_MEM;
+
+	ssize_t count = 0;
+	for (libusb_device* device : simDevices)
+	{
+		if (device->present)
+			devices[count++] = device;
+	}
+
+	*list = devices;
+	return count;
+}
+
+void LIBUSB_CALL libusb_free_device_list(libusb_device** list, int unref_devices)
+{
+	free(list);
+}
+
+// The simulated devices live until the process ends, so no reference counting is needed
+libusb_device* LIBUSB_CALL libusb_ref_device(libusb_device* dev)
+{
+	return dev;
+}
+
+void LIBUSB_CALL libusb_unref_device(libusb_device* dev)
+{
+}
+
+int LIBUSB_CALL libusb_get_device_descriptor(libusb_device* dev, struct libusb_device_descriptor* desc)
+{
+	memset(desc, 0, sizeof(*desc));
+	desc->bLength = LIBUSB_DT_DEVICE_SIZE;
+	desc->bDescriptorType = LIBUSB_DT_DEVICE;
+	desc->bcdUSB = 0x0200;
+	desc->bMaxPacketSize0 = 64;
+	desc->idVendor = HELIOS_VID;
+	desc->idProduct = HELIOS_PID;
+	desc->bNumConfigurations = 1;
+	return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_get_port_numbers(libusb_device* dev, uint8_t* port_numbers, int port_numbers_len)
+{
+	if (port_numbers_len < 1)
+		return LIBUSB_ERROR_OVERFLOW;
+	port_numbers[0] = (uint8_t)(dev->index + 1);
+	return 1;
+}
+
+int LIBUSB_CALL libusb_open(libusb_device* dev, libusb_device_handle** dev_handle)
+{
+	if (!dev->present)
+		return LIBUSB_ERROR_NO_DEVICE;
+
+	*dev_handle = new libusb_device_handle{ dev };
+	return LIBUSB_SUCCESS;
+}
+
+void LIBUSB_CALL libusb_close(libusb_device_handle* dev_handle)
+{
+	delete dev_handle;
+}
+
+libusb_device* LIBUSB_CALL libusb_get_device(libusb_device_handle* dev_handle)
+{
+	return dev_handle->device;
+}
+
+int LIBUSB_CALL libusb_claim_interface(libusb_device_handle* dev_handle, int interface_number)
+{
+	return dev_handle->device->present ? LIBUSB_SUCCESS : LIBUSB_ERROR_NO_DEVICE;
+}
+
+int LIBUSB_CALL libusb_set_interface_alt_setting(libusb_device_handle* dev_handle, int interface_number, int alternate_setting)
+{
+	return dev_handle->device->present ? LIBUSB_SUCCESS : LIBUSB_ERROR_NO_DEVICE;
+}
+
+int LIBUSB_CALL libusb_bulk_transfer(libusb_device_handle* dev_handle, unsigned char endpoint, unsigned char* data, int length,
+	int* actual_length, unsigned int timeout)
+{
+	libusb_device* device = dev_handle->device;
+	*actual_length = 0;
+
+	simUpdate();
+
+	if (!device->present)
+		return LIBUSB_ERROR_NO_DEVICE;
+
+	double durationUs = SIM_BULK_OVERHEAD_US + length / SIM_BULK_BYTES_PER_US;
+	if (((timeout > 0) && (durationUs > timeout * 1000.0)) || simShouldFail())
+	{
+		simSleepUs((timeout > 0) ? timeout * 1000.0 : durationUs);
+		std::lock_guard<std::mutex> lock(device->lock);
+		device->transferErrors++;
+		return LIBUSB_ERROR_TIMEOUT;
+	}
+
+	simSleepUs(durationUs);
+	simReceiveFrame(device, data, length, simNowUs());
+
+	*actual_length = length;
+	return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_interrupt_transfer(libusb_device_handle* dev_handle, unsigned char endpoint, unsigned char* data, int length,
+	int* actual_length, unsigned int timeout)
+{
+	libusb_device* device = dev_handle->device;
+	*actual_length = 0;
+
+	simUpdate();
+
+	if (!device->present)
+		return LIBUSB_ERROR_NO_DEVICE;
+
+	if (simShouldFail())
+	{
+		simSleepUs(timeout * 1000.0);
+		std::lock_guard<std::mutex> lock(device->lock);
+		device->transferErrors++;
+		return LIBUSB_ERROR_TIMEOUT;
+	}
+
+	simSleepUs(SIM_INTERRUPT_US);
+
+	if (endpoint & LIBUSB_ENDPOINT_IN)
+	{
+		std::unique_lock<std::mutex> lock(device->lock);
+		if (device->responses.empty())
+		{
+			lock.unlock();
+			simSleepUs(timeout * 1000.0 - SIM_INTERRUPT_US);
+			return LIBUSB_ERROR_TIMEOUT;
+		}
+
+		std::vector<std::uint8_t> response = device->responses.front();
+		device->responses.pop_front();
+		*actual_length = std::min(length, (int)response.size());
+		memcpy(data, response.data(), *actual_length);
+	}
+	else
+	{
+		simControl(device, data, length, simNowUs());
+		*actual_length = length;
+	}
+
+	return LIBUSB_SUCCESS;
+}
+
+struct libusb_transfer* LIBUSB_CALL libusb_alloc_transfer(int iso_packets)
+{
+	return (libusb_transfer*)calloc(1, sizeof(libusb_transfer) + iso_packets * sizeof(libusb_iso_packet_descriptor));
+}
+
+void LIBUSB_CALL libusb_free_transfer(struct libusb_transfer* transfer)
+{
+	if (transfer == NULL)
+		return;
+	if ((transfer->flags & LIBUSB_TRANSFER_FREE_BUFFER) && (transfer->buffer != NULL))
+		free(transfer->buffer);
+	free(transfer);
+}
+
+int LIBUSB_CALL libusb_submit_transfer(struct libusb_transfer* transfer)
+{
+	libusb_device* device = transfer->dev_handle->device;
+
+	std::lock_guard<std::mutex> lock(simLock);
+	double nowUs = simNowUs();
+	simUpdate(nowUs);
+
+	if (!device->present)
+		return LIBUSB_ERROR_NO_DEVICE;
+
+	// Transfers to the same device go over the wire one after another
+	double doneUs;
+	{
+		std::lock_guard<std::mutex> deviceLock(device->lock);
+		doneUs = std::max(nowUs, device->bulkBusyUntilUs) + SIM_BULK_OVERHEAD_US + transfer->length / SIM_BULK_BYTES_PER_US;
+		device->bulkBusyUntilUs = doneUs;
+	}
+
+	simPending.push_back({ transfer, doneUs, false });
+	simCond.notify_all();
+	return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_cancel_transfer(struct libusb_transfer* transfer)
+{
+	std::lock_guard<std::mutex> lock(simLock);
+
+	for (SimPendingTransfer& pending : simPending)
+	{
+		if (pending.transfer == transfer)
+		{
+			if (pending.cancelled)
+				return LIBUSB_ERROR_NOT_FOUND;
+			pending.cancelled = true;
+			simCond.notify_all();
+			return LIBUSB_SUCCESS;
+		}
+	}
+
+	return LIBUSB_ERROR_NOT_FOUND;
+}
+
+int LIBUSB_CALL libusb_handle_events_timeout_completed(libusb_context* ctx, struct timeval* tv, int* completed)
+{
+	std::unique_lock<std::mutex> lock(simLock);
+
+	double deadlineUs = simNowUs() + ((tv != NULL) ? (tv->tv_sec * 1000000.0 + tv->tv_usec) : 60000000.0);
+
+	while (true)
+	{
+		double nowUs = simNowUs();
+		simUpdate(nowUs);
+
+		std::vector<SimPendingTransfer> due;
+		for (auto it = simPending.begin(); it != simPending.end();)
+		{
+			if (it->cancelled || (it->doneUs <= nowUs))
+			{
+				due.push_back(*it);
+				it = simPending.erase(it);
+			}
+			else
+				++it;
+		}
+
+		std::vector<SimHotplugEvent> events(simHotplugEvents.begin(), simHotplugEvents.end());
+		simHotplugEvents.clear();
+		std::vector<SimHotplugCallback> callbacks = simHotplugCallbacks;
+
+		if (!due.empty() || !events.empty())
+		{
+			lock.unlock();
+
+			for (SimPendingTransfer& pending : due)
+			{
+				libusb_transfer* transfer = pending.transfer;
+				libusb_device* device = transfer->dev_handle->device;
+				transfer->actual_length = 0;
+
+				if (pending.cancelled)
+					transfer->status = LIBUSB_TRANSFER_CANCELLED;
+				else if (!device->present)
+					transfer->status = LIBUSB_TRANSFER_NO_DEVICE;
+				else if (simShouldFail())
+				{
+					std::lock_guard<std::mutex> deviceLock(device->lock);
+					device->transferErrors++;
+					transfer->status = LIBUSB_TRANSFER_TIMED_OUT;
+				}
+				else
+				{
+					simReceiveFrame(device, transfer->buffer, transfer->length, pending.doneUs);
+					transfer->status = LIBUSB_TRANSFER_COMPLETED;
+					transfer->actual_length = transfer->length;
+				}
+
+				bool freeTransfer = (transfer->flags & LIBUSB_TRANSFER_FREE_TRANSFER) != 0;
+				if (transfer->callback != NULL)
+					transfer->callback(transfer);
+				if (freeTransfer)
+					libusb_free_transfer(transfer);
+			}
+
+			for (SimHotplugEvent& event : events)
+			{
+				for (SimHotplugCallback& callback : callbacks)
+				{
+					if (callback.events & event.event)
+						callback.function(&simContext, event.device, event.event, callback.userData);
+				}
+			}
+
+			if (completed != NULL)
+				*completed = 1;
+			return LIBUSB_SUCCESS;
+		}
+
+		if ((completed != NULL && *completed) || (nowUs >= deadlineUs))
+			return LIBUSB_SUCCESS;
+
+		double wakeUs = deadlineUs;
+		for (SimPendingTransfer& pending : simPending)
+			wakeUs = std::min(wakeUs, pending.doneUs);
+		if (!simUnplugged && (simUnplugAtUs > 0))
+			wakeUs = std::min(wakeUs, simUnplugAtUs);
+		else if (simUnplugged && !simReplugged && (simReplugAfterUs > 0))
+			wakeUs = std::min(wakeUs, simUnplugAtUs + simReplugAfterUs);
+
+		simCond.wait_for(lock, std::chrono::microseconds((long long)std::max(1.0, wakeUs - nowUs)));
+	}
+}
+
+int LIBUSB_CALL libusb_hotplug_register_callback(libusb_context* ctx, int events, int flags, int vendor_id, int product_id, int dev_class,
+	libusb_hotplug_callback_fn cb_fn, void* user_data, libusb_hotplug_callback_handle* callback_handle)
+{
+	std::lock_guard<std::mutex> lock(simLock);
+
+	SimHotplugCallback callback = { simNextHotplugHandle++, events, cb_fn, user_data };
+	simHotplugCallbacks.push_back(callback);
+
+	if (flags & LIBUSB_HOTPLUG_ENUMERATE)
+	{
+		for (libusb_device* device : simDevices)
+		{
+			if (device->present)
+				simHotplugEvents.push_back({ device, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED });
+		}
+	}
+
+	if (callback_handle != NULL)
+		*callback_handle = callback.handle;
+	return LIBUSB_SUCCESS;
+}
+
+void LIBUSB_CALL libusb_hotplug_deregister_callback(libusb_context* ctx, libusb_hotplug_callback_handle callback_handle)
+{
+	std::lock_guard<std::mutex> lock(simLock);
+
+	for (auto it = simHotplugCallbacks.begin(); it != simHotplugCallbacks.end(); ++it)
+	{
+		if (it->handle == callback_handle)
+		{
+			simHotplugCallbacks.erase(it);
+			break;
+		}
+	}
+}
+
+
+// -- Inspection and control, see HeliosUsbSim.hpp ----------------
+
+int HeliosSimGetNumDevices()
+{
+	std::lock_guard<std::mutex> lock(simLock);
+	return (int)simDevices.size();
+}
+
+bool HeliosSimGetStats(int index, HeliosSimStats& stats)
+{
+	std::lock_guard<std::mutex> lock(simLock);
+
+	if ((index < 0) || (index >= (int)simDevices.size()))
+		return false;
+
+	libusb_device* device = simDevices[index];
+	std::lock_guard<std::mutex> deviceLock(device->lock);
+	stats.framesReceived = device->framesReceived;
+	stats.pointsReceived = device->pointsReceived;
+	stats.statusRequests = device->statusRequests;
+	stats.framesDropped = device->framesDropped;
+	stats.underruns = device->underruns;
+	stats.transferErrors = device->transferErrors;
+	stats.idleUs = device->idleUs;
+	stats.maxIdleUs = device->maxIdleUs;
+	return true;
+}
+
+void HeliosSimResetStats()
+{
+	std::lock_guard<std::mutex> lock(simLock);
+	double nowUs = simNowUs();
+
+	for (libusb_device* device : simDevices)
+	{
+		std::lock_guard<std::mutex> deviceLock(device->lock);
+		simAdvance(device, nowUs);
+		device->framesReceived = 0;
+		device->pointsReceived = 0;
+		device->statusRequests = 0;
+		device->framesDropped = 0;
+		device->underruns = 0;
+		device->transferErrors = 0;
+		device->idleUs = 0;
+		device->maxIdleUs = 0;
+		device->lastPointsReceived = 0;
+		if (!device->playing)
+			device->lastPlayEndUs = -1;
+	}
+}
+
+void HeliosSimSetCapture(bool enable)
+{
+	std::lock_guard<std::mutex> lock(simLock);
+
+	simCapture = enable;
+	if (!enable)
+	{
+		for (libusb_device* device : simDevices)
+		{
+			std::lock_guard<std::mutex> deviceLock(device->lock);
+			device->captured.clear();
+		}
+	}
+}
+
+std::vector<std::vector<std::uint8_t>> HeliosSimTakeCapturedFrames(int index)
+{
+	std::lock_guard<std::mutex> lock(simLock);
+
+	std::vector<std::vector<std::uint8_t>> frames;
+	if ((index < 0) || (index >= (int)simDevices.size()))
+		return frames;
+
+	libusb_device* device = simDevices[index];
+	std::lock_guard<std::mutex> deviceLock(device->lock);
+	frames.swap(device->captured);
+	return frames;
+}
+
+void HeliosSimSetPresent(int index, bool present)
+{
+	std::lock_guard<std::mutex> lock(simLock);
+
+	if ((index < 0) || (index >= (int)simDevices.size()))
+		return;
+
+	if (present)
+		simReplug(simDevices[index]);
+	else
+		simUnplug(simDevices[index]);
+}
+
+#endif
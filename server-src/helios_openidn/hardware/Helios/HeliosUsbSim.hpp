@@ -0,0 +1,46 @@
+/*
+Inspection and control of the simulated Helios USB DACs, for tests and benchmarks
+
+Only available when building with HELIOS_SIMULATED_USB, see HeliosUsbSim.cpp.
+Devices are numbered in the order they were created at the first libusb_init().
+*/
+
+#pragma once
+
+#ifdef HELIOS_SIMULATED_USB
+
+#include <cstdint>
+#include <vector>
+
+struct HeliosSimStats
+{
+	unsigned int framesReceived;		// valid bulk frames
+	unsigned long long pointsReceived;
+	unsigned int statusRequests;		// status commands on the interrupt endpoint
+	unsigned int framesDropped;			// overwritten in the buffer before they were played
+	unsigned int underruns;				// output gaps between consecutive frames
+	unsigned int transferErrors;
+	double idleUs;						// total length of the output gaps
+	double maxIdleUs;
+};
+
+// Number of simulated DACs, 0 before the first libusb_init()
+int HeliosSimGetNumDevices();
+
+// Returns false for an invalid device index
+bool HeliosSimGetStats(int index, HeliosSimStats& stats);
+
+// Clears the statistics of all devices. The next frame a device receives starts a new measurement, so the
+// time since the last frame played does not count as an underrun.
+void HeliosSimResetStats();
+
+// Keeps a copy of every bulk transfer the devices receive, including the 5 byte trailer
+void HeliosSimSetCapture(bool enable);
+
+// Returns and clears the transfers captured for a device, oldest first
+std::vector<std::vector<std::uint8_t>> HeliosSimTakeCapturedFrames(int index);
+
+// Unplugs or plugs in a device now, with the same hotplug events as the scheduled HELIOS_SIM_UNPLUG_MS
+void HeliosSimSetPresent(int index, bool present);
+
+#endif
@@ -1,14 +1,21 @@
 #include "HeliosProAdapter.hpp"
+#include "HeliosProSim.hpp"
 
 // Interface to internal HeliosPro output buffer microcontroller via SPIdev
 
-HeliosProAdapter::HeliosProAdapter() 
+HeliosProAdapter::HeliosProAdapter(std::shared_ptr<HeliosProSim> simulatedDevice) : sim(simulatedDevice)
 {
-	this->spidevFd = open("/dev/heliospro-spi", O_RDWR);
-	if (!this->spidevFd)
+	this->spidevFd = -1;
+	if (sim != nullptr)
+		printf("HeliosPRO: Using simulated device\n");
+	else
 	{
-		printf("HeliosPRO: Couldn't open /dev/heliospro-spi: %s", strerror(errno));
-		exit(1);
+		this->spidevFd = open("/dev/heliospro-spi", O_RDWR);
+		if (!this->spidevFd)
+		{
+			printf("HeliosPRO: Couldn't open /dev/heliospro-spi: %s", strerror(errno));
+			exit(1);
+		}
 	}
 
 	this->maximumPointrate = HELIOSPRO_MCU_MAXSPEED;
@@ -21,7 +28,7 @@ HeliosProAdapter::HeliosProAdapter()
 
 	// Check if MCU is available
 	uint8_t status[10];
-	int ret = read(this->spidevFd, status, 10);
+	int ret = devRead(status, 10);
 	if (ret == 10)
 	{
 		if (status[0] != 'G' && status[1] != 1)
@@ -36,6 +43,8 @@ HeliosProAdapter::HeliosProAdapter()
 		exit(1);
 	}
 
+	mapRing();
+
 
 	//delay.tv_sec = 5;
 	//delay.tv_nsec = 0;
@@ -100,6 +109,239 @@ HeliosProAdapter::HeliosProAdapter()
 
 HeliosProAdapter::~HeliosProAdapter() 
 {
+	if (ring != nullptr)
+		devMunmap(ring, ringMapSize);
+}
+
+int HeliosProAdapter::devRead(void* buffer, size_t count)
+{
+	return (sim != nullptr) ? sim->read(buffer, count) : read(this->spidevFd, buffer, count);
+}
+
+int HeliosProAdapter::devWrite(const void* buffer, size_t count)
+{
+	return (sim != nullptr) ? sim->write(buffer, count) : write(this->spidevFd, buffer, count);
+}
+
+int HeliosProAdapter::devIoctl(unsigned long request, void* arg)
+{
+	return (sim != nullptr) ? sim->ioctl(request, arg) : ioctl(this->spidevFd, request, arg);
+}
+
+void* HeliosProAdapter::devMmap(size_t length)
+{
+	return (sim != nullptr) ? sim->mmap(length) : mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, this->spidevFd, 0);
+}
+
+void HeliosProAdapter::devMunmap(void* address, size_t length)
+{
+	if (sim == nullptr)
+		munmap(address, length);
+}
+
+// Maps the shared memory ring of the kernel module, if it provides one
+void HeliosProAdapter::mapRing()
+{
+	clock_gettime(CLOCK_MONOTONIC, &statLastTime);
+
+	// Map the header page alone first to learn the number of slots
+	void* headerMap = devMmap(HELIOSPRO_RING_PAGE);
+	if (headerMap == MAP_FAILED)
+	{
+		printf("HeliosPRO: No shared ring in kernel module, using write() transfers\n");
+		return;
+	}
+
+	HeliosProRingHeader* header = (HeliosProRingHeader*)headerMap;
+	uint32_t numSlots = header->numSlots;
+	bool valid = header->magic == HELIOSPRO_RING_MAGIC && header->slotStride == HELIOSPRO_RING_SLOT_STRIDE
+		&& header->slotDataSize == sizeof(HeliosProRingSlot::data) && numSlots > 0;
+	devMunmap(headerMap, HELIOSPRO_RING_PAGE);
+	if (!valid)
+	{
+		printf("HeliosPRO: Shared ring layout of kernel module not supported, using write() transfers\n");
+		return;
+	}
+
+	size_t mapSize = HELIOSPRO_RING_PAGE + (size_t)numSlots * HELIOSPRO_RING_SLOT_STRIDE;
+	void* ringMap = devMmap(mapSize);
+	if (ringMap == MAP_FAILED)
+	{
+		printf("HeliosPRO: Couldn't map shared ring: %s, using write() transfers\n", strerror(errno));
+		return;
+	}
+
+	ring = (HeliosProRingHeader*)ringMap;
+	ringMapSize = mapSize;
+	ringHead = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	statLastPacketsSent = ring->packetsSent;
+	statLastLatencySumNs = ring->latencySumNs;
+
+	HeliosProStatus status;
+	if (readStatus(&status) == 0)
+		statLastUnderruns = status.underruns;
+
+	printf("HeliosPRO: Using shared ring with %u slots\n", numSlots);
+}
+
+// Writes header, point data and footer of a packet to buffer, returns the packet size
+unsigned HeliosProAdapter::buildPacket(uint8_t* buffer, const uint8_t* points, unsigned dataSizeBytes, uint16_t timerValue, uint16_t timerRepeats)
+{
+	buffer[0] = 'H';
+	buffer[1] = 'P';
+	buffer[2] = txId;
+	buffer[3] = 0; // reserved
+	buffer[4] = ((dataSizeBytes + 16) >> 0) & 0xFF;
+	buffer[5] = ((dataSizeBytes + 16) >> 8) & 0xFF;
+	buffer[6] = ((0xFFFF) >> 4) & 0xFF; // shutter
+	buffer[7] = ((0xFFFF) >> 12) & 0xFF; // shutter
+	buffer[8] = ((timerValue) >> 0) & 0xFF;
+	buffer[9] = ((timerValue) >> 8) & 0xFF;
+	buffer[10] = ((timerRepeats) >> 0) & 0xFF;
+	buffer[11] = ((timerRepeats) >> 8) & 0xFF;
+	buffer[12] = 0; // reserved
+	buffer[13] = 0; // reserved
+	buffer[14] = 0; // reserved
+	buffer[15] = 0; // reserved
+
+	memcpy(&buffer[16], points, dataSizeBytes);
+
+	buffer[16 + dataSizeBytes + 0] = txId;
+	buffer[16 + dataSizeBytes + 1] = 'G';
+	buffer[16 + dataSizeBytes + 2] = 'R';
+	buffer[16 + dataSizeBytes + 3] = 'X';
+
+	txId++;
+	txNum++;
+
+	return dataSizeBytes + HELIOSPRO_PACKET_OVERHEAD;
+}
+
+// Builds a packet in the next free ring slot and publishes it to the kernel module.
+// Only needs a syscall if the ring is full, kickRing() has to follow once the batch is complete.
+int HeliosProAdapter::submitRingPacket(const uint8_t* points, unsigned dataSizeBytes, uint16_t timerValue, uint16_t timerRepeats)
+{
+	uint32_t numSlots = ring->numSlots;
+
+	if (ringHead - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= numSlots)
+	{
+		struct timespec start, now;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		while (true)
+		{
+			// Announce the wait before checking again, so the module can't miss waking us
+			__atomic_store_n(&ring->producerWaiting, 1, __ATOMIC_SEQ_CST);
+			if (ringHead - __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) < numSlots)
+				break;
+
+			kickRing();
+			if (sendCommand(HELIOSPRO_COMMAND_RING_WAIT) < 0 && errno != EINTR)
+			{
+				__atomic_store_n(&ring->producerWaiting, 0, __ATOMIC_SEQ_CST);
+				perror("HeliosPRO: ring wait error");
+				return -1;
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if ((now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000 > HELIOSPRO_RING_WAIT_TIMEOUT_US)
+			{
+				__atomic_store_n(&ring->producerWaiting, 0, __ATOMIC_SEQ_CST);
+				printf("WARNING: Timeout waiting for free HeliosPRO ring slot\n");
+				return -1;
+			}
+		}
+
+		__atomic_store_n(&ring->producerWaiting, 0, __ATOMIC_SEQ_CST);
+	}
+
+	HeliosProRingSlot* slot = (HeliosProRingSlot*)((uint8_t*)ring + HELIOSPRO_RING_PAGE + (ringHead % numSlots) * HELIOSPRO_RING_SLOT_STRIDE);
+	slot->size = buildPacket(slot->data, points, dataSizeBytes, timerValue, timerRepeats);
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	slot->submitTimeNs = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+	ringHead++;
+	__atomic_store_n(&ring->head, ringHead, __ATOMIC_SEQ_CST);
+
+	statPackets++;
+	return 0;
+}
+
+// Wakes the SPI thread if it went to sleep before it could see the published packets
+void HeliosProAdapter::kickRing()
+{
+	if (__atomic_load_n(&ring->consumerWaiting, __ATOMIC_SEQ_CST))
+	{
+		if (sendCommand(HELIOSPRO_COMMAND_RING_KICK) < 0)
+			perror("HeliosPRO: ring kick error");
+	}
+}
+
+int HeliosProAdapter::sendCommand(uint8_t command)
+{
+	uint8_t commandBuffer[2] = { 'C', command };
+	statSyscalls++;
+	return devWrite(commandBuffer, 2);
+}
+
+int HeliosProAdapter::readStatus(HeliosProStatus* status)
+{
+	if (!statusSupported)
+		return -1;
+
+	statSyscalls++;
+	if (devIoctl(HELIOSPRO_IOC_STATUS, status) < 0)
+	{
+		if (errno == ENOTTY || errno == EINVAL)
+		{
+			printf("HeliosPRO: Kernel module has no fill level feedback\n");
+			statusSupported = false;
+		}
+		return -1;
+	}
+	return 0;
+}
+
+double HeliosProAdapter::queuedDurationUs()
+{
+	HeliosProStatus status;
+	if (readStatus(&status) < 0)
+		return -1;
+	return status.queuedUs;
+}
+
+void HeliosProAdapter::printStats()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double seconds = (now.tv_sec - statLastTime.tv_sec) + (now.tv_nsec - statLastTime.tv_nsec) / 1000000000.0;
+	statLastTime = now;
+	if (seconds <= 0)
+		return;
+
+	printf("%.0f Packets/s %.0f Syscalls/s ", statPackets / seconds, statSyscalls / seconds);
+	statPackets = 0;
+	statSyscalls = 0;
+
+	if (ring != nullptr)
+	{
+		uint64_t packetsSent = ring->packetsSent;
+		uint64_t latencySumNs = ring->latencySumNs;
+		uint64_t latencyMaxNs = __atomic_exchange_n(&ring->latencyMaxNs, 0, __ATOMIC_RELAXED);
+		if (packetsSent > statLastPacketsSent)
+			printf("%.2f ms avg / %.2f ms max SPI Latency ", (latencySumNs - statLastLatencySumNs) / 1000000.0 / (packetsSent - statLastPacketsSent), latencyMaxNs / 1000000.0);
+		statLastPacketsSent = packetsSent;
+		statLastLatencySumNs = latencySumNs;
+	}
+
+	HeliosProStatus status;
+	if (readStatus(&status) == 0)
+	{
+		printf("%.2f ms Device Queue %u Device Underruns ", status.queuedUs / 1000.0, status.underruns - statLastUnderruns);
+		statLastUnderruns = status.underruns;
+	}
 }
 
 int HeliosProAdapter::writeFrame(const TimeSlice& slice, double durationUs) 
@@ -165,32 +407,22 @@ int HeliosProAdapter::writeFrame(const TimeSlice& slice, double durationUs)
 		dataSizeBytes = pointsThisFrame * bytesPerPoint();
 
 
-		writeBuffer[0] = 'H';
-		writeBuffer[1] = 'P';
-		writeBuffer[2] = txId;
-		writeBuffer[3] = 0; // reserved
-		writeBuffer[4] = ((dataSizeBytes + 16) >> 0) & 0xFF;
-		writeBuffer[5] = ((dataSizeBytes + 16) >> 8) & 0xFF;
-		writeBuffer[6] = ((0xFFFF) >> 4) & 0xFF; // shutter
-		writeBuffer[7] = ((0xFFFF) >> 12) & 0xFF; // shutter
-		writeBuffer[8] = ((desiredTimerInt) >> 0) & 0xFF;
-		writeBuffer[9] = ((desiredTimerInt) >> 8) & 0xFF;
-		writeBuffer[10] = ((timerRepeats) >> 0) & 0xFF;
-		writeBuffer[11] = ((timerRepeats) >> 8) & 0xFF;
-		writeBuffer[12] = 0; // reserved
-		writeBuffer[13] = 0; // reserved
-		writeBuffer[14] = 0; // reserved
-		writeBuffer[15] = 0; // reserved
-
-		memcpy(&writeBuffer[16], data.data() + offsetPoints * bytesPerPoint(), dataSizeBytes);
-
-		writeBuffer[16 + dataSizeBytes + 0] = txId;
-		writeBuffer[16 + dataSizeBytes + 1] = 'G';
-		writeBuffer[16 + dataSizeBytes + 2] = 'R'; 
-		writeBuffer[16 + dataSizeBytes + 3] = 'X';
-
-		txId++;
-		txNum++;
+		const uint8_t* points = data.data() + offsetPoints * bytesPerPoint();
+
+		if (ring != nullptr)
+		{
+			if (submitRingPacket(points, dataSizeBytes, desiredTimerInt, timerRepeats) < 0)
+			{
+				isBusy = false;
+				return 0;
+			}
+
+			pointsLeft -= pointsThisFrame;
+			offsetPoints += pointsThisFrame;
+			continue;
+		}
+
+		unsigned packetSize = buildPacket(writeBuffer, points, dataSizeBytes, desiredTimerInt, timerRepeats);
 
 		// TESTING
 	/*	static int frame = 0;
@@ -253,7 +485,8 @@ int HeliosProAdapter::writeFrame(const TimeSlice& slice, double durationUs)
 		//printf("got ready\n");
 
 		//write the whole block all at once
-		int writeRet = write(this->spidevFd, writeBuffer, dataSizeBytes + 16 + 4);
+		statSyscalls++;
+		int writeRet = devWrite(writeBuffer, packetSize);
 
 		//clock_gettime(CLOCK_MONOTONIC, &now);
 		//sdif = now.tv_sec - then.tv_sec;
@@ -288,13 +521,14 @@ int HeliosProAdapter::writeFrame(const TimeSlice& slice, double durationUs)
 		//	test[i] = 0xE5000000 + i;
 		//}
 		//int writeErr = write(this->spidevFd, test, 128 * 4);
-		if (writeRet != (dataSizeBytes + 16 + 4))
+		if (writeRet != packetSize)
 		{
 			isBusy = false;
 			perror("spi write error");
-			printf("msg size = %u, err %d\n", dataSizeBytes + 16 + 4, writeRet);
+			printf("msg size = %u, err %d\n", packetSize, writeRet);
 			return 0;
 		}
+		statPackets++;
 #ifdef DEBUGOUTPUT
 		//printf("wrote to HelPro size = %u\n", dataSizeBytes + 16 + 4);
 #endif
@@ -342,6 +576,10 @@ int HeliosProAdapter::writeFrame(const TimeSlice& slice, double durationUs)
 		offsetPoints += pointsThisFrame;
 	}
 
+	// All packets of the slice are published at once
+	if (ring != nullptr)
+		kickRing();
+
 	isBusy = false;
 
 #ifdef DEBUGOUTPUT
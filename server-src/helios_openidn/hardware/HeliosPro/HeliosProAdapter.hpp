@@ -11,6 +11,7 @@
 #include <sys/mman.h>
 #include <thread>
 #include <cmath>
+#include <memory>
 
 #define HELIOSPRO_CHUNKSIZE 3780
 
@@ -20,6 +21,53 @@
 #define HELIOSPRO_MCU_MAXSPEED 110000u			// In pps
 #define HELIOSPRO_MCU_MINSPEED 733u				// In pps
 
+#define HELIOSPRO_PACKET_OVERHEAD (16 + 4)		// Header and footer around the point data
+
+// These must match the spi-helios kernel module!
+#define HELIOSPRO_COMMAND_RING_KICK 6
+#define HELIOSPRO_COMMAND_RING_WAIT 7
+#define HELIOSPRO_RING_MAGIC 0x48505247
+#define HELIOSPRO_RING_PAGE 4096
+#define HELIOSPRO_RING_SLOT_STRIDE 4096
+
+#define HELIOSPRO_RING_WAIT_TIMEOUT_US 1000000	// Give up on a packet if no ring slot gets free
+
+// Header page of the shared memory ring, followed by the slots
+struct HeliosProRingHeader
+{
+	uint32_t magic;
+	uint32_t numSlots;
+	uint32_t slotStride;
+	uint32_t slotDataSize;
+	uint32_t head;				// Written by us: next slot to fill
+	uint32_t tail;				// Written by the module: next slot to send
+	uint32_t consumerWaiting;	// Module sleeps on an empty ring, needs a kick
+	uint32_t producerWaiting;	// We wait for a free slot, module wakes us
+	uint64_t packetsSent;
+	uint64_t latencySumNs;		// From submission to the end of the SPI transfer
+	uint64_t latencyMaxNs;
+};
+
+// Fill level feedback of the kernel module
+struct HeliosProStatus
+{
+	uint32_t queuedPackets;		// In the ring, not yet sent over SPI
+	uint32_t queuedUs;			// Playback duration of the queued packets and the rest of the last sent one
+	uint32_t mcuReady;			// Buffer status line, the MCU can take another packet
+	uint32_t underruns;			// Packets that arrived after the previous output had run out (estimated)
+	uint64_t packetsSent;
+};
+
+#define HELIOSPRO_IOC_STATUS _IOR('h', 1, HeliosProStatus)
+
+struct HeliosProRingSlot
+{
+	uint64_t submitTimeNs;		// CLOCK_MONOTONIC
+	uint32_t size;
+	uint32_t reserved;
+	uint8_t data[HELIOSPRO_CHUNKSIZE + HELIOSPRO_PACKET_OVERHEAD];
+};
+
 /*#define GPIO_DIR_IN(g)		*(gpio + (0x04 / 4)) &= ~(1 << (g & 0xFF))
 #define GPIO_DIR_OUT(g)		*(gpio + (0x04 / 4)) |= (1 << (g & 0xFF))
 #define GPIO_SET(g)		*(gpio + (0x00 / 4)) |= (1 << (g & 0xFF))
@@ -32,6 +80,8 @@
 #define GPIOPIN_MCURESET    14    // B6
 #define GPIOPIN_STOP		3    // A3*/
 
+class HeliosProSim;
+
 class HeliosProAdapter : public DACHWInterface {
 public:
 	int writeFrame(const TimeSlice& slice, double duration) override;
@@ -41,13 +91,17 @@ public:
 	unsigned maxPointrate() override;
 	void setMaxPointrate(unsigned) override;
 	void getName(char* nameBufferPtr, unsigned nameBufferSize) override;
+	void printStats() override;
+	double queuedDurationUs() override;
 	//void stop() override;
 
-	HeliosProAdapter();
+	// Opens /dev/heliospro-spi, or uses the given simulated device instead
+	HeliosProAdapter(std::shared_ptr<HeliosProSim> simulatedDevice = nullptr);
 	~HeliosProAdapter();
 
 private:
 	int spidevFd;
+	std::shared_ptr<HeliosProSim> sim;
 	unsigned maximumPointrate;
 	double timerRemainder = 0;
 
@@ -62,6 +116,35 @@ private:
 	uint8_t txId = 1;
 	int txNum = 0;
 
-	uint8_t writeBuffer[HELIOSPRO_CHUNKSIZE + 16 + 4];
+	uint8_t writeBuffer[HELIOSPRO_CHUNKSIZE + HELIOSPRO_PACKET_OVERHEAD];
+
+	// Shared memory ring of the kernel module, packets are built directly in its slots.
+	// Not mapped with older modules, then every packet is passed with write().
+	HeliosProRingHeader* ring = nullptr;
+	size_t ringMapSize = 0;
+	uint32_t ringHead = 0;
+	bool statusSupported = true;
+
+	// Transfer statistics since the last printStats()
+	unsigned statPackets = 0;
+	unsigned statSyscalls = 0;
+	uint64_t statLastPacketsSent = 0;
+	uint64_t statLastLatencySumNs = 0;
+	struct timespec statLastTime;
+	uint32_t statLastUnderruns = 0;
+
+	void mapRing();
+	unsigned buildPacket(uint8_t* buffer, const uint8_t* points, unsigned dataSizeBytes, uint16_t timerValue, uint16_t timerRepeats);
+	int submitRingPacket(const uint8_t* points, unsigned dataSizeBytes, uint16_t timerValue, uint16_t timerRepeats);
+	void kickRing();
+	int sendCommand(uint8_t command);
+	int readStatus(HeliosProStatus* status);
+
+	// Device node access, forwarded to the simulated device if there is one
+	int devRead(void* buffer, size_t count);
+	int devWrite(const void* buffer, size_t count);
+	int devIoctl(unsigned long request, void* arg);
+	void* devMmap(size_t length);
+	void devMunmap(void* address, size_t length);
 };
 
@@ -0,0 +1,383 @@
+#include "HeliosProSim.hpp"
+#include "HeliosProAdapter.hpp"
+
+// Simulated HeliosPRO device node and buffer MCU, see HeliosProSim.hpp
+
+#define SIM_PACKET_OVERHEAD 20
+#define SIM_BYTES_PER_POINT 18
+#define SIM_RING_WAIT_TIMEOUT_MS 100
+
+// Playback duration of a packet from its point count and MCU timer values, 0 if malformed
+static double packetDurationUs(const uint8_t* data, uint32_t size, double* pointUs = nullptr)
+{
+	if (size <= SIM_PACKET_OVERHEAD)
+		return 0;
+
+	uint32_t points = (size - SIM_PACKET_OVERHEAD) / SIM_BYTES_PER_POINT;
+	uint32_t timer = data[8] | (data[9] << 8);
+	uint32_t repeats = data[10] | (data[11] << 8);
+	double period = timer * (double)(repeats ? repeats : 1) * 1000000.0 / HELIOSPRO_MCU_TIMERSPEED;
+	if (pointUs != nullptr)
+		*pointUs = period;
+	return points * period;
+}
+
+HeliosProSim::HeliosProSim(const char* logPath)
+{
+	clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+	ringSize = HELIOSPRO_RING_PAGE + HELIOSPRO_SIM_RING_SLOTS * HELIOSPRO_RING_SLOT_STRIDE;
+	ring = (uint8_t*)aligned_alloc(HELIOSPRO_RING_PAGE, ringSize);
+	memset(ring, 0, ringSize);
+
+	HeliosProRingHeader* header = (HeliosProRingHeader*)ring;
+	header->magic = HELIOSPRO_RING_MAGIC;
+	header->numSlots = HELIOSPRO_SIM_RING_SLOTS;
+	header->slotStride = HELIOSPRO_RING_SLOT_STRIDE;
+	header->slotDataSize = sizeof(HeliosProRingSlot::data);
+
+	if (logPath != nullptr)
+	{
+		logFile = fopen(logPath, "w");
+		if (logFile == nullptr)
+			printf("HeliosPRO sim: Couldn't open log file %s: %s\n", logPath, strerror(errno));
+	}
+
+	spiThread = std::thread(&HeliosProSim::spiLoop, this);
+}
+
+HeliosProSim::~HeliosProSim()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stop = true;
+	}
+	newFrameCond.notify_all();
+	spaceCond.notify_all();
+	spiThread.join();
+
+	double outputS = (lastOutputEndUs - firstOutputUs) / 1000000.0;
+	printf("HeliosPRO sim: %llu packets, %llu points, %.1f kpps, %u underruns (%.2f ms idle), %u lost, %u framing errors\n",
+		(unsigned long long)packetsSent, (unsigned long long)pointsPlayed, (outputS > 0) ? pointsPlayed / outputS / 1000.0 : 0.0,
+		underruns, idleUs / 1000.0, lostPackets, framingErrors);
+
+	if (logFile != nullptr)
+		fclose(logFile);
+	free(ring);
+}
+
+double HeliosProSim::nowUs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - startTime.tv_sec) * 1000000.0 + (now.tv_nsec - startTime.tv_nsec) / 1000.0;
+}
+
+uint32_t HeliosProSim::ringPending()
+{
+	HeliosProRingHeader* header = (HeliosProRingHeader*)ring;
+	return __atomic_load_n(&header->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+}
+
+bool HeliosProSim::ringHasPacket()
+{
+	return ringPending() != 0;
+}
+
+uint8_t* HeliosProSim::ringSlot(uint32_t index)
+{
+	return ring + HELIOSPRO_RING_PAGE + (index % HELIOSPRO_SIM_RING_SLOTS) * HELIOSPRO_RING_SLOT_STRIDE;
+}
+
+// Plays the MCU buffer up to the given time. Caller holds lock.
+void HeliosProSim::advanceMcu(double now)
+{
+	while (playing && now >= playEndUs)
+	{
+		if (queued)
+		{
+			playEndUs += queuedDurationUs;
+			queued = false;
+		}
+		else
+		{
+			playing = false;
+			lastOutputEndUs = playEndUs;
+		}
+	}
+}
+
+// Hands a packet that went over SPI to the MCU. Caller holds lock, the MCU must be ready.
+void HeliosProSim::deliver(const uint8_t* data, uint32_t size)
+{
+	uint32_t dataSize = size - SIM_PACKET_OVERHEAD;
+	if ((size <= SIM_PACKET_OVERHEAD) || (data[0] != 'H') || (data[1] != 'P') || ((uint32_t)(data[4] | (data[5] << 8)) != dataSize + 16)
+		|| (dataSize % SIM_BYTES_PER_POINT != 0) || (data[16 + dataSize] != data[2]) || (data[17 + dataSize] != 'G')
+		|| (data[18 + dataSize] != 'R') || (data[19 + dataSize] != 'X'))
+	{
+		framingErrors++;
+		return;
+	}
+
+	double pointUs = 0;
+	double durationUs = packetDurationUs(data, size, &pointUs);
+	if (durationUs <= 0)
+	{
+		framingErrors++;
+		return;
+	}
+
+	uint8_t txId = data[2];
+	if (hasTxId && txId != expectedTxId)
+		lostPackets += (uint8_t)(txId - expectedTxId);
+	expectedTxId = txId + 1;
+	hasTxId = true;
+
+	double now = nowUs();
+	advanceMcu(now);
+
+	double startUs;
+	double gapUs = 0;
+	if (!playing)
+	{
+		startUs = now;
+		if (lastOutputEndUs >= 0)
+		{
+			gapUs = now - lastOutputEndUs;
+			if (gapUs > 0 && gapUs < HELIOSPRO_SIM_MAX_GAP_US)
+			{
+				underruns++;
+				idleUs += gapUs;
+			}
+		}
+		playing = true;
+		playEndUs = now + durationUs;
+	}
+	else
+	{
+		startUs = playEndUs;
+		queued = true;
+		queuedDurationUs = durationUs;
+	}
+
+	if (firstOutputUs < 0)
+		firstOutputUs = startUs;
+	pointsPlayed += dataSize / SIM_BYTES_PER_POINT;
+
+	if (logFile != nullptr)
+		fprintf(logFile, "%.1f %u %u %.3f %.1f\n", startUs, txId, dataSize / SIM_BYTES_PER_POINT, pointUs, gapUs);
+}
+
+// The module's SPI thread, with the MCU ready line
+void HeliosProSim::spiLoop()
+{
+	HeliosProRingHeader* header = (HeliosProRingHeader*)ring;
+	Packet packet;
+
+	std::unique_lock<std::mutex> guard(lock);
+	while (!stop)
+	{
+		// Only woken by write() or COMMAND_RING_KICK, like the module
+		__atomic_store_n(&header->consumerWaiting, 1, __ATOMIC_SEQ_CST);
+		newFrameCond.wait(guard, [this] { return newFrameReady || ringHasPacket() || stop; });
+		__atomic_store_n(&header->consumerWaiting, 0, __ATOMIC_SEQ_CST);
+
+		// Wait for the ready line
+		while (!stop)
+		{
+			double now = nowUs();
+			advanceMcu(now);
+			if (!queued)
+				break;
+
+			guard.unlock();
+			std::this_thread::sleep_for(std::chrono::microseconds((long long)(playEndUs - now) + 1));
+			guard.lock();
+		}
+		if (stop)
+			break;
+
+		bool fromRing = ringHasPacket();
+		uint32_t tail = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+		if (fromRing)
+		{
+			if (ringPending() > HELIOSPRO_SIM_RING_SLOTS)
+			{
+				printf("HeliosPRO sim: Invalid ring head, dropping queued packets\n");
+				__atomic_store_n(&header->tail, __atomic_load_n(&header->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+				spaceCond.notify_all();
+				continue;
+			}
+
+			HeliosProRingSlot* slot = (HeliosProRingSlot*)ringSlot(tail);
+			packet.size = (slot->size <= sizeof(packet.data)) ? slot->size : 0;
+			memcpy(packet.data, slot->data, packet.size);
+		}
+		else
+		{
+			packet = writeBuffer;
+			newFrameReady = false;
+			newFrameCond.notify_all();
+		}
+
+		// SPI transfer
+		guard.unlock();
+		std::this_thread::sleep_for(std::chrono::nanoseconds((long long)packet.size * 8 * 1000000000 / HELIOSPRO_SIM_SPI_HZ));
+		guard.lock();
+
+		deliver(packet.data, packet.size);
+		packetsSent++;
+
+		if (fromRing)
+		{
+			HeliosProRingSlot* slot = (HeliosProRingSlot*)ringSlot(tail);
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			uint64_t latencyNs = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec - slot->submitTimeNs;
+			header->packetsSent++;
+			header->latencySumNs += latencyNs;
+			if (latencyNs > header->latencyMaxNs)
+				header->latencyMaxNs = latencyNs;
+
+			// Unless a reset dropped the ring meanwhile
+			__atomic_compare_exchange_n(&header->tail, &tail, tail + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&header->producerWaiting, __ATOMIC_SEQ_CST))
+				spaceCond.notify_all();
+		}
+	}
+}
+
+int HeliosProSim::read(void* buffer, size_t count)
+{
+	if (count != 10)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	advanceMcu(nowUs());
+
+	uint8_t* data = (uint8_t*)buffer;
+	memset(data, 0, count);
+	data[0] = 'G';
+	data[1] = !queued;
+	data[2] = newFrameReady;
+	return count;
+}
+
+int HeliosProSim::write(const void* buffer, size_t count)
+{
+	const uint8_t* data = (const uint8_t*)buffer;
+	if (count > sizeof(writeBuffer.data) || count < 2)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+
+	if (count == 2)
+	{
+		if (data[0] != 'C')
+		{
+			errno = EBADMSG;
+			return -1;
+		}
+
+		HeliosProRingHeader* header = (HeliosProRingHeader*)ring;
+		if (data[1] == 5) // Reset MCU
+		{
+			newFrameReady = false;
+			__atomic_store_n(&header->tail, __atomic_load_n(&header->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+			playing = false;
+			queued = false;
+			lastOutputEndUs = -1;
+			hasTxId = false;
+			newFrameCond.notify_all();
+			spaceCond.notify_all();
+			return 2;
+		}
+		else if (data[1] == HELIOSPRO_COMMAND_RING_KICK)
+		{
+			newFrameCond.notify_all();
+			return 2;
+		}
+		else if (data[1] == HELIOSPRO_COMMAND_RING_WAIT)
+		{
+			spaceCond.wait_for(guard, std::chrono::milliseconds(SIM_RING_WAIT_TIMEOUT_MS), [this] { return ringPending() < HELIOSPRO_SIM_RING_SLOTS || stop; });
+			return 2;
+		}
+
+		errno = EBADMSG;
+		return -1;
+	}
+
+	newFrameCond.wait(guard, [this] { return !newFrameReady || stop; });
+	if (stop)
+	{
+		errno = ESHUTDOWN;
+		return -1;
+	}
+
+	memcpy(writeBuffer.data, data, count);
+	writeBuffer.size = count;
+	newFrameReady = true;
+	newFrameCond.notify_all();
+	return count;
+}
+
+int HeliosProSim::ioctl(unsigned long request, void* arg)
+{
+	if (request != HELIOSPRO_IOC_STATUS)
+	{
+		errno = ENOTTY;
+		return -1;
+	}
+
+	HeliosProStatus* status = (HeliosProStatus*)arg;
+	memset(status, 0, sizeof(*status));
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	double queuedUs = 0;
+	uint32_t pending = ringPending();
+	if (pending <= HELIOSPRO_SIM_RING_SLOTS)
+	{
+		HeliosProRingHeader* header = (HeliosProRingHeader*)ring;
+		uint32_t tail = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+		for (uint32_t i = 0; i < pending; i++)
+		{
+			HeliosProRingSlot* slot = (HeliosProRingSlot*)ringSlot(tail + i);
+			if (slot->size <= sizeof(slot->data))
+				queuedUs += packetDurationUs(slot->data, slot->size);
+		}
+		status->queuedPackets = pending;
+	}
+	if (newFrameReady)
+	{
+		queuedUs += packetDurationUs(writeBuffer.data, writeBuffer.size);
+		status->queuedPackets++;
+	}
+
+	double now = nowUs();
+	advanceMcu(now);
+	if (playing)
+		queuedUs += (playEndUs - now) + (queued ? queuedDurationUs : 0);
+
+	status->queuedUs = (uint32_t)queuedUs;
+	status->mcuReady = !queued;
+	status->underruns = underruns;
+	status->packetsSent = packetsSent;
+	return 0;
+}
+
+void* HeliosProSim::mmap(size_t length)
+{
+	if (length > ringSize)
+	{
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+	return ring;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Userspace stand-in for /dev/heliospro-spi and the buffer MCU behind it, so the HeliosPRO
+// output path can be run and timed on any Linux machine (--heliosprosim).
+//
+// Replicates the spi-helios kernel module: the write() double buffer, the mmap'ed packet ring
+// with its kick/wait commands and the status ioctl. The SPI thread waits for the MCU ready line,
+// transfers packets at the SPI clock and checks their framing. The MCU plays one packet while
+// holding the next one and signals ready as soon as that second place is free. Output timing
+// comes from the timer values in the packet headers.
+//
+// Every packet the MCU starts is logged as one line to the optional log file:
+//	<start time us> <txId> <points> <point period us> <gap to previous packet us>
+
+#define HELIOSPRO_SIM_SPI_HZ 27000000			// In practice around 27 MHz on the board
+#define HELIOSPRO_SIM_RING_SLOTS 8
+#define HELIOSPRO_SIM_MAX_GAP_US 1000000		// Longer gaps between packets are pauses, not underruns
+
+class HeliosProSim
+{
+public:
+	HeliosProSim(const char* logPath);
+	~HeliosProSim();
+
+	// Same semantics as the corresponding calls on the device node
+	int read(void* buffer, size_t count);
+	int write(const void* buffer, size_t count);
+	int ioctl(unsigned long request, void* arg);
+	void* mmap(size_t length);
+
+private:
+	struct Packet
+	{
+		uint8_t data[3800];
+		uint32_t size = 0;
+	};
+
+	std::mutex lock;
+	std::condition_variable newFrameCond;	// SPI thread and write(), like the module's wait queues
+	std::condition_variable spaceCond;		// COMMAND_RING_WAIT
+	std::thread spiThread;
+	bool stop = false;
+
+	// Kernel module state
+	uint8_t* ring = nullptr;
+	size_t ringSize = 0;
+	Packet writeBuffer;
+	bool newFrameReady = false;
+
+	// MCU state, times in us since start
+	bool playing = false;
+	bool queued = false;
+	double playEndUs = 0;
+	double queuedDurationUs = 0;
+	double lastOutputEndUs = -1;
+	uint8_t expectedTxId = 0;
+	bool hasTxId = false;
+
+	// Statistics
+	uint32_t underruns = 0;
+	uint64_t packetsSent = 0;
+	uint64_t pointsPlayed = 0;
+	unsigned framingErrors = 0;
+	unsigned lostPackets = 0;
+	double idleUs = 0;
+	double firstOutputUs = -1;
+
+	struct timespec startTime;
+	FILE* logFile = nullptr;
+
+	double nowUs();
+	uint32_t ringPending();
+	bool ringHasPacket();
+	uint8_t* ringSlot(uint32_t index);
+	void advanceMcu(double now);
+	void deliver(const uint8_t* data, uint32_t size);
+	void spiLoop();
+};
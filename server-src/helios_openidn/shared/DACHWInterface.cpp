@@ -4,6 +4,7 @@
 #include <math.h>
 
 #include "../output/RTLaproGraphOut.hpp"
+#include "../ManagementInterface.hpp"
 #include "DACHWInterface.hpp"
 
 
@@ -22,6 +23,14 @@ void DACHWInterface::commitChunk(TransformEnv &tfEnv, std::shared_ptr<SliceBuf>
 }
 
 
+std::shared_ptr<const SliceBuf> DACHWInterface::flushWave(TransformEnv &tfEnv)
+{
+    std::shared_ptr<SliceBuf> sliceBuf(new SliceBuf);
+    commitChunk(tfEnv, sliceBuf);
+    return sliceBuf;
+}
+
+
 int DACHWInterface::enable()
 {
     // Note: Called from server context !!
@@ -57,16 +66,92 @@ int DACHWInterface::putBuffer(ODF_TAXI_BUFFER *taxiBuffer)
     }
     else
     {
+        // Stamp the arrival here, the driver may pick the chunk up much later
+        if(taxiBuffer->getMemoSize() >= sizeof(LAPRO_CHUNK_MEMO))
+            clock_gettime(CLOCK_MONOTONIC, &((LAPRO_CHUNK_MEMO *)(taxiBuffer->getMemoPtr()))->arrivalTime);
+
         return Inherited::putBuffer(taxiBuffer);
     }
 }
 
 
-std::shared_ptr<SliceBuf> DACHWInterface::getNextBuffer(TransformEnv &tfEnv, unsigned &driverMode)
+void DACHWInterface::putLocalFrame(const std::shared_ptr<const SliceBuf>& slices, uint16_t lastX, uint16_t lastY, int outputMode)
+{
+    // Note: Called from local source context !!
+    // -------------------------------------------------------------------------
+
+    LocalFrame frame;
+    frame.slices = slices;
+    frame.durationUs = 0;
+    for(const auto& slice : *slices)
+        frame.durationUs += slice->durationUs;
+    frame.lastX = lastX;
+    frame.lastY = lastY;
+    frame.outputMode = outputMode;
+    clock_gettime(CLOCK_MONOTONIC, &frame.arrivalTime);
+
+    cmdMutex.lock();
+    localFrames.push_back(frame);
+    localQueuedUs += frame.durationUs;
+    localActive = true;
+    cmdMutex.unlock();
+}
+
+
+void DACHWInterface::endLocalFrames()
+{
+    // Note: Called from local source context !!
+    // -------------------------------------------------------------------------
+
+    cmdMutex.lock();
+    localFrames.clear();
+    localQueuedUs = 0;
+    localActive = false;
+    cmdMutex.unlock();
+}
+
+
+double DACHWInterface::localQueuedDurationUs()
+{
+    std::lock_guard<std::mutex> lock(cmdMutex);
+    return localQueuedUs;
+}
+
+
+std::shared_ptr<const SliceBuf> DACHWInterface::getNextBuffer(TransformEnv &tfEnv, unsigned &driverMode)
 {
     // Note: Called from adapter context !!
     // -------------------------------------------------------------------------
 
+    // Local frames are handed over one at a time, like scan-once frames. They are only queued while
+    // the local source owns the output, so there is no IDN input to interleave with.
+    cmdMutex.lock();
+    if(!localFrames.empty())
+    {
+        LocalFrame frame = localFrames.front();
+        localFrames.erase(localFrames.begin());
+        localQueuedUs = localFrames.empty() ? 0 : localQueuedUs - frame.durationUs;
+        cmdMutex.unlock();
+
+        driverMode = DRIVER_FRAMEMODE;
+        tfEnv.db25Accu.clear();
+        tfEnv.scanOnce = true;
+        tfEnv.lastX = frame.lastX;
+        tfEnv.lastY = frame.lastY;
+        tfEnv.outputMode = frame.outputMode;
+        tfEnv.arrivalTime = frame.arrivalTime;
+        return frame.slices;
+    }
+    bool localWaiting = localActive;
+    cmdMutex.unlock();
+
+    // Between local frames the driver waits in frame mode instead of going idle
+    if(localWaiting && !enabledFlag)
+    {
+        driverMode = DRIVER_FRAMEMODE;
+        return nullptr;
+    }
+
     std::shared_ptr<SliceBuf> sliceBuf(new SliceBuf);
 
     while(1)
@@ -99,6 +184,7 @@ std::shared_ptr<SliceBuf> DACHWInterface::getNextBuffer(TransformEnv &tfEnv, uns
             isWave = (memo->type == LAPRO_CHUNK_TYPE_WAVE);
             scanOnce = (memo->type == LAPRO_CHUNK_TYPE_FRAME_ONCE);
             isDiscontinuous = memo->isDiscontinuous;
+            tfEnv.arrivalTime = memo->arrivalTime;
 
             // Decode the input samples into the internally used struct
             unsigned sampleSize = decoder->getSampleSize();
@@ -183,6 +269,8 @@ std::shared_ptr<SliceBuf> DACHWInterface::getNextBuffer(TransformEnv &tfEnv, uns
 
         // The driver may stay in the current mode, change mode or become active.
         driverMode = isWave ? DRIVER_WAVEMODE : DRIVER_FRAMEMODE;
+        tfEnv.scanOnce = scanOnce;
+        tfEnv.outputMode = OUTPUT_MODE_IDN;
 
         // When in frame mode - clear all current data (since new data came in - overrun)
         if (driverMode == DRIVER_FRAMEMODE)
@@ -197,10 +285,19 @@ std::shared_ptr<SliceBuf> DACHWInterface::getNextBuffer(TransformEnv &tfEnv, uns
         std::vector<ISPDB25Point> repairDb25Samples;
         if (sampleCount > 1 && isWave)
         {
+            bool concealing = (tfEnv.concealer != nullptr) && tfEnv.concealer->isEnabled();
+            double inputPointDuration = (double)duration / sampleCount;
+
             if (isDiscontinuous)
             {
                 uint32_t timeskip = duration * 0.9; // A guess, since chunks should be roughly uniformly sized
-                if (timeskip > 10 && timeskip < 1000000)
+                if (timeskip > 10 && timeskip < 1000000 && concealing)
+                {
+                    unsigned numConcealedPoints = tfEnv.concealer->conceal(repairDb25Samples, timeskip, inputPointDuration);
+                    sampleCount += numConcealedPoints;
+                    printf("[WAR] wave timestamp mismatch. concealing %u points, %u us\n", numConcealedPoints, timeskip);
+                }
+                else if (timeskip > 10 && timeskip < 1000000)
                 {
                     uint16_t newX = db25Samples.front().x;
                     uint16_t newY = db25Samples.front().y;
@@ -224,6 +321,18 @@ std::shared_ptr<SliceBuf> DACHWInterface::getNextBuffer(TransformEnv &tfEnv, uns
                     }
                 }
             }
+
+            // After an underrun or gap was concealed, move to the new data and fade it in
+            if (concealing)
+            {
+                if (tfEnv.concealer->isActive())
+                {
+                    size_t numConcealedPoints = repairDb25Samples.size();
+                    tfEnv.concealer->rampIn(repairDb25Samples, db25Samples, inputPointDuration);
+                    sampleCount += repairDb25Samples.size() - numConcealedPoints;
+                }
+                tfEnv.concealer->record(db25Samples, inputPointDuration);
+            }
             previousX = db25Samples.back().x;
             previousY = db25Samples.back().y;
         }
@@ -234,12 +343,27 @@ std::shared_ptr<SliceBuf> DACHWInterface::getNextBuffer(TransformEnv &tfEnv, uns
         double targetPointRate = ((1000000.0 * (double)sampleCount) / (double)duration);
         double rateRatio = maxPointrate() / targetPointRate;
 
+        //reduce the points if the maximum device pointrate is exceeded.
+        //the remaining points take over the duration of the dropped ones.
+        //concealed or interpolated points are reduced together with the chunk they lead into.
+        if (rateRatio < 1.0 && tfEnv.reducer != nullptr)
+        {
+            if (!repairDb25Samples.empty())
+            {
+                db25Samples.insert(db25Samples.begin(), repairDb25Samples.begin(), repairDb25Samples.end());
+                repairDb25Samples.clear();
+            }
+            tfEnv.reducer->reduce(db25Samples, PointReducer::keepCount(db25Samples.size(), rateRatio, tfEnv.reduceCarry));
+            pointDuration = pointDuration * sampleCount / db25Samples.size();
+            sampleCount = db25Samples.size();
+        }
+
         for (auto combinedVector : { &repairDb25Samples, &db25Samples })
         {
             for (auto& sample : *combinedVector)
             {
-                //start downsampling if the maximum device pointrate is exceeded
-                if (rateRatio < 1.0)
+                //without a reducer, downsample if the maximum device pointrate is exceeded
+                if (rateRatio < 1.0 && tfEnv.reducer == nullptr)
                 {
                     //skip point, but act like it was added
                     //this keeps rateRatio% of points
@@ -286,9 +410,16 @@ std::shared_ptr<SliceBuf> DACHWInterface::getNextBuffer(TransformEnv &tfEnv, uns
             }
         }
 
+        tfEnv.lastX = db25Samples.back().x;
+        tfEnv.lastY = db25Samples.back().y;
+
         if (driverMode == DRIVER_FRAMEMODE)
         {
             commitChunk(tfEnv, sliceBuf);
+
+            // Scan-once frames are output in sequence - leave any following frames queued
+            if (scanOnce)
+                break;
         }
     }
     return sliceBuf;
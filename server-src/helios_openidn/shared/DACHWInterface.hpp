@@ -6,9 +6,14 @@
 #include "ISPDB25Point.h"
 
 #include "LaproAdapter.hpp"
+#include "WaveConcealer.hpp"
+#include "PointReducer.hpp"
 
 
 #include <mutex>
+#include <deque>
+#include <vector>
+#include <time.h>
 
 
 class TransformEnv
@@ -20,7 +25,30 @@ class TransformEnv
     double currentSliceTime;
 
     std::vector<ISPDB25Point> db25Accu;
+
+    //drops points beyond the maximum device pointrate, owned by the driver. the fraction of
+    //a point left over by the last chunk is carried to the next one.
+    PointReducer* reducer = nullptr;
+    double reduceCarry = 0;
+
+    //without a reducer, evenly spaced points are skipped instead
     double skipCounter = 0;
+
+    //the last returned frame is to be scanned a single time (LAPRO_CHUNK_TYPE_FRAME_ONCE)
+    bool scanOnce = false;
+
+    //position of the last input sample
+    uint16_t lastX = 0x8000;
+    uint16_t lastY = 0x8000;
+
+    //output mode (OUTPUT_MODE_*, 0 = IDN) the driver requests for the last returned buffer
+    int outputMode = 0;
+
+    //time the last returned buffer was queued to the adapter (CLOCK_MONOTONIC)
+    struct timespec arrivalTime = { 0, 0 };
+
+    //wave mode gap concealment, owned by the driver
+    WaveConcealer* concealer = nullptr;
 };
 
 
@@ -32,6 +60,14 @@ class DACHWInterface: public LaproAdapter
 	//writes byte data to a hardware interface
 	virtual int writeFrame(const TimeSlice& slice, double duration) = 0;
 
+	//whether the device can repeat a frame by itself, see writeLoopingFrame
+	virtual bool canLoopFrames() { return false; }
+
+	//writes a whole frame of at most maxBytesPerTransmission bytes that the device
+	//keeps repeating until the next write. returns a negative value if the frame
+	//could not be written this way.
+	virtual int writeLoopingFrame(const TimeSlice& slice, double duration) { return -1; }
+
 	//converts ISPDB25 Points to bytes in a way that the hardware expects
 	//points the outputBuf pointer to a vector and returns the total
 	//number of bytes.
@@ -49,6 +85,14 @@ class DACHWInterface: public LaproAdapter
 	virtual unsigned maxPointrate() = 0;
 	virtual void setMaxPointrate(unsigned) = 0;
 
+	//prints transfer statistics since the previous call, appended to the
+	//simple debug output of the bridge
+	virtual void printStats() {}
+
+	//duration of the output that has been written to the device but not
+	//emitted yet, in us. negative if the device can't tell.
+	virtual double queuedDurationUs() { return -1; }
+
 
     // -----------------------------------------------------
 
@@ -63,13 +107,40 @@ class DACHWInterface: public LaproAdapter
     uint16_t previousX;
     uint16_t previousY;
 
+    // Frames from local sources, guarded by cmdMutex
+    typedef struct
+    {
+        std::shared_ptr<const SliceBuf> slices;
+        unsigned durationUs;
+        uint16_t lastX;
+        uint16_t lastY;
+        int outputMode;
+        struct timespec arrivalTime;
+    } LocalFrame;
+    std::vector<LocalFrame> localFrames;    // keeps its capacity, so queuing a frame does not allocate
+    bool localActive = false;
+    double localQueuedUs = 0;
+
     protected:
     virtual int enable();
     virtual void disable();
 
     public:
     virtual int putBuffer(ODF_TAXI_BUFFER *taxiBuffer);
-    virtual std::shared_ptr<SliceBuf> getNextBuffer(TransformEnv &tfEnv, unsigned &driverMode);
+    virtual std::shared_ptr<const SliceBuf> getNextBuffer(TransformEnv &tfEnv, unsigned &driverMode);
+
+    //commits the wave points still waiting for their slice to fill, so the end of the input is not
+    //held back while the output runs dry. returns an empty buffer if there are none.
+    std::shared_ptr<const SliceBuf> flushWave(TransformEnv &tfEnv);
+
+    //queues an already converted frame from a local source (e.g. the file player) to be output by the
+    //driver thread like a scan-once IDN frame. frames are output in sequence and the driver stays in
+    //frame mode between them until endLocalFrames() is called. the slices are output without copying them.
+    void putLocalFrame(const std::shared_ptr<const SliceBuf>& slices, uint16_t lastX, uint16_t lastY, int outputMode);
+    void endLocalFrames();
+
+    //duration of the local frames that have not been picked up by the driver yet, in us
+    double localQueuedDurationUs();
 };
 
 #endif
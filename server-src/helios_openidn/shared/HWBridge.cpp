@@ -4,12 +4,27 @@
 extern ManagementInterface* management;
 
 
-double HWBridge::calculateSpeedfactor(double currentSpeed, std::shared_ptr<SliceBuf> buffer) {
+//microseconds from one CLOCK_MONOTONIC time to a later one, without overflow on long stalls
+static uint64_t elapsedUs(const struct timespec& from, const struct timespec& to)
+{
+	int64_t ns = (int64_t)(to.tv_sec - from.tv_sec) * 1000000000 + (to.tv_nsec - from.tv_nsec);
+	return (ns > 0) ? (uint64_t)ns / 1000 : 0;
+}
+
+
+double HWBridge::calculateSpeedfactor(double currentSpeed, std::shared_ptr<const SliceBuf> buffer) {
 	double sm = 6;
 	if(buffer->size() != 0) {
 		double center = this->bufferTargetMs;
 		//bufusage in ms = bufsize * avg slice duration
 		double bufUsageMs = (double)buffer->size()*(double)buffer->front()->durationUs / 1000.0;
+
+		//output already queued in the device is still ahead of the laser, devices
+		//with deep queues would otherwise drain the buffer and get sped up
+		double deviceQueuedUs = device->queuedDurationUs();
+		if(deviceQueuedUs > 0)
+			bufUsageMs += deviceQueuedUs / 1000.0;
+
 		double error = (center - bufUsageMs);
 		double offCenter = error * error * error / center;
 		this->accumOC += offCenter;
@@ -19,7 +34,7 @@ double HWBridge::calculateSpeedfactor(double currentSpeed, std::shared_ptr<Slice
 			newSpeed = (newSpeed + ((sm-1)*currentSpeed))/sm;
 
 		if (debug == DEBUGSIMPLE)
-			printf("Calculating speed factor: center %.2f, bufUsageMs %.2f, buffer->size() %.2f, buffer->front()->durationUs %.2f, accumOC %.2f, newSpeed %.2f \n", center, bufUsageMs, (double)buffer->size(), (double)buffer->front()->durationUs, this->accumOC, newSpeed);
+			printf("Calculating speed factor: center %.2f, bufUsageMs %.2f, deviceQueuedUs %.0f, buffer->size() %.2f, buffer->front()->durationUs %.2f, accumOC %.2f, newSpeed %.2f \n", center, bufUsageMs, deviceQueuedUs, (double)buffer->size(), (double)buffer->front()->durationUs, this->accumOC, newSpeed);
 
 		//return 1;
 		return std::min(1.3, std::max(0.8, newSpeed));
@@ -35,6 +50,21 @@ void HWBridge::clearStats() {
 	numberOfPoints.clear();
 	waveBufUsage.clear();
 	speedFactors.clear();
+	swapLatencies.clear();
+	writeGaps.clear();
+	loopUploads = 0;
+	loopSkips = 0;
+}
+
+
+bool HWBridge::shouldSwapFrame(double remainingUs) {
+	if(frameSwapPolicy == FRAMESWAP_IMMEDIATE)
+		return true;
+	else if(frameSwapPolicy == FRAMESWAP_BOUNDED)
+		return (remainingUs / 1000.0) > frameSwapMaxWaitMs;
+
+	//FRAMESWAP_FRAMEEND: the swap happens once the rotation is complete
+	return false;
 }
 
 
@@ -42,11 +72,29 @@ HWBridge::HWBridge(std::shared_ptr<DACHWInterface> hwDeviceInterface) : device(h
 {
 }
 
-void HWBridge::outputEmptyPoint()
+HWBridge::~HWBridge()
+{
+	stop();
+}
+
+void HWBridge::stop()
+{
+	//the preparation thread uses the device and the bridge, it ends before either goes away
+	{
+		std::lock_guard<std::mutex> lock(prepMutex);
+		prepStop = true;
+	}
+	prepNotFull.notify_all();
+
+	if(prepThread.joinable())
+		prepThread.join();
+}
+
+void HWBridge::outputEmptyPoint(uint16_t x, uint16_t y)
 {
 	ISPDB25Point point;
-	point.x = 0x8000;
-	point.y = 0x8000; 
+	point.x = x;
+	point.y = y;
 	point.r = 0x0000;
 	point.g = 0x0000;
 	point.b = 0x0000;
@@ -66,17 +114,255 @@ void HWBridge::outputEmptyPoint()
 	this->device->writeFrame(emptySlice, emptySlice.durationUs);
 }
 
+void HWBridge::outputConcealment()
+{
+	//points at the rate of the interrupted wave, limited by the device
+	double pointDurationUs = std::max(concealer.getPointDurationUs(), 1000000.0 / (double)device->maxPointrate());
+
+	std::vector<ISPDB25Point> concealmentPoints;
+	concealer.conceal(concealmentPoints, CONCEAL_SLICE_US, pointDurationUs);
+	if (concealmentPoints.empty())
+		return;
+
+	TimeSlice concealmentSlice;
+	concealmentSlice.dataChunk = this->device->convertPoints(concealmentPoints);
+	concealmentSlice.durationUs = concealmentPoints.size() * pointDurationUs;
+	this->device->writeFrame(concealmentSlice, concealmentSlice.durationUs);
+}
+
+bool HWBridge::uploadLoopingFrame(const std::shared_ptr<const SliceBuf>& frameBuf, int outputMode)
+{
+	//merge the slices of the frame into a single transmission
+	TimeSlice frame;
+	frame.durationUs = 0;
+	for(const auto& slice : *frameBuf) {
+		if(frame.dataChunk.size() + slice->dataChunk.size() > device->maxBytesPerTransmission())
+			return false;
+		frame.dataChunk.insert(frame.dataChunk.end(), slice->dataChunk.begin(), slice->dataChunk.end());
+		frame.durationUs += slice->durationUs;
+	}
+
+	//unchanged content keeps looping on the device without a transfer
+	if(loopingActive && frame.durationUs == loopedFrame.durationUs && frame.dataChunk == loopedFrame.dataChunk) {
+		loopSkips++;
+		return true;
+	}
+
+	if(!management->requestOutput(outputMode))
+		return false;
+	hasStopped = false;
+
+	if(device->writeLoopingFrame(frame, frame.durationUs) < 0)
+		return false;
+
+	loopedFrame = std::move(frame);
+	loopUploads++;
+	return true;
+}
+
+void HWBridge::stopLoopingFrame(uint16_t x, uint16_t y)
+{
+	//a single blanked point replaces the frame repeated by the device
+	if(loopingActive) {
+		outputEmptyPoint(x, y);
+		loopingActive = false;
+	}
+}
+
+void HWBridge::applySliceLength(TransformEnv& tfEnv)
+{
+	//apply slice length changes, keeping the time already accumulated in the current slice
+	double targetUsPerSlice = preparedUsPerSlice;
+	if(tfEnv.usPerSlice != targetUsPerSlice) {
+		tfEnv.currentSliceTime += targetUsPerSlice - tfEnv.usPerSlice;
+		tfEnv.usPerSlice = targetUsPerSlice;
+	}
+}
+
+void HWBridge::prepLoop()
+{
+	//runs just below the driver thread priority, so decoding never delays a write
+	struct sched_param sp;
+	int policy;
+	if(pthread_getschedparam(pthread_self(), &policy, &sp) == 0 && policy == SCHED_RR) {
+		sp.sched_priority = std::max(sched_get_priority_min(SCHED_RR), sp.sched_priority - 1);
+		pthread_setschedparam(pthread_self(), SCHED_RR, &sp);
+	}
+
+	TransformEnv tfEnv;
+	tfEnv.usPerSlice = preparedUsPerSlice;
+	tfEnv.currentSliceTime = tfEnv.usPerSlice;
+	tfEnv.concealer = &concealer;
+	tfEnv.reducer = &reducer;
+
+	unsigned driverMode = DRIVER_INACTIVE;
+
+	while (!prepStop) {
+		//wait for a free slot
+		{
+			std::unique_lock<std::mutex> lock(prepMutex);
+			prepNotFull.wait_for(lock, std::chrono::milliseconds(3), [this] { return prepStop || prepRing.size() < PREP_RING_SLOTS; });
+			if(prepStop || prepRing.size() >= PREP_RING_SLOTS)
+				continue;
+		}
+
+		applySliceLength(tfEnv);
+
+		std::shared_ptr<const SliceBuf> bufPtr = device->getNextBuffer(tfEnv, driverMode);
+		if((bufPtr.get() != nullptr) && (bufPtr->size() > 0)) {
+			PreparedBuffer prepared;
+			prepared.bufPtr = bufPtr;
+			prepared.driverMode = driverMode;
+			prepared.scanOnce = tfEnv.scanOnce;
+			prepared.lastX = tfEnv.lastX;
+			prepared.lastY = tfEnv.lastY;
+			prepared.outputMode = tfEnv.outputMode;
+			prepared.arrivalTime = tfEnv.arrivalTime;
+
+			std::lock_guard<std::mutex> lock(prepMutex);
+			prepRing.push_back(prepared);
+			preparedDriverMode = driverMode;
+			continue;
+		}
+
+		//nothing queued: publish the mode only once everything before it has been handed over,
+		//then wait for input, 3ms idle, 0.1ms active, unless the bridge stops
+		{
+			std::unique_lock<std::mutex> lock(prepMutex);
+			preparedDriverMode = driverMode;
+
+			//the driver ran dry and asks for the points still waiting for their slice
+			if(waveTailRequested) {
+				waveTailBufPtr = device->flushWave(tfEnv);
+				waveTailRequested = false;
+			}
+
+			std::chrono::microseconds delay((driverMode == DRIVER_INACTIVE) ? 3000 : 100);
+			prepNotFull.wait_for(lock, delay, [this] { return prepStop.load(); });
+		}
+	}
+}
+
+//takes the wave points still waiting for their slice to fill. the preparation thread owns them in
+//the staged pipeline, so the first call only asks for them and returns false until they are handed over
+bool HWBridge::takeWaveTail(TransformEnv& tfEnv, std::shared_ptr<const SliceBuf>& tailBufPtr)
+{
+	if(!staged) {
+		tailBufPtr = device->flushWave(tfEnv);
+		return true;
+	}
+
+	std::lock_guard<std::mutex> lock(prepMutex);
+	if(waveTailBufPtr != nullptr) {
+		tailBufPtr = waveTailBufPtr;
+		waveTailBufPtr = nullptr;
+		return true;
+	}
+
+	waveTailRequested = true;
+	return false;
+}
+
+std::shared_ptr<const SliceBuf> HWBridge::fetchNextBuffer(TransformEnv& tfEnv, unsigned& driverMode, bool& scanOnce, struct timespec& arrivalTime)
+{
+	if(!staged) {
+		applySliceLength(tfEnv);
+		std::shared_ptr<const SliceBuf> bufPtr = device->getNextBuffer(tfEnv, driverMode);
+		scanOnce = tfEnv.scanOnce;
+		arrivalTime = tfEnv.arrivalTime;
+		return bufPtr;
+	}
+
+	std::lock_guard<std::mutex> lock(prepMutex);
+	if(prepRing.empty()) {
+		driverMode = preparedDriverMode;
+		return nullptr;
+	}
+
+	PreparedBuffer prepared = prepRing.front();
+	prepRing.pop_front();
+
+	if(prepared.driverMode == DRIVER_WAVEMODE) {
+		//hand over all prepared wave chunks at once, the speed control looks at the whole buffer.
+		//a wave tail the driver has not picked up yet precedes the input that followed it.
+		if(waveTailBufPtr != nullptr || (!prepRing.empty() && prepRing.front().driverMode == DRIVER_WAVEMODE)) {
+			std::shared_ptr<SliceBuf> merged(new SliceBuf);
+			if(waveTailBufPtr != nullptr)
+				merged->insert(merged->end(), waveTailBufPtr->begin(), waveTailBufPtr->end());
+			merged->insert(merged->end(), prepared.bufPtr->begin(), prepared.bufPtr->end());
+			while(!prepRing.empty() && prepRing.front().driverMode == DRIVER_WAVEMODE) {
+				merged->insert(merged->end(), prepRing.front().bufPtr->begin(), prepRing.front().bufPtr->end());
+				prepRing.pop_front();
+			}
+			prepared.bufPtr = merged;
+		}
+	} else {
+		//repeating frames are superseded by newer frames, like getNextBuffer does
+		while(!prepared.scanOnce && !prepRing.empty() && prepRing.front().driverMode == DRIVER_FRAMEMODE) {
+			prepared = prepRing.front();
+			prepRing.pop_front();
+		}
+	}
+	waveTailBufPtr = nullptr;
+	prepNotFull.notify_one();
+
+	driverMode = prepared.driverMode;
+	scanOnce = prepared.scanOnce;
+	arrivalTime = prepared.arrivalTime;
+	tfEnv.lastX = prepared.lastX;
+	tfEnv.lastY = prepared.lastY;
+	tfEnv.outputMode = prepared.outputMode;
+	return prepared.bufPtr;
+}
+
 void HWBridge::driverLoop()
 {
     unsigned driverMode = DRIVER_INACTIVE;
     unsigned sliceCounter = 0;
 
-    std::shared_ptr<SliceBuf> currentBufPtr(new SliceBuf);
+    //the buffers are shared with their source and not modified, the position of the next slice
+    //rotates through a repeating frame and reaches the end of anything else once it is output
+    std::shared_ptr<const SliceBuf> currentBufPtr(new SliceBuf);
+    size_t currentPos = 0;
     double speedFactor = 1.0;
 
+    //a frame that arrived while the current frame was being scanned, waiting for its swap
+    std::shared_ptr<const SliceBuf> pendingBufPtr = nullptr;
+    unsigned pendingDriverMode = DRIVER_INACTIVE;
+    bool pendingScanOnce = false;
+    int pendingOutputMode = OUTPUT_MODE_IDN;
+    struct timespec pendingArrivalTime = {};
+    struct timespec frameArrivalTime = {};
+    bool awaitingFirstPoint = false;
+
+    //the current frame is scanned a single time and not repeated
+    bool currentScanOnce = false;
+
+    //output mode requested for the current buffer, IDN or a local source like the file player
+    int currentOutputMode = OUTPUT_MODE_IDN;
+
+    //a scan-once frame that nothing followed yet is blanked at its last position shortly before
+    //the device runs out, a frame that arrives until then follows it without the blank
+    bool blankPending = false;
+    double blankDueUs = 0;
+    uint16_t blankX = 0x8000, blankY = 0x8000;
+    double lastWriteUs = 0;
+
     TransformEnv tfEnv;
     tfEnv.usPerSlice = usPerSlice;
     tfEnv.currentSliceTime = usPerSlice;
+    tfEnv.concealer = &concealer;
+    tfEnv.reducer = &reducer;
+
+    //gap between the end of a write and the start of the next one
+    struct timespec lastWriteEnd = {};
+    bool hasLastWrite = false;
+
+    //the end of the wave input has been output at the start of the current underrun
+    bool waveTailTaken = false;
+
+    if(staged && !prepThread.joinable())
+        prepThread = std::thread(&HWBridge::prepLoop, this);
 
     struct timespec lastDebugTime;
 	clock_gettime(CLOCK_MONOTONIC, &lastDebugTime);
@@ -110,36 +396,142 @@ void HWBridge::driverLoop()
 					}
 
 					printf("%.2f ms Buf. Usage ", sum / (1000.0*waveBufStatSize));
+
+					if(concealer.isEnabled())
+						printf("%.2f ms Concealed ", concealer.getSessionMs());
+				}
+
+				//frame arrival to first point latency of the previous second
+				if(driverMode == DRIVER_FRAMEMODE && swapLatencies.size() > 0) {
+					double sum = 0;
+					unsigned max = 0;
+					for(unsigned latency : swapLatencies) {
+						sum += latency;
+						max = std::max(max, latency);
+					}
+
+					printf("%.2f ms avg / %.2f ms max Swap Latency ", sum / (1000.0*(double)swapLatencies.size()), (double)max / 1000.0);
 				}
 
+				//frames repeated by the device instead of being rewritten
+				if(driverMode == DRIVER_FRAMEMODE && (loopUploads > 0 || loopSkips > 0))
+					printf("%u Loop Uploads %u Unchanged ", loopUploads, loopSkips);
+
+				//worst gap between consecutive writes of the previous second
+				if(writeGaps.size() > 0)
+					printf("%.2f ms max Write Gap ", (double)*std::max_element(writeGaps.begin(), writeGaps.end()) / 1000.0);
+
+				//points dropped to stay within the maximum pointrate of the device
+				reducer.printStats();
+
+				device->printStats();
+
 				printf("\n");
 				clearStats();
 				lastDebugTime = now;
 			}
 		}
 
-		std::shared_ptr<SliceBuf> nextBufPtr = device->getNextBuffer(tfEnv, driverMode);
+		if(autoTuner.isEnabled() && driverMode == DRIVER_WAVEMODE) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if(autoTuner.update(now.tv_sec * 1000000.0 + now.tv_nsec / 1000.0, usPerSlice, bufferTargetMs)) {
+				preparedUsPerSlice = usPerSlice;
+				if(debug != NODEBUG)
+					printf("Auto-tune: chunk length %.0f us, buffer target %.1f ms\n", usPerSlice, bufferTargetMs);
+			}
+		}
+
+		std::shared_ptr<const SliceBuf> nextBufPtr = nullptr;
+		bool nextScanOnce = false;
+		int nextOutputMode = OUTPUT_MODE_IDN;
+		struct timespec nextArrivalTime;
+
+		if((pendingBufPtr != nullptr) && (pendingScanOnce || (pendingDriverMode != DRIVER_FRAMEMODE)))
+		{
+			//scan-once frames are output in sequence and never superseded, and neither is
+			//a wave chunk that ended the previous scan by changing the mode
+			nextBufPtr = pendingBufPtr;
+			nextScanOnce = pendingScanOnce;
+			nextOutputMode = pendingOutputMode;
+			nextArrivalTime = pendingArrivalTime;
+			driverMode = pendingDriverMode;
+		}
+		else
+		{
+			nextBufPtr = fetchNextBuffer(tfEnv, driverMode, nextScanOnce, nextArrivalTime);
+			nextOutputMode = tfEnv.outputMode;
+
+			//a frame picked up during the previous scan is used unless something newer came in
+			if(((nextBufPtr.get() == nullptr) || (nextBufPtr->size() == 0)) && (pendingBufPtr != nullptr) && (driverMode != DRIVER_INACTIVE))
+			{
+				nextBufPtr = pendingBufPtr;
+				nextScanOnce = pendingScanOnce;
+				nextOutputMode = pendingOutputMode;
+				nextArrivalTime = pendingArrivalTime;
+			}
+		}
+		pendingBufPtr = nullptr;
+
 		if((nextBufPtr.get() != nullptr) && (nextBufPtr->size() > 0))
 		{
+			blankPending = false;
+			waveTailTaken = false;
 			currentBufPtr = nextBufPtr;
+			currentPos = 0;
+			currentScanOnce = false;
+			currentOutputMode = nextOutputMode;
 
 			//only trim and adjust speed in wave mode
 			if(driverMode == DRIVER_WAVEMODE) {
 				speedFactor = calculateSpeedfactor(speedFactor, currentBufPtr);
+				awaitingFirstPoint = false;
+				loopingActive = false;
+				autoTuner.addArrival(nextArrivalTime.tv_sec * 1000000.0 + nextArrivalTime.tv_nsec / 1000.0);
 			} else if (driverMode == DRIVER_FRAMEMODE) {
 				speedFactor = 1.0;
+				currentScanOnce = nextScanOnce;
+				frameArrivalTime = nextArrivalTime;
+				awaitingFirstPoint = true;
+
+				//repeating frames that fit a single transmission are looped by the device,
+				//an immediate swap needs the rotation below to be able to abort the scan
+				bool canLoop = deviceLoop && !currentScanOnce && frameSwapPolicy != FRAMESWAP_IMMEDIATE && device->canLoopFrames();
+				loopingActive = canLoop && uploadLoopingFrame(currentBufPtr, currentOutputMode);
+				if(loopingActive) {
+					hasUnderrun = false;
+					if(debug != NODEBUG) {
+						struct timespec now;
+						clock_gettime(CLOCK_MONOTONIC, &now);
+						swapLatencies.push_back(elapsedUs(frameArrivalTime, now));
+					}
+					awaitingFirstPoint = false;
+					continue;
+				}
 			}
 		}
 		else if(driverMode == DRIVER_WAVEMODE || driverMode == DRIVER_INACTIVE)
 		{
+			//the output ends, a scan-once frame still waiting for its blank gets it now
+			if(blankPending) {
+				outputEmptyPoint(blankX, blankY);
+				blankPending = false;
+			}
+			stopLoopingFrame(tfEnv.lastX, tfEnv.lastY);
+
 			//write an empty point if there is a buffer underrun in wave mode or
 			//the driver is set to inactive
 			//printf("I am printing empty frames because I am annoying");
 			//soutputEmptyPoint();
 
 			if (!hasUnderrun)
+			{
 				printf("Underrun\n");
+				if (driverMode == DRIVER_WAVEMODE)
+					autoTuner.addUnderrun();
+			}
 			hasUnderrun = true;
+			hasLastWrite = false;
 
 			if (driverMode == DRIVER_INACTIVE)
 			{
@@ -152,10 +544,38 @@ void HWBridge::driverLoop()
 				delay.tv_nsec = 3000000; //3ms
 				nanosleep(&delay, &dummy);
 
-				if (!hasStopped)
+				//local sources like the file player give up the output themselves
+				if (!hasStopped && currentOutputMode == OUTPUT_MODE_IDN)
+				{
 					management->relinquishOutput(OUTPUT_MODE_IDN);
+
+					double concealedMs = concealer.endSession();
+					if (concealedMs > 0)
+						printf("Concealed %.1f ms of wave output during session\n", concealedMs);
+				}
 				hasStopped = true;
 			}
+			else if (concealer.isEnabled() && concealer.canConceal() && !hasStopped)
+			{
+				//the end of the input goes out first, then the device is kept fed with
+				//concealment points until data resumes
+				std::shared_ptr<const SliceBuf> tailBufPtr;
+				if (waveTailTaken)
+					outputConcealment();
+				else if (takeWaveTail(tfEnv, tailBufPtr))
+				{
+					waveTailTaken = true;
+					for (auto& slice : *tailBufPtr)
+						device->writeFrame(*slice, speedFactor * slice->durationUs);
+				}
+				else
+				{
+					struct timespec delay, dummy;
+					delay.tv_sec = 0;
+					delay.tv_nsec = 100000; //0.1 ms
+					nanosleep(&delay, &dummy);
+				}
+			}
 			else
 			{
 				struct timespec delay, dummy;
@@ -166,23 +586,94 @@ void HWBridge::driverLoop()
 
 			continue;
 		}
+		else if(loopingActive)
+		{
+			//the device repeats the current frame, only watch for a new one. a new frame replaces
+			//the looped one at the end of its current pass anyway, so polling more often than every
+			//2 ms only costs wakeups.
+			struct timespec delay, dummy;
+			delay.tv_sec = 0;
+			delay.tv_nsec = 2000000; //2 ms
+			nanosleep(&delay, &dummy);
+
+			continue;
+		}
+		else if(currentPos >= currentBufPtr->size())
+		{
+			//a scan-once frame has been output, wait for the next frame and blank once the device
+			//is about to run out
+			if(blankPending) {
+				struct timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				if(now.tv_sec * 1000000.0 + now.tv_nsec / 1000.0 >= blankDueUs) {
+					outputEmptyPoint(blankX, blankY);
+					blankPending = false;
+				}
+			}
+
+			struct timespec delay, dummy;
+			delay.tv_sec = 0;
+			delay.tv_nsec = 100000; //0.1 ms
+			nanosleep(&delay, &dummy);
+
+			continue;
+		}
 		//else
 		//	std::this_thread::yield();
 
 		hasUnderrun = false;
 
-		//rotate through the buffer once
+		//remaining slices of the current rotation, a repeating frame has all of them again
 		unsigned currentBufSize = currentBufPtr->size();
+		if(driverMode != DRIVER_FRAMEMODE || currentScanOnce)
+			currentBufSize -= currentPos;
+
+		//remaining scan time of the current rotation, used by the frame swap policy
+		double rotationRemainingUs = 0;
+		for(unsigned i = 0; i < currentBufSize; i++)
+			rotationRemainingUs += speedFactor * (*currentBufPtr)[(currentPos + i) % currentBufPtr->size()]->durationUs;
+
+		//rotate through the buffer once
 		for(int i = 0; i < currentBufSize; i++)
 		{
+			//in frame mode, look for a new frame between slices and swap according to the policy
+			if(driverMode == DRIVER_FRAMEMODE && i > 0) {
+				//only one frame is held back, anything newer stays queued for the next loop
+				if(pendingBufPtr == nullptr) {
+					bool polledScanOnce = false;
+					struct timespec polledArrivalTime;
+					std::shared_ptr<const SliceBuf> polledBufPtr = fetchNextBuffer(tfEnv, driverMode, polledScanOnce, polledArrivalTime);
+					if((polledBufPtr.get() != nullptr) && (polledBufPtr->size() > 0)) {
+						pendingBufPtr = polledBufPtr;
+						pendingDriverMode = driverMode;
+						pendingScanOnce = polledScanOnce;
+						pendingOutputMode = tfEnv.outputMode;
+						pendingArrivalTime = polledArrivalTime;
+					}
+				}
+
+				//a change of mode always ends the current scan
+				if(driverMode != DRIVER_FRAMEMODE)
+					break;
+
+				if(pendingBufPtr != nullptr && shouldSwapFrame(rotationRemainingUs))
+					break;
+			}
+
 			struct timespec then;
 			clock_gettime(CLOCK_MONOTONIC, &then);
 
 
-			std::shared_ptr<TimeSlice> nextSlice = currentBufPtr->front();
-			currentBufPtr->pop_front();
+			std::shared_ptr<TimeSlice> nextSlice = (*currentBufPtr)[currentPos];
+			rotationRemainingUs -= speedFactor * nextSlice->durationUs;
+
+			//if we're in frame mode, come back to the slice in the next rotation
+			//wave mode and scan-once frames just move past it
+			currentPos++;
+			if(driverMode == DRIVER_FRAMEMODE && !currentScanOnce)
+				currentPos %= currentBufPtr->size();
 
-			if (!management->requestOutput(OUTPUT_MODE_IDN))
+			if (!management->requestOutput(currentOutputMode))
 			{
 				struct timespec delay, dummy; // Prevents hogging 100% CPU
 				delay.tv_sec = 0;
@@ -193,23 +684,35 @@ void HWBridge::driverLoop()
 			}
 			hasStopped = false;
 
-			//if we're in frame mode, put the slice back
-			//wave mode just discards
-			if(driverMode == DRIVER_FRAMEMODE) {
-				currentBufPtr->push_back(nextSlice);
+			//measure the time from frame arrival to its first point being written
+			if(awaitingFirstPoint) {
+				awaitingFirstPoint = false;
+				if(debug != NODEBUG) {
+					swapLatencies.push_back(elapsedUs(frameArrivalTime, then));
+				}
 			}
 
 			this->device->writeFrame(*nextSlice, speedFactor*nextSlice->durationUs);
+			lastWriteUs = speedFactor*nextSlice->durationUs;
 
 
 			//measure timing
 			struct timespec now;
 			clock_gettime(CLOCK_MONOTONIC, &now);
 
+			if(debug != NODEBUG && hasLastWrite) {
+				writeGaps.push_back(elapsedUs(lastWriteEnd, then));
+			}
+			lastWriteEnd = now;
+			hasLastWrite = true;
+
 			unsigned sdif = now.tv_sec - then.tv_sec;
 			unsigned nsdif = now.tv_nsec - then.tv_nsec;
 			unsigned tdif = sdif * 1000000000 + nsdif;
 
+			if(driverMode == DRIVER_WAVEMODE)
+				autoTuner.addWrite(tdif/1000.0, speedFactor*nextSlice->durationUs);
+
 			if(debug != NODEBUG) {
 				//add stats
 				writeTimingMeasurements.push_back(tdif/1000);
@@ -227,6 +730,32 @@ void HWBridge::driverLoop()
 				}
 			}
 		}
+
+		//blank at the last position once a scan-once frame is done and nothing follows it yet.
+		//single slice frames are not polled during the scan, so look for a following frame first
+		if(currentScanOnce && currentPos >= currentBufPtr->size() && pendingBufPtr == nullptr && driverMode == DRIVER_FRAMEMODE && !hasStopped) {
+			bool polledScanOnce = false;
+			struct timespec polledArrivalTime;
+			std::shared_ptr<const SliceBuf> polledBufPtr = fetchNextBuffer(tfEnv, driverMode, polledScanOnce, polledArrivalTime);
+			if((polledBufPtr.get() != nullptr) && (polledBufPtr->size() > 0)) {
+				pendingBufPtr = polledBufPtr;
+				pendingDriverMode = driverMode;
+				pendingScanOnce = polledScanOnce;
+				pendingOutputMode = tfEnv.outputMode;
+				pendingArrivalTime = polledArrivalTime;
+			}
+			else if(driverMode == DRIVER_FRAMEMODE) {
+				//the device still outputs what it has queued, or at least the last write. the blank
+				//(1 ms) goes in just before that ends, so a frame that follows in time is not delayed.
+				struct timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				double queuedUs = device->queuedDurationUs();
+				blankDueUs = now.tv_sec * 1000000.0 + now.tv_nsec / 1000.0 + ((queuedUs >= 0) ? queuedUs : lastWriteUs) - 1000;
+				blankX = tfEnv.lastX;
+				blankY = tfEnv.lastY;
+				blankPending = true;
+			}
+		}
 	}
 }
 
@@ -256,5 +785,15 @@ void HWBridge::printStats() {
 	for(const auto& elem : speedFactors)
 		fprintf(stderr, "%f ", elem);
 	fprintf(stderr, "\n");
+
+	fprintf(stderr, "swapLatencies ");
+	for(const auto& elem : swapLatencies)
+		fprintf(stderr, "%u ", elem);
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "writeGaps ");
+	for(const auto& elem : writeGaps)
+		fprintf(stderr, "%u ", elem);
+	fprintf(stderr, "\n");
 }
 
@@ -18,15 +18,41 @@
 #include <algorithm>
 #include <signal.h>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #include "types.h"
 #include "DACHWInterface.hpp"
+#include "WaveConcealer.hpp"
+#include "PointReducer.hpp"
+#include "SliceAutoTuner.hpp"
 
 #define NODEBUG 0
 #define DEBUG 1
 #define DEBUGLIVE 2
 #define DEBUGSIMPLE 3
 
+//frame swap policies: when a newly arrived frame replaces the one being scanned
+#define FRAMESWAP_IMMEDIATE 0   //abort the current scan and swap right away
+#define FRAMESWAP_FRAMEEND 1    //finish the current scan, swap at the frame boundary
+#define FRAMESWAP_BOUNDED 2     //swap at the frame boundary unless it is more than frameSwapMaxWaitMs away
+
+
+//number of prepared buffers the preparation stage keeps ahead of the driver
+#define PREP_RING_SLOTS 4
+
+//a buffer that has been dequeued, decoded and converted ahead of time
+struct PreparedBuffer
+{
+    std::shared_ptr<const SliceBuf> bufPtr;
+    unsigned driverMode;
+    bool scanOnce;
+    uint16_t lastX;
+    uint16_t lastY;
+    int outputMode;
+    struct timespec arrivalTime;
+};
 
 
 class HWBridge
@@ -39,29 +65,75 @@ class HWBridge
     double accumOC = 0.0;
     bool hasUnderrun = false;
     bool hasStopped = true;
+    int frameSwapPolicy = FRAMESWAP_FRAMEEND;
+    double frameSwapMaxWaitMs = 10;
+    WaveConcealer concealer;
+    PointReducer reducer;
+    SliceAutoTuner autoTuner;
+
+    //frame mode: static frames are uploaded once and repeated by the device, if it can
+    bool deviceLoop = true;
+    bool loopingActive = false;
+    TimeSlice loopedFrame;
+    unsigned loopUploads = 0;
+    unsigned loopSkips = 0;
+
+    //staged pipeline: a preparation thread runs getNextBuffer and feeds the driver loop
+    bool staged = false;
+    std::mutex prepMutex;
+    std::condition_variable prepNotFull;
+    std::deque<PreparedBuffer> prepRing;
+    std::atomic<unsigned> preparedDriverMode{DRIVER_INACTIVE};
+    std::atomic<double> preparedUsPerSlice{15000};
+    std::thread prepThread;
+    std::atomic<bool> prepStop{false};
+
+    //the end of the wave input taken out of the preparation stage when the output runs dry, guarded by prepMutex
+    bool waveTailRequested = false;
+    std::shared_ptr<const SliceBuf> waveTailBufPtr = nullptr;
 
     //stats
     int debug = NODEBUG;
     bool sendStats = false;
-    std::vector<unsigned> writeTimingMeasurements, writeDuration, numberOfPoints;
+    std::vector<unsigned> writeTimingMeasurements, writeDuration, numberOfPoints, swapLatencies, writeGaps;
     std::vector<double> speedFactors, waveBufUsage;
 
-    double calculateSpeedfactor(double currentSpeed, std::shared_ptr<SliceBuf> buf);
+    double calculateSpeedfactor(double currentSpeed, std::shared_ptr<const SliceBuf> buf);
     void clearStats();
+    bool shouldSwapFrame(double remainingUs);
+    void applySliceLength(TransformEnv& tfEnv);
+    bool uploadLoopingFrame(const std::shared_ptr<const SliceBuf>& frameBuf, int outputMode);
+    void stopLoopingFrame(uint16_t x, uint16_t y);
+    void prepLoop();
+    bool takeWaveTail(TransformEnv& tfEnv, std::shared_ptr<const SliceBuf>& tailBufPtr);
+    std::shared_ptr<const SliceBuf> fetchNextBuffer(TransformEnv& tfEnv, unsigned& driverMode, bool& scanOnce, struct timespec& arrivalTime);
 
 
     public:
 
     HWBridge(std::shared_ptr<DACHWInterface> hwDeviceInterface);
-    void outputEmptyPoint();
+    ~HWBridge();
+
+    //ends the preparation thread of the staged pipeline, call once the driver loop has ended
+    void stop();
+
+    void outputEmptyPoint(uint16_t x = 0x8000, uint16_t y = 0x8000);
+    void outputConcealment();
 
     void driverLoop();
     void printStats();
 
     // -- Inline Methods ----------------
     std::shared_ptr<DACHWInterface> getDevice() { return this->device; }
-    void setChunkLengthUs(double us) { this->usPerSlice = us; }
+    void setChunkLengthUs(double us) { this->usPerSlice = us; this->preparedUsPerSlice = us; }
+    void setStaged(bool staged) { this->staged = staged; }
+    void setDeviceLoop(bool deviceLoop) { this->deviceLoop = deviceLoop; }
     void setBufferTargetMs(double targetMs) { if (targetMs >= 1) this->bufferTargetMs = targetMs; else this->bufferTargetMs = 1; }
+    void setFrameSwapPolicy(int policy) { this->frameSwapPolicy = policy; }
+    void setFrameSwapMaxWaitMs(double maxWaitMs) { if (maxWaitMs >= 0) this->frameSwapMaxWaitMs = maxWaitMs; else this->frameSwapMaxWaitMs = 0; }
+    WaveConcealer& getConcealer() { return this->concealer; }
+    PointReducer& getReducer() { return this->reducer; }
+    SliceAutoTuner& getAutoTuner() { return this->autoTuner; }
     void setDebugging(int debug) { this->debug = debug; }
     int getDebugging() { return this->debug; }
 };
@@ -9,6 +9,9 @@
 #define LAPRO_ADAPTER_HPP
 
 
+// Standard libraries
+#include <time.h>
+
 // Project headers
 #include "DecoderBase.hpp"
 #include "AdapterBase.hpp"
@@ -39,6 +42,9 @@ typedef struct
 
     bool isDiscontinuous;
 
+    // Time the chunk was queued to the adapter (CLOCK_MONOTONIC)
+    struct timespec arrivalTime;
+
 } LAPRO_CHUNK_MEMO;
 
 
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+
+#include "PointReducer.hpp"
+
+
+static inline bool isLit(const ISPDB25Point& point)
+{
+    return (point.r | point.g | point.b | point.u1 | point.u2 | point.u3 | point.u4) != 0;
+}
+
+
+static inline bool samePosition(const ISPDB25Point& a, const ISPDB25Point& b)
+{
+    return a.x == b.x && a.y == b.y;
+}
+
+
+//distance of p to the segment from a to b, so that reversals count as vertices as well
+static double segmentDistance(const ISPDB25Point& a, const ISPDB25Point& b, const ISPDB25Point& p)
+{
+    double abX = (double)b.x - a.x;
+    double abY = (double)b.y - a.y;
+    double apX = (double)p.x - a.x;
+    double apY = (double)p.y - a.y;
+    double lengthSq = abX * abX + abY * abY;
+
+    double t = (lengthSq > 0) ? (apX * abX + apY * abY) / lengthSq : 0;
+    t = (t < 0) ? 0 : ((t > 1) ? 1 : t);
+
+    double dX = apX - t * abX;
+    double dY = apY - t * abY;
+    return sqrt(dX * dX + dY * dY);
+}
+
+
+static inline unsigned bitLength(unsigned value)
+{
+    unsigned length = 0;
+    while (value != 0)
+    {
+        length++;
+        value >>= 1;
+    }
+    return length;
+}
+
+
+unsigned PointReducer::keepCount(unsigned count, double ratio, double& carry)
+{
+    if (count == 0)
+        return 0;
+    if (ratio >= 1.0)
+        return count;
+
+    double exact = count * ratio + carry;
+    unsigned keep = (exact < count) ? (unsigned)exact : count;
+    carry = exact - keep;
+
+    //a chunk never vanishes completely, its last point carries the position
+    if (keep == 0)
+    {
+        keep = 1;
+        carry = 0;
+    }
+    return keep;
+}
+
+
+void PointReducer::scorePoints(const std::vector<ISPDB25Point>& points)
+{
+    size_t count = points.size();
+    scores.resize(count);
+
+    if (mode == POINTREDUCTION_UNIFORM)
+    {
+        std::fill(scores.begin(), scores.end(), 0);
+        return;
+    }
+
+    //score groups of points at the same position together
+    size_t groupStart = 0;
+    while (groupStart < count)
+    {
+        size_t groupEnd = groupStart + 1;
+        bool transition = (groupStart > 0) && isLit(points[groupStart - 1]) != isLit(points[groupStart]);
+        while (groupEnd < count && samePosition(points[groupEnd], points[groupStart]))
+        {
+            transition |= isLit(points[groupEnd]) != isLit(points[groupEnd - 1]);
+            groupEnd++;
+        }
+        transition |= (groupEnd < count) && isLit(points[groupEnd]) != isLit(points[groupEnd - 1]);
+
+        if (transition)
+        {
+            //keep the beam from switching on or off at a different position
+            for (size_t i = groupStart; i < groupEnd; i++)
+                scores[i] = POINTREDUCTION_SCORE_TRANSITION;
+        }
+        else
+        {
+            unsigned distanceBits = 17;
+            if (groupStart > 0 && groupEnd < count)
+                distanceBits = bitLength((unsigned)segmentDistance(points[groupStart - 1], points[groupEnd], points[groupStart]));
+
+            scores[groupStart] = distanceBits * 2 + (isLit(points[groupStart]) ? 0 : 1);
+            for (size_t i = groupStart + 1; i < groupEnd; i++)
+                scores[i] = POINTREDUCTION_SCORE_DWELL + distanceBits;
+        }
+
+        groupStart = groupEnd;
+    }
+}
+
+
+void PointReducer::reduce(std::vector<ISPDB25Point>& points, unsigned keep)
+{
+    size_t count = points.size();
+    if (keep >= count)
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (keep == 0)
+    {
+        points.clear();
+    }
+    else if (keep == 1)
+    {
+        points.front() = points.back();
+        points.resize(1);
+    }
+    else
+    {
+        scorePoints(points);
+
+        //find the score up to which points are dropped. the first and the last point are always kept.
+        unsigned histogram[256] = { 0 };
+        for (size_t i = 1; i < count - 1; i++)
+            histogram[scores[i]]++;
+
+        size_t drop = count - keep;
+        size_t dropBelow = 0;
+        unsigned threshold = 0;
+        while (dropBelow + histogram[threshold] < drop)
+            dropBelow += histogram[threshold++];
+
+        //of the points with the threshold score, drop evenly spaced ones
+        uint64_t tieDrop = drop - dropBelow;
+        uint64_t tieCount = histogram[threshold];
+        uint64_t tieIndex = 0;
+
+        size_t kept = 1;
+        for (size_t i = 1; i < count - 1; i++)
+        {
+            if (scores[i] < threshold)
+                continue;
+            if (scores[i] == threshold)
+            {
+                bool dropTie = ((tieIndex + 1) * tieDrop / tieCount) > (tieIndex * tieDrop / tieCount);
+                tieIndex++;
+                if (dropTie)
+                    continue;
+            }
+            points[kept++] = points[i];
+        }
+        points[kept++] = points[count - 1];
+        points.resize(kept);
+    }
+
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    statsCalls++;
+    statsPointsIn += count;
+    statsPointsOut += points.size();
+    statsTotalUs += us;
+    if (us > statsMaxUs)
+        statsMaxUs = us;
+}
+
+
+void PointReducer::printStats()
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+
+    if (statsCalls > 0 && statsPointsIn > 0)
+    {
+        printf("%.1f%% Points Reduced (%s) %.1f us avg / %.1f us max Reduce Time ", 100.0 * (double)(statsPointsIn - statsPointsOut) / (double)statsPointsIn,
+            mode == POINTREDUCTION_UNIFORM ? "uniform" : "geometric", statsTotalUs / statsCalls, statsMaxUs);
+    }
+
+    statsCalls = 0;
+    statsPointsIn = 0;
+    statsPointsOut = 0;
+    statsTotalUs = 0;
+    statsMaxUs = 0;
+}
@@ -0,0 +1,61 @@
+#ifndef POINTREDUCER_H_
+#define POINTREDUCER_H_
+
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+
+#include "ISPDB25Point.h"
+
+//how points are dropped when the input exceeds the maximum pointrate of the device
+#define POINTREDUCTION_UNIFORM 0     //drop evenly spaced points
+#define POINTREDUCTION_GEOMETRIC 1   //drop the points that change the drawn geometry the least first
+
+//removal priorities of the geometric reduction, lower values are dropped first.
+//points that are not repeated get 2 * (bit length of their distance to the line through their
+//neighbours) + 1 if blanked, so collinear points of lit segments go first and sharp vertices last.
+#define POINTREDUCTION_SCORE_DWELL 64        //repeated points at the same position, plus the bit length
+#define POINTREDUCTION_SCORE_TRANSITION 128  //points at a position where blanking switches on or off
+
+
+
+class PointReducer
+{
+    private:
+
+    int mode = POINTREDUCTION_GEOMETRIC;
+
+    //scratch space, kept to avoid allocations in the driver context
+    std::vector<uint8_t> scores;
+
+    //stats since the last printStats(), shared between the preparation and the driver context
+    std::mutex statsMutex;
+    unsigned statsCalls = 0;
+    uint64_t statsPointsIn = 0;
+    uint64_t statsPointsOut = 0;
+    double statsTotalUs = 0;
+    double statsMaxUs = 0;
+
+    void scorePoints(const std::vector<ISPDB25Point>& points);
+
+
+    public:
+
+    //number of points to keep of count points at the given ratio. the fraction left over is
+    //carried to the next call, so consecutive wave chunks keep the ratio on average.
+    static unsigned keepCount(unsigned count, double ratio, double& carry);
+
+    //drops points until at most keep points are left, in O(n). the last point is always kept
+    //if keep > 0, and the first one as well if keep > 1.
+    void reduce(std::vector<ISPDB25Point>& points, unsigned keep);
+
+    //prints the stats since the previous call, appended to the simple debug output of the bridge.
+    //prints nothing if no points were dropped.
+    void printStats();
+
+    // -- Inline Methods ----------------
+    void setMode(int mode) { this->mode = mode; }
+    int getMode() { return this->mode; }
+};
+
+#endif
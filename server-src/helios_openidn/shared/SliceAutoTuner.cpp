@@ -0,0 +1,127 @@
+#include "SliceAutoTuner.hpp"
+
+
+static double standardDeviation(double sum, double sqSum, unsigned count)
+{
+    if (count < 2)
+        return 0;
+
+    double mean = sum / count;
+    return sqrt(std::max(0.0, sqSum / count - mean * mean));
+}
+
+
+void SliceAutoTuner::resetWindow(double nowUs)
+{
+    windowStartUs = nowUs;
+    writes = 0;
+    writeSum = 0;
+    writeSqSum = 0;
+    durationSum = 0;
+    arrivals = 0;
+    arrivalSum = 0;
+    arrivalSqSum = 0;
+    underruns = 0;
+}
+
+
+void SliceAutoTuner::addWrite(double callUs, double durationUs)
+{
+    writes++;
+    writeSum += callUs;
+    writeSqSum += callUs * callUs;
+    durationSum += durationUs;
+}
+
+
+void SliceAutoTuner::addArrival(double nowUs)
+{
+    if (lastArrivalUs >= 0)
+    {
+        double interval = nowUs - lastArrivalUs;
+        arrivals++;
+        arrivalSum += interval;
+        arrivalSqSum += interval * interval;
+    }
+    lastArrivalUs = nowUs;
+}
+
+
+void SliceAutoTuner::addUnderrun()
+{
+    underruns++;
+
+    //the next arrival after an underrun is not a regular interval
+    lastArrivalUs = -1;
+}
+
+
+bool SliceAutoTuner::update(double nowUs, double& usPerSlice, double& bufferTargetMs)
+{
+    if (!enabled)
+        return false;
+
+    if (windowStartUs < 0)
+    {
+        resetWindow(nowUs);
+        return false;
+    }
+
+    double elapsedUs = nowUs - windowStartUs;
+    if (elapsedUs < AUTOTUNE_WINDOW_US)
+        return false;
+
+    //too little wave output in this window to judge
+    if (writes < AUTOTUNE_MIN_WRITES || durationSum <= 0)
+    {
+        resetWindow(nowUs);
+        return false;
+    }
+
+    double writeJitterMs = standardDeviation(writeSum, writeSqSum, writes) / 1000.0;
+    double arrivalJitterMs = standardDeviation(arrivalSum, arrivalSqSum, arrivals) / 1000.0;
+    double underrunsPerMin = underruns * 60000000.0 / elapsedUs;
+
+    //share of the output time spent inside write calls: above 1 the device calls are too
+    //expensive for the slice length and the driver falls behind, well below 1 they are cheap.
+    //growing by 1.25 from above the maximum lands above the minimum, so the length settles.
+    double load = writeSum / durationSum;
+
+    double newUsPerSlice = usPerSlice;
+    double newBufferTargetMs = bufferTargetMs;
+
+    if (load > AUTOTUNE_MAX_LOAD)
+        newUsPerSlice = usPerSlice * 1.25;
+    else if (load < AUTOTUNE_MIN_LOAD && underruns == 0)
+        newUsPerSlice = usPerSlice * 0.9;
+    newUsPerSlice = std::min(maxChunkUs, std::max(minChunkUs, newUsPerSlice));
+
+    //the buffer has to cover one slice plus the observed jitter of input and output
+    double jitterBufferMs = newUsPerSlice / 1000.0 + 3.0 * (writeJitterMs + arrivalJitterMs);
+    if (underrunsPerMin > maxUnderrunsPerMin)
+    {
+        underrunBufferMs = bufferTargetMs;
+        newBufferTargetMs = std::max(jitterBufferMs, bufferTargetMs * 1.25);
+        cleanWindows = 0;
+    }
+    else
+    {
+        cleanWindows++;
+        underrunBufferMs *= AUTOTUNE_UNDERRUN_MARK_FADE;
+        if (cleanWindows >= 3)
+        {
+            double floorMs = std::max(jitterBufferMs, underrunBufferMs * 1.1);
+            newBufferTargetMs = std::min(bufferTargetMs, std::max(floorMs, bufferTargetMs * 0.9));
+        }
+    }
+    newBufferTargetMs = std::min(maxBufferMs, std::max(minBufferMs, newBufferTargetMs));
+
+    resetWindow(nowUs);
+
+    if (fabs(newUsPerSlice - usPerSlice) < 1 && fabs(newBufferTargetMs - bufferTargetMs) < 0.1)
+        return false;
+
+    usPerSlice = newUsPerSlice;
+    bufferTargetMs = newBufferTargetMs;
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef SLICEAUTOTUNER_H_
+#define SLICEAUTOTUNER_H_
+
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+
+//length of the measurement window between two tuning steps
+#define AUTOTUNE_WINDOW_US 2000000
+
+//minimum number of writes in a window for a tuning step
+#define AUTOTUNE_MIN_WRITES 10
+
+//write call time per output time that is kept: the slice length grows above the upper
+//and shrinks below the lower value
+#define AUTOTUNE_MAX_LOAD 0.95
+#define AUTOTUNE_MIN_LOAD 0.75
+
+//the buffer target is not lowered to within 10% of the last target that had underruns.
+//that mark fades by this factor per clean window, so lower targets are only retried
+//after a few minutes.
+#define AUTOTUNE_UNDERRUN_MARK_FADE 0.9995
+
+
+
+class SliceAutoTuner
+{
+    private:
+
+    bool enabled = false;
+    double minChunkUs = 2000;
+    double maxChunkUs = 30000;
+    double minBufferMs = 10;
+    double maxBufferMs = 200;
+    double maxUnderrunsPerMin = 1;
+
+    //measurements of the current window
+    double windowStartUs = -1;
+    unsigned writes = 0;
+    double writeSum = 0, writeSqSum = 0, durationSum = 0;
+    unsigned arrivals = 0;
+    double arrivalSum = 0, arrivalSqSum = 0;
+    double lastArrivalUs = -1;
+    unsigned underruns = 0;
+    unsigned cleanWindows = 0;
+    double underrunBufferMs = 0;
+
+    void resetWindow(double nowUs);
+
+
+    public:
+
+    //wave mode measurements, fed by the driver loop
+    void addWrite(double callUs, double durationUs);
+    void addArrival(double nowUs);
+    void addUnderrun();
+
+    //evaluates the measurements once per window and adjusts the slice length and buffer target.
+    //returns true if any of them changed.
+    bool update(double nowUs, double& usPerSlice, double& bufferTargetMs);
+
+    // -- Inline Methods ----------------
+    void setEnabled(bool enabled) { this->enabled = enabled; }
+    bool isEnabled() { return this->enabled; }
+    void setChunkBoundsUs(double minUs, double maxUs) { this->minChunkUs = std::max(100.0, minUs); this->maxChunkUs = std::max(this->minChunkUs, maxUs); }
+    void setBufferBoundsMs(double minMs, double maxMs) { this->minBufferMs = std::max(1.0, minMs); this->maxBufferMs = std::max(this->minBufferMs, maxMs); }
+    void setMaxUnderrunsPerMin(double rate) { this->maxUnderrunsPerMin = std::max(0.0, rate); }
+};
+
+#endif
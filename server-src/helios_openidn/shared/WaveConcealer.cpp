@@ -0,0 +1,210 @@
+#include <string.h>
+#include <math.h>
+
+#include "WaveConcealer.hpp"
+
+
+static void dimPoint(ISPDB25Point& point, double factor)
+{
+    point.r = point.r * factor;
+    point.g = point.g * factor;
+    point.b = point.b * factor;
+    point.intensity = point.intensity * factor;
+    point.u1 = point.u1 * factor;
+    point.u2 = point.u2 * factor;
+    point.u3 = point.u3 * factor;
+    point.u4 = point.u4 * factor;
+}
+
+
+void WaveConcealer::appendBlanked(std::vector<ISPDB25Point>& out, uint16_t x, uint16_t y)
+{
+    ISPDB25Point point;
+    memset(&point, 0, sizeof(point));
+    point.x = x;
+    point.y = y;
+    out.push_back(point);
+
+    currentX = x;
+    currentY = y;
+}
+
+
+void WaveConcealer::stepTowards(std::vector<ISPDB25Point>& out, uint16_t x, uint16_t y)
+{
+    //linear blanked move, reaches the target with the last transit point
+    if (transitLeft == 0)
+    {
+        appendBlanked(out, x, y);
+        return;
+    }
+
+    int stepX = ((int)x - (int)currentX) / (int)transitLeft;
+    int stepY = ((int)y - (int)currentY) / (int)transitLeft;
+    transitLeft--;
+    if (transitLeft == 0)
+        appendBlanked(out, x, y);
+    else
+        appendBlanked(out, currentX + stepX, currentY + stepY);
+}
+
+
+unsigned WaveConcealer::transitPoints(double pointDurationUs)
+{
+    return std::max((unsigned)CONCEAL_TRANSIT_POINTS, (unsigned)(rampMs * 1000.0 / pointDurationUs));
+}
+
+
+void WaveConcealer::record(const std::vector<ISPDB25Point>& samples, double pointDurationUs)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (samples.empty() || pointDurationUs <= 0)
+        return;
+
+    historyPointUs = pointDurationUs;
+    lastPoint = samples.back();
+    hasLastPoint = true;
+
+    if (strategy != CONCEAL_REPEAT)
+        return;
+
+    //keep the last repeatMs of input
+    size_t maxHistory = (size_t)ceil(repeatMs * 1000.0 / pointDurationUs);
+    history.insert(history.end(), samples.begin(), samples.end());
+    if (history.size() > maxHistory)
+        history.erase(history.begin(), history.begin() + (history.size() - maxHistory));
+}
+
+
+unsigned WaveConcealer::conceal(std::vector<ISPDB25Point>& out, double durationUs, double pointDurationUs)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (strategy == CONCEAL_NONE || !hasLastPoint || pointDurationUs <= 0)
+        return 0;
+
+    unsigned count = durationUs / pointDurationUs;
+    if (count == 0)
+        count = 1;
+
+    //start of a concealment: blank at the last position
+    if (!active)
+    {
+        active = true;
+        activeUs = 0;
+        historyPos = 0;
+        currentX = lastPoint.x;
+        currentY = lastPoint.y;
+        transitLeft = transitPoints(pointDurationUs);
+    }
+
+    out.reserve(out.size() + count);
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (strategy == CONCEAL_PARK)
+        {
+            stepTowards(out, parkX, parkY);
+        }
+        else if (strategy == CONCEAL_REPEAT && !history.empty())
+        {
+            //blanked transit to the start of the repeated section, then the section dimmed
+            if (transitLeft > 0)
+            {
+                stepTowards(out, history.front().x, history.front().y);
+                continue;
+            }
+
+            ISPDB25Point point = history[(size_t)historyPos];
+            dimPoint(point, dimFactor);
+            out.push_back(point);
+            currentX = point.x;
+            currentY = point.y;
+
+            historyPos += pointDurationUs / historyPointUs;
+            if (historyPos >= history.size())
+            {
+                historyPos = 0;
+                transitLeft = CONCEAL_TRANSIT_POINTS;
+            }
+        }
+        else
+        {
+            appendBlanked(out, lastPoint.x, lastPoint.y);
+        }
+    }
+
+    activeUs += count * pointDurationUs;
+    sessionUs += count * pointDurationUs;
+
+    //never leave the output resting on a lit point once concealment gives up
+    if (activeUs >= CONCEAL_MAX_US)
+        dimPoint(out.back(), 0);
+
+    return count;
+}
+
+
+void WaveConcealer::rampIn(std::vector<ISPDB25Point>& out, std::vector<ISPDB25Point>& samples, double pointDurationUs)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!active || samples.empty() || pointDurationUs <= 0)
+    {
+        active = false;
+        return;
+    }
+
+    //blanked move from the concealment position to the resumed input
+    unsigned steps = std::max(1u, (unsigned)(rampMs * 1000.0 / pointDurationUs));
+    transitLeft = steps;
+    while (transitLeft > 0)
+        stepTowards(out, samples.front().x, samples.front().y);
+    sessionUs += steps * pointDurationUs;
+
+    //fade in the brightness over the same duration
+    unsigned fadeCount = std::min((size_t)steps, samples.size());
+    for (unsigned i = 0; i < fadeCount; i++)
+        dimPoint(samples[i], (double)(i + 1) / (double)(fadeCount + 1));
+
+    active = false;
+    activeUs = 0;
+}
+
+
+double WaveConcealer::endSession()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    double concealedMs = sessionUs / 1000.0;
+
+    history.clear();
+    hasLastPoint = false;
+    active = false;
+    activeUs = 0;
+    transitLeft = 0;
+    sessionUs = 0;
+
+    return concealedMs;
+}
+
+
+bool WaveConcealer::canConceal()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return hasLastPoint && (activeUs < CONCEAL_MAX_US);
+}
+
+
+double WaveConcealer::getSessionMs()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return sessionUs / 1000.0;
+}
+
+
+double WaveConcealer::getPointDurationUs()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return historyPointUs;
+}
@@ -0,0 +1,99 @@
+#ifndef WAVECONCEALER_H_
+#define WAVECONCEALER_H_
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+
+#include "ISPDB25Point.h"
+
+//concealment strategies for wave mode underruns and timestamp gaps
+#define CONCEAL_NONE 0      //no concealment: idle on underrun, linear blanked jump on gaps
+#define CONCEAL_HOLD 1      //hold and blank at the last position
+#define CONCEAL_PARK 2      //blanked move to the park position and hold there
+#define CONCEAL_REPEAT 3    //repeat the last repeatMs of output, dimmed
+
+//upper limit of continuous concealment, after that the output stays blanked
+#define CONCEAL_MAX_US 500000
+
+//minimum number of points used for blanked transits
+#define CONCEAL_TRANSIT_POINTS 8
+
+//length of the slices written by the driver while the input has run dry
+#define CONCEAL_SLICE_US 2000
+
+
+
+class WaveConcealer
+{
+    private:
+
+    int strategy = CONCEAL_NONE;
+    double repeatMs = 20;
+    double dimFactor = 0.5;
+    double rampMs = 2;
+    uint16_t parkX = 0x8000;
+    uint16_t parkY = 0x8000;
+
+    //recent input, used as the source for concealment. written in the preparation context,
+    //guarded by the mutex like the concealment state
+    std::deque<ISPDB25Point> history;
+    double historyPointUs = 0;
+    ISPDB25Point lastPoint;
+    bool hasLastPoint = false;
+
+    //concealment state, shared between the preparation and the driver context
+    std::mutex mutex;
+    std::atomic<bool> active{false};
+    double activeUs = 0;
+    double historyPos = 0;
+    unsigned transitLeft = 0;
+    uint16_t currentX = 0x8000;
+    uint16_t currentY = 0x8000;
+    double sessionUs = 0;
+
+    void appendBlanked(std::vector<ISPDB25Point>& out, uint16_t x, uint16_t y);
+    void stepTowards(std::vector<ISPDB25Point>& out, uint16_t x, uint16_t y);
+    unsigned transitPoints(double pointDurationUs);
+
+
+    public:
+
+    //keeps track of the input, to be called with every decoded wave chunk
+    void record(const std::vector<ISPDB25Point>& samples, double pointDurationUs);
+
+    //appends concealment points covering durationUs at the given point duration.
+    //returns the number of appended points.
+    unsigned conceal(std::vector<ISPDB25Point>& out, double durationUs, double pointDurationUs);
+
+    //smoothly hands over to resumed input after concealment: appends a blanked move
+    //to the first new sample and fades in the brightness of the new samples
+    void rampIn(std::vector<ISPDB25Point>& out, std::vector<ISPDB25Point>& samples, double pointDurationUs);
+
+    //clears all state at the end of an output session and returns the concealed time in ms
+    double endSession();
+
+    //whether there is input to conceal and the concealment has not run for CONCEAL_MAX_US yet
+    bool canConceal();
+
+    //concealed time of the current output session
+    double getSessionMs();
+
+    //point duration of the recorded input, 0 before any input
+    double getPointDurationUs();
+
+    // -- Inline Methods ----------------
+    void setStrategy(int strategy) { this->strategy = strategy; }
+    void setRepeatMs(double ms) { this->repeatMs = (ms > 0) ? ms : 1; }
+    void setDimFactor(double factor) { this->dimFactor = std::min(1.0, std::max(0.0, factor)); }
+    void setRampMs(double ms) { this->rampMs = (ms >= 0) ? ms : 0; }
+    void setParkPosition(uint16_t x, uint16_t y) { this->parkX = x; this->parkY = y; }
+    int getStrategy() { return this->strategy; }
+    bool isEnabled() { return this->strategy != CONCEAL_NONE; }
+    bool isActive() { return this->active; }
+};
+
+#endif
@@ -403,10 +403,7 @@ int SockIDNServer::receiveUDP(ODF_ENV *env, int fdSocket, uint32_t usRecvTime)
         }
 
         // Populate the taxi buffer. Note: TaxiSource did memset(0) for the header
-        taxiBuffer->taxiSource = taxiSource;
-        taxiBuffer->payloadLen = (uint16_t)payloadLen;
-        taxiBuffer->payloadPtr = (void *)&taxiBuffer[1];
-        taxiBuffer->sourceRefTime = usRecvTime;
+        taxiBuffer->populate(taxiSource, (uint16_t)payloadLen, usRecvTime);
 
         // Read the datagram from the socket
         socklen_t remoteAddrLen = sizeof(rxContext.remoteAddr);
@@ -60,6 +60,15 @@ typedef struct _ODF_TAXI_BUFFER
     ////////////////////////////////////////////////////////////////////////////////////////////////
     public:
 
+    void populate(ODF_TAXI_SOURCE *source, uint16_t len, uint32_t refTime)
+    {
+        // Note: The taxi source allocates the payload right behind the header and does memset(0)
+        taxiSource = source;
+        payloadLen = len;
+        payloadPtr = (void *)&this[1];
+        sourceRefTime = refTime;
+    }
+
     int concat(struct _ODF_TAXI_BUFFER *taxiBuffer)
     {
         int totalLen = 0;
@@ -27,6 +27,7 @@
 
 #include "../hardware/Helios/HeliosAdapter.hpp"
 #include "../hardware/HeliosPro/HeliosProAdapter.hpp"
+#include "../hardware/HeliosPro/HeliosProSim.hpp"
 #include "../dummy/DummyAdapter.hpp"
 
 #include "../output/V1LaproGraphOut.hpp"
@@ -35,6 +36,7 @@
 #include "SockIDNServer.hpp"
 
 #include "../ManagementInterface.hpp"
+#include "../FilePlayer.hpp"
 #include "../UsbInterface.hpp"
 
 std::vector<std::shared_ptr<HWBridge>> driverObjects;
@@ -46,6 +48,7 @@ std::vector<pthread_t> driverThreads;
 // Helios adapter management
 pthread_t management_thread = 0;
 ManagementInterface* management = nullptr;
+extern FilePlayer filePlayer;
 
 bool debug = false;
 int debug_ctr = 0;
@@ -130,9 +133,49 @@ struct ServiceConfig {
     int maxPointRate = -1;
     int bufferTargetMs = -1;
     int chunkLengthUs = -1;
+    int frameSwapPolicy = -1;
+    int frameSwapMaxWaitMs = -1;
+    int concealStrategy = -1;
+    int concealRepeatMs = -1;
+    int concealDimPercent = -1;
+    int concealRampMs = -1;
+    int concealParkX = -1;
+    int concealParkY = -1;
+    bool autoTune = false;
+    int autoTuneMinChunkUs = -1;
+    int autoTuneMaxChunkUs = -1;
+    int autoTuneMinBufferMs = -1;
+    int autoTuneMaxBufferMs = -1;
+    int autoTuneMaxUnderrunsPerMin = -1;
+    bool stagedPipeline = false;
+    int deviceLoop = -1;
  
 };
 
+// Maps a frame swap policy name (immediate, frameend, bounded) to its HWBridge constant, -1 if unknown.
+int parseFrameSwapPolicy(const std::string& value) {
+    if (value == "immediate")
+        return FRAMESWAP_IMMEDIATE;
+    else if (value == "frameend")
+        return FRAMESWAP_FRAMEEND;
+    else if (value == "bounded")
+        return FRAMESWAP_BOUNDED;
+    return -1;
+}
+
+// Maps a wave concealment strategy name (none, hold, park, repeat) to its WaveConcealer constant, -1 if unknown.
+int parseConcealStrategy(const std::string& value) {
+    if (value == "none")
+        return CONCEAL_NONE;
+    else if (value == "hold")
+        return CONCEAL_HOLD;
+    else if (value == "park")
+        return CONCEAL_PARK;
+    else if (value == "repeat")
+        return CONCEAL_REPEAT;
+    return -1;
+}
+
 std::map<std::string, ServiceConfig> readServicesIni(const std::string& filename) {
     std::map<std::string, ServiceConfig> servicesConfig;
     std::ifstream infile(filename);
@@ -193,6 +236,38 @@ std::map<std::string, ServiceConfig> readServicesIni(const std::string& filename
             currentConfig.bufferTargetMs = std::stoi(value);
         else if (key == "chunkLengthUs")
             currentConfig.chunkLengthUs = std::stoi(value);
+        else if (key == "frameSwapPolicy")
+            currentConfig.frameSwapPolicy = parseFrameSwapPolicy(value);
+        else if (key == "frameSwapMaxWaitMs")
+            currentConfig.frameSwapMaxWaitMs = std::stoi(value);
+        else if (key == "concealStrategy")
+            currentConfig.concealStrategy = parseConcealStrategy(value);
+        else if (key == "concealRepeatMs")
+            currentConfig.concealRepeatMs = std::stoi(value);
+        else if (key == "concealDimPercent")
+            currentConfig.concealDimPercent = std::stoi(value);
+        else if (key == "concealRampMs")
+            currentConfig.concealRampMs = std::stoi(value);
+        else if (key == "concealParkX")
+            currentConfig.concealParkX = std::stoi(value);
+        else if (key == "concealParkY")
+            currentConfig.concealParkY = std::stoi(value);
+        else if (key == "autoTune")
+            currentConfig.autoTune = (value == "true" || value == "1");
+        else if (key == "autoTuneMinChunkUs")
+            currentConfig.autoTuneMinChunkUs = std::stoi(value);
+        else if (key == "autoTuneMaxChunkUs")
+            currentConfig.autoTuneMaxChunkUs = std::stoi(value);
+        else if (key == "autoTuneMinBufferMs")
+            currentConfig.autoTuneMinBufferMs = std::stoi(value);
+        else if (key == "autoTuneMaxBufferMs")
+            currentConfig.autoTuneMaxBufferMs = std::stoi(value);
+        else if (key == "autoTuneMaxUnderrunsPerMin")
+            currentConfig.autoTuneMaxUnderrunsPerMin = std::stoi(value);
+        else if (key == "stagedPipeline")
+            currentConfig.stagedPipeline = (value == "true" || value == "1");
+        else if (key == "deviceLoop")
+            currentConfig.deviceLoop = (value == "true" || value == "1") ? 1 : 0;
     }
     // Add the last section if it exists.
     if (!currentSection.empty()) {
@@ -259,12 +334,24 @@ int parseArguments(int argc, char** argv) {
             printf("\t--helios\n");
             if (management->getHardwareType() == HARDWARE_ROCKS0)
                 printf("\t--heliospro\n");
+            printf("\t--heliosprosim [log filename]\n");
             printf("\t--multiservice [filename / automap]\n");
             printf("--list-available-devices\n");
             printf("--dump\n");
+            printf("--convertShow [ILDA file] [show file]\n");
             printf("--setMaxPointRate [pps]\n");
             printf("--setChunkLengthUs [microseconds]\n");
             printf("--setBufferTargetMs [milliseconds]\n");
+            printf("--setFrameSwapPolicy [immediate / frameend / bounded]\n");
+            printf("--setFrameSwapMaxWaitMs [milliseconds]\n");
+            printf("--setConcealStrategy [none / hold / park / repeat]\n");
+            printf("--setPointReduction [uniform / geometric]\n");
+            printf("--autoTune\n");
+            printf("--stagedPipeline\n");
+            printf("--heliosAsync\n");
+            printf("--dummyModel [FIFO points] [latency us] [jitter us]\n");
+            printf("--dummyRecord [filename]\n");
+            printf("--dummyClockSkew [ppm]\n");
             printf("--debug\n");
             printf("--debuglive\n");
             printf("--debugsimple\n");
@@ -291,7 +378,8 @@ int parseArguments(int argc, char** argv) {
                         for(const auto& [name, id] : available) {
                             int serviceID = 1;
                             for(LLNode<ServiceNode> *node = firstService; node != nullptr; node = node->getNextNode()) serviceID++;
-                            createLaProService(std::make_shared<HeliosAdapter>(id), name, serviceID, true);
+                            auto heliosAdapter = std::make_shared<HeliosAdapter>(name);
+                            heliosAdapter->setService(createLaProService(heliosAdapter, name, serviceID, true));
                             printf("Started Helios device: %s \n", name.c_str());
                         }
                     } else {
@@ -349,15 +437,12 @@ int parseArguments(int argc, char** argv) {
                         }
 
                         std::map<std::string, int> available = HeliosAdapter::getAvailableDevices();
-                        auto device = available.find(config.deviceId);
-
-                        if (device == available.end()) {
-                            printf("Service [%s]: Helios device '%s' not found!\n",
+                        if (available.find(config.deviceId) == available.end()) {
+                            printf("Service [%s]: Helios device '%s' not found, waiting for it to be connected\n",
                                 section.c_str(), config.deviceId.c_str());
-                            continue; // Skip this service.
                         }
 
-                        dachw =  std::make_shared<HeliosAdapter>(device->second);
+                        dachw =  std::make_shared<HeliosAdapter>(config.deviceId);
                         
                     }
 
@@ -378,7 +463,56 @@ int parseArguments(int argc, char** argv) {
                     std::optional<int> bufferTargetMs = (config.bufferTargetMs != -1) ? std::make_optional(config.bufferTargetMs) : std::nullopt;
                     std::optional<int> chunkLengthUs = (config.chunkLengthUs != -1) ? std::make_optional(config.chunkLengthUs) : std::nullopt;
 
-                    createLaProService(dachw, serviceNameCStr, config.serviceID, config.serviceID == 1, maxPointRate, bufferTargetMs, chunkLengthUs);
+                    IDNLaproService* service = createLaProService(dachw, serviceNameCStr, config.serviceID, config.serviceID == 1, maxPointRate, bufferTargetMs, chunkLengthUs);
+
+                    if (config.dacType == "Helios")
+                        std::static_pointer_cast<HeliosAdapter>(dachw)->setService(service);
+
+                    if (config.frameSwapPolicy != -1) {
+                        driverObjects.back()->setFrameSwapPolicy(config.frameSwapPolicy);
+                        printf("[Service %d]: Starting with changed Frame Swap Policy: %d \n", config.serviceID, config.frameSwapPolicy);
+                    }
+
+                    if (config.frameSwapMaxWaitMs != -1) {
+                        driverObjects.back()->setFrameSwapMaxWaitMs(config.frameSwapMaxWaitMs);
+                        printf("[Service %d]: Starting with changed Frame Swap Max Wait (MS): %d \n", config.serviceID, config.frameSwapMaxWaitMs);
+                    }
+
+                    WaveConcealer& concealer = driverObjects.back()->getConcealer();
+                    if (config.concealStrategy != -1) {
+                        concealer.setStrategy(config.concealStrategy);
+                        printf("[Service %d]: Starting with changed Wave Concealment Strategy: %d \n", config.serviceID, config.concealStrategy);
+                    }
+                    if (config.concealRepeatMs != -1)
+                        concealer.setRepeatMs(config.concealRepeatMs);
+                    if (config.concealDimPercent != -1)
+                        concealer.setDimFactor(config.concealDimPercent / 100.0);
+                    if (config.concealRampMs != -1)
+                        concealer.setRampMs(config.concealRampMs);
+                    if (config.concealParkX != -1 && config.concealParkY != -1)
+                        concealer.setParkPosition(config.concealParkX, config.concealParkY);
+
+                    if (config.autoTune) {
+                        SliceAutoTuner& autoTuner = driverObjects.back()->getAutoTuner();
+                        autoTuner.setEnabled(true);
+                        if (config.autoTuneMinChunkUs != -1 && config.autoTuneMaxChunkUs != -1)
+                            autoTuner.setChunkBoundsUs(config.autoTuneMinChunkUs, config.autoTuneMaxChunkUs);
+                        if (config.autoTuneMinBufferMs != -1 && config.autoTuneMaxBufferMs != -1)
+                            autoTuner.setBufferBoundsMs(config.autoTuneMinBufferMs, config.autoTuneMaxBufferMs);
+                        if (config.autoTuneMaxUnderrunsPerMin != -1)
+                            autoTuner.setMaxUnderrunsPerMin(config.autoTuneMaxUnderrunsPerMin);
+                        printf("[Service %d]: Starting with chunk length and buffer target auto-tuning \n", config.serviceID);
+                    }
+
+                    if (config.stagedPipeline) {
+                        driverObjects.back()->setStaged(true);
+                        printf("[Service %d]: Starting with staged decode pipeline \n", config.serviceID);
+                    }
+
+                    if (config.deviceLoop != -1) {
+                        driverObjects.back()->setDeviceLoop(config.deviceLoop == 1);
+                        printf("[Service %d]: Starting with changed Device Frame Looping: %d \n", config.serviceID, config.deviceLoop);
+                    }
 
 
                     printf("Added service [%s] with serviceID: %d using %s adapter\n",
@@ -405,6 +539,14 @@ int parseArguments(int argc, char** argv) {
             exit(0);
         }
 
+        if (strcmp(argv[i], "--convertShow") == 0) {
+            if (i + 2 >= argc)
+                return -1;
+
+            // Exit after converting the file
+            exit(filePlayer.convertToCompactShow(argv[i + 1], argv[i + 2]) == 0 ? 0 : 1);
+        }
+
         if (strcmp(argv[i], "--dump") == 0) {
             try {
                 // Initialize Helios devices
@@ -421,7 +563,7 @@ int parseArguments(int argc, char** argv) {
             std::optional<HeliosAdapter> dummyHelios;
 
             if (heliosDevices.size() > 0) {
-                dummyHelios.emplace(0);
+                dummyHelios.emplace();
             }
         
             int serviceCount = 1;
@@ -442,6 +584,10 @@ int parseArguments(int argc, char** argv) {
                 // TODO: Extract these values from HWBridge.hpp / DACHWInterface.hpp
                 printf("bufferTargetMs = %d\n", 40);
                 printf("chunkLengthUs = %d\n", 10000);
+                printf("frameSwapPolicy = frameend\n");
+                printf("frameSwapMaxWaitMs = %d\n", 10);
+                printf("concealStrategy = none\n");
+                printf("deviceLoop = true\n");
                 printf("\n");
             }
         
@@ -487,13 +633,13 @@ int parseArguments(int argc, char** argv) {
                 printf("Using the Helios driver, creating two placeholder services.\n");
 
                 char heliosName[32] = {0};
-                auto heliosAdapter = std::make_shared<HeliosAdapter>(0);
+                auto heliosAdapter = std::make_shared<HeliosAdapter>();
                 heliosAdapter->getName(heliosName, 32);
-                HeliosAdapter::setFirstDeviceService( createLaProService(heliosAdapter, heliosName, isHeliosPro ? 2 : 1, !isHeliosPro) );
-                heliosAdapter = std::make_shared<HeliosAdapter>(1);
+                heliosAdapter->setService( createLaProService(heliosAdapter, heliosName, isHeliosPro ? 2 : 1, !isHeliosPro) );
+                heliosAdapter = std::make_shared<HeliosAdapter>();
                 memset(heliosName, 0, 32);
                 heliosAdapter->getName(heliosName, 32);
-                HeliosAdapter::setSecondDeviceService( createLaProService(heliosAdapter, heliosName, isHeliosPro ? 3 : 2, false) );
+                heliosAdapter->setService( createLaProService(heliosAdapter, heliosName, isHeliosPro ? 3 : 2, false) );
 
 
                 //createLaProService(std::make_shared<HeliosAdapter>(available.begin()->second), available.begin()->first, 1);
@@ -505,7 +651,7 @@ int parseArguments(int argc, char** argv) {
                 else
                 {
                     printf("Using the Helios driver, device: %s\n", available.begin()->first.c_str());
-                    createLaProService(std::make_shared<HeliosAdapter>(available.begin()->second), available.begin()->first, 1);
+                    createLaProService(std::make_shared<HeliosAdapter>(available.begin()->first), available.begin()->first, 1);
                 }*/
             } catch (const std::exception &e) {
                 printf("Helios driver error: %s\n", e.what());
@@ -517,6 +663,20 @@ int parseArguments(int argc, char** argv) {
         //#endif
 
 
+        //HeliosPRO output path against a simulated device node and MCU, on any machine
+        if (strcmp(argv[i], "--heliosprosim") == 0) {
+            const char* logPath = nullptr;
+            if ((i + 1 < argc) && strncmp(argv[i + 1], "--", 2) != 0)
+                logPath = argv[++i];
+
+            printf("Using the HeliosPRO driver with a simulated device\n");
+            auto device = std::make_shared<HeliosProAdapter>(std::make_shared<HeliosProSim>(logPath));
+            char name[32];
+            device->getName(name, 32);
+            createLaProService(device, std::string(name), 1, true);
+            continue;
+        }
+
         //#ifdef INCLUDE_DUMMY
         if (strcmp(argv[i], "--dummy") == 0) {
             printf("Using the Dummy driver, device: Dummy\n");
@@ -560,6 +720,111 @@ int parseArguments(int argc, char** argv) {
             continue;
         }
 
+        if (strcmp(argv[i], "--setFrameSwapPolicy") == 0) {
+            int policy = parseFrameSwapPolicy(argv[i + 1]);
+            if (policy == -1) {
+                printf("Unknown frame swap policy: %s - exiting!\n", argv[i + 1]);
+                exit(-1);
+            }
+            for (auto &drv : driverObjects) {
+                drv->setFrameSwapPolicy(policy);
+            }
+            printf("Changed FrameSwapPolicy to %s for all drivers\n", argv[i + 1]);
+            i++;
+            continue;
+        }
+
+        if (strcmp(argv[i], "--setFrameSwapMaxWaitMs") == 0) {
+            double maxWaitMs = (double)std::stoi(argv[i + 1]);
+            for (auto &drv : driverObjects) {
+                drv->setFrameSwapMaxWaitMs(maxWaitMs);
+            }
+            printf("Changed FrameSwapMaxWait to %f ms for all drivers\n", maxWaitMs);
+            i++;
+            continue;
+        }
+
+        if (strcmp(argv[i], "--setConcealStrategy") == 0) {
+            int strategy = parseConcealStrategy(argv[i + 1]);
+            if (strategy == -1) {
+                printf("Unknown concealment strategy: %s - exiting!\n", argv[i + 1]);
+                exit(-1);
+            }
+            for (auto &drv : driverObjects) {
+                drv->getConcealer().setStrategy(strategy);
+            }
+            printf("Changed ConcealStrategy to %s for all drivers\n", argv[i + 1]);
+            i++;
+            continue;
+        }
+
+        if (strcmp(argv[i], "--setPointReduction") == 0) {
+            int reduction;
+            if (strcmp(argv[i + 1], "uniform") == 0)
+                reduction = POINTREDUCTION_UNIFORM;
+            else if (strcmp(argv[i + 1], "geometric") == 0)
+                reduction = POINTREDUCTION_GEOMETRIC;
+            else {
+                printf("Unknown point reduction: %s - exiting!\n", argv[i + 1]);
+                exit(-1);
+            }
+            for (auto &drv : driverObjects) {
+                drv->getReducer().setMode(reduction);
+            }
+            filePlayer.pointReducer.setMode(reduction);
+            printf("Changed PointReduction to %s for all drivers\n", argv[i + 1]);
+            i++;
+            continue;
+        }
+
+        if (strcmp(argv[i], "--autoTune") == 0) {
+            for (auto &drv : driverObjects) {
+                drv->getAutoTuner().setEnabled(true);
+            }
+            printf("Activated chunk length and buffer target auto-tuning for all drivers\n");
+            continue;
+        }
+
+        if (strcmp(argv[i], "--stagedPipeline") == 0) {
+            for (auto &drv : driverObjects) {
+                drv->setStaged(true);
+            }
+            printf("Activated staged decode pipeline for all drivers\n");
+            continue;
+        }
+
+        if (strcmp(argv[i], "--heliosAsync") == 0) {
+            HeliosAdapter::setAsyncTransfers(true);
+            printf("Activated asynchronous transfers for all Helios devices\n");
+            continue;
+        }
+
+        if (strcmp(argv[i], "--dummyModel") == 0) {
+            unsigned fifoPoints = std::stoi(argv[i + 1]);
+            unsigned latencyUs = std::stoi(argv[i + 2]);
+            unsigned jitterUs = std::stoi(argv[i + 3]);
+            printf("Changed Dummy devices to %u points FIFO, %u us latency, %u us jitter\n", fifoPoints, latencyUs, jitterUs);
+            DummyAdapter::setFifoDepth(fifoPoints);
+            DummyAdapter::setTransferLatency(latencyUs, jitterUs);
+            i += 3;
+            continue;
+        }
+
+        if (strcmp(argv[i], "--dummyClockSkew") == 0) {
+            double ppm = std::stod(argv[i + 1]);
+            printf("Changed Dummy device clocks to %+g ppm\n", ppm);
+            DummyAdapter::setClockSkew(ppm);
+            i++;
+            continue;
+        }
+
+        if (strcmp(argv[i], "--dummyRecord") == 0) {
+            printf("Recording the output of Dummy devices to %s\n", argv[i + 1]);
+            DummyAdapter::setRecordPath(argv[i + 1]);
+            i++;
+            continue;
+        }
+
         if (strcmp(argv[i], "--debug") == 0) {
             debug = true;
 
@@ -619,7 +884,8 @@ int parseArguments(int argc, char** argv) {
                     printf("No Helios devices available!\n");
                     return -1;
                 }
-                createLaProService(std::make_shared<HeliosAdapter>(available.begin()->second), available.begin()->first, 1, true);
+                auto heliosAdapter = std::make_shared<HeliosAdapter>(available.begin()->first);
+                heliosAdapter->setService(createLaProService(heliosAdapter, available.begin()->first, 1, true));
             }
             catch (const std::exception& e) {
                 printf("Helios driver error: %s\n", e.what());
@@ -690,7 +956,9 @@ int main(int argc, char** argv) {
 
     printf("%d critical messages were generated.\n", debug_ctr);
 
-    // Clear the driver list.
+    // Stop the preparation threads and clear the driver list.
+    for (auto &drv : driverObjects)
+        drv->stop();
     driverObjects.clear();
 
     // Delete outputs
@@ -0,0 +1,419 @@
+#include "TestSupport.hpp"
+
+#include <math.h>
+
+//HWBridge driving a dummy device with IDN chunks
+
+
+#define FRAME_POINTS 200
+#define FRAME_US 10000
+#define FRAME_COUNT 5
+
+//frame k is marked by its green value
+static uint16_t frameGreen(unsigned k)
+{
+	return 0x1000 * (k + 1);
+}
+
+//queues the frames before the bridge starts, so they are all waiting for it
+static void scanOnceSequence(bool staged)
+{
+	std::shared_ptr<CaptureDummy> device = std::make_shared<CaptureDummy>();
+	TestChunkSource source;
+	device->start();
+
+	std::vector<ISPDB25Point> expected;
+	for(unsigned k = 0; k < FRAME_COUNT; k++) {
+		std::vector<ISPDB25Point> frame = testFrame(FRAME_POINTS, frameGreen(k));
+		CHECK(source.put(*device, frame, FRAME_US, LAPRO_CHUNK_TYPE_FRAME_ONCE) >= 0);
+		expected.insert(expected.end(), frame.begin(), frame.end());
+	}
+
+	std::shared_ptr<HWBridge> bridge = startBridge(device, staged);
+	testSleepMs(FRAME_COUNT * FRAME_US / 1000 + 100);
+
+	//every frame exactly once and in order, nothing repeated
+	std::vector<ISPDB25Point> lit;
+	for(const auto& point : device->getPoints()) {
+		if(isLitPoint(point))
+			lit.push_back(point);
+	}
+	CHECK_MSG(lit.size() == expected.size(), "%zu lit points, expected %zu", lit.size(), expected.size());
+	for(size_t i = 0; i < std::min(lit.size(), expected.size()); i++) {
+		if(!samePoint(lit[i], expected[i])) {
+			CHECK_MSG(samePoint(lit[i], expected[i]), "lit point %zu differs", i);
+			break;
+		}
+	}
+
+	//then the bridge blanks at the last position and waits
+	std::vector<ISPDB25Point> points = device->getPoints();
+	CHECK(!points.empty() && !isLitPoint(points.back()));
+	CHECK(!points.empty() && points.back().x == expected.back().x && points.back().y == expected.back().y);
+
+	device->stop(false);
+	source.recycle(*device);
+	CHECK(source.outstanding() == 0);
+}
+
+static void scanOnceSequenceDirect()
+{
+	scanOnceSequence(false);
+}
+
+static void scanOnceSequenceStaged()
+{
+	scanOnceSequence(true);
+}
+
+//frames arriving one by one at the frame rate are each output once
+static void scanOncePaced()
+{
+	std::shared_ptr<CaptureDummy> device = std::make_shared<CaptureDummy>();
+	TestChunkSource source;
+	device->start();
+	std::shared_ptr<HWBridge> bridge = startBridge(device);
+
+	for(unsigned k = 0; k < FRAME_COUNT; k++) {
+		CHECK(source.put(*device, testFrame(FRAME_POINTS, frameGreen(k)), FRAME_US, LAPRO_CHUNK_TYPE_FRAME_ONCE) >= 0);
+		testSleepMs(FRAME_US / 1000);
+		source.recycle(*device);
+	}
+	testSleepMs(50);
+
+	unsigned litPerFrame[FRAME_COUNT] = { 0 };
+	unsigned lastFrame = 0;
+	bool inOrder = true;
+	for(const auto& point : device->getPoints()) {
+		if(!isLitPoint(point))
+			continue;
+		unsigned k = point.g / 0x1000 - 1;
+		CHECK(k < FRAME_COUNT);
+		if(k >= FRAME_COUNT)
+			break;
+		inOrder &= (k >= lastFrame);
+		lastFrame = k;
+		litPerFrame[k]++;
+	}
+	CHECK(inOrder);
+	for(unsigned k = 0; k < FRAME_COUNT; k++)
+		CHECK_MSG(litPerFrame[k] == FRAME_POINTS, "frame %u: %u lit points", k, litPerFrame[k]);
+
+	device->stop(false);
+	source.recycle(*device);
+}
+
+//a repeating frame is scanned until the next frame replaces it, a scan-once frame after
+//it ends the repetition
+static void repeatingThenScanOnce()
+{
+	std::shared_ptr<CaptureDummy> device = std::make_shared<CaptureDummy>();
+	TestChunkSource source;
+	device->start();
+	std::shared_ptr<HWBridge> bridge = startBridge(device);
+
+	CHECK(source.put(*device, testFrame(FRAME_POINTS, frameGreen(0)), FRAME_US, LAPRO_CHUNK_TYPE_FRAME_RPT) >= 0);
+	testSleepMs(80);
+	CHECK(source.put(*device, testFrame(FRAME_POINTS, frameGreen(1)), FRAME_US, LAPRO_CHUNK_TYPE_FRAME_ONCE) >= 0);
+	testSleepMs(80);
+
+	unsigned repeated = 0;
+	unsigned once = 0;
+	for(const auto& point : device->getPoints()) {
+		if(point.g == frameGreen(0))
+			repeated++;
+		else if(point.g == frameGreen(1))
+			once++;
+	}
+	CHECK_MSG(repeated >= 3 * FRAME_POINTS, "repeating frame output %u points", repeated);
+	CHECK_MSG(once == FRAME_POINTS, "scan-once frame output %u points", once);
+
+	//nothing is written after the blank that follows the scan-once frame
+	size_t writes = device->getWrites().size();
+	testSleepMs(30);
+	CHECK(device->getWrites().size() == writes);
+
+	device->stop(false);
+	source.recycle(*device);
+}
+
+//a scan-once frame at twice the maximum point rate of the device is reduced to half of its
+//points, keeping the corners of the outline
+static void reducedAtMaxPointrate()
+{
+	std::shared_ptr<CaptureDummy> device = std::make_shared<CaptureDummy>();
+	TestChunkSource source;
+	device->setMaxPointrate(20000);
+	device->start();
+	std::shared_ptr<HWBridge> bridge = startBridge(device);
+
+	std::vector<ISPDB25Point> corners = testStarCorners(0x8000, 0x8000, 0x4000, 0x1800);
+	std::vector<ISPDB25Point> frame = testOutlines({ corners }, 40, 0, 0);
+	CHECK(source.put(*device, frame, frame.size() * 1000000 / 40000, LAPRO_CHUNK_TYPE_FRAME_ONCE) >= 0);
+	testSleepMs(60);
+
+	std::vector<ISPDB25Point> points = device->getPoints();
+	size_t lit = 0;
+	unsigned missing = 0;
+	for(const auto& point : points)
+		lit += isLitPoint(point);
+	for(const auto& corner : corners) {
+		bool found = false;
+		for(const auto& point : points)
+			found |= isLitPoint(point) && point.x == corner.x && point.y == corner.y;
+		missing += !found;
+	}
+	CHECK_MSG(points.size() >= frame.size() / 2 - 1 && points.size() <= frame.size() / 2 + 2, "%zu of %zu points", points.size(), frame.size());
+	CHECK_MSG(lit > 0, "%zu lit points", lit);
+	CHECK_MSG(missing == 0, "%u corners lost", missing);
+
+	device->stop(false);
+	source.recycle(*device);
+}
+
+//without a reducer, getNextBuffer skips evenly spaced points of a frame above the maximum
+//point rate, every other one at twice the rate. the kept points take over the frame duration.
+static void skippedWithoutReducer()
+{
+	std::shared_ptr<CaptureDummy> device = std::make_shared<CaptureDummy>();
+	TestChunkSource source;
+	device->setMaxPointrate(20000);
+	device->start();
+
+	std::vector<ISPDB25Point> frame = testFrame(400, 0x8000);
+	uint32_t durationUs = frame.size() * 1000000 / 40000;
+	CHECK(source.put(*device, frame, durationUs, LAPRO_CHUNK_TYPE_FRAME_ONCE) >= 0);
+
+	TransformEnv tfEnv;
+	tfEnv.usPerSlice = 2000;
+	tfEnv.currentSliceTime = tfEnv.usPerSlice;
+	unsigned driverMode = DRIVER_INACTIVE;
+	std::shared_ptr<const SliceBuf> buffer = device->getNextBuffer(tfEnv, driverMode);
+	CHECK(buffer != nullptr && !buffer->empty());
+	if(buffer == nullptr)
+		return;
+
+	SliceType output;
+	double outputUs = 0;
+	for(const auto& slice : *buffer) {
+		output.insert(output.end(), slice->dataChunk.begin(), slice->dataChunk.end());
+		outputUs += slice->durationUs;
+	}
+	std::vector<ISPDB25Point> kept;
+	for(size_t i = 0; i < frame.size(); i += 2)
+		kept.push_back(frame[i]);
+	CHECK_MSG(output.size() / device->bytesPerPoint() == kept.size(), "%zu of %zu points", output.size() / device->bytesPerPoint(), frame.size());
+	CHECK(output == device->convertPoints(kept));
+	CHECK_MSG(std::fabs(outputUs - durationUs) < buffer->size(), "%.0f us of %u us", outputUs, durationUs);
+
+	device->stop(false);
+	source.recycle(*device);
+}
+
+#define WAVE_CHUNK_POINTS 60
+#define WAVE_CHUNK_US 2000
+#define WAVE_GREEN 0x8000
+#define RESUME_GREEN 0xf000
+#define PARK_POSITION 0x1000
+
+//wave chunks of points moving right along a line at y, marked by their green value
+static void putWave(TestChunkSource& source, DACHWInterface& device, unsigned chunks, uint16_t y, uint16_t green)
+{
+	for(unsigned c = 0; c < chunks; c++) {
+		std::vector<ISPDB25Point> points;
+		for(unsigned i = 0; i < WAVE_CHUNK_POINTS; i++)
+			points.push_back(testPoint(0x2000 + (c * WAVE_CHUNK_POINTS + i) * 4, y, 0, green, 0));
+		CHECK(source.put(device, points, WAVE_CHUNK_US, LAPRO_CHUNK_TYPE_WAVE) >= 0);
+	}
+}
+
+//wave input that runs dry for 700 ms and resumes. the driver conceals the underrun with the
+//strategy for up to CONCEAL_MAX_US, ending blanked, and ramps into the resumed input.
+static void concealUnderrun(int strategy, bool staged = false)
+{
+	std::shared_ptr<CaptureDummy> device = std::make_shared<CaptureDummy>();
+	TestChunkSource source;
+	device->start();
+	std::shared_ptr<HWBridge> bridge = startBridge(device, staged);
+	WaveConcealer& concealer = bridge->getConcealer();
+	concealer.setStrategy(strategy);
+	concealer.setParkPosition(PARK_POSITION, PARK_POSITION);
+
+	putWave(source, *device, 50, 0x6000, WAVE_GREEN);
+	testSleepMs(800);
+	source.recycle(*device);
+	double resumeUs = testNowUs();
+	putWave(source, *device, 25, 0xa000, RESUME_GREEN);
+	testSleepMs(150);
+	device->stop(false);
+	source.recycle(*device);
+
+	//input, then concealment up to the resumed input
+	std::vector<ISPDB25Point> input, concealment, resumed;
+	double concealmentEndUs = 0;
+	for(const auto& write : device->getWrites()) {
+		for(const auto& point : write.points) {
+			if(write.startUs >= resumeUs)
+				resumed.push_back(point);
+			else if(point.g == WAVE_GREEN && concealment.empty())
+				input.push_back(point);
+			else {
+				concealment.push_back(point);
+				concealmentEndUs = write.endUs;
+			}
+		}
+	}
+	double pointUs = (double)WAVE_CHUNK_US / WAVE_CHUNK_POINTS;
+	double concealedMs = concealment.size() * pointUs / 1000;
+	CHECK_MSG(input.size() == 50 * WAVE_CHUNK_POINTS, "%zu input points", input.size());
+	CHECK_MSG(std::fabs(concealedMs - CONCEAL_MAX_US / 1000.0) < 5, "%.1f ms concealed", concealedMs);
+	CHECK_MSG(resumeUs - concealmentEndUs > 100000, "concealment ended %.0f ms before the input resumed", (resumeUs - concealmentEndUs) / 1000);
+	CHECK(!concealment.empty() && !isLitPoint(concealment.back()));
+	if(input.empty() || concealment.empty() || resumed.empty())
+		return;
+
+	const ISPDB25Point& last = input.back();
+	unsigned lit = 0, dimmed = 0, atLast = 0, towardsPark = 0;
+	for(size_t i = 0; i < concealment.size(); i++) {
+		const ISPDB25Point& point = concealment[i];
+		lit += isLitPoint(point);
+		dimmed += (point.g == WAVE_GREEN / 2 && point.y == last.y && point.x <= last.x && point.x + 20 * 30 * 4 > last.x);
+		atLast += (point.x == last.x && point.y == last.y);
+		towardsPark += (i == 0 || (point.x <= concealment[i - 1].x && point.y <= concealment[i - 1].y));
+	}
+	if(strategy == CONCEAL_HOLD) {
+		CHECK_MSG(lit == 0, "%u lit points", lit);
+		CHECK_MSG(atLast == concealment.size(), "%u of %zu points at the last position", atLast, concealment.size());
+	}
+	else if(strategy == CONCEAL_PARK) {
+		CHECK_MSG(lit == 0, "%u lit points", lit);
+		CHECK_MSG(towardsPark == concealment.size(), "%u of %zu points towards the park position", towardsPark, concealment.size());
+		CHECK(concealment.back().x == PARK_POSITION && concealment.back().y == PARK_POSITION);
+	}
+	else if(strategy == CONCEAL_REPEAT) {
+		//the last 20 ms of input repeated at half the brightness, with blanked transits
+		CHECK_MSG(dimmed > concealment.size() / 2, "%u of %zu points repeated", dimmed, concealment.size());
+		CHECK_MSG(lit == dimmed, "%u lit, %u repeated", lit, dimmed);
+	}
+
+	//blanked move from the concealment position to the first resumed point, then the
+	//brightness of the resumed input fades in. the output is concealed again after it.
+	size_t firstLit = 0;
+	while(firstLit < resumed.size() && !isLitPoint(resumed[firstLit]))
+		firstLit++;
+	size_t end = resumed.size();
+	while(end > firstLit && resumed[end - 1].g != RESUME_GREEN)
+		end--;
+	CHECK_MSG(firstLit >= 2000 / pointUs - 1, "%zu blanked points before the resumed input", firstLit);
+	size_t resumedLit = 0;
+	for(size_t i = firstLit; i < end; i++)
+		resumedLit += isLitPoint(resumed[i]);
+	CHECK_MSG(resumedLit == 25 * WAVE_CHUNK_POINTS, "%zu resumed points", resumedLit);
+	if(firstLit == 0 || end == firstLit)
+		return;
+	CHECK(resumed[firstLit].y == 0xa000 && resumed[firstLit - 1].y == 0xa000);
+	CHECK(resumed[firstLit].g < RESUME_GREEN / 10);
+	size_t fadeEnd = firstLit + 1;
+	bool fading = true;
+	for(; fadeEnd < end && resumed[fadeEnd].g != RESUME_GREEN; fadeEnd++)
+		fading &= resumed[fadeEnd].g > resumed[fadeEnd - 1].g;
+	CHECK(fading);
+	CHECK_MSG(end - fadeEnd > 20 * WAVE_CHUNK_POINTS, "%zu points at full brightness", end - fadeEnd);
+}
+
+static void concealHold()
+{
+	concealUnderrun(CONCEAL_HOLD);
+}
+
+static void concealPark()
+{
+	concealUnderrun(CONCEAL_PARK);
+}
+
+static void concealRepeat()
+{
+	concealUnderrun(CONCEAL_REPEAT);
+}
+
+static void concealHoldStaged()
+{
+	concealUnderrun(CONCEAL_HOLD, true);
+}
+
+//wave chunks arriving 2 ms apart on average but up to 1.5 ms early or late. returns the time the
+//device ran empty between the first and the last input write, in us.
+static double jitteredWaveGapUs(bool staged)
+{
+	std::shared_ptr<CaptureDummy> device = std::make_shared<CaptureDummy>();
+	TestChunkSource source;
+	device->start();
+	std::shared_ptr<HWBridge> bridge = std::make_shared<HWBridge>(device);
+	bridge->setStaged(staged);
+	bridge->setBufferTargetMs(4);
+	bridge->setChunkLengthUs(WAVE_CHUNK_US);
+	std::thread([bridge] { bridge->driverLoop(); }).detach();
+
+	const double jitterMs[] = { -1.5, 1.5, -1, 1, 0 };
+	unsigned chunks = 150;
+	double startUs = testNowUs();
+	for(unsigned c = 0; c < chunks; c++) {
+		double dueUs = startUs + c * WAVE_CHUNK_US + jitterMs[c % 5] * 1000;
+		double nowUs = testNowUs();
+		if(dueUs > nowUs)
+			testSleepMs((dueUs - nowUs) / 1000);
+		putWave(source, *device, 1, 0x6000, WAVE_GREEN);
+		source.recycle(*device);
+	}
+	testSleepMs(100);
+	device->stop(false);
+	source.recycle(*device);
+
+	//the preparation thread ends without the driver loop ending first
+	bridge->stop();
+
+	std::vector<CapturedWrite> inputWrites;
+	unsigned inputPoints = 0;
+	for(const auto& write : device->getWrites()) {
+		unsigned lit = 0;
+		for(const auto& point : write.points)
+			lit += isLitPoint(point);
+		if(lit > 0)
+			inputWrites.push_back(write);
+		inputPoints += lit;
+	}
+	//without concealment the points short of a full slice stay with the bridge
+	CHECK_MSG(inputPoints + WAVE_CHUNK_POINTS > chunks * WAVE_CHUNK_POINTS, "%u input points", inputPoints);
+
+	double gapUs = 0;
+	for(size_t i = 1; i < inputWrites.size(); i++)
+		gapUs += std::max(0.0, inputWrites[i].startUs - inputWrites[i - 1].endUs);
+	return gapUs;
+}
+
+//the staged pipeline keeps the device fed at least as well as the driver decoding by itself
+static void stagedWriteGaps()
+{
+	double directGapUs = jitteredWaveGapUs(false);
+	double stagedGapUs = jitteredWaveGapUs(true);
+	printf("     write gaps with jittered input: %.1f ms direct, %.1f ms staged\n", directGapUs / 1000, stagedGapUs / 1000);
+	CHECK_MSG(stagedGapUs <= directGapUs + 2000, "%.1f ms staged, %.1f ms direct", stagedGapUs / 1000, directGapUs / 1000);
+	CHECK_MSG(stagedGapUs < 10000, "%.1f ms staged", stagedGapUs / 1000);
+}
+
+int main(int argc, char** argv)
+{
+	RUN_TEST(scanOnceSequenceDirect);
+	RUN_TEST(scanOnceSequenceStaged);
+	RUN_TEST(scanOncePaced);
+	RUN_TEST(repeatingThenScanOnce);
+	RUN_TEST(reducedAtMaxPointrate);
+	RUN_TEST(skippedWithoutReducer);
+	RUN_TEST(concealHold);
+	RUN_TEST(concealPark);
+	RUN_TEST(concealRepeat);
+	RUN_TEST(concealHoldStaged);
+	RUN_TEST(stagedWriteGaps);
+
+	return finishTests("BridgeTest");
+}
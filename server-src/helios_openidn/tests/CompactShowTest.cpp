@@ -0,0 +1,142 @@
+#include "IldaTestSupport.hpp"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../CompactShow.hpp"
+
+//compact show files converted from generated ILDA files as --convertShow does, decoded by the
+//reader the player streams them with, against the frames the player parses from the ILDA file
+
+
+//the frames of a show file and the frame each was first decoded for. returns 0, or -1 if the
+//reader failed, the frames up to there are returned either way.
+static int readShow(const std::string& path, IldaFrames& frames, std::vector<unsigned>& sourceFrames)
+{
+	CompactShowReader reader;
+	if(reader.open(path.c_str()) != 0)
+		return -1;
+
+	std::vector<ISPDB25Point> points;
+	unsigned sourceFrame;
+	int result;
+	while((result = reader.nextFrame(points, sourceFrame)) > 0) {
+		frames.push_back(points);
+		sourceFrames.push_back(sourceFrame);
+	}
+	return result;
+}
+
+static bool fileExists(const std::string& path)
+{
+	struct stat fileStat;
+	return stat(path.c_str(), &fileStat) == 0;
+}
+
+//the first frame that differs, or the number of frames if none does
+static size_t firstDifference(const IldaFrames& a, const IldaFrames& b)
+{
+	size_t count = std::min(a.size(), b.size());
+	for(size_t i = 0; i < count; i++) {
+		if(a[i].size() != b[i].size() || memcmp(a[i].data(), b[i].data(), a[i].size() * sizeof(ISPDB25Point)) != 0)
+			return i;
+	}
+	return count;
+}
+
+static void roundTrip()
+{
+	//random points in formats 0/1/4/5 with custom palettes, each file converted and decoded into
+	//the frames IldaReader parses. random coordinates do not compress, the sizes only show that.
+	//damaged files are not converted and leave no show file behind.
+	std::mt19937 random(49);
+	unsigned long palette[256];
+	unsigned files = 0, frames = 0, rejected = 0;
+	size_t ildaBytes = 0, showBytes = 0;
+
+	quietStdout(true);
+	for(unsigned file = 0; file < 200; file++) {
+		bool damaged = (file % 4 == 3);
+		std::vector<uint8_t> bytes = generateIldaFile(random, 1 + random() % 30, (file % 3 == 0) ? 20 : 1500, damaged);
+		std::string ildaPath = writeIldaTestFile(bytes);
+		std::string showPath = ildaPath + ".ilz";
+		randomIldaPalette(random, palette);
+
+		IldaFrames ildaFrames, showFrames;
+		std::vector<unsigned> sourceFrames;
+		int ildaResult = readerParseIlda(ildaPath.c_str(), palette, ildaFrames);
+		int convertResult = CompactShow::convertIlda(ildaPath.c_str(), showPath.c_str(), palette);
+		if(ildaResult != 0 || convertResult != 0) {
+			quietStdout(false);
+			CHECK_MSG(ildaResult == convertResult, "file %u: parsed with %d, converted with %d", file, ildaResult, convertResult);
+			CHECK_MSG(!fileExists(showPath), "file %u: show file of a malformed file", file);
+			quietStdout(true);
+			rejected++;
+			continue;
+		}
+
+		int showResult = readShow(showPath, showFrames, sourceFrames);
+		uint32_t frameCount = 0;
+		uint64_t pointCount = 0, ildaPoints = 0;
+		for(const auto& frame : ildaFrames)
+			ildaPoints += frame.size();
+		int infoResult = CompactShow::readInfo(showPath.c_str(), frameCount, pointCount);
+		size_t difference = firstDifference(ildaFrames, showFrames);
+
+		quietStdout(false);
+		CHECK_MSG(showResult == 0, "file %u: reader failed after %zu frames", file, showFrames.size());
+		CHECK_MSG(showFrames.size() == ildaFrames.size(), "file %u: %zu frames, %zu in the ILDA file", file, showFrames.size(), ildaFrames.size());
+		CHECK_MSG(difference == ildaFrames.size(), "file %u: frame %zu differs", file, difference);
+		CHECK(infoResult == 0 && frameCount == ildaFrames.size() && pointCount == ildaPoints);
+		quietStdout(true);
+
+		files++;
+		frames += ildaFrames.size();
+		ildaBytes += bytes.size();
+		struct stat fileStat;
+		if(stat(showPath.c_str(), &fileStat) == 0)
+			showBytes += fileStat.st_size;
+		unlink(showPath.c_str());
+	}
+	quietStdout(false);
+
+	printf("     %u files, %u frames, %.2f MB ILDA to %.2f MB, %u malformed files rejected\n", files, frames, ildaBytes / 1e6, showBytes / 1e6, rejected);
+	CHECK(rejected > 20 && files > 100);
+}
+
+static void repeatedFrames()
+{
+	//frames equal to one in the history are stored as references to it and decoded with the
+	//frame they were first decoded for. the history keeps COMPACT_SHOW_HISTORY_POINTS points, the
+	//filler frame pushes the first two out of it and they are stored again.
+	std::vector<ISPDB25Point> a = testFrame(1000, 0x1000), b = testFrame(1000, 0x2000);
+	std::vector<ISPDB25Point> large = testFrame(60000, 0x3000), filler = testFrame(5000, 0x4000);
+	IldaFrames input = { a, b, a, b, large, a, filler, a, b };
+	const unsigned expectedSources[] = { 0, 1, 0, 1, 4, 0, 6, 7, 8 };
+
+	std::string ildaPath = writeIldaTestFile(encodeIldaFile(input));
+	std::string showPath = ildaPath + ".ilz";
+	unsigned long palette[256] = { 0 };
+	IldaFrames ildaFrames, showFrames;
+	std::vector<unsigned> sourceFrames;
+	quietStdout(true);
+	CHECK(readerParseIlda(ildaPath.c_str(), palette, ildaFrames) == 0);
+	CHECK(CompactShow::convertIlda(ildaPath.c_str(), showPath.c_str(), palette) == 0);
+	CHECK(readShow(showPath, showFrames, sourceFrames) == 0);
+	quietStdout(false);
+
+	CHECK_MSG(showFrames.size() == input.size(), "%zu frames", showFrames.size());
+	CHECK_MSG(firstDifference(ildaFrames, showFrames) == input.size(), "frame %zu differs", firstDifference(ildaFrames, showFrames));
+	for(size_t i = 0; i < sourceFrames.size() && i < input.size(); i++)
+		CHECK_MSG(sourceFrames[i] == expectedSources[i], "frame %zu decoded for frame %u, expected %u", i, sourceFrames[i], expectedSources[i]);
+	unlink(showPath.c_str());
+}
+
+int main()
+{
+	RUN_TEST(roundTrip);
+	RUN_TEST(repeatedFrames);
+	removeIldaTestFiles();
+	return finishTests("CompactShowTest");
+}
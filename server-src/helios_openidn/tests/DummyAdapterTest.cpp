@@ -0,0 +1,275 @@
+#include "TestSupport.hpp"
+
+#include <string>
+#include <cmath>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+//the simulated DAC of DummyAdapter.cpp on its own: its FIFO filling and draining at the point
+//rate of the slices, the underruns it counts, the clock skew and the recording of the output.
+
+
+//slices of 200 points in 10 ms, 20 kpps. the default FIFO takes 5 of them.
+#define SLICE_POINTS 200
+#define SLICE_US 10000
+#define POINT_US (SLICE_US / SLICE_POINTS)
+
+//allowed lateness of a write, for the scheduling of the sleeping thread. the timings are the
+//best of TIMING_TRIES, a busy machine delays single writes by much more.
+#define TIMING_SLACK_US 1500
+#define TIMING_TRIES 5
+
+static TimeSlice testSlice(DummyAdapter& device, unsigned points, uint16_t green)
+{
+	TimeSlice slice;
+	slice.dataChunk = device.convertPoints(testFrame(points, green));
+	slice.durationUs = points * POINT_US;
+	return slice;
+}
+
+//returns the time the write took
+static double timedWrite(DummyAdapter& device, const TimeSlice& slice)
+{
+	double startUs = testNowUs();
+	CHECK(device.writeFrame(slice, slice.durationUs) == 0);
+	return testNowUs() - startUs;
+}
+
+//five slices fill the FIFO up to 1000 points and are taken at once. the sixth waits until
+//176 points are emitted, and a slice larger than the FIFO waits for it to run empty.
+//returns how much later than the model the writes returned, in us.
+static double fifoLateness()
+{
+	DummyAdapter device;
+	TimeSlice slice = testSlice(device, SLICE_POINTS, 0x8000);
+	double lateness = 0;
+
+	double startUs = testNowUs();
+	for(unsigned i = 0; i < 5; i++)
+		lateness = std::max(lateness, timedWrite(device, slice));
+	double queued = device.queuedDurationUs();
+	CHECK_MSG(queued <= 5 * SLICE_US && queued > 5 * SLICE_US - (testNowUs() - startUs), "%.0f us queued", queued);
+
+	double waitUs = timedWrite(device, slice);
+	double expectedUs = (5 * SLICE_POINTS + SLICE_POINTS - DUMMY_DEFAULT_FIFO_POINTS) * POINT_US - (testNowUs() - waitUs - startUs);
+	CHECK_MSG(waitUs > expectedUs - 100, "waited %.0f us for room, %.0f us expected", waitUs, expectedUs);
+	lateness = std::max(lateness, waitUs - expectedUs);
+
+	//the FIFO drains at the point rate
+	double before = testNowUs();
+	queued = device.queuedDurationUs();
+	double expectedQueued = 6 * SLICE_US - (before - startUs);
+	CHECK_MSG(queued <= expectedQueued + 100, "%.0f us queued, %.0f us expected", queued, expectedQueued);
+	lateness = std::max(lateness, expectedQueued - queued);
+
+	testSleepMs(queued / 1000 + 1);
+	CHECK(device.queuedDurationUs() == 0);
+	CHECK(device.getUnderruns() == 0);
+
+	//larger than the FIFO
+	TimeSlice large = testSlice(device, 2 * DUMMY_DEFAULT_FIFO_POINTS, 0x8000);
+	timedWrite(device, slice);
+	waitUs = timedWrite(device, large);
+	CHECK_MSG(waitUs > SLICE_US - 100, "waited %.0f us for the empty FIFO", waitUs);
+	lateness = std::max(lateness, waitUs - SLICE_US);
+
+	//the output restarting after the drain, and the large slice that waited for the FIFO to
+	//run empty before its transfer
+	CHECK_MSG(device.getUnderruns() == 2, "%u underruns", device.getUnderruns());
+	return lateness;
+}
+
+static void fifoFillAndDrain()
+{
+	DummyAdapter::setTransferLatency(0, 0);
+	double best = 1e9;
+	for(unsigned t = 0; t < TIMING_TRIES && best > TIMING_SLACK_US; t++)
+		best = std::min(best, fifoLateness());
+	printf("     writes returned up to %.0f us late\n", best);
+	CHECK_MSG(best <= TIMING_SLACK_US, "writes up to %.0f us late", best);
+	DummyAdapter::setTransferLatency(DUMMY_DEFAULT_LATENCY_US, DUMMY_DEFAULT_JITTER_US);
+}
+
+//writes take the transfer latency and up to the jitter more, the slice starts after it
+static void transferLatency()
+{
+	const unsigned latencyUs = 2000, jitterUs = 1000;
+	DummyAdapter::setTransferLatency(latencyUs, jitterUs);
+	double best = 1e9;
+	for(unsigned t = 0; t < TIMING_TRIES && best > latencyUs + jitterUs + TIMING_SLACK_US; t++) {
+		DummyAdapter device;
+		TimeSlice slice = testSlice(device, SLICE_POINTS, 0x8000);
+		double writeUs = timedWrite(device, slice);
+		double queued = device.queuedDurationUs();
+		CHECK_MSG(writeUs >= latencyUs, "write took %.0f us", writeUs);
+		CHECK_MSG(queued > SLICE_US - TIMING_SLACK_US && queued <= SLICE_US, "%.0f us queued", queued);
+		best = std::min(best, writeUs);
+	}
+	CHECK_MSG(best <= latencyUs + jitterUs + TIMING_SLACK_US, "write took %.0f us", best);
+	DummyAdapter::setTransferLatency(DUMMY_DEFAULT_LATENCY_US, DUMMY_DEFAULT_JITTER_US);
+}
+
+//a slice written before the previous one ends plays right after it, one written later leaves the
+//device idle from the end of the previous one. pauses of more than a second are not counted.
+static void underrunDetection()
+{
+	DummyAdapter::setTransferLatency(0, 0);
+	DummyAdapter device;
+	TimeSlice slice = testSlice(device, SLICE_POINTS, 0x8000);
+
+	timedWrite(device, slice);
+	testSleepMs(SLICE_US / 2000.0);
+	timedWrite(device, slice);
+	CHECK_MSG(device.getUnderruns() == 0, "%u underruns", device.getUnderruns());
+
+	double fifoEndUs = testNowUs() + device.queuedDurationUs();
+	testSleepMs(SLICE_US * 3 / 1000.0);
+	double before = testNowUs();
+	timedWrite(device, slice);
+	double after = testNowUs();
+	CHECK_MSG(device.getUnderruns() == 1, "%u underruns", device.getUnderruns());
+	CHECK_MSG(device.getIdleUs() >= before - fifoEndUs - 10 && device.getIdleUs() <= after - fifoEndUs + 10,
+		"%.0f us idle, %.0f to %.0f us expected", device.getIdleUs(), before - fifoEndUs, after - fifoEndUs);
+
+	//printStats starts the next period
+	device.printStats();
+	printf("\n");
+	CHECK(device.getUnderruns() == 0 && device.getIdleUs() == 0);
+
+	testSleepMs(DUMMY_MAX_UNDERRUN_US / 1000.0 + SLICE_US / 1000.0 + 50);
+	timedWrite(device, slice);
+	CHECK_MSG(device.getUnderruns() == 0, "%u underruns after a pause", device.getUnderruns());
+	DummyAdapter::setTransferLatency(DUMMY_DEFAULT_LATENCY_US, DUMMY_DEFAULT_JITTER_US);
+}
+
+//slices queued back to back in a FIFO that takes them all. returns the time from the first
+//write to the end of the output.
+static double skewedOutputUs(double ppm, unsigned slices)
+{
+	DummyAdapter::setClockSkew(ppm);
+	DummyAdapter device;
+	TimeSlice slice = testSlice(device, SLICE_POINTS, 0x8000);
+	double startUs = testNowUs();
+	for(unsigned i = 0; i < slices; i++)
+		timedWrite(device, slice);
+	double endUs = testNowUs() + device.queuedDurationUs();
+	DummyAdapter::setClockSkew(0);
+	CHECK_MSG(device.getUnderruns() == 0, "%u underruns", device.getUnderruns());
+	return endUs - startUs;
+}
+
+//a positive skew makes the device emit faster than the slice durations, like a DAC crystal
+//running fast, a negative one slower
+static void clockSkew()
+{
+	const unsigned slices = 20;
+	DummyAdapter::setFifoDepth(slices * SLICE_POINTS);
+	DummyAdapter::setTransferLatency(0, 0);
+	double nominal = skewedOutputUs(0, slices);
+	double fast = skewedOutputUs(10000, slices);
+	double slow = skewedOutputUs(-10000, slices);
+	DummyAdapter::setFifoDepth(DUMMY_DEFAULT_FIFO_POINTS);
+	DummyAdapter::setTransferLatency(DUMMY_DEFAULT_LATENCY_US, DUMMY_DEFAULT_JITTER_US);
+
+	double total = slices * SLICE_US;
+	printf("     %.0f us of slices emitted in %.1f us at 0 ppm, %.1f us at +10000 ppm, %.1f us at -10000 ppm\n", total, nominal, fast, slow);
+	CHECK_MSG(std::fabs(nominal - total) < 100, "%.1f us", nominal);
+	CHECK_MSG(std::fabs(fast - total / 1.01) < 100, "%.1f us", fast);
+	CHECK_MSG(std::fabs(slow - total / 0.99) < 100, "%.1f us", slow);
+}
+
+struct RecordedPoint
+{
+	uint64_t timeNs;
+	uint16_t x, y, r, g, b, reserved;
+} __attribute__((packed));
+
+static std::vector<uint8_t> readFile(const std::string& path)
+{
+	std::vector<uint8_t> bytes;
+	FILE* file = fopen(path.c_str(), "rb");
+	if(file == NULL)
+		return bytes;
+	uint8_t buffer[4096];
+	size_t count;
+	while((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		bytes.insert(bytes.end(), buffer, buffer + count);
+	fclose(file);
+	return bytes;
+}
+
+//every emitted point with its emission time, in a file per device
+static void recording()
+{
+	char file[] = "/tmp/dummyrecXXXXXX";
+	int fd = mkstemp(file);
+	CHECK(fd >= 0);
+	if(fd < 0)
+		return;
+	close(fd);
+	std::string path = file;
+	std::string secondPath = path + ".2";
+
+	std::vector<CapturedWrite> writes;
+	DummyAdapter::setRecordPath(path.c_str());
+	{
+		CaptureDummy device, second;
+		const uint16_t greens[] = { 0x4000, 0x8000, 0xc000 };
+		for(uint16_t green : greens) {
+			TimeSlice slice = testSlice(device, SLICE_POINTS, green);
+			device.writeFrame(slice, slice.durationUs);
+		}
+		TimeSlice slice = testSlice(second, SLICE_POINTS / 2, 0xffff);
+		second.writeFrame(slice, slice.durationUs);
+		writes = device.getWrites();
+	}
+	DummyAdapter::setRecordPath(nullptr);
+
+	std::vector<uint8_t> bytes = readFile(path);
+	std::vector<uint8_t> secondBytes = readFile(secondPath);
+	unlink(path.c_str());
+	unlink(secondPath.c_str());
+
+	const size_t headerSize = 16;
+	CHECK(sizeof(RecordedPoint) == 20);
+	CHECK_MSG(bytes.size() == headerSize + 3 * SLICE_POINTS * sizeof(RecordedPoint), "%zu bytes", bytes.size());
+	CHECK_MSG(secondBytes.size() == headerSize + SLICE_POINTS / 2 * sizeof(RecordedPoint), "%zu bytes from the second device", secondBytes.size());
+	if(bytes.size() < headerSize || writes.size() != 3)
+		return;
+
+	uint32_t version, recordSize;
+	memcpy(&version, &bytes[8], 4);
+	memcpy(&recordSize, &bytes[12], 4);
+	CHECK(memcmp(bytes.data(), "DUMMYREC", 8) == 0);
+	CHECK(version == 1 && recordSize == sizeof(RecordedPoint));
+
+	//the slices were written while the previous one played, so the points follow each other
+	//at the point rate from the start of the first slice
+	size_t count = (bytes.size() - headerSize) / sizeof(RecordedPoint);
+	unsigned wrongPoints = 0, wrongTimes = 0;
+	double firstUs = 0;
+	for(size_t i = 0; i < count; i++) {
+		RecordedPoint record;
+		memcpy(&record, &bytes[headerSize + i * sizeof(RecordedPoint)], sizeof(record));
+		const ISPDB25Point& point = writes[i / SLICE_POINTS].points[i % SLICE_POINTS];
+		wrongPoints += (record.x != point.x || record.y != point.y || record.r != point.r || record.g != point.g || record.b != point.b);
+		if(i == 0)
+			firstUs = record.timeNs / 1000.0;
+		wrongTimes += std::fabs(record.timeNs / 1000.0 - (firstUs + i * POINT_US)) > 1;
+	}
+	CHECK_MSG(wrongPoints == 0, "%u of %zu points differ", wrongPoints, count);
+	CHECK_MSG(wrongTimes == 0, "%u of %zu emission times differ", wrongTimes, count);
+	//CaptureDummy takes the start time after the write returned
+	CHECK_MSG(firstUs <= writes[0].startUs && firstUs > writes[0].startUs - 1000, "first point at %.0f us, slice started at %.0f us", firstUs, writes[0].startUs);
+}
+
+int main()
+{
+	RUN_TEST(fifoFillAndDrain);
+	RUN_TEST(transferLatency);
+	RUN_TEST(underrunDetection);
+	RUN_TEST(clockSkew);
+	RUN_TEST(recording);
+	return finishTests("DummyAdapterTest");
+}
@@ -0,0 +1,290 @@
+#include "IldaTestSupport.hpp"
+
+#include <filesystem>
+#include <sys/stat.h>
+
+#include "../FilePlayer.hpp"
+#include "../ManagementInterface.hpp"
+
+//startup and program list latency of FilePlayer with a library of 10k files, with the library
+//index saved by a previous run and without it. the files were just written, so the page cache
+//holds them and the cold scan is faster than from a USB stick. then the CPU time of a program
+//played on 1 to 8 Dummy devices through their driver threads, and the size and decode time of a
+//show converted to a compact show file (--convertShow).
+
+extern ManagementInterface* management;
+
+
+#define BENCH_FILES 10000
+#define BENCH_PROGRAM_FILES 4       // Files per .prg program, the other files are programs of their own
+#define BENCH_PRG_PROGRAMS 500
+#define BENCH_PAGE_LENGTH (8192 - 13)   // Page length of the management interface (UDP_MAXBUF - 13)
+#define BENCH_LIST_RUNS 20
+#define BENCH_FANOUT_FRAMES 60
+#define BENCH_FANOUT_POINTS 1000
+#define BENCH_FANOUT_S 3
+#define BENCH_SHOW_FRAMES 3600
+#define BENCH_SHOW_LOOP 30          // Frames of an animation loop, each loop is played 3 times
+#define BENCH_SHOW_RUNS 5
+
+
+static double elapsedMs(double startUs)
+{
+	return (testNowUs() - startUs) / 1000.0;
+}
+
+static std::string fileName(unsigned index)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "file%05u.ild", index);
+	return name;
+}
+
+//files of 1 to 8 frames of 20 to 400 points, 7 kB on average
+static size_t writeLibrary(const std::string& directory)
+{
+	std::mt19937 random(2024);
+	size_t bytes = 0;
+	for(unsigned i = 0; i < BENCH_FILES; i++) {
+		IldaFrames frames;
+		unsigned numFrames = 1 + random() % 8;
+		for(unsigned k = 0; k < numFrames; k++)
+			frames.push_back(testFrame(20 + random() % 381, (uint16_t)(0x100 * (1 + k))));
+		std::vector<uint8_t> file = encodeIldaFile(frames);
+
+		FILE* out = fopen((directory + fileName(i)).c_str(), "wb");
+		if(out == NULL)
+			continue;
+		fwrite(file.data(), 1, file.size(), out);
+		fclose(out);
+		bytes += file.size();
+	}
+
+	for(unsigned p = 0; p < BENCH_PRG_PROGRAMS; p++) {
+		char name[32];
+		snprintf(name, sizeof(name), "program%03u.prg", p);
+		FILE* out = fopen((directory + name).c_str(), "w");
+		if(out == NULL)
+			continue;
+		for(unsigned k = 0; k < BENCH_PROGRAM_FILES; k++)
+			fprintf(out, "%s,30,1\n", fileName(p * BENCH_PROGRAM_FILES + k).c_str());
+		fclose(out);
+	}
+	return bytes;
+}
+
+static double processCpuMs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+//a program of 1000-point frames on all outputs, the devices and their driver threads added one
+//after the other. parsing and conversion happen once, each device adds its driver thread.
+static void fanOut(FilePlayer& player, const std::vector<std::string>& directories)
+{
+	IldaFrames frames;
+	for(unsigned k = 0; k < BENCH_FANOUT_FRAMES; k++)
+		frames.push_back(testFrame(BENCH_FANOUT_POINTS, (uint16_t)(0x100 * (1 + k))));
+	std::vector<uint8_t> file = encodeIldaFile(frames);
+	FILE* out = fopen((player.usbFileDirectory + "fanout.ild").c_str(), "wb");
+	if(out == NULL)
+		return;
+	fwrite(file.data(), 1, file.size(), out);
+	fclose(out);
+	out = fopen((player.usbFileDirectory + "fanout.prg").c_str(), "w");
+	if(out == NULL)
+		return;
+	fputs("#outputs,all\nfanout.ild,30,1\n", out);
+	fclose(out);
+	player.libraryIndex.scan(directories);
+	player.buildProgramMap();
+
+	printf("\n-- fan-out, frames of %d points for %d s\n", BENCH_FANOUT_POINTS, BENCH_FANOUT_S);
+	printf("  %-8s %9s %9s\n", "devices", "cpu %", "per added");
+	std::vector<std::shared_ptr<DACHWInterface>> devices;
+	double previousPercent = 0;
+	unsigned previousCount = 0;
+	for(unsigned count : { 1, 2, 4, 8 }) {
+		while(devices.size() < count) {
+			devices.push_back(std::make_shared<DummyAdapter>());
+			startBridge(devices.back());
+		}
+		management->devices = devices;
+
+		quietStdout(true);
+		player.playFile("fanout.prg");
+		testSleepMs(500);
+		double startUs = testNowUs();
+		double cpuBefore = processCpuMs();
+		testSleepMs(BENCH_FANOUT_S * 1000);
+		double percent = 100.0 * (processCpuMs() - cpuBefore) / elapsedMs(startUs);
+		player.stop();
+		testSleepMs(200);
+		quietStdout(false);
+
+		printf("  %-8u %9.1f", count, percent);
+		if(previousCount > 0)
+			printf(" %9.2f", (percent - previousPercent) / (count - previousCount));
+		printf("\n");
+		previousPercent = percent;
+		previousCount = count;
+	}
+	management->devices.clear();
+}
+
+//animation loops of a square and a star moving towards each other, changing size and color from
+//loop to loop. both files are decoded from the page cache into the points the player outputs,
+//the best of BENCH_SHOW_RUNS.
+static void compactShow()
+{
+	IldaFrames frames;
+	size_t points = 0;
+	for(unsigned loop = 0; frames.size() < BENCH_SHOW_FRAMES; loop++) {
+		IldaFrames loopFrames;
+		for(unsigned f = 0; f < BENCH_SHOW_LOOP; f++) {
+			uint16_t offset = (uint16_t)(f * 0x300);
+			std::vector<ISPDB25Point> frame = testOutlines({ testSquareCorners(0x4000 + offset, 0x8000, 0x1800 + loop * 0x40),
+				testStarCorners(0xc000 - offset, 0x8000, 0x2800, 0x1000 + loop * 0x20) }, 20 + loop % 40, 3, 10);
+			for(auto& point : frame) {
+				if(point.g != 0) {
+					point.r = (uint16_t)((loop * 0x2900) & 0xff00);
+					point.b = (uint16_t)((f * 0x0800) & 0xff00);
+				}
+			}
+			loopFrames.push_back(frame);
+		}
+		for(unsigned repeat = 0; repeat < 3; repeat++) {
+			frames.insert(frames.end(), loopFrames.begin(), loopFrames.end());
+			for(const auto& frame : loopFrames)
+				points += frame.size();
+		}
+	}
+
+	std::vector<uint8_t> bytes = encodeIldaFile(frames);
+	std::string ildaPath = writeIldaTestFile(bytes);
+	std::string showPath = ildaPath + ".ilz";
+	unsigned long palette[256] = { 0 };
+
+	printf("\n-- compact show, %zu frames of %.0f points on average\n", frames.size(), (double)points / frames.size());
+	double startUs = testNowUs();
+	int result = CompactShow::convertIlda(ildaPath.c_str(), showPath.c_str(), palette);
+	double convertMs = elapsedMs(startUs);
+	struct stat showStat;
+	if(result != 0 || stat(showPath.c_str(), &showStat) != 0) {
+		printf("  conversion failed\n");
+		return;
+	}
+
+	double ildaMs = 1e9, showMs = 1e9;
+	for(unsigned run = 0; run < BENCH_SHOW_RUNS; run++) {
+		IldaFrames decoded;
+		startUs = testNowUs();
+		readerParseIlda(ildaPath.c_str(), palette, decoded);
+		ildaMs = std::min(ildaMs, elapsedMs(startUs));
+
+		decoded.clear();
+		CompactShowReader reader;
+		std::vector<ISPDB25Point> frame;
+		unsigned sourceFrame;
+		startUs = testNowUs();
+		if(reader.open(showPath.c_str()) == 0) {
+			while(reader.nextFrame(frame, sourceFrame) > 0)
+				decoded.push_back(frame);
+		}
+		showMs = std::min(showMs, elapsedMs(startUs));
+	}
+
+	printf("  %-24s %9s %9s %12s\n", "file", "MB", "decode ms", "frames/s");
+	printf("  %-24s %9.2f %9.1f %12.0f\n", "ILDA", bytes.size() / 1e6, ildaMs, frames.size() / ildaMs * 1000);
+	printf("  %-24s %9.2f %9.1f %12.0f\n", "compact show", showStat.st_size / 1e6, showMs, frames.size() / showMs * 1000);
+	printf("  size ratio %.2f, converted in %.0f ms\n", (double)bytes.size() / showStat.st_size, convertMs);
+}
+
+int main(int argc, char** argv)
+{
+	std::string directory = ildaTestDirectory();
+	FilePlayer player;
+	player.localFileDirectory = directory + "/library/";
+	player.usbFileDirectory = directory + "/usb/";
+	player.libraryIndex.setIndexPath(directory + "/library.idx");
+	std::filesystem::create_directories(player.localFileDirectory);
+	std::filesystem::create_directories(player.usbFileDirectory);
+	std::vector<std::string> directories = { player.localFileDirectory, player.usbFileDirectory };
+
+	double startUs = testNowUs();
+	size_t bytes = writeLibrary(player.localFileDirectory);
+	printf("library of %d ILDA files, %.1f MB, and %d programs of %d files, written in %.0f ms\n", BENCH_FILES, bytes / 1048576.0,
+		BENCH_PRG_PROGRAMS, BENCH_PROGRAM_FILES, elapsedMs(startUs));
+
+	//startup without a saved index: every file is read, then the index is saved
+	quietStdout(true);
+	startUs = testNowUs();
+	unsigned scanned = player.libraryIndex.scan(directories);
+	double scanMs = elapsedMs(startUs);
+	player.libraryIndex.save();
+	double saveMs = elapsedMs(startUs) - scanMs;
+	startUs = testNowUs();
+	player.buildProgramMap();
+	double buildMs = elapsedMs(startUs);
+	quietStdout(false);
+	printf("\n-- startup\n");
+	printf("  %-24s %9.1f ms (scan %.1f ms of %u files, save %.1f ms, program map %.1f ms)\n", "cold scan", scanMs + saveMs + buildMs, scanMs, scanned, saveMs, buildMs);
+
+	//startup with the saved index, as FilePlayer::startup() loads it
+	quietStdout(true);
+	startUs = testNowUs();
+	int loadResult = player.libraryIndex.load();
+	double loadMs = elapsedMs(startUs);
+	startUs = testNowUs();
+	player.buildProgramMap();
+	buildMs = elapsedMs(startUs);
+	quietStdout(false);
+	printf("  %-24s %9.1f ms (load %.1f ms of %zu entries%s, program map %.1f ms)\n", "saved index", loadMs + buildMs, loadMs, player.libraryIndex.size(),
+		loadResult == 0 ? "" : ", failed", buildMs);
+
+	//what the watcher thread does next: the scan that finds nothing changed, and one with 10 changed files
+	startUs = testNowUs();
+	unsigned changed = player.libraryIndex.scan(directories);
+	printf("  %-24s %9.1f ms (%u changed)\n", "rescan, unchanged", elapsedMs(startUs), changed);
+	for(unsigned i = 0; i < 10; i++) {
+		FILE* out = fopen((player.localFileDirectory + fileName(i * 997)).c_str(), "ab");
+		if(out != NULL) {
+			fputc(0, out);
+			fclose(out);
+		}
+	}
+	startUs = testNowUs();
+	changed = player.libraryIndex.scan(directories);
+	printf("  %-24s %9.1f ms (%u changed)\n", "rescan, 10 files changed", elapsedMs(startUs), changed);
+
+	//the whole list as command 0x5 sends it, and every page of command 0x14
+	printf("\n-- program list\n");
+	std::string list;
+	startUs = testNowUs();
+	for(int run = 0; run < BENCH_LIST_RUNS; run++)
+		list = player.getProgramListString();
+	printf("  %-24s %9.2f ms (%.0f kB)\n", "whole list", elapsedMs(startUs) / BENCH_LIST_RUNS, list.size() / 1000.0);
+
+	unsigned first = 0, pages = 0, programsInPage = 0, totalPrograms = 0;
+	double pageSumMs = 0, pageMaxMs = 0;
+	do {
+		startUs = testNowUs();
+		std::string page = player.getProgramListPage(first, BENCH_PAGE_LENGTH, programsInPage, totalPrograms);
+		double pageMs = elapsedMs(startUs);
+		pageSumMs += pageMs;
+		pageMaxMs = std::max(pageMaxMs, pageMs);
+		first += programsInPage;
+		pages++;
+	} while(programsInPage > 0 && first < totalPrograms);
+	printf("  %-24s %9.2f ms mean, %.2f ms max (%u pages of up to %d bytes, %u programs)\n", "page", pageSumMs / pages, pageMaxMs, pages,
+		BENCH_PAGE_LENGTH, totalPrograms);
+
+	fanOut(player, directories);
+	compactShow();
+
+	removeIldaTestFiles();
+	fflush(stdout);
+	_exit(0);
+}
@@ -0,0 +1,754 @@
+#include "IldaTestSupport.hpp"
+
+#include <stdlib.h>
+#include <dirent.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <set>
+#include <new>
+#include <filesystem>
+
+#include "../FilePlayer.hpp"
+#include "../ManagementInterface.hpp"
+
+//FilePlayer playing generated files from a library in the test directory to dummy devices
+//behind HWBridge. the player threads never end, so all tests share one player.
+
+extern ManagementInterface* management;
+
+
+// -- Allocation counting -----------------------------------------------------
+//every operator new is counted for the thread that calls it, so the output thread of the player
+//can be checked on its own
+
+#define ALLOC_SLOTS 256
+
+struct AllocSlot
+{
+	std::atomic<pid_t> tid;
+	std::atomic<unsigned long long> count;
+	std::atomic<unsigned long long> bytes;
+};
+
+static AllocSlot allocSlots[ALLOC_SLOTS];
+static thread_local AllocSlot* threadSlot = nullptr;
+
+//the slot of the thread, a free one is claimed if claim is set
+static AllocSlot* allocSlot(pid_t tid, bool claim)
+{
+	for(auto& slot : allocSlots) {
+		pid_t current = slot.tid.load();
+		if(current == 0 && claim && slot.tid.compare_exchange_strong(current, tid))
+			return &slot;
+		if(current == tid)
+			return &slot;
+	}
+	return nullptr;
+}
+
+void* operator new(size_t size)
+{
+	if(threadSlot == nullptr)
+		threadSlot = allocSlot((pid_t)syscall(SYS_gettid), true);
+	if(threadSlot != nullptr) {
+		threadSlot->count++;
+		threadSlot->bytes += size;
+	}
+
+	void* memory = malloc(size ? size : 1);
+	if(memory == nullptr)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+//every form of delete releases what the new above allocated. they are kept out of line, inlined
+//into a caller gcc sees free() on memory from operator new and warns about the mismatch.
+__attribute__((noinline)) void operator delete(void* memory) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete[](void* memory) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete(void* memory, size_t) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete[](void* memory, size_t) noexcept { free(memory); }
+
+struct AllocCount
+{
+	unsigned long long count = 0;
+	unsigned long long bytes = 0;
+};
+
+static AllocCount allocationsOf(pid_t tid)
+{
+	AllocCount result;
+	AllocSlot* slot = allocSlot(tid, false);
+	if(slot != nullptr) {
+		result.count = slot->count;
+		result.bytes = slot->bytes;
+	}
+	return result;
+}
+
+static AllocCount ownAllocations()
+{
+	return allocationsOf((pid_t)syscall(SYS_gettid));
+}
+
+static std::set<pid_t> processThreads()
+{
+	std::set<pid_t> threads;
+	DIR* directory = opendir("/proc/self/task");
+	if(directory == NULL)
+		return threads;
+	while(struct dirent* entry = readdir(directory)) {
+		if(entry->d_name[0] != '.')
+			threads.insert((pid_t)atoi(entry->d_name));
+	}
+	closedir(directory);
+	return threads;
+}
+
+static size_t residentBytes()
+{
+	long pages = 0, resident = 0;
+	FILE* file = fopen("/proc/self/statm", "r");
+	if(file != NULL) {
+		if(fscanf(file, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(file);
+	}
+	return (size_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+
+// -- Player ------------------------------------------------------------------
+
+static FilePlayer* player = nullptr;
+static pid_t outputThread = 0;
+
+//dummy device that counts the frames converted for it
+class CountingDummy : public CaptureDummy
+{
+	public:
+
+	SliceType convertPoints(const std::vector<ISPDB25Point>& points) override
+	{
+		conversions++;
+		return CaptureDummy::convertPoints(points);
+	}
+
+	std::atomic<unsigned> conversions{ 0 };
+};
+
+static void createPlayer()
+{
+	std::set<pid_t> before = processThreads();
+	player = new FilePlayer();
+	for(pid_t tid : processThreads()) {
+		if(before.count(tid) == 0)
+			outputThread = tid;
+	}
+
+	std::string directory = ildaTestDirectory();
+	player->localFileDirectory = directory + "/library/";
+	player->usbFileDirectory = directory + "/usb/";
+	player->frameCacheDirectory = directory + "/cache/";
+	std::filesystem::create_directories(player->localFileDirectory);
+	std::filesystem::create_directories(player->usbFileDirectory);
+	std::filesystem::create_directories(player->frameCacheDirectory);
+}
+
+static void setSliceCacheMb(unsigned megabytes)
+{
+	mINI::INIStructure ini;
+	ini["file_player"]["slice_cache_mb"] = std::to_string(megabytes);
+	player->readSettings(ini);
+}
+
+static void addLibraryFile(const std::string& name, const IldaFrames& frames)
+{
+	std::vector<uint8_t> bytes = encodeIldaFile(frames);
+	FILE* file = fopen((player->localFileDirectory + name).c_str(), "wb");
+	if(file == NULL)
+		return;
+	fwrite(bytes.data(), 1, bytes.size(), file);
+	fclose(file);
+}
+
+//count frames of points each, frame k marked by the green value (first + k) << 8
+static void removeLibraryFiles()
+{
+	std::filesystem::remove_all(player->localFileDirectory);
+	std::filesystem::create_directories(player->localFileDirectory);
+}
+
+static void addProgramFile(const std::string& name, const char* lines)
+{
+	FILE* file = fopen((player->localFileDirectory + name).c_str(), "w");
+	if(file == NULL)
+		return;
+	fputs(lines, file);
+	fclose(file);
+}
+
+static IldaFrames markedFrames(unsigned count, unsigned points, unsigned first)
+{
+	IldaFrames frames;
+	for(unsigned k = 0; k < count; k++)
+		frames.push_back(testFrame(points, (uint16_t)((first + k) << 8)));
+	return frames;
+}
+
+static std::shared_ptr<CountingDummy> newOutput()
+{
+	std::shared_ptr<CountingDummy> device = std::make_shared<CountingDummy>();
+	startBridge(device);
+	return device;
+}
+
+static void loadLibrary()
+{
+	player->libraryIndex.scan({ player->localFileDirectory, player->usbFileDirectory });
+	player->buildProgramMap();
+}
+
+static void playProgram(const std::string& name, const std::vector<std::shared_ptr<DACHWInterface>>& devices)
+{
+	management->devices = devices;
+	loadLibrary();
+	player->playFile(name);
+}
+
+//waits until the player started playing and stopped again, returns the time in ms since it started
+static double waitForStop(double timeoutMs)
+{
+	double startUs = testNowUs();
+	while(player->state.load() == FILEPLAYER_STATE_STOP && testNowUs() - startUs < timeoutMs * 1000)
+		testSleepMs(1);
+	startUs = testNowUs();
+	while(player->state.load() != FILEPLAYER_STATE_STOP && testNowUs() - startUs < timeoutMs * 1000)
+		testSleepMs(1);
+	return (testNowUs() - startUs) / 1000.0;
+}
+
+//stops the player and lets the devices play out what they had
+static void stopPlayer()
+{
+	player->stop();
+	testSleepMs(100);
+	for(const auto& device : management->devices)
+		device->stop(false);
+}
+
+
+// -- Slice cache ---------------------------------------------------------------
+
+#define CACHE_FRAME_POINTS 1000
+
+static std::shared_ptr<FrameSliceCache::ConvertedFrame> convertedFrame(DummyAdapter& device, uint32_t fileId, uint32_t frameIndex)
+{
+	std::vector<ISPDB25Point> points = testFrame(CACHE_FRAME_POINTS, 0x8000);
+	std::shared_ptr<FrameSliceCache::ConvertedFrame> frame = std::make_shared<FrameSliceCache::ConvertedFrame>(FrameSliceCache::Key(fileId, frameIndex, typeid(device), 30000));
+	std::shared_ptr<TimeSlice> slice = std::make_shared<TimeSlice>();
+	slice->dataChunk = device.convertPoints(points);
+	slice->durationUs = CACHE_FRAME_POINTS * 1000000 / 30000;
+	frame->bytes = slice->dataChunk.capacity() * sizeof(SlicePrimitive) + sizeof(TimeSlice) + sizeof(std::shared_ptr<TimeSlice>);
+	frame->slices.push_back(slice);
+	return frame;
+}
+
+static void sliceCacheHitsDoNotAllocate()
+{
+	//the lookups of the loader for every queued frame, hits and misses
+	DummyAdapter device;
+	FrameSliceCache cache;
+	for(uint32_t i = 0; i < 100; i++)
+		cache.insert(convertedFrame(device, 1, i));
+
+	AllocCount before = ownAllocations();
+	unsigned hits = 0, misses = 0;
+	for(uint32_t i = 0; i < 50000; i++) {
+		hits += (cache.find(FrameSliceCache::Key(1, i % 100, typeid(device), 30000)) != nullptr);
+		misses += (cache.find(FrameSliceCache::Key(2, i % 100, typeid(device), 30000)) == nullptr);
+	}
+	AllocCount after = ownAllocations();
+
+	CHECK(hits == 50000 && misses == 50000);
+	CHECK_MSG(after.count == before.count, "%llu allocations, %llu bytes", after.count - before.count, after.bytes - before.bytes);
+}
+
+static void sliceCacheAccounting()
+{
+	//the bytes counted against the budget are what the cache holds on the heap, and the
+	//process does not grow beyond the budget while frames are evicted
+	const size_t budget = 16 * 1024 * 1024;
+	DummyAdapter device;
+
+	malloc_trim(0);
+	size_t heapBefore = mallinfo2().uordblks;
+	size_t residentBefore = residentBytes();
+
+	FrameSliceCache cache;
+	cache.setBudget(budget);
+	size_t inserted = 0;
+	for(uint32_t i = 0; inserted < 4 * budget; i++) {
+		std::shared_ptr<FrameSliceCache::ConvertedFrame> frame = convertedFrame(device, 1, i);
+		inserted += frame->bytes;
+		cache.insert(frame);
+	}
+
+	size_t used = cache.getUsed();
+	double heapGrowth = (double)mallinfo2().uordblks - heapBefore;
+	double residentGrowth = (double)residentBytes() - residentBefore;
+	printf("     %.1f MB inserted, %.1f MB cached, heap +%.1f MB, resident +%.1f MB\n", inserted / 1048576.0,
+		used / 1048576.0, heapGrowth / 1048576.0, residentGrowth / 1048576.0);
+
+	CHECK_MSG(used <= budget && used > budget * 0.9, "%zu bytes used", used);
+	CHECK_MSG(std::fabs(heapGrowth - used) < used * 0.1, "heap +%.0f bytes for %zu bytes", heapGrowth, used);
+	CHECK_MSG(residentGrowth < budget * 1.25 + 4 * 1024 * 1024, "resident +%.0f bytes", residentGrowth);
+
+	//a budget of 0 disables the cache and frees everything
+	cache.setBudget(0);
+	malloc_trim(0);
+	heapGrowth = (double)mallinfo2().uordblks - heapBefore;
+	residentGrowth = (double)residentBytes() - residentBefore;
+	CHECK(cache.getUsed() == 0);
+	CHECK_MSG(heapGrowth < budget * 0.05, "heap +%.0f bytes", heapGrowth);
+	CHECK_MSG(residentGrowth < budget * 0.25, "resident +%.0f bytes", residentGrowth);
+}
+
+
+// -- Playback ------------------------------------------------------------------
+
+struct LoopRun
+{
+	unsigned conversions;
+	unsigned frames;
+	AllocCount allocations;
+};
+
+//plays a looping file of frames of framePoints points and measures the output thread for one
+//second once the passes the loader queued ahead of the cache have played
+static LoopRun playLoop(const std::string& name, unsigned framePoints)
+{
+	std::shared_ptr<CountingDummy> device = newOutput();
+	quietStdout(true);
+	playProgram(name, { device });
+	testSleepMs(1500);
+
+	unsigned conversionsBefore = device->conversions;
+	size_t pointsBefore = device->getPoints().size();
+	AllocCount before = allocationsOf(outputThread);
+	testSleepMs(1000);
+	AllocCount after = allocationsOf(outputThread);
+
+	LoopRun run;
+	run.conversions = device->conversions - conversionsBefore;
+	run.frames = (unsigned)((device->getPoints().size() - pointsBefore) / framePoints);
+	run.allocations.count = after.count - before.count;
+	run.allocations.bytes = after.bytes - before.bytes;
+
+	stopPlayer();
+	quietStdout(false);
+	printf("     %u points per frame: %u frames, %u conversions, %.1f allocations and %.0f bytes per frame\n", framePoints, run.frames,
+		run.conversions, run.allocations.count / (double)run.frames, run.allocations.bytes / (double)run.frames);
+	return run;
+}
+
+static void loopingPlaybackReusesSlices()
+{
+	//once the file played, its frames come from the slice cache and are not converted again.
+	//the driver outputs the cached slices as they are, the output thread does not allocate.
+	addLibraryFile("small.ild", markedFrames(10, 300, 1));
+	addLibraryFile("large.ild", markedFrames(4, 3000, 1));
+	player->mode = FILEPLAYER_MODE_REPEAT;
+	setSliceCacheMb(FRAME_SLICE_CACHE_DEFAULT_BUDGET_MB);
+
+	LoopRun small = playLoop("small.prg", 300);
+	LoopRun large = playLoop("large.prg", 3000);
+	CHECK_MSG(small.frames >= 90 && large.frames >= 9, "%u and %u frames", small.frames, large.frames);
+	CHECK(small.conversions == 0 && large.conversions == 0);
+
+	CHECK_MSG(small.allocations.count == 0, "%llu allocations, %llu bytes", small.allocations.count, small.allocations.bytes);
+	CHECK_MSG(large.allocations.count == 0, "%llu allocations, %llu bytes", large.allocations.count, large.allocations.bytes);
+
+	//without the cache every pass converts again
+	setSliceCacheMb(0);
+	LoopRun uncached = playLoop("small.prg", 300);
+	CHECK_MSG(uncached.conversions + 10 >= uncached.frames, "%u conversions for %u frames", uncached.conversions, uncached.frames);
+
+	setSliceCacheMb(FRAME_SLICE_CACHE_DEFAULT_BUDGET_MB);
+	removeLibraryFiles();
+}
+
+//the frame marker of a write, 0 for a blank write
+static unsigned writeMarker(const CapturedWrite& write)
+{
+	for(const auto& point : write.points) {
+		if(isLitPoint(point))
+			return point.g >> 8;
+	}
+	return 0;
+}
+
+static void programTransitionsAreGapless()
+{
+	//programs a, b and c of 5 frames each in next mode. the loader opens the next program while
+	//the current one still plays, so its first frame follows the last one without a gap.
+	const unsigned framePoints = 300;
+	const char* names[] = { "a.ild", "b.ild", "c.ild" };
+	for(unsigned program = 0; program < 3; program++)
+		addLibraryFile(names[program], markedFrames(5, framePoints, 10 * program + 1));
+	player->mode = FILEPLAYER_MODE_NEXT;
+
+	std::shared_ptr<CountingDummy> device = newOutput();
+	quietStdout(true);
+	playProgram("a.prg", { device });
+	testSleepMs(2000);
+	stopPlayer();
+	quietStdout(false);
+
+	//frames in sequence, a program ends with marker 5 and the next one starts with 1
+	std::vector<CapturedWrite> writes = device->getWrites();
+	unsigned frames = 0, transitions = 0, outOfSequence = 0;
+	double maxFrameGapUs = 0, maxTransitionGapUs = 0, transitionGapSumUs = 0;
+	const CapturedWrite* previous = nullptr;
+	for(const auto& write : writes) {
+		unsigned marker = writeMarker(write);
+		if(marker == 0)
+			continue;
+		frames++;
+
+		if(previous != nullptr) {
+			unsigned previousMarker = writeMarker(*previous);
+			double gapUs = write.startUs - previous->endUs;
+			if(previousMarker % 10 == 5 && marker % 10 == 1) {
+				transitions++;
+				transitionGapSumUs += gapUs;
+				maxTransitionGapUs = std::max(maxTransitionGapUs, gapUs);
+			}
+			else if(marker == previousMarker + 1)
+				maxFrameGapUs = std::max(maxFrameGapUs, gapUs);
+			else
+				outOfSequence++;
+		}
+		previous = &write;
+	}
+
+	printf("     %u frames, %u transitions, gap mean %.0f us, max %.0f us, within programs max %.0f us\n", frames, transitions,
+		transitions ? transitionGapSumUs / transitions : 0, maxTransitionGapUs, maxFrameGapUs);
+	CHECK_MSG(frames > 150, "%u frames", frames);
+	CHECK_MSG(transitions > 30, "%u transitions", transitions);
+	CHECK_MSG(outOfSequence == 0, "%u frames out of sequence", outOfSequence);
+	CHECK_MSG(maxTransitionGapUs < 1000, "%.0f us", maxTransitionGapUs);
+
+	player->mode = FILEPLAYER_MODE_REPEAT;
+	removeLibraryFiles();
+}
+
+
+static void framesKeepTheirDuration()
+{
+	//100 frames of 10 ms played once. the driver looks for the next frame before it blanks after
+	//a frame, and blanks only once the device is about to run out, so the frames follow each
+	//other without blanks and the file takes its 1 s.
+	const unsigned framePoints = 300, numFrames = 100;
+	addLibraryFile("once.ild", markedFrames(numFrames, framePoints, 1));
+	player->mode = FILEPLAYER_MODE_ONCE;
+
+	std::shared_ptr<CountingDummy> device = newOutput();
+	quietStdout(true);
+	playProgram("once.prg", { device });
+	waitForStop(3000);
+	testSleepMs(100);
+	quietStdout(false);
+
+	std::vector<CapturedWrite> writes = device->getWrites();
+	unsigned frames = 0, blanks = 0;
+	double firstStartUs = 0, lastEndUs = 0;
+	for(const auto& write : writes) {
+		if(writeMarker(write) == 0) {
+			blanks += (frames > 0 && frames < numFrames);
+			continue;
+		}
+		if(frames == 0)
+			firstStartUs = write.startUs;
+		lastEndUs = write.endUs;
+		frames++;
+	}
+
+	double playedMs = (lastEndUs - firstStartUs) / 1000.0;
+	printf("     %u frames in %.1f ms, %u blanks between them\n", frames, playedMs, blanks);
+	CHECK_MSG(player->state.load() == FILEPLAYER_STATE_STOP, "still playing");
+	CHECK_MSG(frames == numFrames, "%u frames", frames);
+	CHECK_MSG(blanks == 0, "%u blanks", blanks);
+	CHECK_MSG(std::fabs(playedMs - numFrames * 10.0) < 2, "%.1f ms", playedMs);
+
+	device->stop(false);
+	player->mode = FILEPLAYER_MODE_REPEAT;
+	removeLibraryFiles();
+}
+
+static void endActionWaitsForProgramOutputs()
+{
+	//a program on output 2 ends while output 1 has local frames that its driver never picks up.
+	//the end action only waits for the outputs the program played on.
+	addLibraryFile("second.ild", markedFrames(10, 300, 1));
+	addProgramFile("second.prg", "#outputs,2\nsecond.ild,30,1\n");
+	player->mode = FILEPLAYER_MODE_ONCE;
+
+	std::shared_ptr<CountingDummy> idle = std::make_shared<CountingDummy>();
+	std::shared_ptr<CountingDummy> device = newOutput();
+	std::shared_ptr<SliceBuf> slices = std::make_shared<SliceBuf>();
+	slices->push_back(std::make_shared<TimeSlice>());
+	slices->back()->dataChunk = idle->convertPoints(testFrame(300, 0x8000));
+	slices->back()->durationUs = 10000;
+	idle->putLocalFrame(slices, 0x8000, 0x8000, OUTPUT_MODE_FILE);
+
+	quietStdout(true);
+	playProgram("second.prg", { idle, device });
+	double stoppedMs = waitForStop(1000);
+	testSleepMs(100);
+	quietStdout(false);
+
+	printf("     stopped after %.0f ms\n", stoppedMs);
+	CHECK_MSG(stoppedMs < 300, "%.0f ms", stoppedMs);
+	CHECK(device->getPoints().size() >= 10 * 300);
+	CHECK(idle->getPoints().empty());
+
+	stopPlayer();
+	player->mode = FILEPLAYER_MODE_REPEAT;
+	removeLibraryFiles();
+}
+
+//the lit writes of a device, with the frame marker of each
+static std::vector<std::pair<unsigned, double>> markedWrites(CaptureDummy& device)
+{
+	std::vector<std::pair<unsigned, double>> marked;
+	for(const auto& write : device.getWrites()) {
+		unsigned marker = writeMarker(write);
+		if(marker != 0)
+			marked.push_back(std::make_pair(marker, write.endUs));
+	}
+	return marked;
+}
+
+static void fanOutToSeveralOutputs()
+{
+	//a program on outputs 1, 3 and 4 of four. the frames are converted once for the device type
+	//and played on the three devices within a frame of each other, output 2 gets nothing. the
+	//file is longer than the loader queues ahead, so its second pass finds the conversions of
+	//the first in the slice cache.
+	const unsigned numFrames = 60;
+	addLibraryFile("fan.ild", markedFrames(numFrames, 300, 1));
+	addProgramFile("fan.prg", "#outputs,1,3,4\nfan.ild,30,1\n");
+
+	std::vector<std::shared_ptr<CountingDummy>> devices;
+	for(int i = 0; i < 4; i++)
+		devices.push_back(newOutput());
+
+	quietStdout(true);
+	playProgram("fan.prg", { devices[0], devices[1], devices[2], devices[3] });
+	testSleepMs(1500);
+	stopPlayer();
+	quietStdout(false);
+
+	std::vector<std::pair<unsigned, double>> first = markedWrites(*devices[0]);
+	unsigned outOfSequence = 0;
+	for(size_t k = 1; k < first.size(); k++)
+		outOfSequence += (first[k].first != first[k - 1].first % numFrames + 1);
+
+	//the outputs start with the same frame, give or take the one that was in hand-over
+	double maxOffsetUs = 0;
+	for(int i : { 2, 3 }) {
+		std::vector<std::pair<unsigned, double>> other = markedWrites(*devices[i]);
+		size_t skipFirst = 0, skipOther = 0;
+		if(!first.empty() && !other.empty() && first[0].first != other[0].first) {
+			if(first.size() > 1 && first[1].first == other[0].first)
+				skipFirst = 1;
+			else
+				skipOther = 1;
+		}
+		size_t matched = std::min(first.size() - skipFirst, other.size() - skipOther);
+		CHECK_MSG(matched + 2 >= first.size(), "output %d: %zu frames, output 1 %zu", i + 1, other.size(), first.size());
+		for(size_t k = 0; k < matched; k++) {
+			const auto& a = first[k + skipFirst];
+			const auto& b = other[k + skipOther];
+			if(a.first != b.first)
+				outOfSequence++;
+			else
+				maxOffsetUs = std::max(maxOffsetUs, std::fabs(a.second - b.second));
+		}
+	}
+
+	unsigned conversions = devices[0]->conversions + devices[2]->conversions + devices[3]->conversions;
+	printf("     %zu frames on output 1, %u conversions, outputs 3 and 4 at most %.0f us apart from output 1\n", first.size(), conversions,
+		maxOffsetUs);
+	CHECK_MSG(first.size() > 100, "%zu frames", first.size());
+	CHECK_MSG(outOfSequence == 0, "%u frames out of sequence", outOfSequence);
+	CHECK_MSG(conversions <= numFrames, "%u conversions", conversions);
+	CHECK(devices[2]->conversions == 0 && devices[3]->conversions == 0);
+	CHECK(devices[1]->getPoints().empty());
+	CHECK_MSG(maxOffsetUs < 10000, "%.0f us", maxOffsetUs);
+
+	removeLibraryFiles();
+}
+
+
+// -- Clock timing ------------------------------------------------------------------
+
+#define DRIFT_FPS 30
+#define DRIFT_SKEW_PPM 5000
+#define DRIFT_PLAY_MS 6000
+
+//offset in us of each frame written against its period on the wall clock, from the first frame
+static std::vector<double> frameOffsets(const char* timing)
+{
+	mINI::INIStructure ini;
+	ini["file_player"]["timing"] = timing;
+	player->readSettings(ini);
+	DummyAdapter::setClockSkew(DRIFT_SKEW_PPM);
+
+	std::shared_ptr<CountingDummy> device = newOutput();
+	quietStdout(true);
+	playProgram("drift.prg", { device });
+	testSleepMs(DRIFT_PLAY_MS);
+	stopPlayer();
+	quietStdout(false);
+	DummyAdapter::setClockSkew(0);
+
+	std::vector<double> offsets;
+	std::vector<std::pair<unsigned, double>> writes = markedWrites(*device);
+	for(size_t k = 0; k < writes.size(); k++)
+		offsets.push_back(writes[k].second - writes[0].second - k * 1000000.0 / DRIFT_FPS);
+	return offsets;
+}
+
+//mean offset of the frames in the second of play from startS on
+static double meanOffsetMs(const std::vector<double>& offsets, double startS)
+{
+	double sum = 0;
+	unsigned count = 0;
+	for(size_t k = (size_t)(startS * DRIFT_FPS); k < offsets.size() && k < (size_t)((startS + 1) * DRIFT_FPS); k++) {
+		sum += offsets[k];
+		count++;
+	}
+	return count ? sum / count / 1000 : 0;
+}
+
+static void clockTimingBoundsDrift()
+{
+	//a 30 fps file on a device whose clock runs 0.5% fast. timed by its points, the frames come
+	//5 ms earlier every second. on the clock the frames keep their period on the wall clock with
+	//a bounded offset.
+	addLibraryFile("drift.ild", markedFrames(DRIFT_FPS, 300, 1));
+	addProgramFile("drift.prg", "drift.ild,30fps,1\n");
+
+	std::vector<double> pointOffsets = frameOffsets("points");
+	std::vector<double> clockOffsets = frameOffsets("clock");
+
+	//the clock drifts until it settled, the correction then ends the drift with an offset of its
+	//correction time times the skew
+	double pointDriftMs = meanOffsetMs(pointOffsets, 4) - meanOffsetMs(pointOffsets, 3);
+	double clockDriftMs = meanOffsetMs(clockOffsets, 4) - meanOffsetMs(clockOffsets, 3);
+	double clockMaxMs = 0;
+	for(double offset : clockOffsets)
+		clockMaxMs = std::max(clockMaxMs, std::fabs(offset) / 1000);
+	double boundMs = (FILEPLAYER_CLOCK_SETTLE_MS + FILEPLAYER_CLOCK_CORRECTION_MS) * DRIFT_SKEW_PPM / 1000000.0 + 5;
+
+	printf("     drift from 3 s to 4 s: %.1f ms timed by points, %.1f ms on the clock, clock offset max %.1f ms\n", pointDriftMs,
+		clockDriftMs, clockMaxMs);
+	CHECK_MSG(pointOffsets.size() > (DRIFT_PLAY_MS - 1000) * DRIFT_FPS / 1000, "%zu frames", pointOffsets.size());
+	CHECK_MSG(clockOffsets.size() > (DRIFT_PLAY_MS - 1000) * DRIFT_FPS / 1000, "%zu frames", clockOffsets.size());
+	CHECK_MSG(pointDriftMs < -4, "%.1f ms", pointDriftMs);
+	CHECK_MSG(std::fabs(clockDriftMs) < 2, "%.1f ms", clockDriftMs);
+	CHECK_MSG(clockMaxMs < boundMs, "%.1f ms, bound %.1f ms", clockMaxMs, boundMs);
+
+	mINI::INIStructure ini;
+	ini["file_player"]["timing"] = "points";
+	player->readSettings(ini);
+	removeLibraryFiles();
+}
+
+
+// -- Program list ----------------------------------------------------------------
+
+static void programListPages()
+{
+	//pages hold whole programs up to the requested length, the management interface sends them
+	//as they are. a program too long for a page on its own is cut after its last line that fits
+	//and counted, so the paging goes on behind it.
+	std::string longProgram;
+	for(unsigned i = 0; i < 50; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "%s%02u.ild", (i < 30) ? "long" : "solo", i);
+		addLibraryFile(name, markedFrames(1, 10, 1));
+		if(i < 30)
+			longProgram += std::string(name) + ",30,1\n";
+	}
+	FILE* file = fopen((player->localFileDirectory + "long.prg").c_str(), "w");
+	if(file != NULL) {
+		fputs(longProgram.c_str(), file);
+		fclose(file);
+	}
+	quietStdout(true);
+	loadLibrary();
+	quietStdout(false);
+
+	unsigned programsInPage = 0, totalPrograms = 0;
+	std::string wholeList = player->getProgramListPage(0, 1000000, programsInPage, totalPrograms);
+	CHECK_MSG(totalPrograms == 21 && programsInPage == 21, "%u of %u programs", programsInPage, totalPrograms);
+
+	for(size_t maxLength : { (size_t)8, (size_t)40, (size_t)100, (size_t)300, (size_t)8192 - 13 }) {
+		std::string pages;
+		unsigned first = 0, numPages = 0, longPrograms = 0;
+		bool fits = true, whole = true;
+		quietStdout(true);
+		while(first < totalPrograms && numPages <= totalPrograms) {
+			std::string page = player->getProgramListPage(first, maxLength, programsInPage, totalPrograms);
+			fits &= (page.size() <= maxLength && programsInPage >= 1);
+			whole &= (!page.empty() && page.back() == '\n');
+			longPrograms += (page.find("long.prg") != std::string::npos);
+			pages += page;
+			first += programsInPage;
+			numPages++;
+		}
+		quietStdout(false);
+
+		CHECK_MSG(fits, "%zu bytes: a page is too long or empty", maxLength);
+		CHECK_MSG(first == totalPrograms, "%zu bytes: %u of %u programs listed", maxLength, first, totalPrograms);
+		CHECK_MSG(longPrograms == 1, "%zu bytes: long.prg on %u pages", maxLength, longPrograms);
+
+		//the long program is cut below 1100 bytes, program lines below 20
+		if(maxLength >= 1100)
+			CHECK_MSG(pages == wholeList, "%zu bytes: pages differ from the whole list", maxLength);
+		if(maxLength >= 20)
+			CHECK_MSG(whole, "%zu bytes: a line is cut", maxLength);
+		if(maxLength < 1100)
+			CHECK_MSG(pages.size() < wholeList.size(), "%zu bytes: the long program is not cut", maxLength);
+	}
+
+	removeLibraryFiles();
+}
+
+
+int main(int argc, char** argv)
+{
+	createPlayer();
+
+	RUN_TEST(sliceCacheHitsDoNotAllocate);
+	RUN_TEST(sliceCacheAccounting);
+	RUN_TEST(loopingPlaybackReusesSlices);
+	RUN_TEST(programTransitionsAreGapless);
+	RUN_TEST(framesKeepTheirDuration);
+	RUN_TEST(endActionWaitsForProgramOutputs);
+	RUN_TEST(fanOutToSeveralOutputs);
+	RUN_TEST(clockTimingBoundsDrift);
+	RUN_TEST(programListPages);
+
+	removeIldaTestFiles();
+	return finishTests("FilePlayerTest");
+}
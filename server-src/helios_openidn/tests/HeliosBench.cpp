@@ -0,0 +1,307 @@
+#include "HeliosTestSupport.hpp"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <thread>
+#include <atomic>
+
+//measurements of the Helios output path on simulated DACs. "make bench" runs all sections,
+//single sections are selected by name on the command line.
+
+
+#define BENCH_DEVICES 4
+#define BENCH_PPS 30000
+#define BENCH_RUN_S 2
+
+
+struct WriteResult
+{
+	double framesPerS;
+	double statusPerFrame;
+	double idleMs;
+	unsigned underruns;
+	unsigned dropped;
+};
+
+//writes frames of count points back to back for the given time, like the driver thread in frame mode
+static WriteResult writeFrames(HeliosAdapter& adapter, int deviceIndex, unsigned count, double seconds)
+{
+	SliceType frame = heliosTestFrame(adapter, count);
+	double durationUs = count * 1000000.0 / BENCH_PPS;
+
+	HeliosSimStats before;
+	HeliosSimGetStats(deviceIndex, before);
+
+	double startUs = testNowUs();
+	double endUs = startUs + seconds * 1000000.0;
+	while(testNowUs() < endUs)
+		writeHeliosTestFrame(adapter, frame, durationUs);
+	double elapsedS = (testNowUs() - startUs) / 1000000.0;
+
+	HeliosSimStats after;
+	HeliosSimGetStats(deviceIndex, after);
+
+	WriteResult result;
+	unsigned frames = after.framesReceived - before.framesReceived;
+	result.framesPerS = frames / elapsedS;
+	result.statusPerFrame = frames ? (after.statusRequests - before.statusRequests) / (double)frames : 0;
+	result.idleMs = (after.idleUs - before.idleUs) / 1000.0;
+	result.underruns = after.underruns - before.underruns;
+	result.dropped = after.framesDropped - before.framesDropped;
+	return result;
+}
+
+//lets the DACs play out the frames of the previous run
+static void settle()
+{
+	testSleepMs(300);
+	HeliosSimResetStats();
+}
+
+
+// -- Sections ----------------------------------------------------------------
+
+typedef std::vector<std::shared_ptr<HeliosAdapter>> AdapterList;
+
+//synchronous writes poll the status before every frame and block on the bulk transfer,
+//asynchronous writes pipeline the transfer and predict when the DAC is ready
+static void asyncTransfers(AdapterList& adapters)
+{
+	HeliosAdapter& adapter = *adapters[0];
+
+	printf("frames of n points at %d pps on one DAC, %d s per run\n", BENCH_PPS, BENCH_RUN_S);
+	printf("  %-5s %5s %8s %9s %9s %9s %7s %8s\n", "mode", "n", "frame ms", "frames/s", "underruns", "idle ms", "status", "dropped");
+
+	unsigned counts[] = { 50, 100, 300, 1000, 4000 };
+	for(int async = 0; async < 2; async++) {
+		HeliosAdapter::setAsyncTransfers(async != 0);
+		for(unsigned count : counts) {
+			settle();
+			WriteResult result = writeFrames(adapter, 0, count, BENCH_RUN_S);
+			printf("  %-5s %5u %8.2f %9.1f %9u %9.1f %7.2f %8u\n", async ? "async" : "sync", count, count * 1000.0 / BENCH_PPS,
+				result.framesPerS, result.underruns, result.idleMs, result.statusPerFrame, result.dropped);
+		}
+	}
+	HeliosAdapter::setAsyncTransfers(false);
+}
+
+//one driver thread per DAC, as with one HWBridge per Helios service. the DACs only share the
+//device list, so the aggregate frame rate grows with the number of DACs. management requests
+//for the DAC names run alongside in the second half of the runs.
+static void deviceScaling(AdapterList& adapters)
+{
+	const unsigned count = 300;
+	printf("frames of %u points at %d pps (%.1f ms) on 1 to %d DACs, %d s per run\n", count, BENCH_PPS, count * 1000.0 / BENCH_PPS, (int)adapters.size(), BENCH_RUN_S);
+	printf("  %-5s %4s %-5s %9s %9s %9s %9s\n", "mode", "DACs", "names", "frames/s", "per DAC", "underruns", "idle ms");
+
+	for(int async = 0; async < 2; async++) {
+		HeliosAdapter::setAsyncTransfers(async != 0);
+		for(int names = 0; names < 2; names++) {
+			for(size_t numDacs = 1; numDacs <= adapters.size(); numDacs++) {
+				settle();
+
+				//reads the names of all DACs every 10 ms, like the management interface listing the devices
+				std::atomic<bool> running(true);
+				std::atomic<unsigned> nameRequests(0);
+				std::thread management;
+				if(names) {
+					management = std::thread([&] {
+						while(running) {
+							for(auto& adapter : adapters) {
+								char name[32];
+								adapter->getName(name, sizeof(name));
+								nameRequests++;
+							}
+							testSleepMs(10);
+						}
+					});
+				}
+
+				std::vector<WriteResult> results(numDacs);
+				std::vector<std::thread> writers;
+				for(size_t k = 0; k < numDacs; k++)
+					writers.emplace_back([&, k] { results[k] = writeFrames(*adapters[k], (int)k, count, BENCH_RUN_S); });
+				for(auto& writer : writers)
+					writer.join();
+
+				running = false;
+				if(management.joinable())
+					management.join();
+
+				double framesPerS = 0, idleMs = 0;
+				unsigned underruns = 0;
+				for(const auto& result : results) {
+					framesPerS += result.framesPerS;
+					underruns += result.underruns;
+					idleMs += result.idleMs;
+				}
+				printf("  %-5s %4zu %-5s %9.1f %9.1f %9u %9.1f\n", async ? "async" : "sync", numDacs, names ? "yes" : "no",
+					framesPerS, framesPerS / numDacs, underruns, idleMs);
+			}
+		}
+	}
+	HeliosAdapter::setAsyncTransfers(false);
+}
+
+//writes frames until running is cleared, retrying every ms while the adapter has no DAC
+static void writeWhile(HeliosAdapter& adapter, unsigned count, std::atomic<bool>& running)
+{
+	SliceType frame = heliosTestFrame(adapter, count);
+	double durationUs = count * 1000000.0 / BENCH_PPS;
+	while(running) {
+		if(writeHeliosTestFrame(adapter, frame, durationUs) < 0)
+			testSleepMs(1);
+	}
+}
+
+static bool adapterHasDac(HeliosAdapter& adapter)
+{
+	char name[33] = { 0 };
+	adapter.getName(name, 32);
+	return strncmp(name, "[Missing", 8) != 0;
+}
+
+//the last DAC is unplugged and plugged back in while it and the first DAC are playing. measures
+//the time until the adapter lets go of the DAC, the time from the replug to the first frame the
+//DAC receives again, and the underruns of the first DAC meanwhile.
+static void hotplugRecovery(AdapterList& adapters)
+{
+	const unsigned count = 300;
+	const int cycles = 5;
+	int last = (int)adapters.size() - 1;
+	printf("frames of %u points at %d pps on DACs 0 and %d, DAC %d unplugged and replugged %d times\n", count, BENCH_PPS, last, last, cycles);
+	printf("  %5s %10s %12s %16s\n", "cycle", "detach ms", "recovery ms", "DAC 0 underruns");
+
+	settle();
+	std::atomic<bool> running(true);
+	std::thread first([&] { writeWhile(*adapters[0], count, running); });
+	std::thread second([&] { writeWhile(*adapters[last], count, running); });
+
+	double detachSum = 0, recoverySum = 0, recoveryMax = 0;
+	for(int cycle = 0; cycle < cycles; cycle++) {
+		testSleepMs(300);
+		HeliosSimStats firstBefore;
+		HeliosSimGetStats(0, firstBefore);
+
+		double unplugUs = testNowUs();
+		HeliosSimSetPresent(last, false);
+		while(adapterHasDac(*adapters[last]) && testNowUs() - unplugUs < 5000000)
+			testSleepMs(0.2);
+		double detachMs = (testNowUs() - unplugUs) / 1000.0;
+
+		testSleepMs(200);
+
+		HeliosSimStats lastBefore, lastNow;
+		HeliosSimGetStats(last, lastBefore);
+		double replugUs = testNowUs();
+		HeliosSimSetPresent(last, true);
+		do {
+			testSleepMs(0.2);
+			HeliosSimGetStats(last, lastNow);
+		} while(lastNow.framesReceived == lastBefore.framesReceived && testNowUs() - replugUs < 5000000);
+		double recoveryMs = (testNowUs() - replugUs) / 1000.0;
+
+		testSleepMs(100);
+		HeliosSimStats firstAfter;
+		HeliosSimGetStats(0, firstAfter);
+
+		printf("  %5d %10.1f %12.1f %16u\n", cycle + 1, detachMs, recoveryMs, firstAfter.underruns - firstBefore.underruns);
+		detachSum += detachMs;
+		recoverySum += recoveryMs;
+		recoveryMax = std::max(recoveryMax, recoveryMs);
+	}
+	printf("  mean detach %.1f ms, mean recovery %.1f ms, max recovery %.1f ms\n", detachSum / cycles, recoverySum / cycles, recoveryMax);
+
+	running = false;
+	first.join();
+	second.join();
+}
+
+static double processCpuMs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+//a repeating IDN frame through HWBridge, with the frame looped by the DAC (HELIOS_FLAGS_SINGLE_MODE
+//cleared) and rewritten by the bridge. the source sends the frame once, resends the same frame at
+//30 fps like a typical IDN stream of a still scene, or changes it every time.
+static void deviceLooping(AdapterList& adapters)
+{
+	const unsigned count = 300;
+	const double seconds = 3;
+	printf("repeating frames of %u points, %.1f ms, through HWBridge for %.0f s\n", count, count * 1000.0 / BENCH_PPS, seconds);
+	printf("  %-8s %-6s %9s %9s %9s %8s %9s\n", "source", "loop", "transfers", "status", "kB", "cpu ms", "underruns");
+
+	std::shared_ptr<HeliosAdapter> adapter = adapters[0];
+	std::shared_ptr<HWBridge> bridge = startBridge(adapter);
+	TestChunkSource source;
+
+	const char* sources[] = { "once", "resent", "changing" };
+	for(int mode = 0; mode < 3; mode++) {
+		for(int loop = 1; loop >= 0; loop--) {
+			bridge->setDeviceLoop(loop != 0);
+			settle();
+			adapter->start();
+
+			HeliosSimStats before, after;
+			HeliosSimGetStats(0, before);
+			double cpuBefore = processCpuMs();
+			double startUs = testNowUs();
+
+			for(unsigned k = 0; testNowUs() - startUs < seconds * 1000000.0; k++) {
+				if(k == 0 || mode > 0) {
+					uint16_t green = (mode == 2) ? (uint16_t)(0x1000 + (k % 0xe0) * 0x100) : 0x8000;
+					source.put(*adapter, testFrame(count, green), count * 1000000 / BENCH_PPS, LAPRO_CHUNK_TYPE_FRAME_RPT);
+				}
+				testSleepMs(1000.0 / 30);
+				source.recycle(*adapter);
+			}
+
+			double cpuMs = processCpuMs() - cpuBefore;
+			HeliosSimGetStats(0, after);
+			adapter->stop(false);
+			source.recycle(*adapter);
+
+			printf("  %-8s %-6s %9u %9u %9.1f %8.1f %9u\n", sources[mode], loop ? "device" : "bridge",
+				after.framesReceived - before.framesReceived, after.statusRequests - before.statusRequests,
+				(after.pointsReceived - before.pointsReceived) * HELIOS_PACKED_POINT_SIZE / 1000.0, cpuMs,
+				after.underruns - before.underruns);
+		}
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	double startupMs = startHeliosSim(BENCH_DEVICES);
+	printf("startup with %d simulated DACs: %.1f ms\n", BENCH_DEVICES, startupMs);
+
+	//bound by name, so adapter k outputs to simulated DAC k
+	AdapterList adapters;
+	for(int i = 0; i < BENCH_DEVICES; i++)
+		adapters.push_back(std::make_shared<HeliosAdapter>("Helios Sim " + std::to_string(i)));
+
+	struct { const char* name; void (*function)(AdapterList&); } sections[] = {
+		{ "async", asyncTransfers },
+		{ "scaling", deviceScaling },
+		{ "hotplug", hotplugRecovery },
+		{ "loop", deviceLooping },
+	};
+
+	for(const auto& section : sections) {
+		bool selected = (argc < 2);
+		for(int i = 1; i < argc; i++)
+			selected |= (strcmp(argv[i], section.name) == 0);
+		if(!selected)
+			continue;
+
+		printf("\n-- %s\n", section.name);
+		section.function(adapters);
+	}
+
+	fflush(stdout);
+	_exit(0);
+}
@@ -0,0 +1,158 @@
+#include "HeliosTestSupport.hpp"
+
+#include <random>
+
+//the points HeliosAdapter packs into the USB wire format (PackPoint, WriteFramePacked) against
+//the conversion to HeliosPoint and WriteFrame they replaced. both are written to a simulated
+//DAC, which captures the bulk transfers, and have to arrive byte for byte the same.
+
+
+static HeliosDac dac;
+static std::shared_ptr<HeliosAdapter> adapter;
+
+//the conversion of HeliosAdapter::convertPoints before the points were packed directly
+static std::vector<HeliosPoint> legacyConvert(const std::vector<ISPDB25Point>& points)
+{
+	std::vector<HeliosPoint> result;
+	for(const auto& point : points) {
+		HeliosPoint heliosPoint;
+		heliosPoint.x = (std::uint16_t)(point.x >> 4);
+		heliosPoint.y = (std::uint16_t)(point.y >> 4);
+		heliosPoint.r = (std::uint8_t)(point.r >> 8);
+		heliosPoint.g = (std::uint8_t)(point.g >> 8);
+		heliosPoint.b = (std::uint8_t)(point.b >> 8);
+		heliosPoint.i = (std::uint8_t)(point.intensity >> 8);
+		result.push_back(heliosPoint);
+	}
+	return result;
+}
+
+static ISPDB25Point pointWithIntensity(uint16_t x, uint16_t y, uint16_t r, uint16_t g, uint16_t b, uint16_t intensity)
+{
+	ISPDB25Point point = testPoint(x, y, r, g, b);
+	point.intensity = intensity;
+	return point;
+}
+
+static std::vector<uint8_t> takeSingleTransfer()
+{
+	std::vector<std::vector<uint8_t>> frames = HeliosSimTakeCapturedFrames(0);
+	CHECK_MSG(frames.size() <= 1, "%zu transfers", frames.size());
+	return frames.empty() ? std::vector<uint8_t>() : frames.back();
+}
+
+//writes the points both ways and compares results and transfers. returns the transfer.
+static std::vector<uint8_t> compareWrites(const char* name, const std::vector<ISPDB25Point>& points, unsigned pps, uint8_t flags)
+{
+	std::vector<HeliosPoint> legacyPoints = legacyConvert(points);
+	int legacyResult = dac.WriteFrame(0, pps, flags, legacyPoints.data(), legacyPoints.size());
+	std::vector<uint8_t> legacyTransfer = takeSingleTransfer();
+
+	SliceType packed = adapter->convertPoints(points);
+	int packedResult = dac.WriteFramePacked(0, pps, flags, packed.data(), points.size());
+	std::vector<uint8_t> packedTransfer = takeSingleTransfer();
+
+	CHECK_MSG(legacyResult == packedResult, "%s: result %d, legacy %d", name, packedResult, legacyResult);
+	CHECK_MSG(legacyTransfer.size() == packedTransfer.size(), "%s: %zu bytes, legacy %zu", name, packedTransfer.size(), legacyTransfer.size());
+	for(size_t i = 0; i < std::min(legacyTransfer.size(), packedTransfer.size()); i++) {
+		if(legacyTransfer[i] != packedTransfer[i]) {
+			CHECK_MSG(legacyTransfer[i] == packedTransfer[i], "%s: byte %zu is %02x, legacy %02x", name, i, packedTransfer[i], legacyTransfer[i]);
+			break;
+		}
+	}
+	return packedTransfer;
+}
+
+
+static void singlePointLayout()
+{
+	//checks the layout itself, so that both paths are not equally wrong
+	std::vector<ISPDB25Point> points = { pointWithIntensity(0x1234, 0xabcd, 0x12ff, 0x3400, 0xff01, 0x8080) };
+	std::vector<uint8_t> transfer = compareWrites("single point", points, 1000, HELIOS_FLAGS_SINGLE_MODE);
+	std::vector<uint8_t> expected = { 0x12, 0x3a, 0xbc, 0x12, 0x34, 0xff, 0x80, 0xe8, 0x03, 0x01, 0x00, HELIOS_FLAGS_SINGLE_MODE };
+	CHECK(transfer == expected);
+}
+
+static void fixedPointSets()
+{
+	std::vector<ISPDB25Point> square;
+	for(unsigned i = 0; i < 100; i++) {
+		uint16_t t = (uint16_t)(i % 25 * 0x0a00);
+		uint16_t corners[4][2] = { { t, 0x1000 }, { 0xf000, t }, { (uint16_t)(0xffff - t), 0xf000 }, { 0x1000, (uint16_t)(0xffff - t) } };
+		square.push_back(pointWithIntensity(corners[i / 25][0], corners[i / 25][1], 0xffff, i * 0x0291, 0, 0xffff));
+	}
+	compareWrites("square", square, 30000, HELIOS_FLAGS_SINGLE_MODE);
+	compareWrites("square looping", square, 30000, 0);
+
+	std::mt19937 random(4711);
+	for(unsigned k = 0; k < 3; k++) {
+		std::vector<ISPDB25Point> points;
+		for(unsigned i = 0; i < 1000; i++)
+			points.push_back(pointWithIntensity(random(), random(), random(), random(), random(), random()));
+		compareWrites("random", points, 20000 + k * 15000, HELIOS_FLAGS_SINGLE_MODE);
+	}
+}
+
+static void bitDepthEdges()
+{
+	//values around the bits that are dropped by the reduction to 12 and 8 bits
+	const uint16_t values[] = { 0x0000, 0x000f, 0x0010, 0x00ff, 0x0100, 0x7fff, 0x8000, 0xfff0, 0xffff };
+	const unsigned numValues = sizeof(values) / sizeof(values[0]);
+
+	std::vector<ISPDB25Point> points;
+	for(unsigned i = 0; i < numValues * numValues; i++) {
+		unsigned a = i % numValues, b = i / numValues;
+		points.push_back(pointWithIntensity(values[a], values[b], values[(a + 1) % numValues], values[(b + 2) % numValues],
+			values[(a + b) % numValues], values[(a + 2 * b) % numValues]));
+	}
+	compareWrites("edge values", points, 30000, HELIOS_FLAGS_SINGLE_MODE);
+}
+
+static void frameSizes()
+{
+	//45 + 64k points trigger the transfer length workaround, 0xfff is the largest frame and
+	//larger ones are subsampled
+	const unsigned sizes[] = { 1, 2, 44, 45, 46, 109, 173, 1000, 4013, 4077, HELIOS_MAX_POINTS - 1, HELIOS_MAX_POINTS, HELIOS_MAX_POINTS + 1, 5000, 8190, 12000 };
+	for(unsigned size : sizes) {
+		char name[32];
+		snprintf(name, sizeof(name), "%u points", size);
+		std::vector<ISPDB25Point> points;
+		for(unsigned i = 0; i < size; i++)
+			points.push_back(pointWithIntensity(i * 7, 0xffff - i * 5, i * 3, i * 11, i * 13, 0xffff));
+		std::vector<uint8_t> transfer = compareWrites(name, points, 30000, HELIOS_FLAGS_SINGLE_MODE);
+		CHECK_MSG(transfer.size() <= HELIOS_MAX_POINTS * HELIOS_PACKED_POINT_SIZE + 5, "%s: %zu bytes", name, transfer.size());
+	}
+}
+
+static void pointRates()
+{
+	//below HELIOS_MIN_PPS the points are duplicated, above HELIOS_MAX_PPS subsampled
+	const unsigned rates[] = { 0, 1, 3, 6, HELIOS_MIN_PPS, 8, 1000, 65534, HELIOS_MAX_PPS, HELIOS_MAX_PPS + 1, 100000, 200000 };
+	const unsigned sizes[] = { 10, 100, 1000 };
+	for(unsigned size : sizes) {
+		std::vector<ISPDB25Point> points;
+		for(unsigned i = 0; i < size; i++)
+			points.push_back(pointWithIntensity(i * 37, i * 59, 0xffff - i, i * 17, 0x8000, 0xffff));
+		for(unsigned pps : rates) {
+			char name[48];
+			snprintf(name, sizeof(name), "%u points at %u pps", size, pps);
+			compareWrites(name, points, pps, HELIOS_FLAGS_SINGLE_MODE);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	startHeliosSim(1);
+	adapter = std::make_shared<HeliosAdapter>();
+	dac.OpenDevicesOnlyUsb();
+	HeliosSimSetCapture(true);
+
+	RUN_TEST(singlePointLayout);
+	RUN_TEST(fixedPointSets);
+	RUN_TEST(bitDepthEdges);
+	RUN_TEST(frameSizes);
+	RUN_TEST(pointRates);
+
+	return finishTests("HeliosPackTest");
+}
@@ -0,0 +1,235 @@
+#include "TestSupport.hpp"
+#include "../hardware/HeliosPro/HeliosProAdapter.hpp"
+#include "../hardware/HeliosPro/HeliosProSim.hpp"
+
+#include <string>
+#include <thread>
+#include <cmath>
+#include <stdlib.h>
+#include <unistd.h>
+
+//HeliosProAdapter on the simulated device of HeliosProSim.cpp: the packets it puts in the
+//mmap'ed ring, the fill level the status ioctl reports and the wave speed loop closed on it.
+
+
+//packets of 5 ms with 100 points, 20 kpps. the timer rounds them to 4995 us.
+#define PACKET_POINTS 100
+#define PACKET_US 5000
+#define PACKET_PLAYED_US 4995
+
+//allowed lateness of the simulated SPI thread. the fill levels are the best of FILL_TRIES,
+//a busy machine delays single transfers by much more.
+#define FILL_SLACK_US 1500
+#define FILL_TRIES 5
+
+#define WAVE_CHUNK_POINTS 200
+#define WAVE_CHUNK_US 5000
+#define WAVE_TARGET_MS 20
+
+struct LoggedPacket
+{
+	double startUs;
+	unsigned txId;
+	unsigned points;
+	double pointUs;
+	double gapUs;
+};
+
+static std::string logPath()
+{
+	static std::string path;
+	if(path.empty()) {
+		char file[] = "/tmp/heliosprosimXXXXXX";
+		int fd = mkstemp(file);
+		if(fd < 0)
+			printf("Cannot create the log file\n");
+		else {
+			close(fd);
+			path = file;
+		}
+	}
+	return path;
+}
+
+//the packets the simulated MCU started, read after the simulated device is destroyed
+static std::vector<LoggedPacket> readLog()
+{
+	std::vector<LoggedPacket> packets;
+	FILE* file = fopen(logPath().c_str(), "r");
+	if(file == NULL)
+		return packets;
+	LoggedPacket packet;
+	while(fscanf(file, "%lf %u %u %lf %lf", &packet.startUs, &packet.txId, &packet.points, &packet.pointUs, &packet.gapUs) == 5)
+		packets.push_back(packet);
+	fclose(file);
+	return packets;
+}
+
+static TimeSlice testSlice(HeliosProAdapter& adapter, unsigned points)
+{
+	TimeSlice slice;
+	slice.dataChunk = adapter.convertPoints(testFrame(points, 0x8000));
+	slice.durationUs = PACKET_US;
+	return slice;
+}
+
+static HeliosProStatus readStatus(HeliosProSim& sim)
+{
+	HeliosProStatus status;
+	CHECK(sim.ioctl(HELIOSPRO_IOC_STATUS, &status) == 0);
+	return status;
+}
+
+//packets through the ring with its head and tail counters crossing 2^32, so the slot index
+//wraps around the 8 slots and the counters wrap to 0. the writer waits while the ring is full.
+static void ringWraparound()
+{
+	const uint32_t startHead = 0xfffffff0;
+	const unsigned packets = 40;
+	double writeUs;
+	{
+		std::shared_ptr<HeliosProSim> sim = std::make_shared<HeliosProSim>(logPath().c_str());
+		HeliosProRingHeader* header = (HeliosProRingHeader*)sim->mmap(HELIOSPRO_RING_PAGE);
+		header->head = startHead;
+		header->tail = startHead;
+		HeliosProAdapter adapter(sim);
+
+		//each packet one point longer than the previous one, so the log shows their order
+		double startUs = testNowUs();
+		for(unsigned i = 0; i < packets; i++)
+			CHECK(adapter.writeFrame(testSlice(adapter, PACKET_POINTS + i), PACKET_US) >= 0);
+		writeUs = testNowUs() - startUs;
+
+		testSleepMs(12 * PACKET_US / 1000.0);
+		HeliosProStatus status = readStatus(*sim);
+		CHECK_MSG(header->head == startHead + packets, "head %u", header->head);
+		CHECK_MSG(header->tail == header->head, "tail %u, head %u", header->tail, header->head);
+		CHECK_MSG(header->packetsSent == packets, "%llu packets sent", (unsigned long long)header->packetsSent);
+		CHECK_MSG(status.underruns == 0, "%u underruns", status.underruns);
+		CHECK(status.queuedPackets == 0 && status.queuedUs == 0);
+	}
+
+	//the ring and the MCU hold 10 packets, the others are written as the output frees slots
+	double blockedMs = (packets - HELIOSPRO_SIM_RING_SLOTS - 2) * PACKET_PLAYED_US / 1000.0;
+	printf("     %u packets written in %.1f ms\n", packets, writeUs / 1000);
+	CHECK_MSG(writeUs / 1000 > blockedMs - 2, "%.1f ms writing, %.1f ms expected", writeUs / 1000, blockedMs);
+
+	std::vector<LoggedPacket> log = readLog();
+	CHECK_MSG(log.size() == packets, "%zu packets played", log.size());
+	for(size_t i = 0; i < log.size(); i++) {
+		CHECK_MSG(log[i].points == PACKET_POINTS + i, "packet %zu with %u points", i, log[i].points);
+		if(i > 0)
+			CHECK_MSG(log[i].txId == ((log[i - 1].txId + 1) & 0xff), "txId %u after %u", log[i].txId, log[i - 1].txId);
+	}
+}
+
+//the queued duration the adapter reports while packets play, against the duration written
+//minus the time since the first one started
+static double fillError(double& reportedMs, double& expectedMs)
+{
+	const unsigned packets = 6;
+	std::shared_ptr<HeliosProSim> sim = std::make_shared<HeliosProSim>(nullptr);
+	HeliosProAdapter adapter(sim);
+
+	double startUs = testNowUs();
+	for(unsigned i = 0; i < packets; i++)
+		CHECK(adapter.writeFrame(testSlice(adapter, PACKET_POINTS), PACKET_US) >= 0);
+	double first = adapter.queuedDurationUs();
+	double firstUs = testNowUs();
+
+	//nothing has played but what went out since the first packet was written
+	double total = packets * PACKET_PLAYED_US;
+	double error = std::max(std::fabs(first - total) - (firstUs - startUs), 0.0);
+
+	testSleepMs(12);
+	double before = testNowUs();
+	double later = adapter.queuedDurationUs();
+	double after = testNowUs();
+	double expected = total - ((before + after) / 2 - startUs);
+	error = std::max(error, std::fabs(later - expected) - (after - before) / 2);
+	reportedMs = later / 1000;
+	expectedMs = expected / 1000;
+
+	//all played
+	testSleepMs(total / 1000 - 12 + 5);
+	HeliosProStatus status = readStatus(*sim);
+	CHECK_MSG(adapter.queuedDurationUs() == 0, "%.0f us left", adapter.queuedDurationUs());
+	CHECK(status.queuedPackets == 0 && status.mcuReady);
+	CHECK_MSG(status.packetsSent == packets, "%llu packets sent", (unsigned long long)status.packetsSent);
+	return error;
+}
+
+static void fillLevel()
+{
+	double best = 1e9, reportedMs = 0, expectedMs = 0;
+	for(unsigned t = 0; t < FILL_TRIES && best > FILL_SLACK_US; t++)
+		best = std::min(best, fillError(reportedMs, expectedMs));
+	printf("     %.2f ms queued after 12 ms, %.2f ms expected\n", reportedMs, expectedMs);
+	CHECK_MSG(best <= FILL_SLACK_US, "fill level off by %.0f us", best);
+}
+
+//wave input with 50 ms more in the pipeline than the buffer target, then arriving in real time.
+//the bridge counts the fill level of the device into its buffer usage and plays faster until
+//the device holds about the target.
+static void speedLoopConverges()
+{
+	std::shared_ptr<HeliosProSim> sim = std::make_shared<HeliosProSim>(nullptr);
+	std::shared_ptr<HeliosProAdapter> device = std::make_shared<HeliosProAdapter>(sim);
+	TestChunkSource source;
+	device->start();
+	std::shared_ptr<HWBridge> bridge = std::make_shared<HWBridge>(device);
+	bridge->setBufferTargetMs(WAVE_TARGET_MS);
+	bridge->setChunkLengthUs(WAVE_CHUNK_US);
+	std::thread([bridge] { bridge->driverLoop(); }).detach();
+
+	std::vector<ISPDB25Point> chunk = testFrame(WAVE_CHUNK_POINTS, 0x8000);
+	unsigned preload = (WAVE_TARGET_MS + 50) * 1000 / WAVE_CHUNK_US;
+	for(unsigned c = 0; c < preload; c++)
+		CHECK(source.put(*device, chunk, WAVE_CHUNK_US, LAPRO_CHUNK_TYPE_WAVE) >= 0);
+
+	const unsigned chunks = 800;
+	double startUs = testNowUs();
+	double earlyMs = 0, lateMs = 0;
+	unsigned earlySamples = 0, lateSamples = 0;
+	for(unsigned c = 0; c < chunks; c++) {
+		double dueUs = startUs + c * WAVE_CHUNK_US;
+		double nowUs = testNowUs();
+		if(dueUs > nowUs)
+			testSleepMs((dueUs - nowUs) / 1000);
+		CHECK(source.put(*device, chunk, WAVE_CHUNK_US, LAPRO_CHUNK_TYPE_WAVE) >= 0);
+		source.recycle(*device);
+
+		//the first 100 ms and the last second
+		double queuedMs = device->queuedDurationUs() / 1000;
+		if(c > 2 && c <= 20) {
+			earlyMs += queuedMs;
+			earlySamples++;
+		}
+		else if(c >= chunks - 200) {
+			lateMs += queuedMs;
+			lateSamples++;
+		}
+	}
+	HeliosProStatus status = readStatus(*sim);
+	device->stop(false);
+	testSleepMs(50);
+	source.recycle(*device);
+
+	earlyMs /= earlySamples;
+	lateMs /= lateSamples;
+	printf("     device queue %.1f ms at the start, %.1f ms after 3 s, target %d ms\n", earlyMs, lateMs, WAVE_TARGET_MS);
+	CHECK_MSG(earlyMs > WAVE_TARGET_MS + 10, "%.1f ms queued at the start", earlyMs);
+	CHECK_MSG(std::fabs(lateMs - WAVE_TARGET_MS) < 10, "%.1f ms queued after 3 s", lateMs);
+	//a stalled machine can starve the simulated MCU once in a while, a loop that drains the
+	//device runs it empty all the time
+	CHECK_MSG(status.underruns < 3, "%u underruns", status.underruns);
+}
+
+int main()
+{
+	RUN_TEST(ringWraparound);
+	RUN_TEST(fillLevel);
+	RUN_TEST(speedLoopConverges);
+	unlink(logPath().c_str());
+	return finishTests("HeliosProSimTest");
+}
@@ -0,0 +1,29 @@
+#include "HeliosTestSupport.hpp"
+
+#include <stdlib.h>
+
+
+double startHeliosSim(int numDevices)
+{
+	char value[16];
+	snprintf(value, sizeof(value), "%d", numDevices);
+	setenv("HELIOS_SIM_DEVICES", value, 1);
+	setenv("HELIOS_SIM_STATS_S", "0", 1);
+
+	double startUs = testNowUs();
+	HeliosAdapter::initialize();
+	return (testNowUs() - startUs) / 1000.0;
+}
+
+SliceType heliosTestFrame(HeliosAdapter& adapter, unsigned count)
+{
+	return adapter.convertPoints(testFrame(count, 0x8000));
+}
+
+int writeHeliosTestFrame(HeliosAdapter& adapter, const SliceType& frame, double durationUs)
+{
+	TimeSlice slice;
+	slice.dataChunk = frame;
+	slice.durationUs = (unsigned)durationUs;
+	return adapter.writeFrame(slice, durationUs);
+}
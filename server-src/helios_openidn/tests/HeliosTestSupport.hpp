@@ -0,0 +1,22 @@
+#ifndef HELIOSTESTSUPPORT_H_
+#define HELIOSTESTSUPPORT_H_
+
+#include "TestSupport.hpp"
+
+#include "../hardware/Helios/HeliosAdapter.hpp"
+#include "../hardware/Helios/HeliosUsbSim.hpp"
+
+//programs running the Helios output path against the simulated USB DACs of HeliosUsbSim.cpp.
+//the simulated devices are created once per process, at the first libusb_init().
+
+//configures the simulation for the given number of DACs and initializes the HeliosAdapter on
+//them. returns the time the initialization took in ms.
+double startHeliosSim(int numDevices);
+
+//a test frame of count points, converted by the adapter
+SliceType heliosTestFrame(HeliosAdapter& adapter, unsigned count);
+
+//writes the frame in a slice of the given duration
+int writeHeliosTestFrame(HeliosAdapter& adapter, const SliceType& frame, double durationUs);
+
+#endif
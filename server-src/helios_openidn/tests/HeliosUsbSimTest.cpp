@@ -0,0 +1,277 @@
+#include "HeliosTestSupport.hpp"
+
+//the simulated libusb backend of HeliosUsbSim.cpp on its own, through the libusb calls
+//HeliosDac.cpp makes: enumeration, the status the DAC reports and the transfer timing.
+
+
+#define SIM_DEVICES 3
+
+//bulk transfers take 150 us plus 1 us per byte, interrupt transfers 500 us
+#define BULK_OVERHEAD_US 150
+#define INTERRUPT_US 500
+
+//allowed lateness of a transfer, for the scheduling of the sleeping thread. the timings are
+//the best of TIMING_TRIES, a busy machine delays single transfers by much more.
+#define TIMING_SLACK_US 3000
+#define TIMING_TRIES 5
+
+static libusb_device_handle* handle = nullptr;
+
+//a bulk frame of count points in the wire format, with the pps/points/flags trailer
+static std::vector<uint8_t> wireFrame(unsigned count, unsigned pps, uint8_t flags)
+{
+	std::vector<uint8_t> frame(count * HELIOS_PACKED_POINT_SIZE + 5, 0x40);
+	frame[frame.size() - 5] = pps & 0xff;
+	frame[frame.size() - 4] = pps >> 8;
+	frame[frame.size() - 3] = count & 0xff;
+	frame[frame.size() - 2] = count >> 8;
+	frame[frame.size() - 1] = flags;
+	return frame;
+}
+
+static int sendFrame(std::vector<uint8_t> frame)
+{
+	int transferred = 0;
+	int result = libusb_bulk_transfer(handle, EP_BULK_OUT, frame.data(), frame.size(), &transferred, 100);
+	CHECK(result != LIBUSB_SUCCESS || transferred == (int)frame.size());
+	return result;
+}
+
+//sends a control command and returns the response, empty for none
+static std::vector<uint8_t> control(uint8_t command)
+{
+	uint8_t request[2] = { command, 0 };
+	int transferred = 0;
+	CHECK(libusb_interrupt_transfer(handle, EP_INT_OUT, request, sizeof(request), &transferred, 32) == LIBUSB_SUCCESS);
+
+	uint8_t response[32];
+	if(libusb_interrupt_transfer(handle, EP_INT_IN, response, sizeof(response), &transferred, 32) != LIBUSB_SUCCESS)
+		return std::vector<uint8_t>();
+	return std::vector<uint8_t>(response, response + transferred);
+}
+
+//1 if the DAC can take the next frame, 0 if one is buffered, -1 for a missing response
+static int status()
+{
+	std::vector<uint8_t> response = control(0x03);
+	if(response.size() < 2 || response[0] != 0x83)
+		return -1;
+	return response[1];
+}
+
+static ssize_t listDevices(std::vector<libusb_device*>& devices)
+{
+	libusb_device** list = nullptr;
+	ssize_t count = libusb_get_device_list(nullptr, &list);
+	devices.assign(list, list + std::max(count, (ssize_t)0));
+	libusb_free_device_list(list, 1);
+	return count;
+}
+
+
+static void enumeration()
+{
+	//every DAC with the Helios ids on a port of its own
+	std::vector<libusb_device*> devices;
+	CHECK_MSG(listDevices(devices) == SIM_DEVICES, "%zu devices", devices.size());
+	CHECK(HeliosSimGetNumDevices() == SIM_DEVICES);
+	for(size_t i = 0; i < devices.size(); i++) {
+		struct libusb_device_descriptor descriptor;
+		CHECK(libusb_get_device_descriptor(devices[i], &descriptor) == LIBUSB_SUCCESS);
+		CHECK(descriptor.idVendor == HELIOS_VID && descriptor.idProduct == HELIOS_PID);
+		uint8_t port = 0;
+		CHECK(libusb_get_port_numbers(devices[i], &port, 1) == 1 && port == i + 1);
+	}
+
+	//an unplugged DAC is not listed and cannot be opened until it is plugged in again
+	libusb_device* unplugged = devices.back();
+	HeliosSimSetPresent(SIM_DEVICES - 1, false);
+	CHECK(listDevices(devices) == SIM_DEVICES - 1);
+	libusb_device_handle* unpluggedHandle = nullptr;
+	CHECK(libusb_open(unplugged, &unpluggedHandle) == LIBUSB_ERROR_NO_DEVICE);
+
+	HeliosSimSetPresent(SIM_DEVICES - 1, true);
+	CHECK(listDevices(devices) == SIM_DEVICES);
+	CHECK(libusb_open(unplugged, &unpluggedHandle) == LIBUSB_SUCCESS);
+	libusb_close(unpluggedHandle);
+}
+
+static void controlResponses()
+{
+	std::vector<uint8_t> firmware = control(0x04);
+	CHECK(firmware.size() >= 2 && firmware[0] == 0x84 && firmware[1] == 6);
+
+	std::vector<uint8_t> name = control(0x05);
+	CHECK(name.size() == 32 && name[0] == 0x85 && strcmp((const char*)&name[1], "Helios Sim 0") == 0);
+
+	//nothing was asked, the read times out
+	uint8_t response[32];
+	int transferred = 0;
+	CHECK(libusb_interrupt_transfer(handle, EP_INT_IN, response, sizeof(response), &transferred, 5) == LIBUSB_ERROR_TIMEOUT);
+}
+
+static void statusFollowsPlayback()
+{
+	//one frame plays and one waits in the buffer. the status reports ready again once the
+	//buffered frame started playing, 100 ms later.
+	control(0x01);
+	CHECK(status() == 1);
+	CHECK(sendFrame(wireFrame(200, 2000, HELIOS_FLAGS_SINGLE_MODE)) == LIBUSB_SUCCESS);
+	CHECK(status() == 1);
+	CHECK(sendFrame(wireFrame(200, 2000, HELIOS_FLAGS_SINGLE_MODE)) == LIBUSB_SUCCESS);
+	CHECK(status() == 0);
+	testSleepMs(110);
+	CHECK(status() == 1);
+
+	//a looping frame keeps playing, the next frame waits until it started over
+	control(0x01);
+	CHECK(sendFrame(wireFrame(100, 1000, 0)) == LIBUSB_SUCCESS);
+	testSleepMs(130);
+	CHECK(sendFrame(wireFrame(100, 1000, 0)) == LIBUSB_SUCCESS);
+	CHECK(status() == 0);
+	testSleepMs(80);
+	CHECK(status() == 1);
+	control(0x01);
+}
+
+static void underrunStats()
+{
+	//single frames of 10 ms with a gap between them count as an underrun of the length of the gap.
+	//a frame arrives at the end of its transfer, somewhere within the call.
+	std::vector<uint8_t> frame = wireFrame(100, 10000, HELIOS_FLAGS_SINGLE_MODE);
+	double transferUs = BULK_OVERHEAD_US + frame.size();
+	control(0x01);
+	HeliosSimResetStats();
+	double firstStartUs = testNowUs();
+	CHECK(sendFrame(frame) == LIBUSB_SUCCESS);
+	double firstEndUs = testNowUs();
+	testSleepMs(30);
+	double secondStartUs = testNowUs();
+	CHECK(sendFrame(frame) == LIBUSB_SUCCESS);
+	double secondEndUs = testNowUs();
+	double minIdleUs = secondStartUs + transferUs - firstEndUs - 10000;
+	double maxIdleUs = secondEndUs - (firstStartUs + transferUs) - 10000;
+
+	//a third frame overwrites the second one in the buffer before it played
+	CHECK(sendFrame(frame) == LIBUSB_SUCCESS);
+	CHECK(sendFrame(frame) == LIBUSB_SUCCESS);
+
+	//a frame without points is an error
+	CHECK(sendFrame(wireFrame(0, 10000, HELIOS_FLAGS_SINGLE_MODE)) == LIBUSB_SUCCESS);
+
+	HeliosSimStats stats;
+	CHECK(HeliosSimGetStats(0, stats));
+	CHECK_MSG(stats.framesReceived == 4 && stats.pointsReceived == 400, "%u frames, %llu points", stats.framesReceived, stats.pointsReceived);
+	CHECK_MSG(stats.underruns == 1, "%u underruns", stats.underruns);
+	CHECK_MSG(stats.idleUs >= minIdleUs && stats.idleUs <= maxIdleUs, "%.0f us idle, expected %.0f to %.0f us", stats.idleUs, minIdleUs, maxIdleUs);
+	CHECK_MSG(stats.framesDropped == 1, "%u frames dropped", stats.framesDropped);
+	CHECK_MSG(stats.transferErrors == 1, "%u transfer errors", stats.transferErrors);
+	CHECK(!HeliosSimGetStats(SIM_DEVICES, stats));
+	control(0x01);
+}
+
+static void transferTiming()
+{
+	//a bulk transfer takes as long as it is on the wire, interrupt transfers a polling interval
+	for(unsigned count : { 10, 1000, 4000 }) {
+		std::vector<uint8_t> frame = wireFrame(count, 30000, HELIOS_FLAGS_SINGLE_MODE);
+		double expectedUs = BULK_OVERHEAD_US + frame.size();
+		double tookUs = 1e9;
+		for(int i = 0; i < TIMING_TRIES; i++) {
+			double startUs = testNowUs();
+			CHECK(sendFrame(frame) == LIBUSB_SUCCESS);
+			tookUs = std::min(tookUs, testNowUs() - startUs);
+		}
+		CHECK_MSG(tookUs >= expectedUs && tookUs < expectedUs + TIMING_SLACK_US, "%u points: %.0f us, expected %.0f us", count, tookUs, expectedUs);
+	}
+
+	double tookUs = 1e9;
+	for(int i = 0; i < TIMING_TRIES; i++) {
+		double startUs = testNowUs();
+		CHECK(status() >= 0);
+		tookUs = std::min(tookUs, testNowUs() - startUs);
+	}
+	CHECK_MSG(tookUs >= 2 * INTERRUPT_US && tookUs < 2 * INTERRUPT_US + TIMING_SLACK_US, "status: %.0f us", tookUs);
+
+	//a transfer that cannot finish within its timeout fails after the timeout
+	std::vector<uint8_t> frame = wireFrame(4000, 30000, HELIOS_FLAGS_SINGLE_MODE);
+	int transferred = 0;
+	double startUs = testNowUs();
+	CHECK(libusb_bulk_transfer(handle, EP_BULK_OUT, frame.data(), frame.size(), &transferred, 10) == LIBUSB_ERROR_TIMEOUT);
+	tookUs = testNowUs() - startUs;
+	CHECK(transferred == 0);
+	CHECK_MSG(tookUs >= 10000 && tookUs < 4 * 10000, "timeout after %.0f us", tookUs);
+	control(0x01);
+}
+
+static struct AsyncResult
+{
+	int status;
+	double doneUs;
+} asyncResults[2];
+
+static void LIBUSB_CALL asyncDone(struct libusb_transfer* transfer)
+{
+	AsyncResult* result = (AsyncResult*)transfer->user_data;
+	result->status = transfer->status;
+	result->doneUs = testNowUs();
+}
+
+static void asyncTransfers()
+{
+	//asynchronous transfers to a device go over the wire one after another
+	std::vector<uint8_t> frames[2] = { wireFrame(1000, 30000, HELIOS_FLAGS_SINGLE_MODE), wireFrame(1000, 30000, HELIOS_FLAGS_SINGLE_MODE) };
+	double expectedUs = BULK_OVERHEAD_US + frames[0].size();
+	double tookUs[2] = { 1e9, 1e9 };
+	for(int t = 0; t < TIMING_TRIES; t++) {
+		double startUs = testNowUs();
+		for(int i = 0; i < 2; i++) {
+			asyncResults[i].status = -1;
+			libusb_transfer* transfer = libusb_alloc_transfer(0);
+			libusb_fill_bulk_transfer(transfer, handle, EP_BULK_OUT, frames[i].data(), frames[i].size(), asyncDone, &asyncResults[i], 100);
+			transfer->flags = LIBUSB_TRANSFER_FREE_TRANSFER;
+			CHECK(libusb_submit_transfer(transfer) == LIBUSB_SUCCESS);
+		}
+
+		int completed = 0;
+		while(asyncResults[1].status < 0 && testNowUs() - startUs < 100000) {
+			struct timeval timeout = { 0, 10000 };
+			libusb_handle_events_timeout_completed(nullptr, &timeout, &completed);
+		}
+
+		for(int i = 0; i < 2; i++) {
+			CHECK(asyncResults[i].status == LIBUSB_TRANSFER_COMPLETED);
+			tookUs[i] = std::min(tookUs[i], asyncResults[i].doneUs - startUs);
+		}
+	}
+
+	for(int i = 0; i < 2; i++)
+		CHECK_MSG(tookUs[i] >= (i + 1) * expectedUs && tookUs[i] < (i + 1) * expectedUs + TIMING_SLACK_US, "transfer %d done after %.0f us", i, tookUs[i]);
+	control(0x01);
+}
+
+int main(int argc, char** argv)
+{
+	char devices[16];
+	snprintf(devices, sizeof(devices), "%d", SIM_DEVICES);
+	setenv("HELIOS_SIM_DEVICES", devices, 1);
+	setenv("HELIOS_SIM_STATS_S", "0", 1);
+	CHECK(libusb_init(nullptr) == LIBUSB_SUCCESS);
+
+	RUN_TEST(enumeration);
+
+	std::vector<libusb_device*> list;
+	listDevices(list);
+	CHECK(!list.empty() && libusb_open(list.front(), &handle) == LIBUSB_SUCCESS);
+	CHECK(libusb_claim_interface(handle, 0) == LIBUSB_SUCCESS);
+
+	RUN_TEST(controlResponses);
+	RUN_TEST(statusFollowsPlayback);
+	RUN_TEST(underrunStats);
+	RUN_TEST(transferTiming);
+	RUN_TEST(asyncTransfers);
+
+	libusb_close(handle);
+	libusb_exit(nullptr);
+	return finishTests("HeliosUsbSimTest");
+}
@@ -0,0 +1,55 @@
+#include "IldaTestSupport.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+//parse throughput of IldaReader and the stdio parser it replaced in FilePlayer, on a
+//generated show file. the file is parsed once before the runs, so it is in the page cache.
+
+
+#define BENCH_FILE_SECTIONS 6000   //about 5000 frames of up to 1500 points, around 32 MB
+#define BENCH_RUNS 3
+
+typedef int (*ParseFunction)(const char*, const unsigned long*, IldaFrames&);
+
+static void measure(const char* name, ParseFunction parse, const std::string& path, size_t fileSize, const unsigned long* palette)
+{
+	double bestMs = 0;
+	size_t frameCount = 0;
+	for(int run = 0; run < BENCH_RUNS; run++) {
+		IldaFrames frames;
+		frames.reserve(BENCH_FILE_SECTIONS);
+		double startUs = testNowUs();
+		int result = parse(path.c_str(), palette, frames);
+		double ms = (testNowUs() - startUs) / 1000.0;
+		if(result != 0)
+			printf("  %s: parse failed\n", name);
+		if(run == 0 || ms < bestMs)
+			bestMs = ms;
+		frameCount = frames.size();
+	}
+	printf("  %-10s %8.1f %9.1f %10.0f\n", name, bestMs, fileSize / 1000.0 / bestMs, frameCount * 1000.0 / bestMs);
+}
+
+int main(int argc, char** argv)
+{
+	std::mt19937 random(2024);
+	unsigned long palette[256];
+	randomIldaPalette(random, palette);
+
+	std::vector<uint8_t> bytes = generateIldaFile(random, BENCH_FILE_SECTIONS, 1500, false);
+	std::string path = writeIldaTestFile(bytes);
+
+	IldaFrames frames;
+	readerParseIlda(path.c_str(), palette, frames);
+	printf("%.1f MB, %zu frames, best of %d runs\n", bytes.size() / 1e6, frames.size(), BENCH_RUNS);
+	frames.clear();
+	frames.shrink_to_fit();
+
+	printf("  %-10s %8s %9s %10s\n", "parser", "ms", "MB/s", "frames/s");
+	measure("stdio", legacyParseIlda, path, bytes.size(), palette);
+	measure("IldaReader", readerParseIlda, path, bytes.size(), palette);
+
+	removeIldaTestFiles();
+	return 0;
+}
@@ -0,0 +1,276 @@
+#include "IldaTestSupport.hpp"
+
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+
+//IldaReader against the stdio parser it replaced in FilePlayer, and its handling of files
+//that shrink or vanish while they are mapped
+
+
+static bool sameFrames(const IldaFrames& a, const IldaFrames& b)
+{
+	if(a.size() != b.size())
+		return false;
+	for(size_t i = 0; i < a.size(); i++) {
+		if(a[i].size() != b[i].size() || memcmp(a[i].data(), b[i].data(), a[i].size() * sizeof(ISPDB25Point)) != 0)
+			return false;
+	}
+	return true;
+}
+
+//whether the first frames are the beginning of all frames
+static bool isPrefix(const IldaFrames& first, const IldaFrames& all)
+{
+	if(first.size() > all.size())
+		return false;
+	return sameFrames(first, IldaFrames(all.begin(), all.begin() + first.size()));
+}
+
+static std::string largeTestFile(std::mt19937& random)
+{
+	//about 40 frames of up to 2000 points, around 350 kB
+	return writeIldaTestFile(generateIldaFile(random, 50, 2000, false));
+}
+
+
+static void generatedFiles()
+{
+	//formats 0/1/4/5, custom palettes, truncation, stray last point flags, bad signatures and
+	//format codes, insane record counts and garbage, each parsed both ways into identical frames
+	std::mt19937 random(4711);
+	unsigned long palette[256];
+	unsigned damagedFiles = 0, failedFiles = 0, framesCompared = 0;
+
+	quietStdout(true);
+	for(unsigned file = 0; file < 600; file++) {
+		bool damaged = (file % 2 == 1);
+		std::string path = writeIldaTestFile(generateIldaFile(random, 1 + random() % 12, (file % 3 == 0) ? 20 : 1500, damaged));
+		randomIldaPalette(random, palette);
+
+		IldaFrames legacyFrames, readerFrames;
+		int legacyResult = legacyParseIlda(path.c_str(), palette, legacyFrames);
+		int readerResult = readerParseIlda(path.c_str(), palette, readerFrames);
+
+		damagedFiles += (legacyResult != 0);
+		failedFiles += (readerResult != 0);
+		framesCompared += legacyFrames.size();
+
+		if(!sameFrames(legacyFrames, readerFrames)) {
+			quietStdout(false);
+			CHECK_MSG(false, "file %u: %zu frames, legacy parser %zu", file, readerFrames.size(), legacyFrames.size());
+			quietStdout(true);
+		}
+	}
+	quietStdout(false);
+
+	printf("     600 files, %u frames, %u malformed (%u for IldaReader)\n", framesCompared, damagedFiles, failedFiles);
+	CHECK(damagedFiles > 200);
+	CHECK(failedFiles == damagedFiles);
+}
+
+static void truncatedWhileMapped()
+{
+	//pages beyond the end of a truncated file raise SIGBUS on access, like the pages of a
+	//file on a USB stick that has been pulled. the reader ends with an error instead.
+	std::mt19937 random(815);
+	unsigned long palette[256];
+	randomIldaPalette(random, palette);
+
+	for(size_t cut : { (size_t)4096, (size_t)65536, (size_t)200000 }) {
+		std::string path = largeTestFile(random);
+		IldaFrames allFrames;
+		CHECK(legacyParseIlda(path.c_str(), palette, allFrames) == 0);
+
+		IldaReader reader;
+		CHECK(reader.open(path.c_str()) == 0);
+		CHECK(truncate(path.c_str(), cut) == 0);
+
+		quietStdout(true);
+		IldaFrames frames;
+		int result;
+		IldaReader::IldaSection section;
+		unsigned long customPalette[256];
+		const unsigned long* currentPalette = palette;
+		while((result = reader.nextSection(section)) > 0) {
+			if(section.formatCode == ILDA_FORMAT_PALETTE) {
+				if((result = reader.decodePalette(section, customPalette)) != 0)
+					break;
+				currentPalette = customPalette;
+				continue;
+			}
+			std::vector<ISPDB25Point> frame(section.recordCnt);
+			if((result = reader.decodePoints(section, 0, section.recordCnt, currentPalette, frame.data())) != 0)
+				break;
+			reader.lastPointFlagSet(section);
+			frames.push_back(frame);
+		}
+		quietStdout(false);
+
+		CHECK_MSG(result == -1, "cut at %zu: result %d", cut, result);
+		CHECK_MSG(frames.size() < allFrames.size(), "cut at %zu: %zu of %zu frames", cut, frames.size(), allFrames.size());
+		CHECK_MSG(isPrefix(frames, allFrames), "cut at %zu", cut);
+	}
+}
+
+static void putSectionHeader(std::vector<uint8_t>& file, uint8_t formatCode, uint16_t recordCnt)
+{
+	const uint8_t header[ILDA_HEADER_SIZE] = { 'I', 'L', 'D', 'A', 0, 0, 0, formatCode };
+	file.insert(file.end(), header, header + ILDA_HEADER_SIZE);
+	file[file.size() - 8] = (uint8_t)(recordCnt >> 8);
+	file[file.size() - 7] = (uint8_t)recordCnt;
+}
+
+static void truncatedPalette()
+{
+	//a frame of 622 points in format 1 and a palette that starts in the first page and ends
+	//in the second one, the fault is in decodePalette
+	std::vector<uint8_t> file;
+	putSectionHeader(file, ILDA_FORMAT_2D_INDEXED, 622);
+	file.resize(file.size() + 622 * 6, 0);
+	file[file.size() - 2] = 0x80;
+	putSectionHeader(file, ILDA_FORMAT_PALETTE, 200);
+	file.resize(file.size() + 200 * 3, 0x55);
+	CHECK(file.size() - 200 * 3 < 4096 && file.size() > 4096);
+	std::string path = writeIldaTestFile(file);
+
+	IldaReader reader;
+	CHECK(reader.open(path.c_str()) == 0);
+	CHECK(truncate(path.c_str(), 4096) == 0);
+
+	quietStdout(true);
+	IldaReader::IldaSection section;
+	int firstResult = reader.nextSection(section);
+	int secondResult = reader.nextSection(section);
+	unsigned long palette[256];
+	int paletteResult = reader.decodePalette(section, palette);
+	quietStdout(false);
+
+	CHECK(firstResult == 1);
+	CHECK(secondResult == 1 && section.formatCode == ILDA_FORMAT_PALETTE);
+	CHECK(paletteResult == -1);
+}
+
+static void readerUsableAfterFault()
+{
+	//the jump target is cleared after a fault, the next files parse normally on the same
+	//thread and on others, also while another thread takes a fault
+	std::mt19937 random(1234);
+	unsigned long palette[256];
+	randomIldaPalette(random, palette);
+
+	std::string path = largeTestFile(random);
+	IldaFrames expected, frames;
+	CHECK(legacyParseIlda(path.c_str(), palette, expected) == 0);
+	CHECK(readerParseIlda(path.c_str(), palette, frames) == 0);
+	CHECK(sameFrames(frames, expected));
+
+	std::vector<std::string> truncatedPaths;
+	for(int i = 0; i < 4; i++)
+		truncatedPaths.push_back(largeTestFile(random));
+
+	std::vector<int> faultResults(truncatedPaths.size(), 0);
+	std::vector<int> goodResults(truncatedPaths.size(), -1);
+	std::vector<IldaFrames> goodFrames(truncatedPaths.size());
+	std::vector<std::thread> threads;
+
+	quietStdout(true);
+	for(size_t i = 0; i < truncatedPaths.size(); i++) {
+		threads.emplace_back([&, i] {
+			IldaReader reader;
+			IldaReader::IldaSection section;
+			if(reader.open(truncatedPaths[i].c_str()) != 0 || truncate(truncatedPaths[i].c_str(), 4096) != 0)
+				return;
+			int result;
+			while((result = reader.nextSection(section)) > 0) {
+				std::vector<ISPDB25Point> frame(section.recordCnt);
+				if(section.formatCode != ILDA_FORMAT_PALETTE && (result = reader.decodePoints(section, 0, section.recordCnt, palette, frame.data())) != 0)
+					break;
+			}
+			faultResults[i] = result;
+			goodResults[i] = readerParseIlda(path.c_str(), palette, goodFrames[i]);
+		});
+	}
+	for(auto& thread : threads)
+		thread.join();
+	quietStdout(false);
+
+	for(size_t i = 0; i < truncatedPaths.size(); i++) {
+		CHECK_MSG(faultResults[i] == -1, "thread %zu: result %d", i, faultResults[i]);
+		CHECK_MSG(goodResults[i] == 0 && sameFrames(goodFrames[i], expected), "thread %zu", i);
+	}
+
+	CHECK(readerParseIlda(path.c_str(), palette, frames) == 0);
+	CHECK(sameFrames(frames, expected));
+}
+
+static void removedWhileMapped()
+{
+	//an unlinked file stays mapped until it is closed
+	std::mt19937 random(4242);
+	unsigned long palette[256];
+	randomIldaPalette(random, palette);
+
+	std::string path = largeTestFile(random);
+	IldaFrames expected;
+	CHECK(legacyParseIlda(path.c_str(), palette, expected) == 0);
+
+	IldaReader reader;
+	CHECK(reader.open(path.c_str()) == 0);
+	CHECK(unlink(path.c_str()) == 0);
+
+	IldaFrames frames;
+	IldaReader::IldaSection section;
+	int result;
+	while((result = reader.nextSection(section)) > 0) {
+		if(section.formatCode == ILDA_FORMAT_PALETTE)
+			continue;
+		std::vector<ISPDB25Point> frame(section.recordCnt);
+		if((result = reader.decodePoints(section, 0, section.recordCnt, palette, frame.data())) != 0)
+			break;
+		frames.push_back(frame);
+	}
+	CHECK(result == 0);
+	CHECK(frames.size() == expected.size());
+}
+
+static void foreignBusError()
+{
+	//a SIGBUS outside of the reader still ends the program, as without the handler
+	std::mt19937 random(77);
+	std::string path = largeTestFile(random);
+
+	fflush(stdout);
+	pid_t child = fork();
+	if(child == 0) {
+		IldaReader reader;
+		int fd = open(path.c_str(), O_RDONLY);
+		const volatile uint8_t* map = (const volatile uint8_t*)mmap(NULL, 65536, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map == MAP_FAILED || truncate(path.c_str(), 0) != 0)
+			_exit(2);
+		uint8_t value = map[8192];
+		_exit(value == 0 ? 3 : 4);
+	}
+
+	int status = 0;
+	CHECK(waitpid(child, &status, 0) == child);
+	CHECK_MSG(WIFSIGNALED(status) && WTERMSIG(status) == SIGBUS, "child status 0x%x", status);
+}
+
+
+int main(int argc, char** argv)
+{
+	RUN_TEST(generatedFiles);
+	RUN_TEST(truncatedWhileMapped);
+	RUN_TEST(truncatedPalette);
+	RUN_TEST(readerUsableAfterFault);
+	RUN_TEST(removedWhileMapped);
+	RUN_TEST(foreignBusError);
+
+	removeIldaTestFiles();
+	return finishTests("IldaReaderTest");
+}
@@ -0,0 +1,386 @@
+#include "IldaTestSupport.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <filesystem>
+
+
+// -- Generated files ---------------------------------------------------------
+
+static void putShort(std::vector<uint8_t>& out, uint16_t value)
+{
+	out.push_back((uint8_t)(value >> 8));
+	out.push_back((uint8_t)value);
+}
+
+static void putHeader(std::vector<uint8_t>& out, uint8_t formatCode, uint16_t recordCnt, uint16_t number, uint16_t count)
+{
+	const char* name = "TESTNAMEOPENIDN ";
+	out.insert(out.end(), { 'I', 'L', 'D', 'A', 0, 0, 0, formatCode });
+	out.insert(out.end(), name, name + 16);
+	putShort(out, recordCnt);
+	putShort(out, number);
+	putShort(out, count);
+	out.push_back(0);
+	out.push_back(0);
+}
+
+static unsigned frameRecordSize(uint8_t formatCode)
+{
+	return (formatCode == 0 || formatCode == 5) ? 8 : (formatCode == 1) ? 6 : 10;
+}
+
+std::vector<uint8_t> generateIldaFile(std::mt19937& random, unsigned numSections, unsigned maxPoints, bool damaged)
+{
+	const uint8_t frameFormats[] = { 0, 1, 4, 5 };
+
+	//the section the damage is done in and its kind
+	unsigned damagedSection = random() % numSections;
+	unsigned damage = damaged ? 1 + random() % 7 : 0;
+
+	std::vector<uint8_t> out;
+	for(unsigned section = 0; section < numSections; section++) {
+		bool damageHere = (section == damagedSection);
+		size_t headerPos = out.size();
+
+		if(random() % 6 == 0) {
+			//palette, damage 5 makes it too large
+			unsigned count = 1 + random() % 256;
+			if(damageHere && damage == 5)
+				count = 257 + random() % 10;
+			putHeader(out, 2, count, section, numSections);
+			for(unsigned i = 0; i < count * 3; i++)
+				out.push_back((uint8_t)random());
+		}
+		else {
+			uint8_t formatCode = frameFormats[random() % 4];
+			unsigned count = 2 + random() % (maxPoints - 1);
+			if(damageHere && damage == 4)
+				count = 1;
+			putHeader(out, formatCode, count, section, numSections);
+
+			unsigned size = frameRecordSize(formatCode);
+			unsigned statusOffset = (formatCode == 0 || formatCode == 4) ? 6 : 4;
+			unsigned strayFlag = (damageHere && damage == 2) ? random() % (count - 1) : count;
+			for(unsigned i = 0; i < count; i++) {
+				size_t recordPos = out.size();
+				for(unsigned k = 0; k < size; k++)
+					out.push_back((uint8_t)random());
+
+				//blanked points now and then, the last point flag on the last point most of the time
+				uint8_t status = (random() % 4 == 0) ? 0x40 : 0;
+				if((i == count - 1 && random() % 10 != 0) || i == strayFlag)
+					status |= 0x80;
+				out[recordPos + statusOffset] = status;
+			}
+		}
+
+		if(damageHere && damage == 3)
+			out[headerPos + 1 + random() % 3] = (uint8_t)random();
+		if(damageHere && damage == 6) {
+			const uint8_t badFormats[] = { 3, 6, 7, 0x40, 0xFF };
+			out[headerPos + 7] = badFormats[random() % 5];
+		}
+	}
+
+	//a regular end section, a zero signature or nothing
+	switch(random() % 3) {
+		case 0: putHeader(out, 0, 0, 0, 0); break;
+		case 1: out.insert(out.end(), { 0, 0, 0, 0 }); break;
+	}
+
+	if(damage == 1)
+		out.resize(1 + random() % (out.size() - 1));
+	if(damage == 7) {
+		unsigned count = 1 + random() % 100;
+		for(unsigned i = 0; i < count; i++)
+			out.push_back((uint8_t)random());
+	}
+	return out;
+}
+
+std::vector<uint8_t> encodeIldaFile(const IldaFrames& frames)
+{
+	std::vector<uint8_t> out;
+	for(size_t frame = 0; frame < frames.size(); frame++) {
+		const std::vector<ISPDB25Point>& points = frames[frame];
+		putHeader(out, 5, (uint16_t)points.size(), (uint16_t)frame, (uint16_t)frames.size());
+		for(size_t i = 0; i < points.size(); i++) {
+			const ISPDB25Point& point = points[i];
+			putShort(out, (uint16_t)(point.x - 0x8000));
+			putShort(out, (uint16_t)(point.y - 0x8000));
+			uint8_t status = isLitPoint(point) ? 0 : 0x40;
+			if(i == points.size() - 1)
+				status |= 0x80;
+			out.insert(out.end(), { status, (uint8_t)(point.b >> 8), (uint8_t)(point.g >> 8), (uint8_t)(point.r >> 8) });
+		}
+	}
+	putHeader(out, 0, 0, 0, 0);
+	return out;
+}
+
+static std::string testDirectory;
+static unsigned testFileCount = 0;
+
+std::string ildaTestDirectory()
+{
+	if(testDirectory.empty()) {
+		char directory[] = "/tmp/ildatestXXXXXX";
+		if(mkdtemp(directory) == NULL)
+			printf("Cannot create the test directory\n");
+		else
+			testDirectory = directory;
+	}
+	return testDirectory;
+}
+
+std::string writeIldaTestFile(const std::vector<uint8_t>& bytes)
+{
+	if(ildaTestDirectory().empty())
+		return "";
+
+	std::string path = testDirectory + "/test" + std::to_string(testFileCount++) + ".ild";
+	FILE* file = fopen(path.c_str(), "wb");
+	if(file == NULL)
+		return "";
+	fwrite(bytes.data(), 1, bytes.size(), file);
+	fclose(file);
+	return path;
+}
+
+void removeIldaTestFiles()
+{
+	if(!testDirectory.empty())
+		std::filesystem::remove_all(testDirectory);
+	testDirectory.clear();
+}
+
+void randomIldaPalette(std::mt19937& random, unsigned long* palette)
+{
+	for(unsigned i = 0; i < 256; i++)
+		palette[i] = random() & 0xFFFFFF;
+}
+
+static int savedStdout = -1;
+
+void quietStdout(bool quiet)
+{
+	fflush(stdout);
+	if(quiet && savedStdout < 0) {
+		savedStdout = dup(STDOUT_FILENO);
+		int devNull = open("/dev/null", O_WRONLY);
+		dup2(devNull, STDOUT_FILENO);
+		close(devNull);
+	}
+	else if(!quiet && savedStdout >= 0) {
+		dup2(savedStdout, STDOUT_FILENO);
+		close(savedStdout);
+		savedStdout = -1;
+	}
+}
+
+
+// -- Parsers -----------------------------------------------------------------
+
+static uint16_t readShort(FILE* file)
+{
+	uint16_t c1 = ((uint16_t)fgetc(file)) & 0xFF;
+	uint16_t c2 = ((uint16_t)fgetc(file)) & 0xFF;
+
+	return (uint16_t)((c1 << 8) | c2);
+}
+
+//FilePlayer::playFileInnerJob before IldaReader, without the chunk splitting, the queueing
+//and the error messages
+int legacyParseIlda(const char* filename, const unsigned long* defaultPalette, IldaFrames& frames)
+{
+	frames.clear();
+	unsigned long customPalette[256];
+	const unsigned long* currentPalette = defaultPalette;
+
+	const float xScale = 0xFFFF;
+	const float yScale = 0xFFFF;
+
+	FILE* fpIDTF = fopen(filename, "rb");
+	if(!fpIDTF)
+		return -1;
+
+	uint8_t ilda[4];
+	fread(ilda, sizeof(ilda), 1, fpIDTF);
+	if(feof(fpIDTF) || !((ilda[0] == 'I') && (ilda[1] == 'L') && (ilda[2] == 'D') && (ilda[3] == 'A'))) {
+		fclose(fpIDTF);
+		return -1;
+	}
+	fseek(fpIDTF, 0, SEEK_SET);
+
+	int result = 0;
+	while(1) {
+		fread(ilda, sizeof(ilda), 1, fpIDTF);
+		if(feof(fpIDTF))
+			break;
+
+		if((ilda[0] == 0) && (ilda[1] == 0) && (ilda[2] == 0) && (ilda[3] == 0))
+			break;
+
+		if(!((ilda[0] == 'I') && (ilda[1] == 'L') && (ilda[2] == 'D') && (ilda[3] == 'A'))) {
+			result = -1;
+			break;
+		}
+
+		fgetc(fpIDTF);
+		fgetc(fpIDTF);
+		fgetc(fpIDTF);
+		uint8_t formatCode = (uint8_t)fgetc(fpIDTF);
+		if(feof(fpIDTF)) {
+			result = -1;
+			break;
+		}
+
+		uint8_t dataSetName[8], companyName[8];
+		fread(dataSetName, 8, 1, fpIDTF);
+		fread(companyName, 8, 1, fpIDTF);
+		if(feof(fpIDTF)) {
+			result = -1;
+			break;
+		}
+
+		uint16_t recordCnt = (uint16_t)readShort(fpIDTF);
+		readShort(fpIDTF);
+		if(feof(fpIDTF)) {
+			result = -1;
+			break;
+		}
+
+		readShort(fpIDTF);
+		fgetc(fpIDTF);
+		fgetc(fpIDTF);
+
+		if(recordCnt == 0)
+			break;
+
+		if((formatCode == 0) || (formatCode == 1) || (formatCode == 4) || (formatCode == 5)) {
+			if(recordCnt <= 1) {
+				result = -1;
+				break;
+			}
+
+			int hasZ = (formatCode == 0) || (formatCode == 4);
+			int hasIndex = (formatCode == 0) || (formatCode == 1);
+
+			std::vector<ISPDB25Point> frame;
+			for(int i = 0; i < recordCnt; i++) {
+				int16_t x, y;
+				uint8_t statusCode, r, g, b;
+
+				x = (short)((float)(short)readShort(fpIDTF) * xScale);
+				y = (short)((float)(short)readShort(fpIDTF) * yScale);
+				if(hasZ)
+					readShort(fpIDTF);
+
+				statusCode = (uint8_t)fgetc(fpIDTF);
+
+				if(hasIndex) {
+					uint8_t colorIndex = (uint8_t)fgetc(fpIDTF);
+					long rgb = currentPalette[colorIndex];
+					r = (uint8_t)(rgb >> 16);
+					g = (uint8_t)(rgb >> 8);
+					b = (uint8_t)rgb;
+				}
+				else {
+					b = (uint8_t)fgetc(fpIDTF);
+					g = (uint8_t)fgetc(fpIDTF);
+					r = (uint8_t)fgetc(fpIDTF);
+				}
+
+				if(feof(fpIDTF)) {
+					result = -1;
+					break;
+				}
+
+				if(statusCode & 0x40)
+					r = g = b = 0;
+
+				//the shutter field was left uninitialised, IldaReader zeroes it
+				ISPDB25Point point = {};
+				point.x = 0xFFFF - (x + 0x8000);
+				point.y = 0xFFFF - (y + 0x8000);
+				point.r = r * 0x101;
+				point.g = g * 0x101;
+				point.b = b * 0x101;
+				point.intensity = 0xFFFF;
+				point.u1 = point.u2 = point.u3 = point.u4 = 0;
+				frame.push_back(point);
+
+				if((statusCode & 0x80) && (i + 1) != recordCnt) {
+					result = -1;
+					break;
+				}
+			}
+			if(result != 0)
+				break;
+
+			frames.push_back(frame);
+		}
+		else if(formatCode == 2) {
+			if(recordCnt > 256) {
+				result = -1;
+				break;
+			}
+
+			memset(customPalette, 0, sizeof(customPalette));
+			for(int i = 0; i < recordCnt; i++) {
+				uint8_t r = (uint8_t)fgetc(fpIDTF);
+				uint8_t g = (uint8_t)fgetc(fpIDTF);
+				uint8_t b = (uint8_t)fgetc(fpIDTF);
+				if(feof(fpIDTF)) {
+					result = -1;
+					break;
+				}
+				customPalette[i] = ((r & 0xFF) << 16) | ((g & 0xFF) << 8) | (b & 0xFF);
+			}
+			if(result != 0)
+				break;
+
+			currentPalette = customPalette;
+		}
+		else {
+			result = -1;
+			break;
+		}
+	}
+
+	fclose(fpIDTF);
+	return result;
+}
+
+//the section loop of FilePlayer::playFileInnerJob
+int readerParseIlda(const char* filename, const unsigned long* defaultPalette, IldaFrames& frames)
+{
+	frames.clear();
+	unsigned long customPalette[256];
+	const unsigned long* currentPalette = defaultPalette;
+
+	IldaReader reader;
+	if(reader.open(filename) != 0)
+		return -1;
+
+	int result = 0;
+	IldaReader::IldaSection section;
+	while((result = reader.nextSection(section)) > 0) {
+		if(section.formatCode == ILDA_FORMAT_PALETTE) {
+			if((result = reader.decodePalette(section, customPalette)) != 0)
+				break;
+			currentPalette = customPalette;
+			continue;
+		}
+
+		std::vector<ISPDB25Point> frame(section.recordCnt);
+		if((result = reader.decodePoints(section, 0, section.recordCnt, currentPalette, frame.data())) != 0)
+			break;
+		frames.push_back(frame);
+	}
+
+	return result;
+}
@@ -0,0 +1,48 @@
+#ifndef ILDATESTSUPPORT_H_
+#define ILDATESTSUPPORT_H_
+
+#include "TestSupport.hpp"
+
+#include <random>
+#include <string>
+
+#include "../IldaReader.hpp"
+
+//generated ILDA files and the stdio parser FilePlayer used before IldaReader, for comparing
+//the two and measuring the parse throughput
+
+typedef std::vector<std::vector<ISPDB25Point>> IldaFrames;
+
+//a file of numSections palette and frame sections in random formats with up to maxPoints
+//points per frame. a damaged file has one random defect: truncated, a stray last point flag,
+//a bad signature or format code, an insane record count or garbage behind the end.
+std::vector<uint8_t> generateIldaFile(std::mt19937& random, unsigned numSections, unsigned maxPoints, bool damaged);
+
+//the frames in format 5 (2D true color), with the 8 most significant bits of the colors and
+//points without color blanked. the player decodes coordinates one lower than they were.
+std::vector<uint8_t> encodeIldaFile(const IldaFrames& frames);
+
+//writes the file to a new path in the test directory, returns the path
+std::string writeIldaTestFile(const std::vector<uint8_t>& bytes);
+
+//the test directory, created on first use
+std::string ildaTestDirectory();
+
+//removes the test directory and everything in it
+void removeIldaTestFiles();
+
+//the frames the stdio parser of FilePlayer emitted before IldaReader (fopen, fgetc, fread).
+//returns 0 or -1 on a malformed file, the frames up to there are returned either way.
+int legacyParseIlda(const char* filename, const unsigned long* defaultPalette, IldaFrames& frames);
+
+//the same with IldaReader, as FilePlayer parses now
+int readerParseIlda(const char* filename, const unsigned long* defaultPalette, IldaFrames& frames);
+
+//a palette of 256 random colors in ILDACOLOR layout
+void randomIldaPalette(std::mt19937& random, unsigned long* palette);
+
+//sends stdout to /dev/null or back. IldaReader reports malformed files and FilePlayer every file
+//it plays on stdout, which would drown the test output.
+void quietStdout(bool quiet);
+
+#endif
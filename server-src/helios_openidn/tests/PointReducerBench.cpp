@@ -0,0 +1,52 @@
+#include "TestSupport.hpp"
+
+#include "../shared/PointReducer.hpp"
+
+//time per frame of PointReducer for frames of star outlines from 500 to 65535 points, reduced
+//to a ratio of the points. the frame is copied before each run, the copy is not timed.
+
+
+#define BENCH_RUNS 200
+
+static void measure(int mode, const std::vector<ISPDB25Point>& frame, double ratio)
+{
+	PointReducer reducer;
+	reducer.setMode(mode);
+	std::vector<ISPDB25Point> points;
+	points.reserve(frame.size());
+	unsigned keep = (unsigned)(frame.size() * ratio);
+
+	double totalUs = 0, maxUs = 0;
+	for(int run = 0; run < BENCH_RUNS; run++) {
+		points.assign(frame.begin(), frame.end());
+		double startUs = testNowUs();
+		reducer.reduce(points, keep);
+		double us = testNowUs() - startUs;
+		totalUs += us;
+		maxUs = std::max(maxUs, us);
+	}
+	printf("  %-10s %7zu %6.2f %10.1f %10.1f %8.1f\n", mode == POINTREDUCTION_UNIFORM ? "uniform" : "geometric", frame.size(), ratio,
+		totalUs / BENCH_RUNS, maxUs, 1000.0 * totalUs / BENCH_RUNS / frame.size());
+}
+
+int main(int argc, char** argv)
+{
+	printf("star outlines, mean of %d runs\n", BENCH_RUNS);
+	printf("  %-10s %7s %6s %10s %10s %8s\n", "mode", "points", "ratio", "us avg", "us max", "ns/point");
+
+	for(unsigned size : { 500, 5000, 20000, 65535 }) {
+		//four stars side by side, 10 edges each, with blanked jumps between them
+		std::vector<std::vector<ISPDB25Point>> corners;
+		for(unsigned star = 0; star < 4; star++)
+			corners.push_back(testStarCorners(0x2000 + star * 0x4000, 0x8000, 0x1c00, 0xa00));
+		unsigned edgePoints = std::max(2u, size / 40);
+		std::vector<ISPDB25Point> frame = testOutlines(corners, edgePoints, 2, 10);
+		frame.resize(std::min((size_t)size, frame.size()));
+
+		for(double ratio : { 0.75, 0.5 }) {
+			measure(POINTREDUCTION_UNIFORM, frame, ratio);
+			measure(POINTREDUCTION_GEOMETRIC, frame, ratio);
+		}
+	}
+	return 0;
+}
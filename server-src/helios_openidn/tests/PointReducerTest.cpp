@@ -0,0 +1,202 @@
+#include "TestSupport.hpp"
+
+#include <math.h>
+
+#include "../shared/PointReducer.hpp"
+
+//PointReducer on outlines with corners, dwell points and blanked jumps, against the uniform
+//skipping it replaced in getNextBuffer
+
+
+//largest distance of a lit point of the original to the lit segments of the reduced points
+static double maxLitError(const std::vector<ISPDB25Point>& original, const std::vector<ISPDB25Point>& reduced)
+{
+	double maxError = 0;
+	for(const auto& p : original) {
+		if(!isLitPoint(p))
+			continue;
+		double best = INFINITY;
+		for(size_t i = 0; i < reduced.size() && best > 0; i++) {
+			if(!isLitPoint(reduced[i]))
+				continue;
+			const ISPDB25Point& a = (i > 0) ? reduced[i - 1] : reduced[i];
+			const ISPDB25Point& b = reduced[i];
+			double abX = (double)b.x - a.x, abY = (double)b.y - a.y;
+			double apX = (double)p.x - a.x, apY = (double)p.y - a.y;
+			double lengthSq = abX * abX + abY * abY;
+			double t = (lengthSq > 0) ? std::min(1.0, std::max(0.0, (apX * abX + apY * abY) / lengthSq)) : 0;
+			best = std::min(best, hypot(apX - t * abX, apY - t * abY));
+		}
+		maxError = std::max(maxError, best);
+	}
+	return maxError;
+}
+
+//the points where blanking switches on or off, with the state after the switch
+static std::vector<ISPDB25Point> transitions(const std::vector<ISPDB25Point>& points)
+{
+	std::vector<ISPDB25Point> result;
+	for(size_t i = 1; i < points.size(); i++) {
+		if(isLitPoint(points[i]) != isLitPoint(points[i - 1]))
+			result.push_back(points[i]);
+	}
+	return result;
+}
+
+static bool sameTransitions(const std::vector<ISPDB25Point>& a, const std::vector<ISPDB25Point>& b)
+{
+	if(a.size() != b.size())
+		return false;
+	for(size_t i = 0; i < a.size(); i++) {
+		if(!samePoint(a[i], b[i]))
+			return false;
+	}
+	return true;
+}
+
+//corners of the outlines that are missing as lit points in the reduced points
+static unsigned missingCorners(const std::vector<std::vector<ISPDB25Point>>& corners, const std::vector<ISPDB25Point>& reduced)
+{
+	unsigned missing = 0;
+	for(const auto& outline : corners) {
+		for(const auto& corner : outline) {
+			bool found = false;
+			for(const auto& point : reduced)
+				found |= isLitPoint(point) && point.x == corner.x && point.y == corner.y;
+			missing += !found;
+		}
+	}
+	return missing;
+}
+
+struct ReductionResult
+{
+	size_t size;
+	unsigned missingCorners;
+	bool sameTransitions;
+	double maxError;
+};
+
+static ReductionResult reduceOutlines(int mode, const std::vector<std::vector<ISPDB25Point>>& corners, const std::vector<ISPDB25Point>& original, unsigned keep)
+{
+	PointReducer reducer;
+	reducer.setMode(mode);
+	std::vector<ISPDB25Point> points = original;
+	reducer.reduce(points, keep);
+
+	ReductionResult result;
+	result.size = points.size();
+	result.missingCorners = missingCorners(corners, points);
+	result.sameTransitions = sameTransitions(transitions(original), transitions(points));
+	result.maxError = maxLitError(original, points);
+	return result;
+}
+
+//the outlines reduced to each ratio both ways. the geometric reduction keeps every corner and
+//every blanking transition and stays on the outline. uniform skipping keeps corners with dwell
+//points only by chance, without them it cuts corners.
+static void compareWithUniform(const char* name, const std::vector<std::vector<ISPDB25Point>>& corners, unsigned edgePoints, unsigned dwell)
+{
+	std::vector<ISPDB25Point> original = testOutlines(corners, edgePoints, dwell, 8);
+	double worstUniformError = 0;
+
+	for(double ratio : { 0.6, 0.4, 0.25 }) {
+		unsigned keep = (unsigned)(original.size() * ratio);
+		ReductionResult geometric = reduceOutlines(POINTREDUCTION_GEOMETRIC, corners, original, keep);
+		ReductionResult uniform = reduceOutlines(POINTREDUCTION_UNIFORM, corners, original, keep);
+		worstUniformError = std::max(worstUniformError, uniform.maxError);
+
+		printf("     %s, dwell %u, %zu to %u points: error %.1f, uniform %.1f with %u corners and %s transitions lost\n", name, dwell,
+			original.size(), keep, geometric.maxError, uniform.maxError, uniform.missingCorners, uniform.sameTransitions ? "no" : "some");
+		CHECK_MSG(geometric.size == keep && uniform.size == keep, "%zu and %zu points", geometric.size, uniform.size);
+		CHECK_MSG(geometric.missingCorners == 0, "ratio %.2f: %u corners lost", ratio, geometric.missingCorners);
+		CHECK_MSG(geometric.sameTransitions, "ratio %.2f", ratio);
+		CHECK_MSG(geometric.maxError < 2, "ratio %.2f: %.1f", ratio, geometric.maxError);
+		CHECK_MSG(geometric.maxError <= uniform.maxError + 1, "ratio %.2f: %.1f, uniform %.1f", ratio, geometric.maxError, uniform.maxError);
+	}
+	if(dwell == 0)
+		CHECK_MSG(worstUniformError > 100, "%.1f", worstUniformError);
+}
+
+static void squares()
+{
+	std::vector<std::vector<ISPDB25Point>> corners = { testSquareCorners(0x4000, 0x8000, 0x3000), testSquareCorners(0xc000, 0x8000, 0x2000) };
+	compareWithUniform("squares", corners, 50, 0);
+	compareWithUniform("squares", corners, 50, 3);
+}
+
+static void stars()
+{
+	std::vector<std::vector<ISPDB25Point>> corners = { testStarCorners(0x4000, 0x8000, 0x3000, 0x1200), testStarCorners(0xc000, 0x8000, 0x3000, 0x1200) };
+	compareWithUniform("stars", corners, 20, 0);
+	compareWithUniform("stars", corners, 20, 3);
+}
+
+static void transitionsScoredHighest()
+{
+	//with fewer points to keep than there are corners and transitions, the transitions and the
+	//corners of the blanked jump go last, that is everything left is scored POINTREDUCTION_SCORE_TRANSITION
+	std::vector<std::vector<ISPDB25Point>> corners = { testStarCorners(0x4000, 0x8000, 0x3000, 0x1200), testStarCorners(0xc000, 0x8000, 0x3000, 0x1200) };
+	std::vector<ISPDB25Point> original = testOutlines(corners, 20, 0, 8);
+	std::vector<ISPDB25Point> originalTransitions = transitions(original);
+
+	PointReducer reducer;
+	std::vector<ISPDB25Point> points = original;
+	reducer.reduce(points, 8);
+	CHECK(points.size() == 8);
+
+	//the outline starts and ends are a lit point between two blanked ones at the same position
+	unsigned transitionPoints = 0;
+	for(const auto& point : points) {
+		for(const auto& transition : originalTransitions)
+			transitionPoints += (point.x == transition.x && point.y == transition.y);
+	}
+	CHECK_MSG(transitionPoints >= 7, "%u of 8 points at transitions", transitionPoints);
+}
+
+static void keepCountCarriesFraction()
+{
+	//chunks of 7 points at 0.3 keep 2.1 points each on average, and at least one
+	double carry = 0;
+	unsigned kept = 0;
+	for(int chunk = 0; chunk < 100; chunk++) {
+		unsigned keep = PointReducer::keepCount(7, 0.3, carry);
+		CHECK(keep >= 2 && keep <= 3);
+		kept += keep;
+	}
+	CHECK_MSG(kept >= 209 && kept <= 211, "%u points kept", kept);
+
+	carry = 0;
+	CHECK(PointReducer::keepCount(0, 0.3, carry) == 0);
+	CHECK(PointReducer::keepCount(3, 0.1, carry) == 1);
+	CHECK(PointReducer::keepCount(10, 1.5, carry) == 10);
+}
+
+static void uniformSkipsEvenly()
+{
+	//100 points on a line reduced to 25: the first and last are kept, the points between them
+	//are evenly spaced
+	std::vector<ISPDB25Point> points = testFrame(100, 0x8000);
+	for(size_t i = 0; i < points.size(); i++)
+		points[i].y = (uint16_t)i;
+	PointReducer reducer;
+	reducer.setMode(POINTREDUCTION_UNIFORM);
+	reducer.reduce(points, 25);
+
+	CHECK(points.size() == 25);
+	CHECK(points.front().y == 0 && points.back().y == 99);
+	for(size_t i = 2; i + 1 < points.size(); i++)
+		CHECK_MSG(points[i].y - points[i - 1].y >= 3 && points[i].y - points[i - 1].y <= 5, "gap %d at %zu", points[i].y - points[i - 1].y, i);
+}
+
+
+int main(int argc, char** argv)
+{
+	RUN_TEST(squares);
+	RUN_TEST(stars);
+	RUN_TEST(transitionsScoredHighest);
+	RUN_TEST(keepCountCarriesFraction);
+	RUN_TEST(uniformSkipsEvenly);
+
+	return finishTests("PointReducerTest");
+}
@@ -0,0 +1,192 @@
+#include "TestSupport.hpp"
+
+#include <random>
+
+#include "../shared/SliceAutoTuner.hpp"
+
+//the auto-tuner in a simulated wave output with injected jitter. time is simulated and
+//the random generator seeded, so every run gives the same result.
+
+
+#define SIM_CHUNK_US 10000     //the source sends 10 ms wave chunks
+#define SIM_SECONDS 600
+
+struct JitterProfile
+{
+	const char* name;
+	double writeBaseUs;        //fixed cost of a write call
+	double writeCostPerUs;     //cost per us of output written
+	double writeJitterUs;      //uniform random extra cost
+	double arrivalJitterUs;    //uniform random network delay of each chunk
+	unsigned burstEvery;       //every n-th chunk is delayed by burstUs, 0 for none
+	double burstUs;
+};
+
+struct SimResult
+{
+	double usPerSlice;
+	double bufferTargetMs;
+	double load;               //write call time per output time in the second half
+	double underrunsPerMin;    //in the second half
+	unsigned adjustments;
+};
+
+//the driver writes slices back to back. while the device buffer is at the target it waits
+//for the output, when the write calls take longer than the output the buffer drains.
+//a chunk arriving later than the buffer target minus one slice is an input underrun.
+static SimResult simulate(const JitterProfile& profile, double usPerSlice, double bufferTargetMs)
+{
+	SliceAutoTuner tuner;
+	tuner.setEnabled(true);
+	tuner.setChunkBoundsUs(2000, 30000);
+	tuner.setBufferBoundsMs(10, 200);
+	tuner.setMaxUnderrunsPerMin(1);
+
+	std::mt19937 random(4711);
+	std::uniform_real_distribution<double> unit(0, 1);
+
+	SimResult result = { 0, 0, 0, 0, 0 };
+	double endUs = SIM_SECONDS * 1000000.0;
+	double secondHalfUs = endUs / 2;
+	double halfWriteUs = 0, halfOutputUs = 0;
+	unsigned halfUnderruns = 0;
+
+	double nowUs = 0;
+	double backlogUs = bufferTargetMs * 1000;
+	unsigned chunk = 0;
+	double lastArrivalUs = 0;
+	double delayUs = 0;
+
+	tuner.update(nowUs, usPerSlice, bufferTargetMs);
+
+	while(nowUs < endUs) {
+		//a write call
+		double callUs = profile.writeBaseUs + profile.writeCostPerUs * usPerSlice + profile.writeJitterUs * unit(random);
+		tuner.addWrite(callUs, usPerSlice);
+
+		double targetUs = bufferTargetMs * 1000;
+		backlogUs += usPerSlice - callUs;
+		double waitUs = 0;
+		if(backlogUs > targetUs) {
+			waitUs = backlogUs - targetUs;
+			backlogUs = targetUs;
+		}
+		bool underrun = false;
+		if(backlogUs < 0) {
+			underrun = true;
+			backlogUs = usPerSlice;
+		}
+		nowUs += callUs + waitUs;
+
+		if(nowUs >= secondHalfUs) {
+			halfWriteUs += callUs;
+			halfOutputUs += usPerSlice;
+		}
+
+		//chunks that arrived in the meantime, in order
+		while(true) {
+			double arrivalUs = std::max(lastArrivalUs, chunk * (double)SIM_CHUNK_US + delayUs);
+			if(arrivalUs > nowUs)
+				break;
+			lastArrivalUs = arrivalUs;
+			tuner.addArrival(arrivalUs);
+			if(delayUs > targetUs - usPerSlice)
+				underrun = true;
+
+			chunk++;
+			delayUs = profile.arrivalJitterUs * unit(random);
+			if(profile.burstEvery != 0 && (chunk % profile.burstEvery) == 0)
+				delayUs += profile.burstUs;
+		}
+
+		if(underrun) {
+			tuner.addUnderrun();
+			if(nowUs >= secondHalfUs)
+				halfUnderruns++;
+		}
+
+		if(tuner.update(nowUs, usPerSlice, bufferTargetMs))
+			result.adjustments++;
+	}
+
+	result.usPerSlice = usPerSlice;
+	result.bufferTargetMs = bufferTargetMs;
+	result.load = halfWriteUs / halfOutputUs;
+	result.underrunsPerMin = halfUnderruns * 60000000.0 / (endUs - secondHalfUs);
+	printf("  %-12s %6.0f us chunks %6.1f ms buffer, load %.2f, %.2f underruns/min, %u adjustments\n",
+		profile.name, result.usPerSlice, result.bufferTargetMs, result.load, result.underrunsPerMin, result.adjustments);
+	return result;
+}
+
+
+static void steadyLinkShrinks()
+{
+	//cheap writes and a steady source: short chunks and a small buffer
+	JitterProfile profile = { "steady", 300, 0, 100, 500, 0, 0 };
+	SimResult result = simulate(profile, 15000, 40);
+	CHECK_MSG(result.usPerSlice <= 2500, "%.0f us chunks", result.usPerSlice);
+	CHECK_MSG(result.bufferTargetMs <= 15, "%.1f ms buffer", result.bufferTargetMs);
+	CHECK(result.underrunsPerMin == 0);
+}
+
+static void slowLinkGrows()
+{
+	//each transfer has a fixed cost of 3 ms: chunks grow until the writes keep up
+	JitterProfile profile = { "slow link", 3000, 0.02, 300, 500, 0, 0 };
+	SimResult result = simulate(profile, 2000, 40);
+	CHECK_MSG(result.usPerSlice >= 3000, "%.0f us chunks", result.usPerSlice);
+	CHECK_MSG(result.load <= 1.05, "load %.2f", result.load);
+	CHECK_MSG(result.underrunsPerMin <= 1, "%.2f underruns/min", result.underrunsPerMin);
+}
+
+static void jitteryNetworkBuffers()
+{
+	//up to 20 ms of network delay: the buffer target grows to cover it
+	JitterProfile profile = { "jittery", 300, 0, 100, 20000, 0, 0 };
+	SimResult result = simulate(profile, 15000, 10);
+	CHECK_MSG(result.bufferTargetMs >= 20 && result.bufferTargetMs <= 40, "%.1f ms buffer", result.bufferTargetMs);
+	CHECK_MSG(result.underrunsPerMin <= 1, "%.2f underruns/min", result.underrunsPerMin);
+}
+
+static void burstyNetworkBuffers()
+{
+	//a 30 ms stall every 3 s
+	JitterProfile profile = { "bursty", 300, 0, 100, 1000, 300, 30000 };
+	SimResult result = simulate(profile, 15000, 10);
+	CHECK_MSG(result.underrunsPerMin <= 1, "%.2f underruns/min", result.underrunsPerMin);
+	CHECK_MSG(result.bufferTargetMs >= 30 && result.bufferTargetMs <= 60, "%.1f ms buffer", result.bufferTargetMs);
+}
+
+static void boundsHold()
+{
+	//writes that can never keep up and a source that stalls for longer than the maximum
+	//buffer: the values stop at the configured bounds
+	JitterProfile profile = { "hopeless", 40000, 0, 0, 500, 100, 300000 };
+	SimResult result = simulate(profile, 15000, 40);
+	CHECK(result.usPerSlice == 30000);
+	CHECK(result.bufferTargetMs == 200);
+}
+
+static void disabledKeepsValues()
+{
+	SliceAutoTuner tuner;
+	double usPerSlice = 15000, bufferTargetMs = 40;
+	for(unsigned i = 0; i < 1000; i++) {
+		tuner.addWrite(50000, usPerSlice);
+		tuner.addUnderrun();
+		CHECK(!tuner.update(i * 10000.0, usPerSlice, bufferTargetMs));
+	}
+	CHECK(usPerSlice == 15000 && bufferTargetMs == 40);
+}
+
+int main(int argc, char** argv)
+{
+	RUN_TEST(steadyLinkShrinks);
+	RUN_TEST(slowLinkGrows);
+	RUN_TEST(jitteryNetworkBuffers);
+	RUN_TEST(burstyNetworkBuffers);
+	RUN_TEST(boundsHold);
+	RUN_TEST(disabledKeepsValues);
+
+	return finishTests("SliceAutoTunerTest");
+}
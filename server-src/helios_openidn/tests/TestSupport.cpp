@@ -0,0 +1,303 @@
+#include "TestSupport.hpp"
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <thread>
+
+#include "../ManagementInterface.hpp"
+
+
+unsigned testFailures = 0;
+
+
+// -- Management stub ---------------------------------------------------------
+//the tests link the output path without ManagementInterface.cpp, every request is granted
+
+ManagementInterface::ManagementInterface()
+{
+}
+
+bool ManagementInterface::requestOutput(int outputMode)
+{
+	return true;
+}
+
+void ManagementInterface::relinquishOutput(int outputMode)
+{
+}
+
+static ManagementInterface testManagement;
+ManagementInterface* management = &testManagement;
+
+
+// -- Helpers -----------------------------------------------------------------
+
+int finishTests(const char* programName)
+{
+	if(testFailures == 0)
+		printf("%s: all tests passed\n", programName);
+	else
+		printf("%s: %u checks failed\n", programName, testFailures);
+
+	fflush(stdout);
+	_exit(testFailures == 0 ? 0 : 1);
+}
+
+double testNowUs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000.0 + now.tv_nsec / 1000.0;
+}
+
+void testSleepMs(double ms)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds((long long)(ms * 1000)));
+}
+
+ISPDB25Point testPoint(uint16_t x, uint16_t y, uint16_t r, uint16_t g, uint16_t b)
+{
+	ISPDB25Point point;
+	memset(&point, 0, sizeof(point));
+	point.x = x;
+	point.y = y;
+	point.r = r;
+	point.g = g;
+	point.b = b;
+	return point;
+}
+
+std::vector<ISPDB25Point> testFrame(unsigned count, uint16_t green)
+{
+	std::vector<ISPDB25Point> points;
+	for(unsigned i = 0; i < count; i++)
+		points.push_back(testPoint(0x1000 + i * 0xc000 / count, 0x8000, 0, green, 0));
+	return points;
+}
+
+bool isLitPoint(const ISPDB25Point& point)
+{
+	return (point.r | point.g | point.b) != 0;
+}
+
+bool samePoint(const ISPDB25Point& a, const ISPDB25Point& b)
+{
+	return a.x == b.x && a.y == b.y && a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+static ISPDB25Point betweenPoints(const ISPDB25Point& a, const ISPDB25Point& b, double t)
+{
+	ISPDB25Point point = a;
+	point.x = (uint16_t)lround(a.x + (b.x - (double)a.x) * t);
+	point.y = (uint16_t)lround(a.y + (b.y - (double)a.y) * t);
+	return point;
+}
+
+std::vector<ISPDB25Point> testOutlines(const std::vector<std::vector<ISPDB25Point>>& corners, unsigned edgePoints, unsigned dwell, unsigned jumpPoints)
+{
+	std::vector<ISPDB25Point> points;
+	for(const auto& outline : corners) {
+		if(outline.empty())
+			continue;
+		if(!points.empty()) {
+			ISPDB25Point from = points.back();
+			for(unsigned i = 1; i <= jumpPoints; i++)
+				points.push_back(betweenPoints(from, testPoint(outline[0].x, outline[0].y, 0, 0, 0), i / (jumpPoints + 1.0)));
+		}
+		points.push_back(testPoint(outline[0].x, outline[0].y, 0, 0, 0));
+
+		for(size_t c = 0; c <= outline.size(); c++) {
+			ISPDB25Point corner = testPoint(outline[c % outline.size()].x, outline[c % outline.size()].y, 0, 0xffff, 0);
+			for(unsigned d = 0; d <= dwell; d++)
+				points.push_back(corner);
+			if(c == outline.size())
+				break;
+			ISPDB25Point next = testPoint(outline[(c + 1) % outline.size()].x, outline[(c + 1) % outline.size()].y, 0, 0xffff, 0);
+			for(unsigned i = 1; i < edgePoints; i++)
+				points.push_back(betweenPoints(corner, next, i / (double)edgePoints));
+		}
+		points.push_back(testPoint(outline[0].x, outline[0].y, 0, 0, 0));
+	}
+	return points;
+}
+
+std::vector<ISPDB25Point> testSquareCorners(uint16_t cx, uint16_t cy, uint16_t halfSize)
+{
+	return { testPoint(cx - halfSize, cy - halfSize, 0, 0, 0), testPoint(cx + halfSize, cy - halfSize, 0, 0, 0),
+		testPoint(cx + halfSize, cy + halfSize, 0, 0, 0), testPoint(cx - halfSize, cy + halfSize, 0, 0, 0) };
+}
+
+std::vector<ISPDB25Point> testStarCorners(uint16_t cx, uint16_t cy, uint16_t outerRadius, uint16_t innerRadius)
+{
+	std::vector<ISPDB25Point> corners;
+	for(int i = 0; i < 10; i++) {
+		double angle = M_PI / 2 + i * M_PI / 5;
+		double radius = (i % 2 == 0) ? outerRadius : innerRadius;
+		corners.push_back(testPoint((uint16_t)lround(cx + radius * cos(angle)), (uint16_t)lround(cy + radius * sin(angle)), 0, 0, 0));
+	}
+	return corners;
+}
+
+std::shared_ptr<HWBridge> startBridge(std::shared_ptr<DACHWInterface> device, bool staged)
+{
+	std::shared_ptr<HWBridge> bridge = std::make_shared<HWBridge>(device);
+	bridge->setStaged(staged);
+	std::thread([bridge] { bridge->driverLoop(); }).detach();
+	return bridge;
+}
+
+
+// -- TestChunkSource ---------------------------------------------------------
+
+//input samples are ISPDB25Points already
+class CopyDecoder : public RTLaproDecoder
+{
+    public:
+
+    unsigned getSampleSize() override
+    {
+        return sizeof(ISPDB25Point);
+    }
+
+    void decode(uint8_t *dstPtr, uint8_t *srcPtr) override
+    {
+        memcpy(dstPtr, srcPtr, sizeof(ISPDB25Point));
+    }
+
+    void decode(uint8_t *dstPtr, uint8_t *srcPtr, unsigned sampleCount) override
+    {
+        memcpy(dstPtr, srcPtr, sampleCount * sizeof(ISPDB25Point));
+    }
+};
+
+TestChunkSource::TestChunkSource()
+{
+	decoder = new CopyDecoder();
+}
+
+TestChunkSource::~TestChunkSource()
+{
+	decoder->refDec();
+}
+
+int TestChunkSource::put(DACHWInterface& device, const std::vector<ISPDB25Point>& points, uint32_t durationUs, uint8_t type, bool discontinuous)
+{
+	uint16_t payloadLen = points.size() * sizeof(ISPDB25Point);
+	ODF_TAXI_BUFFER *taxiBuffer = allocTaxiBuffer(payloadLen);
+	if(taxiBuffer == (ODF_TAXI_BUFFER *)0)
+		return -1;
+
+	taxiBuffer->populate(this, payloadLen, 0);
+	memcpy(taxiBuffer->getPayloadPtr(), points.data(), payloadLen);
+
+	LAPRO_CHUNK_MEMO *memo = (LAPRO_CHUNK_MEMO *)(taxiBuffer->getMemoPtr());
+	memset(memo, 0, sizeof(LAPRO_CHUNK_MEMO));
+	memo->decoder = decoder;
+	memo->decoder->refInc();
+	memo->duration = durationUs;
+	memo->sampleCount = points.size();
+	memo->type = type;
+	memo->isDiscontinuous = discontinuous;
+
+	int rcPush = device.putBuffer(taxiBuffer);
+	if(rcPush < 0)
+	{
+		decoder->refDec();
+		taxiBuffer->discard();
+	}
+	return rcPush;
+}
+
+unsigned TestChunkSource::recycle(DACHWInterface& device)
+{
+	unsigned result = 0;
+	while(1)
+	{
+		ODF_TAXI_BUFFER *taxiBuffer = device.getTrash();
+		if(taxiBuffer == (ODF_TAXI_BUFFER *)0)
+			break;
+
+		LAPRO_CHUNK_MEMO *memo = (LAPRO_CHUNK_MEMO *)(taxiBuffer->getMemoPtr());
+		if(memo->decoder != (DecoderBase *)0)
+			(memo->decoder)->refDec();
+		taxiBuffer->discard();
+		result++;
+	}
+	return result;
+}
+
+ODF_TAXI_BUFFER *TestChunkSource::allocTaxiBuffer(uint16_t payloadLen)
+{
+	ODF_TAXI_BUFFER *taxiBuffer = (ODF_TAXI_BUFFER *)malloc(sizeof(ODF_TAXI_BUFFER) + payloadLen);
+	if(taxiBuffer != (ODF_TAXI_BUFFER *)0)
+	{
+		memset(taxiBuffer, 0, sizeof(ODF_TAXI_BUFFER));
+		taxiCount++;
+	}
+	return taxiBuffer;
+}
+
+void TestChunkSource::freeTaxiBuffer(ODF_TAXI_BUFFER *taxiBuffer)
+{
+	taxiCount--;
+	free(taxiBuffer);
+}
+
+
+// -- CaptureDummy ------------------------------------------------------------
+
+static uint16_t decodeChannel(const uint8_t* bytes)
+{
+	return ((bytes[1] & 0x0f) << 12) | (bytes[2] << 4) | (bytes[3] >> 4);
+}
+
+int CaptureDummy::writeFrame(const TimeSlice& slice, double duration)
+{
+	double queuedBefore = queuedDurationUs();
+	double fifoEndBefore = testNowUs() + queuedBefore;
+
+	int result = DummyAdapter::writeFrame(slice, duration);
+	if(slice.dataChunk.empty() || duration <= 0)
+		return result;
+
+	double now = testNowUs();
+	CapturedWrite write;
+	write.endUs = now + queuedDurationUs();
+	write.startUs = (queuedBefore > 0 && fifoEndBefore > now) ? fifoEndBefore : now;
+	if(write.startUs > write.endUs)
+		write.startUs = write.endUs;
+
+	unsigned numPoints = slice.dataChunk.size() / bytesPerPoint();
+	for(unsigned i = 0; i < numPoints; i++)
+	{
+		const uint8_t* point = (const uint8_t*)&slice.dataChunk[i * bytesPerPoint()];
+		write.points.push_back(testPoint(decodeChannel(point), decodeChannel(point + 4), decodeChannel(point + 8), decodeChannel(point + 12), decodeChannel(point + 16)));
+	}
+
+	std::lock_guard<std::mutex> lock(writesMutex);
+	writes.push_back(std::move(write));
+	return result;
+}
+
+std::vector<CapturedWrite> CaptureDummy::getWrites()
+{
+	std::lock_guard<std::mutex> lock(writesMutex);
+	return writes;
+}
+
+void CaptureDummy::clearWrites()
+{
+	std::lock_guard<std::mutex> lock(writesMutex);
+	writes.clear();
+}
+
+std::vector<ISPDB25Point> CaptureDummy::getPoints()
+{
+	std::lock_guard<std::mutex> lock(writesMutex);
+	std::vector<ISPDB25Point> points;
+	for(const auto& write : writes)
+		points.insert(points.end(), write.points.begin(), write.points.end());
+	return points;
+}
@@ -0,0 +1,119 @@
+#ifndef TESTSUPPORT_H_
+#define TESTSUPPORT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <memory>
+
+#include "../shared/ISPDB25Point.h"
+#include "../shared/DACHWInterface.hpp"
+#include "../shared/HWBridge.hpp"
+#include "../output/RTLaproGraphOut.hpp"
+#include "../dummy/DummyAdapter.hpp"
+
+//test programs built by "make test". each program runs its tests in sequence and
+//exits with 1 if any check failed. the ManagementInterface is replaced by a stub that
+//grants every output request, so the output path runs without the rest of the server.
+
+extern unsigned testFailures;
+
+#define CHECK(condition) \
+	do { if(!(condition)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); testFailures++; } } while(0)
+
+//like CHECK, printing the values that were compared
+#define CHECK_MSG(condition, ...) \
+	do { if(!(condition)) { printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #condition); printf(__VA_ARGS__); printf("\n"); testFailures++; } } while(0)
+
+//runs a test function and reports it
+#define RUN_TEST(function) \
+	do { unsigned failuresBefore = testFailures; function(); printf("%s %s\n", (testFailures == failuresBefore) ? "ok  " : "FAIL", #function); } while(0)
+
+//prints the summary and ends the program. driver threads of the bridges never return,
+//so the program exits without running destructors under them.
+int finishTests(const char* programName);
+
+double testNowUs();
+void testSleepMs(double ms);
+
+//a point at x, y with the given color, everything else 0
+ISPDB25Point testPoint(uint16_t x, uint16_t y, uint16_t r, uint16_t g, uint16_t b);
+
+//a frame of count lit points on a horizontal line, marked by the given green value
+std::vector<ISPDB25Point> testFrame(unsigned count, uint16_t green);
+
+bool isLitPoint(const ISPDB25Point& point);
+bool samePoint(const ISPDB25Point& a, const ISPDB25Point& b);
+
+//closed outlines through the given corners in lit green, edgePoints points per edge and dwell
+//repeats of each corner. each outline starts with a blanked point at its first corner, reached
+//from the previous outline by a blanked jump of jumpPoints points, and ends with a blanked point.
+std::vector<ISPDB25Point> testOutlines(const std::vector<std::vector<ISPDB25Point>>& corners, unsigned edgePoints, unsigned dwell, unsigned jumpPoints);
+
+//corners of a square and of a five-pointed star around cx, cy
+std::vector<ISPDB25Point> testSquareCorners(uint16_t cx, uint16_t cy, uint16_t halfSize);
+std::vector<ISPDB25Point> testStarCorners(uint16_t cx, uint16_t cy, uint16_t outerRadius, uint16_t innerRadius);
+
+
+//feeds chunks to a device like the IDN server does: points in taxi buffers with a chunk
+//memo, decoded by a decoder that copies ISPDB25Points
+class TestChunkSource : public ODF_TAXI_SOURCE
+{
+    public:
+
+    TestChunkSource();
+    ~TestChunkSource();
+
+    //type is one of LAPRO_CHUNK_TYPE_*. returns the result of putBuffer
+    int put(DACHWInterface& device, const std::vector<ISPDB25Point>& points, uint32_t durationUs, uint8_t type, bool discontinuous = false);
+
+    //frees the buffers the device is done with, returns the number freed
+    unsigned recycle(DACHWInterface& device);
+
+    //taxi buffers that have not been freed yet
+    unsigned outstanding() { return taxiCount; }
+
+    ODF_TAXI_BUFFER *allocTaxiBuffer(uint16_t payloadLen) override;
+    void freeTaxiBuffer(ODF_TAXI_BUFFER *taxiBuffer) override;
+
+    private:
+
+    RTLaproDecoder *decoder;
+    unsigned taxiCount = 0;
+};
+
+
+//one write to a CaptureDummy, with the time the simulated device emits it
+struct CapturedWrite
+{
+    double startUs;
+    double endUs;
+    std::vector<ISPDB25Point> points;
+};
+
+//dummy device that keeps every write. emission times follow the dummy FIFO model,
+//so gaps between writes are times the device ran empty.
+class CaptureDummy : public DummyAdapter
+{
+    public:
+
+    int writeFrame(const TimeSlice& slice, double duration) override;
+
+    std::vector<CapturedWrite> getWrites();
+    void clearWrites();
+
+    //all captured points in order of emission
+    std::vector<ISPDB25Point> getPoints();
+
+    private:
+
+    std::mutex writesMutex;
+    std::vector<CapturedWrite> writes;
+};
+
+
+//starts the driver loop of a new bridge for the device in a thread of its own
+std::shared_ptr<HWBridge> startBridge(std::shared_ptr<DACHWInterface> device, bool staged = false);
+
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+
+//declarations for compiling the tests without the library installed, see TEST_CFLAGS in the Makefile
+
+struct GError { const char* message; };
+struct GPtrArray { void** pdata; unsigned len; };
+#define g_ptr_array_index(a,i) ((a)->pdata[i])
+struct NMClient; struct NMActiveConnection; struct NMDevice; struct NMIPConfig; struct NMIPAddress;
+typedef int NMActiveConnectionState;
+#define NM_ACTIVE_CONNECTION_STATE_ACTIVATED 2
+#define NM_ACTIVE_CONNECTION(x) ((NMActiveConnection*)(x))
+#define NM_DEVICE(x) ((NMDevice*)(x))
+NMClient* nm_client_new(void*, GError**);
+const GPtrArray* nm_client_get_active_connections(NMClient*);
+const char* nm_active_connection_get_id(NMActiveConnection*);
+NMActiveConnectionState nm_active_connection_get_state(NMActiveConnection*);
+const GPtrArray* nm_active_connection_get_devices(NMActiveConnection*);
+NMIPConfig* nm_device_get_ip4_config(NMDevice*);
+const GPtrArray* nm_ip_config_get_addresses(NMIPConfig*);
+const char* nm_ip_address_get_address(NMIPAddress*);
+void g_error_free(GError*);
+void g_object_unref(void*);
@@ -0,0 +1,10 @@
+#pragma once
+
+//declarations for compiling the tests without the library installed, see TEST_CFLAGS in the Makefile
+
+#include <iostream>
+namespace ola { struct DmxBuffer { unsigned Size() const {return 0;} };
+template<class...A> struct Callback{}; 
+template<class F> void* NewCallback(F){return nullptr;}
+template<class F> void* NewSingleCallback(F){return nullptr;}
+namespace rdm { struct UID { UID(int,int){} }; } }
@@ -0,0 +1,6 @@
+#pragma once
+
+//declarations for compiling the tests without the library installed, see TEST_CFLAGS in the Makefile
+
+#include <iostream>
+#define OLA_WARN std::cerr
@@ -0,0 +1,13 @@
+#pragma once
+
+//declarations for compiling the tests without the library installed, see TEST_CFLAGS in the Makefile
+
+#include <string>
+namespace ola { namespace client {
+enum RegAct { REGISTER };
+struct Result { bool Success() const {return true;} std::string Error() const {return "";} };
+struct DMXMetadata { unsigned universe; unsigned priority; };
+struct OlaClient { void SetSourceUID(const ola::rdm::UID&, void*){} void SetDMXCallback(void*){} void RegisterUniverse(int, RegAct, void*){} };
+struct SelectServer { void Run(){} };
+struct OlaClientWrapper { bool Setup(){return true;} OlaClient* GetClient(){return nullptr;} SelectServer* GetSelectServer(){return nullptr;} };
+} }
@@ -11,6 +11,12 @@
 #include <linux/miscdevice.h>
 #include <linux/uaccess.h>
 #include <linux/interrupt.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/moduleparam.h>
+#include <linux/ktime.h>
+#include <linux/ioctl.h>
+#include <linux/math64.h>
 
 #define HELIOS_MAXFRAMESIZE 210			// In points
 #define HELIOS_BYTESPERFRAME 18
@@ -21,10 +27,67 @@
 #define READ_BUFSIZE 10
 
 #define COMMAND_RESET_MCU 5
+#define COMMAND_RING_KICK 6		// Wake up the SPI thread after publishing ring slots while it waits
+#define COMMAND_RING_WAIT 7		// Block until a ring slot is free
+
+// Shared memory ring, mmap'ed by userspace. The layout must match HeliosProAdapter!
+// Page 0 holds the header, followed by numSlots slots of RING_SLOT_STRIDE bytes each.
+// Userspace fills the slot at head and then advances head, the SPI thread sends the
+// slot at tail and then advances tail. Both indices are free running.
+#define RING_MAGIC 0x48505247			// "HPRG"
+#define RING_PAGE 4096
+#define RING_SLOT_STRIDE 4096
+#define RING_DEFAULT_SLOTS 8
+#define RING_MAX_SLOTS 64
+#define RING_WAIT_TIMEOUT_MS 100
+
+struct heliospro_ring_header {
+	uint32_t magic;
+	uint32_t numSlots;
+	uint32_t slotStride;
+	uint32_t slotDataSize;
+	uint32_t head;				// Written by userspace
+	uint32_t tail;				// Written by the SPI thread
+	uint32_t consumerWaiting;	// Set while the SPI thread sleeps on an empty ring
+	uint32_t producerWaiting;	// Set while userspace waits for a free slot
+	uint64_t packetsSent;
+	uint64_t latencySumNs;		// From submission to the end of the SPI transfer
+	uint64_t latencyMaxNs;
+};
+
+struct heliospro_ring_slot {
+	uint64_t submitTimeNs;		// CLOCK_MONOTONIC
+	uint32_t size;
+	uint32_t reserved;
+	uint8_t data[BUF_SIZE];
+};
+
+// Must match the MCU firmware, used to get the playback duration of packets from their timer values
+#define MCU_TIMERSPEED (96050000 / 2)
+
+// Gaps longer than this between the expected end of output and the next packet are pauses, not underruns
+#define UNDERRUN_MAX_GAP_NS 1000000000ull
+
+// Fill level feedback. The layout must match HeliosProAdapter!
+struct heliospro_status {
+	uint32_t queuedPackets;		// In the ring or write buffer, not yet sent over SPI
+	uint32_t queuedUs;			// Playback duration of the queued packets and the rest of the last sent one
+	uint32_t mcuReady;			// Buffer status line, the MCU can take another packet
+	uint32_t underruns;			// Packets that arrived after the previous output had run out (estimated)
+	uint64_t packetsSent;
+};
+
+#define HELIOSPRO_IOC_MAGIC 'h'
+#define HELIOSPRO_IOC_STATUS _IOR(HELIOSPRO_IOC_MAGIC, 1, struct heliospro_status)
+
+static unsigned int ring_slots = RING_DEFAULT_SLOTS;
+module_param(ring_slots, uint, 0444);
+MODULE_PARM_DESC(ring_slots, "Number of packet slots in the shared memory ring (1-64)");
 
 struct heliospro_buffer {
 	uint8_t* data;
 	uint16_t size;
+	uint64_t submitTimeNs;
 };
 
 static atomic_t stop = ATOMIC_INIT(0);
@@ -47,11 +110,72 @@ static atomic_t newFrameReady = ATOMIC_INIT(0);
 
 static int bufferstatus_irq;
 
+static struct heliospro_ring_header* ring;
+static size_t ringSize;
+DECLARE_WAIT_QUEUE_HEAD(ringSpaceWaitQueue);
+
+// Output timing of the last packet sent over SPI, for the fill level and underrun estimate
+static atomic64_t lastOutputEndNs = ATOMIC64_INIT(0);
+static atomic_t underruns = ATOMIC_INIT(0);
+static atomic64_t packetsSent = ATOMIC64_INIT(0);
+
+
+// Playback duration of a packet in us, from its point count and MCU timer values
+static uint32_t packet_duration_us(const uint8_t* data, uint32_t size)
+{
+	if (size <= HELIOS_FRAMEHEADER_SIZE + HELIOS_FRAMEFOOTER_SIZE)
+		return 0;
+	
+	uint64_t points = (size - HELIOS_FRAMEHEADER_SIZE - HELIOS_FRAMEFOOTER_SIZE) / HELIOS_BYTESPERFRAME;
+	uint64_t timer = data[8] | (data[9] << 8);
+	uint64_t repeats = data[10] | (data[11] << 8);
+	return (uint32_t)div_u64(points * timer * (repeats ? repeats : 1) * 1000000, MCU_TIMERSPEED);
+}
+
+// Called by the SPI thread before each packet goes out
+static void account_packet(const uint8_t* data, uint32_t size, uint64_t submitTimeNs)
+{
+	uint64_t now = ktime_get_ns();
+	uint64_t outputEnd = atomic64_read(&lastOutputEndNs);
+	
+	// The previous output had run out before this packet was even submitted
+	if (outputEnd && submitTimeNs > outputEnd && submitTimeNs - outputEnd < UNDERRUN_MAX_GAP_NS)
+		atomic_inc(&underruns);
+	
+	// The MCU starts on the packet once its previous one has finished
+	uint64_t start = max(now, outputEnd);
+	atomic64_set(&lastOutputEndNs, start + (uint64_t)packet_duration_us(data, size) * 1000);
+	atomic64_inc(&packetsSent);
+}
+
+
+static struct heliospro_ring_slot* ring_slot(uint32_t index)
+{
+	return (struct heliospro_ring_slot*)((uint8_t*)ring + RING_PAGE + (index % ring_slots) * RING_SLOT_STRIDE);
+}
+
+// Number of slots published by userspace and not yet sent
+static uint32_t ring_pending(void)
+{
+	return smp_load_acquire(&ring->head) - READ_ONCE(ring->tail);
+}
+
+static bool ring_has_packet(void)
+{
+	return ring_pending() != 0;
+}
+
+static bool ring_has_space(void)
+{
+	return ring_pending() < ring_slots;
+}
+
 
 
 static ssize_t reset_mcu(void)
 {
 	pr_warn("reset MCU\n");
+	atomic64_set(&lastOutputEndNs, 0);
 	
 	if (mutex_lock_interruptible(&lock))
 		return -ESHUTDOWN;
@@ -95,8 +219,13 @@ static int spi_worker(void *data)
 
     while (!kthread_should_stop() && !atomic_read(&stop)) 
 	{
-        // Wait until there's data or we're told to stop
-        if (wait_event_interruptible(newFrameWaitQueue,  atomic_read(&newFrameReady) || atomic_read(&stop) || kthread_should_stop()))
+        // Wait until there's data or we're told to stop. Userspace only kicks the thread
+		// through COMMAND_RING_KICK if it sees consumerWaiting after publishing a slot.
+		WRITE_ONCE(ring->consumerWaiting, 1);
+		smp_mb();
+        int waitRet = wait_event_interruptible(newFrameWaitQueue,  atomic_read(&newFrameReady) || ring_has_packet() || atomic_read(&stop) || kthread_should_stop());
+		WRITE_ONCE(ring->consumerWaiting, 0);
+		if (waitRet)
 			continue;
         
 		int ret = wait_event_interruptible_timeout(statusSignalWaitQueue,  gpiod_get_value(bufferstatus_gpiod) || atomic_read(&stop) || kthread_should_stop(), msecs_to_jiffies(2500));
@@ -112,6 +241,42 @@ static int spi_worker(void *data)
 		if (atomic_read(&stop) || kthread_should_stop())
             break;
 		
+		if (ring_has_packet())
+		{
+			uint32_t tail = READ_ONCE(ring->tail);
+			if (ring_pending() > ring_slots)
+			{
+				pr_warn("Invalid ring head, dropping queued packets\n");
+				smp_store_release(&ring->tail, READ_ONCE(ring->head));
+				wake_up_interruptible(&ringSpaceWaitQueue);
+				continue;
+			}
+			
+			// Sent straight from the shared slot, userspace doesn't touch it until tail has advanced
+			struct heliospro_ring_slot* slot = ring_slot(tail);
+			uint32_t size = READ_ONCE(slot->size);
+			if (size > 0 && size <= BUF_SIZE)
+			{
+				account_packet(slot->data, size, READ_ONCE(slot->submitTimeNs));
+				ret = spi_write(spi, slot->data, size);
+				if (ret)
+					pr_warn("Failed to write SPI message: %d\n", ret);
+				
+				uint64_t latencyNs = ktime_get_ns() - READ_ONCE(slot->submitTimeNs);
+				ring->packetsSent++;
+				ring->latencySumNs += latencyNs;
+				if (latencyNs > ring->latencyMaxNs)
+					ring->latencyMaxNs = latencyNs;
+			}
+			else
+				pr_warn("Invalid ring packet size: %u\n", size);
+			
+			cmpxchg(&ring->tail, tail, tail + 1); // Unless a reset dropped the ring meanwhile, full barrier
+			if (READ_ONCE(ring->producerWaiting))
+				wake_up_interruptible(&ringSpaceWaitQueue);
+			continue;
+		}
+		
 		if (!atomic_read(&newFrameReady))
 			continue;
 
@@ -123,6 +288,7 @@ static int spi_worker(void *data)
 		atomic_set(&newFrameReady, 0);
         mutex_unlock(&lock);
 		wake_up_interruptible(&newFrameWaitQueue);
+		account_packet(frameBuffer->data, frameBuffer->size, frameBuffer->submitTimeNs);
 		ret = spi_write(spi, frameBuffer->data, frameBuffer->size);
 		if (ret)
 			pr_warn("Failed to write SPI message: %d\n", ret);
@@ -155,11 +321,27 @@ static ssize_t heliospro_write(struct file *file, const char __user *buf, size_t
 			{
 				mutex_lock(&lock);
 				atomic_set(&newFrameReady, 0);
+				smp_store_release(&ring->tail, READ_ONCE(ring->head));
 				mutex_unlock(&lock);
 				int ret = reset_mcu();
 				wake_up_interruptible(&newFrameWaitQueue);
+				wake_up_interruptible(&ringSpaceWaitQueue);
 				return ret;
 			}
+			else if (previewBuffer[1] == COMMAND_RING_KICK)
+			{
+				wake_up_interruptible(&newFrameWaitQueue);
+				return 2;
+			}
+			else if (previewBuffer[1] == COMMAND_RING_WAIT)
+			{
+				int ret = wait_event_interruptible_timeout(ringSpaceWaitQueue, ring_has_space() || atomic_read(&stop), msecs_to_jiffies(RING_WAIT_TIMEOUT_MS));
+				if (ret < 0)
+					return ret;
+				if (atomic_read(&stop))
+					return -ESHUTDOWN;
+				return 2;
+			}
 			
 			return -EBADMSG;
 		}
@@ -182,6 +364,7 @@ static ssize_t heliospro_write(struct file *file, const char __user *buf, size_t
         return -EFAULT;
     }
 	newFrameBuffer->size = count;
+	newFrameBuffer->submitTimeNs = ktime_get_ns();
 	atomic_set(&newFrameReady, 1);
 	mutex_unlock(&lock);
 	wake_up_interruptible(&newFrameWaitQueue);
@@ -218,10 +401,68 @@ static ssize_t heliospro_read(struct file *file, char __user *buf, size_t count,
 }
 
 
+static int heliospro_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	// Maps the ring from its start, partial mappings are allowed to read the header first
+	if (vma->vm_pgoff != 0 || (vma->vm_end - vma->vm_start) > ringSize)
+		return -EINVAL;
+	
+	return remap_vmalloc_range(vma, ring, 0);
+}
+
+
+static long heliospro_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	if (cmd != HELIOSPRO_IOC_STATUS)
+		return -ENOTTY;
+	
+	struct heliospro_status status;
+	memset(&status, 0, sizeof(status));
+	
+	if (mutex_lock_interruptible(&lock))
+		return -ERESTARTSYS;
+	
+	uint32_t tail = READ_ONCE(ring->tail);
+	uint32_t pending = ring_pending();
+	if (pending <= ring_slots)
+	{
+		for (uint32_t i = 0; i < pending; i++)
+		{
+			struct heliospro_ring_slot* slot = ring_slot(tail + i);
+			uint32_t size = READ_ONCE(slot->size);
+			if (size <= BUF_SIZE)
+				status.queuedUs += packet_duration_us(slot->data, size);
+		}
+		status.queuedPackets = pending;
+	}
+	if (atomic_read(&newFrameReady))
+	{
+		status.queuedUs += packet_duration_us(newFrameBuffer->data, newFrameBuffer->size);
+		status.queuedPackets++;
+	}
+	mutex_unlock(&lock);
+	
+	uint64_t now = ktime_get_ns();
+	uint64_t outputEnd = atomic64_read(&lastOutputEndNs);
+	if (outputEnd > now)
+		status.queuedUs += (uint32_t)div_u64(outputEnd - now, 1000);
+	
+	status.mcuReady = gpiod_get_value(bufferstatus_gpiod);
+	status.underruns = atomic_read(&underruns);
+	status.packetsSent = atomic64_read(&packetsSent);
+	
+	if (copy_to_user((void __user*)arg, &status, sizeof(status)))
+		return -EFAULT;
+	return 0;
+}
+
+
 static const struct file_operations myspi_fileops = {
     .owner  = THIS_MODULE,
     .write  = heliospro_write,
-	.read 	= heliospro_read
+	.read 	= heliospro_read,
+	.mmap	= heliospro_mmap,
+	.unlocked_ioctl = heliospro_ioctl
 };
 
 static struct miscdevice heliospro_miscdev = {
@@ -295,12 +536,33 @@ static int my_spi_probe(struct spi_device *_spi)
 	newFrameBuffer = &frameBuffer1;
 	frameBuffer = &frameBuffer2;
 	
+	if (ring_slots < 1 || ring_slots > RING_MAX_SLOTS)
+	{
+		pr_warn("Invalid ring_slots %u, using %u\n", ring_slots, RING_DEFAULT_SLOTS);
+		ring_slots = RING_DEFAULT_SLOTS;
+	}
+	ringSize = RING_PAGE + (size_t)ring_slots * RING_SLOT_STRIDE;
+	ring = (struct heliospro_ring_header*)vmalloc_user(ringSize); // Zeroed
+	if (!ring)
+	{
+		pr_err("Failed to alloc memory to ring\n");
+		if (bufferstatus_irq > 0)
+			free_irq(bufferstatus_irq, NULL);
+		return -ENOMEM;
+	}
+	ring->magic = RING_MAGIC;
+	ring->numSlots = ring_slots; // Informational only, userspace can write to the header
+	ring->slotStride = RING_SLOT_STRIDE;
+	ring->slotDataSize = BUF_SIZE;
+	
     ret = misc_register(&heliospro_miscdev);
     if (ret) 
 	{
         pr_err("Could not register misc device\n");
 		if (bufferstatus_irq > 0)
 			free_irq(bufferstatus_irq, NULL);
+		vfree(ring);
+		ring = NULL;
         return ret;
     }
 	
@@ -331,8 +593,12 @@ static void my_spi_remove(struct spi_device *spi)
 	
 	wake_up_interruptible(&newFrameWaitQueue);
 	wake_up_interruptible(&statusSignalWaitQueue);
+	wake_up_interruptible(&ringSpaceWaitQueue);
     if (spi_thread)
         kthread_stop(spi_thread);
+	
+	vfree(ring);
+	ring = NULL;
 }
 
 static const struct of_device_id my_spi_dt_ids[] = {